@@ -15,6 +15,7 @@
 #include "file_utils.h"
 #include "draw_utils.h"
 #include "tree_leaf.h"
+#include "profiler.h"
 #include <set>
 #include <thread> // for std::thread::hardware_concurrency()
 
@@ -73,7 +74,7 @@ char *lighting_file[NUM_LIGHTING_TYPES] = {0};
 bool combined_gu(0), underwater(0), kbd_text_mode(0), univ_stencil_shadows(1), use_waypoint_app_spots(0), enable_tiled_mesh_ao(0), tiled_terrain_only(0);
 bool show_lightning(0), disable_shader_effects(0), use_waypoints(0), group_back_face_cull(0), start_maximized(0), claim_planet(0), skip_light_vis_test(0);
 bool no_smoke_over_mesh(0), enable_model3d_tex_comp(0), global_lighting_update(0), lighting_update_offline(0), mesh_difuse_tex_comp(1), smoke_dlights(0), keep_keycards_on_death(0);
-bool texture_alpha_in_red_comp(0), use_model3d_tex_mipmaps(1), mt_cobj_tree_build(0), two_sided_lighting(0), inf_terrain_scenery(1), invert_model_nmap_bscale(0);
+bool texture_alpha_in_red_comp(0), use_model3d_tex_mipmaps(1), mt_cobj_tree_build(0), use_wide_cobj_bvh(0), two_sided_lighting(0), inf_terrain_scenery(1), invert_model_nmap_bscale(0);
 bool gen_tree_roots(1), fast_water_reflect(0), vsync_enabled(0), use_voxel_cobjs(0), disable_sound(0), enable_depth_clamp(0), volume_lighting(0), no_subdiv_model(0);
 bool detail_normal_map(0), init_core_context(0), use_core_context(0), enable_multisample(1), dynamic_smap_bias(0), model3d_wn_normal(0), snow_shadows(0), user_action_key(0);
 bool enable_dlight_shadows(1), tree_indir_lighting(0), ctrl_key_pressed(0), only_pine_palm_trees(0), enable_gamma_correct(0), use_z_prepass(0), reflect_dodgeballs(0);
@@ -104,7 +105,7 @@ int read_snow_file(0), write_snow_file(0), mesh_detail_tex(NOISE_TEX), add_city_
 int read_light_files[NUM_LIGHTING_TYPES] = {0}, write_light_files[NUM_LIGHTING_TYPES] = {0};
 unsigned num_snowflakes(0), create_voxel_landscape(0), hmap_filter_width(0), num_dynam_parts(100), snow_coverage_resolution(2), show_map_view_fractal(0);
 unsigned num_birds_per_tile(2), num_fish_per_tile(15), num_bflies_per_tile(4);
-unsigned erosion_iters(0), erosion_iters_tt(0), skybox_tid(0), tiled_terrain_gen_heightmap_sz(0), game_mode_disable_mask(0), num_frame_draw_calls(0);
+unsigned erosion_iters(0), erosion_iters_tt(0), skybox_tid(0), tiled_terrain_gen_heightmap_sz(0), tiled_hmap_cache_mb(512), game_mode_disable_mask(0), num_frame_draw_calls(0), cobj_bvh_benchmark_rays(0);
 float NEAR_CLIP(DEF_NEAR_CLIP), FAR_CLIP(DEF_FAR_CLIP), system_max_orbit(1.0), sky_occlude_scale(0.0), tree_slope_thresh(5.0), mouse_sensitivity(1.0), tt_grass_scale_factor(1.0);
 float water_plane_z(0.0), base_gravity(1.0), crater_depth(1.0), crater_radius(1.0), disabled_mesh_z(FAR_CLIP), vegetation(1.0), atmosphere(1.0), biome_x_offset(0.0);
 float mesh_file_scale(1.0), mesh_file_tz(0.0), speed_mult(1.0), mesh_z_cutoff(-FAR_CLIP), relh_adj_tex(0.0), dodgeball_metalness(1.0), ray_step_size_mult(1.0);
@@ -119,7 +120,7 @@ float mouse_smooth_factor(0.0), tree_depth_scale(1.0), head_bob_amount(0.0);
 float light_int_scale[NUM_LIGHTING_TYPES] = {1.0, 1.0, 1.0, 1.0, 1.0}, first_ray_weight[NUM_LIGHTING_TYPES] = {1.0, 1.0, 1.0, 1.0, 1.0};
 double camera_zh(0.0);
 point mesh_origin, camera_pos, cube_map_center;
-string user_text, cobjs_out_fn, sphere_materials_fn, hmap_out_fn, skybox_cube_map_name, coll_damage_name, assimp_alpha_exclude_str;
+string user_text, cobjs_out_fn, sphere_materials_fn, hmap_out_fn, tiled_hmap_out_fn, skybox_cube_map_name, coll_damage_name, assimp_alpha_exclude_str;
 colorRGB ambient_lighting_scale(1,1,1), mesh_color_scale(1,1,1);
 colorRGBA flower_color(ALPHA0);
 set<unsigned char> keys, keyset;
@@ -135,7 +136,7 @@ char player_name[MAX_CHARS] = "Player";
 bool vert_opt_flags[3] = {0}; // {enable, full_opt, verbose}
 
 
-extern bool clear_landscape_vbo, use_dense_voxels, tree_4th_branches, model_calc_tan_vect, water_is_lava, use_grass_tess, def_tex_compress, ship_cube_map_reflection;
+extern bool clear_landscape_vbo, use_dense_voxels, tree_4th_branches, model_calc_tan_vect, compress_model3d_files, write_model3d_coll_tree, water_is_lava, use_grass_tess, def_tex_compress, ship_cube_map_reflection;
 extern bool flashlight_on, player_wait_respawn, camera_in_building, player_in_tunnel, player_on_moving_ww, player_on_escalator;
 extern int camera_flight, DISABLE_WATER, DISABLE_SCENERY, camera_invincible, onscreen_display, mesh_freq_filter, show_waypoints, last_inventory_frame;
 extern int tree_coll_level, GLACIATE, UNLIMITED_WEAPONS, destroy_thresh, MAX_RUN_DIST, mesh_gen_mode, mesh_gen_shape, map_drag_x, map_drag_y, player_in_water;
@@ -1776,6 +1777,7 @@ int load_config(string const &config_file) {
 	kwmb.add("use_dense_voxels", use_dense_voxels);
 	kwmb.add("use_voxel_cobjs", use_voxel_cobjs);
 	kwmb.add("mt_cobj_tree_build", mt_cobj_tree_build);
+	kwmb.add("use_wide_cobj_bvh", use_wide_cobj_bvh);
 	kwmb.add("global_lighting_update", global_lighting_update);
 	kwmb.add("lighting_update_offline", lighting_update_offline);
 	kwmb.add("two_sided_lighting", two_sided_lighting);
@@ -1791,6 +1793,8 @@ int load_config(string const &config_file) {
 	kwmb.add("tree_4th_branches", tree_4th_branches);
 	kwmb.add("skip_light_vis_test", skip_light_vis_test);
 	kwmb.add("model_calc_tan_vect", model_calc_tan_vect);
+	kwmb.add("compress_model3d_files", compress_model3d_files);
+	kwmb.add("write_model3d_coll_tree", write_model3d_coll_tree);
 	kwmb.add("invert_model_nmap_bscale", invert_model_nmap_bscale);
 	kwmb.add("enable_dlight_shadows", enable_dlight_shadows);
 	kwmb.add("tree_indir_lighting", tree_indir_lighting);
@@ -1910,8 +1914,10 @@ int load_config(string const &config_file) {
 	kwmu.add("snow_coverage_resolution", snow_coverage_resolution);
 	kwmu.add("dlight_grid_bitshift", DL_GRID_BS);
 	kwmu.add("tiled_terrain_gen_heightmap_sz", tiled_terrain_gen_heightmap_sz);
+	kwmu.add("tiled_hmap_cache_mb", tiled_hmap_cache_mb);
 	kwmu.add("game_mode_disable_mask", game_mode_disable_mask);
 	kwmu.add("show_map_view_fractal", show_map_view_fractal);
+	kwmu.add("cobj_bvh_benchmark_rays", cobj_bvh_benchmark_rays);
 
 	kw_to_val_map_t<float> kwmf(error);
 	kwmf.add("gravity", base_gravity);
@@ -2028,6 +2034,7 @@ int load_config(string const &config_file) {
 	kwms.add("font_texture_atlas_fn", font_texture_atlas_fn);
 	kwms.add("sphere_materials_fn", sphere_materials_fn);
 	kwms.add("write_heightmap_png", hmap_out_fn);
+	kwms.add("write_tiled_heightmap", tiled_hmap_out_fn);
 	kwms.add("skybox_cube_map", skybox_cube_map_name);
 	kwms.add("assimp_alpha_exclude_str", assimp_alpha_exclude_str);
 
@@ -2372,12 +2379,39 @@ void init_debug_callback() {
 }
 
 
+// CPU-only world generation with no window, GL context, or sound, for benchmarking; prints a timing breakdown per stage and exits
+void run_headless_gen() {
+
+	int const HEADLESS_TILE_RADIUS = 4; // generate (2R+1)^2 terrain tiles around the origin
+	cout << "Running headless world generation" << endl;
+	if (!global_profiler_enabled) {toggle_timing_profiler();} // collect timing values and print them together at the end
+	profiler_start_bkg_drain(); // there's no frame loop to drain the profiler thread buffers
+	timer_t timer("Headless Generation Total");
+	reset_planet_defaults();
+	init_objects();
+	alloc_matrices();
+	init_terrain_mesh();
+	{
+		timer_t timer("Terrain Mesh Generation");
+		gen_mesh(0, 0, 0); // also sets up the sine table used for tile heights
+	}
+	if (world_mode == WMODE_INF_TERRAIN) {gen_tiled_terrain_headless(HEADLESS_TILE_RADIUS);} // terrain, cities, buildings, room objects, cars, and pedestrians
+	else {
+		gen_buildings();
+		gen_all_building_room_geom();
+	}
+	timer.end();
+	profiler_stop_bkg_drain();
+	timing_profiler_stats();
+}
+
 int main(int argc, char** argv) {
 
 	cout << "Starting 3DWorld" << endl;
 	//HeapSetInformation(NULL, HeapEnableTerminationOnCorruption, NULL, 0);
 	//_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
-	if (argc == 2) {read_ueventlist(argv[1]);}
+	bool const headless(argc >= 2 && strcmp(argv[1], "-headless") == 0); // usage: 3dworld -headless [config_file]
+	if (argc == 2 && !headless) {read_ueventlist(argv[1]);}
 	int rs(1);
 	if      (srand_param == 1) {rs = GET_TIME_MS();}
 	else if (srand_param != 0) {rs = srand_param;}
@@ -2385,8 +2419,12 @@ int main(int argc, char** argv) {
 	create_sin_table();
 	set_scene_constants();
 	load_texture_names(); // needs to be before config file load
-	load_top_level_config(defaults_file);
+	load_top_level_config((headless && argc >= 3) ? argv[2] : defaults_file);
 	gen_gauss_rand_arr(); // after reading seed from config file
+	if (headless) {run_headless_gen(); return 0;}
+#ifdef _DEBUG
+	if (!profiler_self_test()) {exit(1);}
+#endif
 	cout << "Loading."; cout.flush();
 	
  	// Initialize GLUT
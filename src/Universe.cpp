@@ -8,6 +8,8 @@
 #include "shaders.h"
 #include "gl_ext_arb.h"
 #include "asteroid.h"
+#include "job_system.h"
+#include <mutex>
 
 
 // temperatures
@@ -40,6 +42,8 @@ unsigned const MAX_PLANETS_PER_SYSTEM  = 16;
 unsigned const MAX_MOONS_PER_PLANET    = 8;
 unsigned const GAS_GIANT_TSIZE         = 1024;
 unsigned const GAS_GIANT_BANDS         = 63;
+unsigned const PLACEHOLDER_TSIZE       = 32; // textures up to this size are generated in the draw thread
+unsigned const MAX_TEX_CACHE_ENTRIES   = 64; // ~450KB each at max size
 
 int   const RAND_CONST       = 1;
 float const ROTREV_TIMESCALE = 1.0;
@@ -2058,6 +2062,126 @@ void uobj_solid::gen_colorAB(float delta) {
 // *** TEXTURES ***
 
 
+// generates rocky planet and moon textures and heightmaps in streaming jobs, highest projected screen size first,
+// so that flying through a system doesn't stall the draw thread; results are cached by body seed and size so that revisits are free
+class rocky_tex_gen_queue_t {
+public:
+	struct result_t {
+		p_upsurface surface;
+		vector<unsigned char> data; // RGB texture data
+		surface_color_params_t params; // colors the data was generated with
+		unsigned size=0;
+	};
+	typedef std::shared_ptr<result_t> p_result_t;
+private:
+	struct job_t {
+		urev_body const *body; // only used as a key; never dereferenced by the job
+		p_result_t result;
+		float priority; // projected screen size of the body
+		bool started=0, done=0;
+		job_t(urev_body const *body_, p_result_t const &result_, float priority_) : body(body_), result(result_), priority(priority_) {}
+	};
+	struct cache_key_t {
+		long rs1, rs2;
+		unsigned size;
+		cache_key_t(urev_body const &body, unsigned size_) : rs1(body.rgen.rseed1), rs2(body.rgen.rseed2), size(size_) {}
+		bool operator<(cache_key_t const &k) const {
+			if (rs1 != k.rs1) return (rs1 < k.rs1);
+			if (rs2 != k.rs2) return (rs2 < k.rs2);
+			return (size < k.size);
+		}
+	};
+	struct cache_entry_t {
+		p_result_t result;
+		unsigned last_used=0;
+	};
+	std::mutex mutex;
+	vector<job_t> jobs;
+	map<cache_key_t, cache_entry_t> cache;
+	unsigned use_counter=0;
+	job_group_t gen_group;
+
+	vector<job_t>::iterator find_job(urev_body const *body) {
+		for (auto i = jobs.begin(); i != jobs.end(); ++i) {if (i->body == body) return i;}
+		return jobs.end();
+	}
+	void add_to_cache(cache_key_t const &key, p_result_t const &result) { // mutex must be locked
+		cache_entry_t &entry(cache[key]);
+		entry.result    = result;
+		entry.last_used = ++use_counter;
+		if (cache.size() <= MAX_TEX_CACHE_ENTRIES) return;
+		auto lru(cache.begin()); // evict the least recently used entry
+		for (auto i = cache.begin(); i != cache.end(); ++i) {if (i->second.last_used < lru->second.last_used) {lru = i;}}
+		cache.erase(lru);
+	}
+	void run_next_job() { // one call is queued per added job; runs the highest priority job that hasn't been started, which may not be the one that queued it
+		p_result_t result;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job_t *job(nullptr);
+
+			for (job_t &j : jobs) {
+				if (!j.started && (job == nullptr || j.priority > job->priority)) {job = &j;}
+			}
+			if (job == nullptr) return; // canceled
+			job->started = 1;
+			result = job->result;
+		}
+		gen_texture_data_and_heightmap(result->data.data(), result->size, *result->surface, result->params); // slow part, unlocked
+		std::lock_guard<std::mutex> lock(mutex);
+		for (job_t &j : jobs) {if (j.result == result) {j.done = 1;}} // may have been canceled
+	}
+public:
+	~rocky_tex_gen_queue_t() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.clear(); // queued calls that haven't started will find no job
+		}
+		gen_group.wait(); // for running jobs to finish
+	}
+	p_result_t find_cached(urev_body const &body, unsigned size, surface_color_params_t const &params) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it(cache.find(cache_key_t(body, size)));
+		if (it == cache.end() || !(it->second.result->params == params)) return nullptr; // colors can change with temperature
+		it->second.last_used = ++use_counter;
+		return it->second.result;
+	}
+	void add_job(urev_body const &body, unsigned size, float priority, p_upsurface const &surface, surface_color_params_t const &params) {
+		p_result_t result(new result_t);
+		result->surface = surface;
+		result->params  = params;
+		result->size    = size;
+		result->data.resize(3*size*size);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			assert(find_job(&body) == jobs.end()); // only one job per body
+			jobs.emplace_back(&body, result, priority);
+		}
+		get_job_system().run_async([this] {run_next_job();}, JOB_PRI_STREAM, &gen_group);
+	}
+	bool get_result(urev_body const &body, float priority, p_result_t &result) { // returns false if there's no job for this body
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it(find_job(&body));
+		if (it == jobs.end()) return 0; // can happen if the body was copied
+		if (!it->done) {it->priority = priority; return 1;} // not yet done; result is null
+		result = it->result;
+		add_to_cache(cache_key_t(body, result->size), result);
+		jobs.erase(it);
+		return 1;
+	}
+	void cancel(urev_body const &body) { // if the job was started, it will be finished but the result is dropped
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it(find_job(&body));
+		if (it != jobs.end()) {jobs.erase(it);}
+	}
+};
+
+rocky_tex_gen_queue_t &get_rocky_tex_gen_queue() {
+	static rocky_tex_gen_queue_t *queue(new rocky_tex_gen_queue_t); // never freed, since bodies may cancel jobs in their destructors during static destruction
+	return *queue;
+}
+
+
 void urev_body::check_gen_texture(unsigned size) {
 
 	if (use_procedural_shader()) return; // no texture used
@@ -2067,32 +2191,61 @@ void urev_body::check_gen_texture(unsigned size) {
 		if (!glIsTexture(tid)) {create_gas_giant_texture();} // texture has not been generated
 		return;
 	}
-	unsigned const tsize0(get_texture_size(size));
+	rocky_tex_gen_queue_t &queue(get_rocky_tex_gen_queue());
 
-	if (!glIsTexture(tid)) { // texture has not been generated
-		gen_surface();
+	if (tex_gen_pending) { // keep drawing with the current texture, or the placeholder, until the job is done
+		rocky_tex_gen_queue_t::p_result_t result;
+		if (queue.get_result(*this, size, result) && !result) return;
+		tex_gen_pending = 0;
+		// may not be the size we want now; if not, we'll request another one below
+		if (result) {apply_rocky_texture(result->surface, result->data, result->size);}
 	}
-	else if (tsize0 != tsize) { // new texture size
-		::free_texture(tid); // delete old texture
-	}
-	else {
-		return; // nothing to do
+	unsigned const tsize0(get_texture_size(size));
+	if (glIsTexture(tid) && tsize0 == tsize) return; // nothing to do
+	surface_color_params_t const params(get_surface_color_params());
+	rocky_tex_gen_queue_t::p_result_t const cached(queue.find_cached(*this, tsize0, params));
+	if (cached) {apply_rocky_texture(cached->surface, cached->data, cached->size); return;}
+
+	if (tsize0 <= PLACEHOLDER_TSIZE) { // small, fast to generate
+		create_rocky_texture(tsize0);
+		return;
 	}
-	create_rocky_texture(tsize0); // new texture
+	if (!glIsTexture(tid)) {create_rocky_texture(PLACEHOLDER_TSIZE);} // low resolution placeholder to draw until the real texture is ready
+	queue.add_job(*this, tsize0, size, create_surface(), params);
+	tex_gen_pending = 1;
+}
+
+
+void urev_body::create_rocky_texture(unsigned size) { // generated in this thread
+
+	assert(size <= MAX_TEXTURE_SIZE);
+	p_upsurface const new_surface(create_surface());
+	vector<unsigned char> data(3*size*size);
+	gen_texture_data_and_heightmap(data.data(), size, *new_surface, get_surface_color_params());
+	apply_rocky_texture(new_surface, data, size);
 }
 
 
-void urev_body::create_rocky_texture(unsigned size) {
+void urev_body::apply_rocky_texture(p_upsurface const &surface_, vector<unsigned char> const &data, unsigned size) {
 
-	tsize = size;
-	assert(tsize <= MAX_TEXTURE_SIZE);
-	vector<unsigned char> data(3*tsize*tsize);
-	gen_texture_data_and_heightmap(data.data(), tsize);
+	assert(size <= MAX_TEXTURE_SIZE);
+	assert(data.size() == 3*size*size);
+	::free_texture(tid); // delete old texture, if any
+	surface = surface_; // may delete a previous surface
+	tsize   = size;
 	setup_texture(tid, 0, 1, 0);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, tsize, tsize, 0, GL_RGB, GL_UNSIGNED_BYTE, data.data());
 }
 
 
+void urev_body::cancel_tex_gen() {
+
+	if (!tex_gen_pending) return;
+	get_rocky_tex_gen_queue().cancel(*this);
+	tex_gen_pending = 0;
+}
+
+
 void urev_body::create_gas_giant_texture() {
 
 	tsize = GAS_GIANT_TSIZE;
@@ -2137,9 +2290,27 @@ void urev_body::upload_colors_to_shader(shader_t &s) const {
 }
 
 
-void urev_body::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
+surface_color_params_t urev_body::get_surface_color_params() const {
+
+	surface_color_params_t params;
+	get_colors(params.a, params.b);
+	params.frozen      = (temp < FREEZE_TEMP);
+	params.below_boil  = (temp < BOIL_TEMP);
+	params.water       = water;
+	params.atmos       = atmos;
+	params.lava        = lava;
+	params.snow_thresh = snow_thresh;
+	params.wr_scale    = 1.0/max(0.01, (1.0 - water));
+	return params;
+}
+
+bool surface_color_params_t::operator==(surface_color_params_t const &p) const {
+	return (!memcmp(a, p.a, 3) && !memcmp(b, p.b, 3) && frozen == p.frozen && below_boil == p.below_boil && water == p.water &&
+		atmos == p.atmos && lava == p.lava && snow_thresh == p.snow_thresh && wr_scale == p.wr_scale);
+}
+
+void surface_color_params_t::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
 
-	bool const frozen(temp < FREEZE_TEMP);
 	unsigned char const white[3] = {255, 255, 255};
 	unsigned char const gray[3]  = {100, 100, 100};
 	float const coldness(frozen ? 0.0 : fabs(phi - PI_TWO)*2.0*PI_INV); // phi=PI/2 => equator, phi=0.0 => north pole, phi=PI => south pole
@@ -2171,7 +2342,7 @@ void urev_body::get_surface_color(unsigned char *data, float val, float phi) con
 		if      (val < lava)            {RGB_BLOCK_COPY(data, lavac);} // move up?
 		else if (val < lava + lava_adj) {BLEND_COLOR(data, data, lavac, (val - lava)/lava_adj);} // close to lava line
 	}
-	else if (temp < BOIL_TEMP) { // handle water/ice/snow
+	else if (below_boil) { // handle water/ice/snow
 		if (val < water + water_adj) { // close to water line (can have a little water even if water == 0)
 			BLEND_COLOR(data, data, wic[frozen], (val - water)/water_adj);
 			
@@ -2759,6 +2930,13 @@ string ustar::get_info() const {
 }
 
 
+struct closest_obj_hint_t {int galaxy=-1, cluster=-1, system=-1;}; // search starting points from the previous query
+static thread_local closest_obj_hint_t closest_obj_hint; // thread_local because this is called from the parallel univ object query
+
+// called before each query in the parallel univ object query so that the search order, and therefore the result, doesn't depend on which
+// object this thread queried last
+void reset_closest_object_hints() {closest_obj_hint = closest_obj_hint_t();}
+
 // if not find_largest then find closest
 int universe_t::get_closest_object(s_object &result, point pos, int max_level, bool include_asteroids,
 	bool offset, float expand, bool get_destroyed, float g_expand, float r_add, int galaxy_hint) const
@@ -2783,10 +2961,10 @@ int universe_t::get_closest_object(s_object &result, point pos, int max_level, b
 	pos -= cell.pos;
 	float const planet_thresh(expand*4.0*MAX_PLANET_EXTENT + r_add), moon_thresh(expand*2.0*MAX_PLANET_EXTENT + r_add);
 	float const pt_sq(planet_thresh*planet_thresh), mt_sq(moon_thresh*moon_thresh);
-	static int last_galaxy(-1), last_cluster(-1), last_system(-1);
+	int const last_galaxy(closest_obj_hint.galaxy), last_cluster(closest_obj_hint.cluster), last_system(closest_obj_hint.system);
 	int const first_galaxy_to_try((galaxy_hint >= 0) ? galaxy_hint : last_galaxy);
 	unsigned const ng((unsigned)cell.galaxies->size());
-	unsigned const go((first_galaxy_to_try >= 0 && first_galaxy_to_try < int(ng)) ? last_galaxy : 0);
+	unsigned const go((first_galaxy_to_try >= 0 && first_galaxy_to_try < int(ng)) ? first_galaxy_to_try : 0);
 	bool found_system(0);
 
 	for (unsigned gc_ = 0; gc_ < ng && !found_system; ++gc_) { // find galaxy
@@ -2911,9 +3089,9 @@ int universe_t::get_closest_object(s_object &result, point pos, int max_level, b
 		} // cluster
 	} // galaxy
 	result.val = ((result.dist < CELL_SIZE) ? 1 : -1);
-	if (result.galaxy  >= 0) {last_galaxy  = result.galaxy; }
-	if (result.cluster >= 0) {last_cluster = result.cluster;}
-	if (result.system  >= 0) {last_system  = result.system; }
+	if (result.galaxy  >= 0) {closest_obj_hint.galaxy  = result.galaxy; }
+	if (result.cluster >= 0) {closest_obj_hint.cluster = result.cluster;}
+	if (result.system  >= 0) {closest_obj_hint.system  = result.system; }
 	return (result.val == 1);
 }
 
@@ -3360,6 +3538,7 @@ vector3d ustar::get_solar_wind_accel(point const &obj_pos, float obj_mass, float
 
 void urev_body::free_texture() { // and also free vbos
 
+	cancel_tex_gen();
 	if (surface != nullptr) {surface->free_context();}
 	::free_texture(tid);
 	tsize = 0;
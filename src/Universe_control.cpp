@@ -8,6 +8,8 @@
 #include "asteroid.h"
 #include "timetest.h"
 #include "openal_wrap.h"
+#include "profiler.h"
+#include "job_system.h"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -335,31 +337,86 @@ void proc_collision(free_obj *const uobj, upos_point_type const &cpos, point con
 }
 
 
+struct univ_obj_query_t { // results of the read-only query phase for one object
+	s_object clobj; // closest object
+	vector3d gravity, swp_accel; // only valid if calc_gravity
+	point sun_pos;
+	float base_temp=0.0; // temperature at the object's position, before scaling
+	int found_close=0;
+	bool active=0, calc_gravity=0, near_b_hole=0;
+};
+
+void calc_uobj_gravity(free_obj const *const uobj, univ_obj_query_t &q, vector<free_obj const*> &stat_obj_query_res) {
+	upos_point_type const &obj_pos(uobj->get_pos());
+	q.gravity = q.swp_accel = zero_vector; // sum of gravity from sun, planets, possibly some moons, and possibly asteroids
+	q.near_b_hole = 0;
+	if (q.found_close && q.clobj.type != UTYPE_ASTEROID) {get_gravity(q.clobj, obj_pos, q.gravity, 1);}
+
+	if (!stat_objs.empty()) {
+		all_query_data qdata(&stat_objs, obj_pos, 10.0, urm_static, uobj, stat_obj_query_res);
+		get_all_close_objects(qdata);
+				
+		for (unsigned j = 0; j < stat_obj_query_res.size(); ++j) { // asteroid/black hole gravity
+			q.near_b_hole |= (stat_obj_query_res[j]->get_gravity(q.gravity, obj_pos) == 2);
+		}
+	}
+	if (q.clobj.has_valid_system()) {
+		q.swp_accel = q.clobj.get_star().get_solar_wind_accel(obj_pos, uobj->get_mass(), uobj->get_surf_area());
+	}
+}
+
+void query_univ_object(free_obj const *const uobj, univ_obj_query_t &q, vector<free_obj const*> &stat_obj_query_res) { // read-only; may be called from multiple threads
+	bool const no_coll(uobj->no_coll()), particle(uobj->is_particle()), projectile(uobj->is_proj());
+	q.active = !(no_coll && particle) && !uobj->is_stationary(); // skip objects with no collisions, gravity, or temperature
+	if (!q.active) return;
+	reset_closest_object_hints(); // same search order for this object on every thread
+	q.calc_gravity = (((uobj->get_time() + unsigned(size_t(uobj)>>8)) & (GRAV_CHECK_MOD-1)) == 0);
+	float const radius(uobj->get_c_radius()*(no_coll ? 0.5 : 1.0));
+	upos_point_type const &obj_pos(uobj->get_pos());
+	// skip orbiting objects (no collisions or gravity effects, temperature is mostly constant)
+	bool const include_asteroids(!particle); // disable particle-asteroid collisions because they're too slow
+	q.found_close = (uobj->is_orbiting() ? 0 : universe.get_object_closest_to_pos(q.clobj, obj_pos, include_asteroids, 1.0, (no_coll ? 0.0 : radius)));
+	bool const sobj_temp(q.found_close && q.clobj.type != UTYPE_ASTEROID);
+	if (sobj_temp || (!particle && !projectile)) {q.base_temp = universe.get_point_temperature(q.clobj, obj_pos, q.sun_pos);}
+	if (q.calc_gravity) {calc_uobj_gravity(uobj, q, stat_obj_query_res);}
+}
+
+// runs in two phases: a parallel read-only query phase that finds the closest object, temperature, and gravity for each object,
+// followed by a serial phase in object order that handles collisions and modifies object state, so results don't depend on the thread count
 void process_univ_objects() {
 
+	PROFILE_SCOPE("Process Univ Objects");
+	unsigned const QUERY_BLOCK_SIZE = 64; // objects per task
+	static vector<univ_obj_query_t> queries; // reused across frames
+	unsigned const num_objs(uobjs.size()), num_blocks((num_objs + QUERY_BLOCK_SIZE - 1)/QUERY_BLOCK_SIZE);
+	queries.clear();
+	queries.resize(num_objs);
+	{
+		PROFILE_SCOPE("Univ Obj Query");
+		// can't use OpenMP because this is called from inside a parallel region
+		get_job_system().parallel_for(num_blocks, [&](unsigned block) {
+			static thread_local vector<free_obj const*> stat_obj_query_res;
+			unsigned const start(block*QUERY_BLOCK_SIZE), end(min(num_objs, start+QUERY_BLOCK_SIZE));
+			for (unsigned i = start; i < end; ++i) {query_univ_object(uobjs[i], queries[i], stat_obj_query_res);}
+		});
+	}
+	PROFILE_SCOPE("Univ Obj Apply");
 	vector<free_obj const*> stat_obj_query_res;
 
-	for (unsigned i = 0; i < uobjs.size(); ++i) { // can we use cached_objs?
+	for (unsigned i = 0; i < num_objs; ++i) { // can we use cached_objs?
 		free_obj *const uobj(uobjs[i]);
+		univ_obj_query_t &q(queries[i]);
+		if (!q.active) continue;
 		bool const no_coll(uobj->no_coll()), particle(uobj->is_particle()), projectile(uobj->is_proj());
-		if (no_coll && particle)   continue; // no collisions, gravity, or temperature on this object
-		if (uobj->is_stationary()) continue;
 		bool const is_ship(uobj->is_ship()), orbiting(uobj->is_orbiting());
-		bool const calc_gravity(((uobj->get_time() + unsigned(size_t(uobj)>>8)) & (GRAV_CHECK_MOD-1)) == 0);
 		bool const lod_coll(PLAYER_SLOW_PLANET_APPROACH && is_ship && uobj->is_player_ship()); // enable if we want to do close planet flyby
 		float const radius(uobj->get_c_radius()*(no_coll ? 0.5 : 1.0));
 		upos_point_type const &obj_pos(uobj->get_pos());
-		vector3d gravity; // sum of gravity from sun, planets, possibly some moons, and possibly asteroids
-		point sun_pos;
-
-		// skip orbiting objects (no collisions or gravity effects, temperature is mostly constant)
-		s_object clobj; // closest object
-		bool const include_asteroids(!particle); // disable particle-asteroid collisions because they're too slow
-		int const found_close(orbiting ? 0 : universe.get_object_closest_to_pos(clobj, obj_pos, include_asteroids, 1.0, (no_coll ? 0.0 : radius)));
-		bool temp_known(0), has_rings(0);
+		s_object &clobj(q.clobj); // closest object
+		bool temp_known(0), has_rings(0), collided(0);
 		float limit_speed_dist(clobj.dist);
 
-		if (found_close) {
+		if (q.found_close) {
 			if (clobj.type == UTYPE_ASTEROID) {
 				uasteroid const &asteroid(clobj.get_asteroid());
 				float const dist_to_cobj(clobj.dist - (asteroid.radius + radius));
@@ -377,6 +434,7 @@ void process_univ_objects() {
 						float const elastic((lod_coll ? 0.1 : 1.0)*SBODY_COLL_ELASTIC);
 						upos_point_type const cpos(asteroid.pos + norm*min(rsum, 1.1*dist)); // move away from the asteroid, but limit the distance to smooth the response
 						proc_collision(uobj, cpos, asteroid.pos, asteroid.radius, asteroid.get_velocity(), 1.0, elastic, asteroid.get_fragment_tid(obj_pos));
+						collided = 1;
 
 						if (is_ship && clobj.asteroid_field == AST_BELT_ID) { // ship collision with asteroid belt
 							//clobj.get_asteroid_belt().detach_asteroid(clobj.asteroid); // incomplete
@@ -388,8 +446,8 @@ void process_univ_objects() {
 				assert(clobj.object != NULL);
 				float const clobj_radius(clobj.object->get_radius());
 				point const clobj_pos(clobj.object->get_pos());
-				float const temperature(universe.get_point_temperature(clobj, obj_pos, sun_pos)*(FOBJ_TEMP_SCALE - uobj->get_shadow_val())); // shadow_val = 0-3
-				uobj->set_temp(temperature, sun_pos);
+				float const temperature(q.base_temp*(FOBJ_TEMP_SCALE - uobj->get_shadow_val())); // shadow_val = 0-3
+				uobj->set_temp(temperature, q.sun_pos);
 				temp_known = 1;
 				float hmap_scale(0.0);
 				if (clobj.type == UTYPE_MOON  ) {hmap_scale = MOON_HMAP_SCALE;  }
@@ -422,11 +480,11 @@ void process_univ_objects() {
 						if (clobj.object->collision(obj_pos, radius_coll, uobj->get_velocity(), cpos, coll_r, simple_coll)) {
 							proc_collision(uobj, cpos, clobj_pos, coll_r, zero_vector, clobj.object->mass, elastic, clobj.object->get_fragment_tid(obj_pos));
 							coll = 2;
+							collided = 1;
 						}
 					} // collision
 					if (is_ship) {uobj->near_sobj(clobj, coll);}
 				} // planet or moon
-				if (calc_gravity) {get_gravity(clobj, obj_pos, gravity, 1);}
 
 				if (clobj.type == UTYPE_PLANET) {
 					// when near a planet with rings, use the dist to the outer rings to limit speed so that we don't fly through the rings too quickly
@@ -437,26 +495,12 @@ void process_univ_objects() {
 			}
 		} // found_close
 		if (!temp_known) {
-			float temperature(0.0);
-			if (!particle && !projectile) {temperature = universe.get_point_temperature(clobj, obj_pos, sun_pos)*FOBJ_TEMP_SCALE;}
-			uobj->set_temp(temperature, sun_pos);
+			float const temperature((!particle && !projectile) ? q.base_temp*FOBJ_TEMP_SCALE : 0.0);
+			uobj->set_temp(temperature, q.sun_pos);
 		}
-		if (calc_gravity) {
-			bool near_b_hole(0);
-			vector3d swp_accel;
-
-			if (!stat_objs.empty()) {
-				all_query_data qdata(&stat_objs, obj_pos, 10.0, urm_static, uobj, stat_obj_query_res);
-				get_all_close_objects(qdata);
-				
-				for (unsigned j = 0; j < stat_obj_query_res.size(); ++j) { // asteroid/black hole gravity
-					near_b_hole |= (stat_obj_query_res[j]->get_gravity(gravity, obj_pos) == 2);
-				}
-			}
-			if (clobj.has_valid_system()) {
-				swp_accel = clobj.get_star().get_solar_wind_accel(obj_pos, uobj->get_mass(), uobj->get_surf_area());
-			}
-			uobj->add_gravity_swp(gravity, swp_accel, float(GRAV_CHECK_MOD), near_b_hole);
+		if (q.calc_gravity) {
+			if (collided) {calc_uobj_gravity(uobj, q, stat_obj_query_res);} // the collision moved the object, so gravity must be recomputed at its new position
+			uobj->add_gravity_swp(q.gravity, q.swp_accel, float(GRAV_CHECK_MOD), q.near_b_hole);
 		}
 		if (is_ship) {
 			for (unsigned t = 0; t < temp_sources.size(); ++t) { // check for temperature of weapons - inefficient
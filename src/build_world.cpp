@@ -707,6 +707,7 @@ void coll_obj::translate_pts_and_bcube(vector3d const &vd) {
 void coll_obj::shift_by(vector3d const &vd, bool force, bool no_texture_offset) {
 	if (!fixed && !force) return;
 	translate_pts_and_bcube(vd);
+	mark_cobj_moved(*this);
 	if (!no_texture_offset && cp.tscale != 0.0 && !was_a_cube()) {texture_offset -= vd;}
 	if (cgroup_id >= 0) {cobj_groups.invalidate_group(cgroup_id);} // force recompute of center of mass, etc.
 	if (is_movable()) {last_coll = 8;} // mark as moving/collided to prevent the physics system from putting this cobj to sleep
@@ -782,6 +783,7 @@ void flag_cobjs_indoors_outdoors() {
 
 void coll_obj_group::clear_ids() {
 	dynamic_ids.clear();
+	++dynamic_ids_version;
 	drawn_ids.clear();
 	platform_ids.clear();
 }
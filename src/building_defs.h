@@ -664,6 +664,9 @@ struct building_params_t {
 	vector<std::string> food_box_names; // same size as food_box_tids
 	map<unsigned, unsigned> tid_to_nmap_tid;
 	int last_read_tid=-1;
+	// building tile disk cache
+	std::string tile_cache_dir; // empty=disabled; directory must exist
+	unsigned config_hash=0; // hash of all building config option text, used as part of the cache key
 	// use for option reading
 	int read_error=0;
 	kw_to_val_map_t<bool     >  kwmb;
@@ -698,6 +701,7 @@ struct building_params_t {
 	int get_nm_tid_for(unsigned tid) const;
 private:
 	void init_kw_maps();
+	bool parse_buildings_option_int(FILE *fp);
 	int read_building_texture(FILE *fp, std::string const &str, bool is_normal_map, int &error, bool check_filename=0, bool *no_cracks=nullptr);
 	void read_texture_and_add_if_valid(FILE *fp, std::string const &str, int &error, vector<unsigned> &tids);
 };
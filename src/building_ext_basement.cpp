@@ -89,15 +89,15 @@ struct ext_basement_room_params_t {
 };
 
 bool building_t::is_basement_room_not_int_bldg(cube_t const &room, building_t const *exclude, bool allow_outside_grid) const {
-	// check for other buildings, including their extended basements
-	if (check_buildings_cube_coll(room, 0, 1, this, exclude)) return 0; // xy_only=0, inc_basement=1, exclude ourself
-
+	// check the grid first so that we never query buildings outside our grid, which may be generated in parallel with this one
 	if (!allow_outside_grid) {
 		cube_t const grid_bcube(get_grid_bcube_for_building(*this));
 		assert(!grid_bcube.is_all_zeros()); // must be found
 		assert(grid_bcube.contains_cube_xy(bcube)); // must contain our building
 		if (!grid_bcube.contains_cube_xy(room)) return 0; // outside the grid (tile or city) bcube
 	}
+	// check for other buildings, including their extended basements
+	if (check_buildings_cube_coll(room, 0, 1, this, exclude)) return 0; // xy_only=0, inc_basement=1, exclude ourself
 	if (cube_int_underground_obj(room)) return 0; // check tunnels, in-ground pools, etc.
 	return 1;
 }
@@ -394,7 +394,7 @@ void building_t::add_ceiling_tile_objects(rand_gen_t rgen) {
 			int const rand_val(rgen.rand() % 7);
 
 			if (rand_val == 0) { // make the light fall
-				room_object_t &light(objs[cur_obj_ix]);
+				room_object_t &light(interior->room_geom->get_placed_obj_for_edit(cur_obj_ix)); // will be enlarged
 				cube_t frame(light);
 				vector3d const light_sz(light.get_size());
 				bool const dim(light.dim), dir(rgen.rand_bool()); // long dim
@@ -7,7 +7,7 @@
 #include "lightmap.h" // for light_source
 #include "cobj_bsp_tree.h"
 #include "profiler.h"
-#include <thread>
+#include "job_system.h"
 #include <queue>
 #include <mutex>
 #include <condition_variable>
@@ -729,12 +729,13 @@ colorRGBA get_outdoor_light_color() {
 
 unsigned const IS_WINDOW_BIT = (1<<24); // if this bit is set, the light is from a window; if not, it's from a light room object
 
+typedef vector<pair<unsigned, colorRGB>> lmap_delta_t; // ordered sequence of {cell index, color} additions from one worker/ray
+
 class lmap_manager_local_t {
 	vector<colorRGB> data;
 	vector<unsigned char> tex_data;
 	unsigned xsize=0, ysize=0, zsize=0, update_block_ix=0;
 	vector3d ray_scale, ray_offset;
-	float step_sz_inv=0.0;
 	bool realloc_tid=0;
 
 	void update_elem(unsigned i) {
@@ -758,21 +759,24 @@ public:
 	void reset_all() {
 		for (colorRGB &c : data) {c = BLACK;}
 	}
-	void set_step_sz(bool half_step_sz) {
-		step_sz_inv = (half_step_sz ? 2.0 : 1.0); // 1-2 steps per grid on average
-	}
-	void add_path_to_lmcs(point p1, point p2, float weight, colorRGBA const &color) {
+	// Note: thread safe; writes to the caller's delta rather than to data, which is updated later in a deterministic order by apply_delta()
+	void add_path_to_lmcs(point p1, point p2, float weight, colorRGBA const &color, float step_sz_inv, lmap_delta_t &delta) const {
 		p1 = ray_scale*p1 + ray_offset;
 		p2 = ray_scale*p2 + ray_offset;
-		colorRGBA const cw(color*weight);
+		colorRGB const cw(color*weight);
 		unsigned const nsteps(1 + unsigned(p2p_dist(p1, p2)*step_sz_inv)); // round up (dist can be 0)
 		vector3d const step((p2 - p1)/nsteps); // at least two points
 
 		for (unsigned s = 0; s < nsteps; ++s) {
 			p1 += step; // don't double count the first step
 			int const x(p1.x), y(p1.y), z(p1.z);
-			// Note: this is run by multiple threads writing to the same values, so is nondeterministic; removing light won't reset values to exactly 0
-			if ((x >= 0 && x < (int)xsize && y >= 0 && y < (int)ysize && z >= 0 && z < (int)zsize)) {data[(y*xsize + x)*zsize + z] += cw;}
+			if ((x >= 0 && x < (int)xsize && y >= 0 && y < (int)ysize && z >= 0 && z < (int)zsize)) {delta.emplace_back(((y*xsize + x)*zsize + z), cw);}
+		}
+	}
+	void apply_delta(lmap_delta_t const &delta) { // not thread safe
+		for (auto const &d : delta) {
+			assert(d.first < data.size());
+			data[d.first] += d.second;
 		}
 	}
 	void update_indir_light_texture(unsigned &tid, bool incremental) {
@@ -838,7 +842,7 @@ public:
 
 class building_indir_light_mgr_t {
 	bool is_running=0, kill_thread=0, lighting_updated=0, needs_to_join=0, need_bvh_rebuild=0, update_windows=0, target_in_extb=0;
-	int cur_bix=-1, cur_floor=-1, last_room_id=-1, timer_val=0;
+	int cur_bix=-1, cur_floor=-1, timer_val=0;
 	unsigned cur_tid=0, num_to_remove=0, grid_sz[3]={};
 	colorRGBA outdoor_color;
 	cube_t valid_area, light_bounds;
@@ -848,9 +852,9 @@ class building_indir_light_mgr_t {
 	set<unsigned> lights_complete, lights_seen, lights_pend;
 	vector<vector3d> ray_directions;
 	vect_cube_with_ix_t windows;
-	cube_bvh_t bvh, room_bvh;
+	cube_bvh_t bvh;
 	lmap_manager_local_t lmgr;
-	std::thread rt_thread;
+	job_group_t rt_job;
 
 	struct light_job_t {
 		int lix; // -1 is invalid
@@ -858,6 +862,26 @@ class building_indir_light_mgr_t {
 		light_job_t(unsigned l=-1, bool n=0) : lix(l), neg(n) {}
 		bool is_valid() const {return (lix >= 0);}
 	};
+	struct room_bvh_entry_t {
+		int room_id=-1;
+		bool used=0; // used by a light in the current batch
+		cube_t area; // all zeros if the room BVH is disabled
+		cube_bvh_t bvh;
+	};
+	deque<room_bvh_entry_t> room_bvhs; // per-room BVHs for lights in the current batch, reused across batches
+	
+	struct light_ray_params_t { // per-light state computed once and shared by all rays of the light
+		light_job_t job;
+		bool is_window=0, is_skylight=0, hanging=0, in_attic=0, in_ext_basement=0;
+		unsigned dim=2, dir=0, num_pri_splits=16; // default dim is z; dir=2 is omnidirectional
+		int num_rays=0;
+		float weight=0.0, light_radius=0.0, step_sz_inv=1.0, tolerance=0.0;
+		point light_center;
+		cube_t light_cube, room_area;
+		colorRGBA lcolor, pri_lcolor;
+		vector3d light_dir; // points toward the light
+		cube_bvh_t const *room_bvh=nullptr;
+	};
 	light_job_t cur_job;
 	ConcurrentQueue<light_job_t> light_queue, lights_done;
 
@@ -871,17 +895,28 @@ class building_indir_light_mgr_t {
 		for (unsigned n = 0; n < 3; ++n) {grid_sz[n] = max(1, min(round_fp(sz[n]*scale), (int)ceil(sz[n]/min_spacing[n])));}
 		lmgr.alloc(grid_sz[0], grid_sz[1], grid_sz[2], light_bounds);
 	}
-	void get_room_bvh(building_t const &b, int room_id, cube_t &room_area_out) {
-		if (room_id < 0) return;
+	room_bvh_entry_t const &get_room_bvh(building_t const &b, int room_id) { // not thread safe; must be called before casting rays
+		for (room_bvh_entry_t &e : room_bvhs) {
+			if (e.room_id == room_id) {e.used = 1; return e;} // already valid (or cached as unused)
+		}
+		room_bvh_entry_t *entry(nullptr);
+
+		for (room_bvh_entry_t &e : room_bvhs) {
+			if (!e.used) {entry = &e; break;} // reuse an entry not needed by the current batch
+		}
+		if (entry == nullptr) {room_bvhs.emplace_back(); entry = &room_bvhs.back();} // deque, so references to other entries remain valid
+		entry->room_id = room_id;
+		entry->used    = 1;
+		entry->area.set_to_zeros(); // zero area disables the room BVH
+		entry->bvh.clear();
+		if (room_id < 0) return *entry;
 		room_t const &room(b.get_room(room_id));
-		if (room.get_volume() > 0.5*valid_area.get_volume()) return; // room accounts for most of the area (factory, rest, backrooms, PG, retail)
+		if (room.get_volume() > 0.5*valid_area.get_volume()) return *entry; // room accounts for most of the area (factory, rest, backrooms, PG, retail)
 		cube_t room_area(room);
 		room_area.expand_by(b.get_wall_thickness()); // include adjacent walls, ceilings, and floors
 		if (b.is_restroom_with_high_ceil()) {max_eq(room_area.z2(), b.interior_z2);} // extend up to the roof peak
-		if (room_id == last_room_id) {room_area_out = room_area; return;} // already valid
 		auto const &all_objs(bvh.get_objs());
-		auto &room_objs(room_bvh.get_objs());
-		room_bvh.clear();
+		auto &room_objs(entry->bvh.get_objs());
 
 		for (auto const &c : all_objs) {
 			assert(c.is_strictly_normalized());
@@ -889,10 +924,10 @@ class building_indir_light_mgr_t {
 			room_objs.push_back(c);
 			room_objs.back().intersect_with_cube(room_area);
 		}
-		if (room_objs.size() > all_objs.size()/2) return; // most of the objects are in this room
-		room_bvh.build_tree_top(0); // verbose=0
-		room_area_out = room_area;
-		last_room_id  = room_id;
+		if (room_objs.size() > all_objs.size()/2) {room_objs.clear(); return *entry;} // most of the objects are in this room
+		entry->bvh.build_tree_top(0); // verbose=0
+		entry->area = room_area;
+		return *entry;
 	}
 	void init_ray_directions() {
 		rand_gen_t rgen;
@@ -904,7 +939,7 @@ class building_indir_light_mgr_t {
 		if (ix >= ray_directions.size()) {ix = 0;}
 		return ray_directions[ix++];
 	}
-	vector3d get_reflect_dir(vector3d const &dir, vector3d const &cnorm) {
+	static vector3d get_reflect_dir(vector3d const &dir, vector3d const &cnorm) {
 		vector3d v_ref;
 		calc_reflection_angle(dir, v_ref, cnorm);
 		v_ref.normalize();
@@ -915,53 +950,46 @@ class building_indir_light_mgr_t {
 		if (dot_product(dir, cnorm) < 0.0) {dir.negate();} // make sure it points away from the surface (is this needed?)
 		pos = cpos + tolerance*dir; // move slightly away from the surface
 	}
-	void cast_light_rays(building_t const &b) {
-		// Note: modifies lmgr, but otherwise thread safe
-		assert(cur_job.is_valid());
-		bool const reserve_draw_thread(USE_BKG_THREAD && (int)NUM_THREADS >= omp_get_max_threads()); // reserve a thread for drawing if needed
-		unsigned num_rt_threads(max(1U, (NUM_THREADS - reserve_draw_thread)));
-		// if there are many threads, reserve an extra thread for omp parallel bloocks using two threads on the master (calc_mesh_shadows, tile_t::create_texture(), etc.)
-		if (USE_BKG_THREAD && num_rt_threads > 8) {--num_rt_threads;}
-		unsigned base_num_rays(LOCAL_RAYS), dim(2), dir(0); // default dim is z; dir=2 is omnidirectional
-		float const tolerance(1.0E-5*valid_area.get_max_dim_sz());
-		bool const is_window(cur_job.lix & IS_WINDOW_BIT);
-		bool in_attic(0), in_ext_basement(0), is_skylight(0), in_jail_cell(0), half_step_sz(1), hanging(0);
+	bool setup_light_job(building_t const &b, light_job_t const &job, light_ray_params_t &p) { // not thread safe; returns 0 if there's nothing to do
+		assert(job.is_valid());
+		p.job = job;
+		unsigned base_num_rays(LOCAL_RAYS);
+		bool const is_window(job.lix & IS_WINDOW_BIT);
+		bool half_step_sz(1);
 		int light_room_id(-1);
-		float weight(100.0), light_radius(0.0);
-		point light_center;
-		cube_t light_cube;
-		colorRGBA lcolor, pri_lcolor;
-		vector3d light_dir; // points toward the light
+		float weight(100.0);
+		p.is_window = is_window;
+		p.tolerance = 1.0E-5*valid_area.get_max_dim_sz();
 
 		if (is_window) { // window
-			unsigned const window_ix(cur_job.lix & ~IS_WINDOW_BIT);
+			unsigned const window_ix(job.lix & ~IS_WINDOW_BIT);
 			assert(window_ix < windows.size());
 			cube_with_ix_t const &window(windows[window_ix]);
 			float surface_area(0.0);
-			light_cube = window;
+			p.light_cube = window;
 
 			if (window.dz() < min(window.dx(), window.dy())) { // skylight; we could encode skylights as a different ix, but testing aspect ratio is easier
 				bool const in_mall(window.z1() <= b.ground_floor_z1), is_rr(b.is_restroom_with_high_ceil());
 				float const light_xlate(is_rr ? (b.ground_floor_z1 + b.get_fc_thickness() - window.z1()) : -b.get_fc_thickness());
-				is_skylight    = 1;
+				p.is_skylight  = 1;
 				surface_area   = window.dx()*window.dy();
 				base_num_rays *= (in_mall ? 16 : (is_rr ? 4 : 8)); // more rays, since skylights are larger and can cover multiple rooms
 				weight        *= (is_rr ? 40.0 : 10.0); // stronger due to direct sun/moon/cloud lighting and reduced occlusion from buildings and terrain
-				light_cube.translate_dim(2, light_xlate); // shift slightly down into the building to avoid collision with the roof/ceiling
+				p.light_cube.translate_dim(2, light_xlate); // shift slightly down into the building to avoid collision with the roof/ceiling
 				// select primary light rays oriented away from the sun/moon; doesn't work well due to reduced ray scattering
-				light_dir     = get_light_pos().get_norm(); // more accurate, but requires indir to be recomputed when sun/moon pos changes
-				//light_dir     = plus_z; // make it vertical so that it doesn't need to be updated when the sun/moon pos changes
-				lcolor        = cur_ambient*2.0; // split rays into two groups for ambient and diffuse
-				pri_lcolor    = cur_diffuse;
-				dir           = 1; // pointed up
+				p.light_dir   = get_light_pos().get_norm(); // more accurate, but requires indir to be recomputed when sun/moon pos changes
+				//p.light_dir   = plus_z; // make it vertical so that it doesn't need to be updated when the sun/moon pos changes
+				p.lcolor      = cur_ambient*2.0; // split rays into two groups for ambient and diffuse
+				p.pri_lcolor  = cur_diffuse;
+				p.dir         = 1; // pointed up
 			}
 			else { // normal window
 				assert(window.ix < 4); // encodes 2*dim + dir
-				dim =  bool(window.ix & 2);
-				dir = !bool(window.ix & 1); // cast toward the interior
-				surface_area = window.dz()*window.get_sz_dim(!bool(dim));
-				light_cube.translate_dim(dim, (dir ? 1.0 : -1.0)*0.5*b.get_wall_thickness()); // shift slightly inside the building to avoid collision with the exterior wall
-				lcolor = outdoor_color;
+				p.dim =  bool(window.ix & 2);
+				p.dir = !bool(window.ix & 1); // cast toward the interior
+				surface_area = window.dz()*window.get_sz_dim(!bool(p.dim));
+				p.light_cube.translate_dim(p.dim, (p.dir ? 1.0 : -1.0)*0.5*b.get_wall_thickness()); // shift slightly inside the building to avoid collision with the exterior wall
+				p.lcolor = outdoor_color;
 				
 				if (b.is_industrial()) {
 					base_num_rays /= 8; // faster indir lighting, since there are many windows
@@ -971,43 +999,43 @@ class building_indir_light_mgr_t {
 					base_num_rays *= 2; // more rays to reduce noise, since windows are large and few
 					surface_area  *= 0.5; // less indir light
 				}
-				else if (b.is_restaurant() && b.interior->rooms.front().intersects(light_cube)) {base_num_rays = 2*base_num_rays/3;} // fewer rays in restaurant dining area
-				else if (b.is_attic_window(window)) {in_attic = 1; base_num_rays *= 8;} // attic window
+				else if (b.is_restaurant() && b.interior->rooms.front().intersects(p.light_cube)) {base_num_rays = 2*base_num_rays/3;} // fewer rays in restaurant dining area
+				else if (b.is_attic_window(window)) {p.in_attic = 1; base_num_rays *= 8;} // attic window
 			}
-			light_room_id = b.get_room_containing_pt(light_cube.get_cube_center());
+			light_room_id = b.get_room_containing_pt(p.light_cube.get_cube_center());
 			// light intensity scales with surface area, since incoming light is a constant per unit area (large windows = more light)
 			weight *= surface_area/0.0016f; // a fraction the surface area weight of lights
 		} // end window case
 		else { // room light or lamp, pointing downward (unless on the wall)
 			vect_room_object_t const &objs(b.interior->room_geom->objs);
-			assert((unsigned)cur_job.lix < objs.size());
-			room_object_t const &ro(objs[cur_job.lix]);
+			assert((unsigned)job.lix < objs.size());
+			room_object_t const &ro(objs[job.lix]);
 			// maybe light was removed by the player and re-assigned as another object
-			if (!ro.is_light_type() && ro.type != TYPE_BLOCKER) {is_running = 0; return;} // nothing to do?
+			if (!ro.is_light_type() && ro.type != TYPE_BLOCKER) return 0; // nothing to do?
 			bool const light_in_basement(ro.z1() < b.ground_floor_z1), is_lamp(ro.type == TYPE_LAMP);
-			light_cube      = ro;
-			light_cube.z1() = light_cube.z2() = (ro.z1() - 0.01*ro.dz()); // set slightly below bottom of light
-			light_center    = light_cube.get_cube_center();
-			light_room_id   = ro.room_id;
-			in_attic        = ro.in_attic();
-			in_ext_basement = (light_in_basement && b.point_in_extended_basement_not_basement(light_center));
-			in_jail_cell    = (in_ext_basement && b.interior->has_jail && is_jail_room(b.get_room(ro.room_id).get_room_type(0)));
-			if (in_attic) {base_num_rays *= 8;} // more rays in attic, since light is large and there are only 1-2 of them
-			if (is_lamp ) {base_num_rays /= 2;} // half the rays for lamps
-			if (is_lamp ) {dir = 2;} // onmidirectional; dim stays at 2/Z
-			else if (ro.flags & (RO_FLAG_ADJ_HI | RO_FLAG_ROTATING)) {dim = ro.dim; dir = ro.dir;} // wall light or rotated/hanging
+			p.light_cube      = ro;
+			p.light_cube.z1() = p.light_cube.z2() = (ro.z1() - 0.01*ro.dz()); // set slightly below bottom of light
+			p.light_center    = p.light_cube.get_cube_center();
+			light_room_id     = ro.room_id;
+			p.in_attic        = ro.in_attic();
+			p.in_ext_basement = (light_in_basement && b.point_in_extended_basement_not_basement(p.light_center));
+			bool const in_jail_cell(p.in_ext_basement && b.interior->has_jail && is_jail_room(b.get_room(ro.room_id).get_room_type(0)));
+			if (p.in_attic) {base_num_rays *= 8;} // more rays in attic, since light is large and there are only 1-2 of them
+			if (is_lamp   ) {base_num_rays /= 2;} // half the rays for lamps
+			if (is_lamp   ) {p.dir = 2;} // onmidirectional; dim stays at 2/Z
+			else if (ro.flags & (RO_FLAG_ADJ_HI | RO_FLAG_ROTATING)) {p.dim = ro.dim; p.dir = ro.dir;} // wall light or rotated/hanging
 			float const surface_area(ro.dx()*ro.dy() + 2.0f*(ro.dx() + ro.dy())*ro.dz()); // bottom + 4 sides (top is occluded), 0.0003 for houses
-			lcolor  = (is_lamp ? LAMP_COLOR : ro.get_color());
-			weight *= surface_area/0.0003f;
+			p.lcolor = (is_lamp ? LAMP_COLOR : ro.get_color());
+			weight  *= surface_area/0.0003f;
 			if (b.has_pri_hall())     {weight *= 0.70;} // floorplan is open and well lit, indir lighting value seems too high
 			if (ro.type == TYPE_LAMP) {weight *= 0.33;} // lamps are less bright
-			if (ro.is_round())        {light_radius = ro.get_radius();}
+			if (ro.is_round())        {p.light_radius = ro.get_radius();}
 			if (in_jail_cell)         {weight *= 0.25;} // lower weight for jail cell lights since there are so many
-			if (in_attic)             {weight *= ATTIC_LIGHT_RADIUS_SCALE*ATTIC_LIGHT_RADIUS_SCALE;} // based on surface area rather than radius
-			else if (b.point_in_industrial(light_center)) {base_num_rays /= 4; half_step_sz = 0;} // many lights in industrial areas, fewer rays needed
+			if (p.in_attic)           {weight *= ATTIC_LIGHT_RADIUS_SCALE*ATTIC_LIGHT_RADIUS_SCALE;} // based on surface area rather than radius
+			else if (b.point_in_industrial(p.light_center)) {base_num_rays /= 4; half_step_sz = 0;} // many lights in industrial areas, fewer rays needed
 			else if (b.is_restaurant() && b.interior->rooms.front().contains_pt(cube_bot_center(ro))) {base_num_rays /= 4;} // fewer rays in restaurant dining area
 			else if (light_in_basement) {
-				if (in_ext_basement) {
+				if (p.in_ext_basement) {
 					if      (b.interior->has_backrooms) {weight *= 0.2; base_num_rays /= 4;} // darker and fewer rays
 					else if (b.has_mall()             ) {weight *= 0.1; base_num_rays /= 8; half_step_sz = 0;} // darker and fewer rays, since there are so many lights
 					else if (light_room_id == b.interior->pool.room_ix) {weight *= 0.5;} // extended basement pool room
@@ -1017,92 +1045,141 @@ class building_indir_light_mgr_t {
 				else {weight *= 0.5; base_num_rays *= 2;} // basement is darker
 			}
 			if (!is_lamp && (ro.flags & RO_FLAG_ROTATING)) { // rotated/hanging ceiling light
-				light_dir = ro.get_dir();
-				hanging   = 1;
+				p.light_dir = ro.get_dir();
+				p.hanging   = 1;
 			}
 		} // end room light case
 		if (b.is_restroom()) {base_num_rays *= 4;} // more rays, since there are only 2 lights and 2-5 windows
-		if (b.check_pt_in_retail_room(light_center)) {weight *= 0.5; base_num_rays /= 5; half_step_sz = 0;} // many lights, fewer rays; windows or ceiling lights
+		if (b.check_pt_in_retail_room(p.light_center)) {weight *= 0.5; base_num_rays /= 5; half_step_sz = 0;} // many lights, fewer rays; windows or ceiling lights
 		if (light_room_id >= 0 && b.is_datacenter() && b.get_room(light_room_id).get_room_type(0) == RTYPE_SERVER) {base_num_rays /= 5;}
 		if (b.is_house ) {weight *=  2.0;} // houses have dimmer lights and seem to work better with more indir
-		if (cur_job.neg) {weight *= -1.0;}
+		if (job.neg) {weight *= -1.0;}
 		weight /= base_num_rays; // normalize to the number of rays
 		if (half_step_sz) {weight *= 0.5;}
-		unsigned NUM_PRI_SPLITS(is_window ? 4 : 16); // we're counting primary rays for windows, use fewer primary splits to reduce noise at the cost of increased time
-		max_eq(base_num_rays, NUM_PRI_SPLITS);
-		int const num_rays(base_num_rays/NUM_PRI_SPLITS);
+		p.num_pri_splits = (is_window ? 4 : 16); // we're counting primary rays for windows, use fewer primary splits to reduce noise at the cost of increased time
+		max_eq(base_num_rays, p.num_pri_splits);
+		p.num_rays    = base_num_rays/p.num_pri_splits;
+		p.weight      = weight;
+		p.step_sz_inv = (half_step_sz ? 2.0 : 1.0); // 1-2 steps per grid on average
+		room_bvh_entry_t const &room_bvh(get_room_bvh(b, light_room_id)); // build per-room BVH if needed
+		p.room_area = room_bvh.area;
+		p.room_bvh  = &room_bvh.bvh;
+		return 1;
+	}
+	void cast_light_ray(building_t const &b, light_ray_params_t const &p, ray_cast_args_t const &args, int n, lmap_delta_t &delta) const { // thread safe
+		rand_gen_t rgen;
+		rgen.set_state(n+1, p.job.lix); // deterministic per ray
+		unsigned dir_ix(rgen.rand() % ray_directions.size());
+		vector3d pri_dir;
+		colorRGBA ray_lcolor(p.lcolor), ccolor(WHITE);
+		bool const is_skylight_dir(p.is_skylight && (n&1)); // alternate between sky ambient and sun/moon directional
+		
+		if (is_skylight_dir) { // skylight directional diffuse
+			pri_dir    = p.light_dir;
+			ray_lcolor = p.pri_lcolor;
+		}
+		else { // omidirectional or sky ambient from windows
+			pri_dir = get_ray_dir(dir_ix); // should this be cosine weighted for windows? and clipped to the beamwidth for ceiling lights?
+			if ( p.is_window && ((pri_dir[p.dim] > 0.0) ^ bool(p.dir)))          {pri_dir[p.dim] *= -1.0;} // reflect light if needed about window plane to ensure it enters the room
+			if (!p.is_window && p.dir < 2 && (pri_dir[p.dim] > 0) != bool(p.dir)) {pri_dir[p.dim] *= -1.0;} // point in general light dir/hemisphere; doesn't seem to improve quality
+			if (p.hanging && dot_product(pri_dir, p.light_dir) < 0.0) {pri_dir.negate();}
+		}
+		float const lum_thresh(0.1*ray_lcolor.get_luminance());
+		point origin, init_cpos, cpos;
+		vector3d init_cnorm, cnorm;
+
+		// select a random point on the light cube
+		for (unsigned N = 0; N < 10; ++N) { // 10 attempts to find a point within the light shape
+			for (unsigned d = 0; d < 3; ++d) {
+				float const lo(p.light_cube.d[d][0]), hi(p.light_cube.d[d][1]);
+				origin[d] = ((lo == hi) ? lo : rgen.rand_uniform(lo, hi));
+			}
+			if (p.light_radius == 0.0 || dist_xy_less_than(origin, p.light_center, p.light_radius)) break; // done/success
+		} // for N
+		init_cpos = origin; // init value
+		bool const hit(b.ray_cast_interior(origin, pri_dir, args, init_cpos, init_cnorm, ccolor, &rgen));
+
+		// room lights already contribute direct lighting, so we skip this ray; however, windows don't, so we add their primary ray contribution
+		if (p.is_window && /*!is_skylight_dir*/!p.is_skylight && init_cpos != origin) {
+			lmgr.add_path_to_lmcs(origin, init_cpos, p.weight, ray_lcolor*p.num_pri_splits, p.step_sz_inv, delta); // scale color based on splits
+		}
+		if (!hit) return; // done
+		colorRGBA const init_color(ray_lcolor.modulate_with(ccolor));
+		if (init_color.get_luminance() < lum_thresh) return; // done (Note: get_weighted_luminance() will discard too much blue light)
+		vector3d const v_ref(get_reflect_dir(pri_dir, init_cnorm));
+
+		for (unsigned splits = 0; splits < p.num_pri_splits; ++splits) {
+			point pos(origin);
+			vector3d dir(pri_dir);
+			colorRGBA cur_color(init_color);
+			calc_reflect_ray(pos, init_cpos, dir, init_cnorm, v_ref, dir_ix, p.tolerance);
+
+			for (unsigned bounce = 1; bounce < MAX_RAY_BOUNCES; ++bounce) { // allow up to MAX_RAY_BOUNCES bounces
+				cpos = pos; // init value
+				bool const hit(b.ray_cast_interior(pos, dir, args, cpos, cnorm, ccolor, &rgen));
+				// accumulate light along the ray from pos to cpos (which is always valid) with color cur_color
+				if (cpos != pos) {lmgr.add_path_to_lmcs(pos, cpos, p.weight, cur_color, p.step_sz_inv, delta);}
+				if (!hit || bounce+1 == MAX_RAY_BOUNCES) break; // done on hit or last iteration
+				cur_color = cur_color.modulate_with(ccolor);
+				if (cur_color.get_luminance() < lum_thresh) break; // done
+				calc_reflect_ray(pos, cpos, dir, cnorm, get_reflect_dir(dir, cnorm), dir_ix, p.tolerance);
+			} // for bounce
+		} // for splits
+	}
+	void cast_light_rays(building_t const &b, vector<light_job_t> const &jobs) {
+		// Note: modifies lmgr, but otherwise thread safe
+		// Rays from all lights in the batch are cast in parallel, with each primary ray recording its lighting contributions into its own delta;
+		// deltas are applied to lmgr in {light, ray} order, which gives the same result as casting the rays serially, independent of thread count
+		bool const reserve_draw_thread(USE_BKG_THREAD && (int)NUM_THREADS >= omp_get_max_threads()); // reserve a thread for drawing if needed
+		unsigned num_rt_threads(max(1U, (NUM_THREADS - reserve_draw_thread)));
+		// if there are many threads, reserve an extra thread for omp parallel bloocks using two threads on the master (calc_mesh_shadows, tile_t::create_texture(), etc.)
+		if (USE_BKG_THREAD && num_rt_threads > 8) {--num_rt_threads;}
 		building_colors_t bcolors;
 		b.set_building_colors(bcolors);
-		cube_t room_area;
-		get_room_bvh(b, light_room_id, room_area); // build per-room BVH if needed
-		ray_cast_args_t const args(valid_area, room_area, bvh, room_bvh, in_attic, in_ext_basement, b.is_restroom_with_high_ceil(), bcolors);
-		lmgr.set_step_sz(half_step_sz);
-		
+		vector<light_ray_params_t> params(jobs.size());
+		vector<ray_cast_args_t> args;
+		vector<unsigned> job_end_ray(jobs.size()); // exclusive prefix sum of the number of primary rays per light
+		unsigned num_items(0), next_to_apply(0), next_job(0);
+		args.reserve(jobs.size());
+		for (room_bvh_entry_t &e : room_bvhs) {e.used = 0;}
+
+		for (unsigned i = 0; i < jobs.size(); ++i) {
+			light_ray_params_t &p(params[i]);
+			if (!setup_light_job(b, jobs[i], p)) {p.num_rays = 0;} // light was removed; no rays
+			args.emplace_back(valid_area, p.room_area, bvh, (p.room_bvh ? *p.room_bvh : bvh), p.in_attic, p.in_ext_basement, b.is_restroom_with_high_ceil(), bcolors);
+			num_items     += p.num_rays;
+			job_end_ray[i] = num_items;
+		}
+		vector<lmap_delta_t> deltas(num_items);
+		vector<uint8_t> ray_done(num_items, 0);
+
 		// Note: dynamic scheduling is faster, and using blocks doesn't help
 #pragma omp parallel for schedule(dynamic) num_threads(num_rt_threads)
-		for (int n = 0; n < num_rays; ++n) {
-			if (kill_thread) continue;
-			rand_gen_t rgen;
-			rgen.set_state(n+1, cur_job.lix); // should be deterministic, though add_path_to_lmcs() is not (due to thread races)
-			unsigned dir_ix(rgen.rand() % ray_directions.size());
-			vector3d pri_dir;
-			colorRGBA ray_lcolor(lcolor), ccolor(WHITE);
-			bool const is_skylight_dir(is_skylight && (n&1)); // alternate between sky ambient and sun/moon directional
-			
-			if (is_skylight_dir) { // skylight directional diffuse
-				pri_dir    = light_dir;
-				ray_lcolor = pri_lcolor;
-			}
-			else { // omidirectional or sky ambient from windows
-				pri_dir = get_ray_dir(dir_ix); // should this be cosine weighted for windows? and clipped to the beamwidth for ceiling lights?
-				if ( is_window && ((pri_dir[dim] > 0.0) ^ dir))               {pri_dir[dim] *= -1.0;} // reflect light if needed about window plane to ensure it enters the room
-				if (!is_window && dir < 2 && (pri_dir[dim] > 0) != bool(dir)) {pri_dir[dim] *= -1.0;} // point in general light dir/hemisphere; doesn't seem to improve quality
-				if (hanging && dot_product(pri_dir, light_dir) < 0.0) {pri_dir.negate();}
-			}
-			float const lum_thresh(0.1*ray_lcolor.get_luminance());
-			point origin, init_cpos, cpos;
-			vector3d init_cnorm, cnorm;
-
-			// select a random point on the light cube
-			for (unsigned N = 0; N < 10; ++N) { // 10 attempts to find a point within the light shape
-				for (unsigned d = 0; d < 3; ++d) {
-					float const lo(light_cube.d[d][0]), hi(light_cube.d[d][1]);
-					origin[d] = ((lo == hi) ? lo : rgen.rand_uniform(lo, hi));
+		for (int i = 0; i < (int)num_items; ++i) {
+			if (!kill_thread) {
+				unsigned const job_ix(std::upper_bound(job_end_ray.begin(), job_end_ray.end(), unsigned(i)) - job_end_ray.begin());
+				assert(job_ix < jobs.size());
+				int const n(i - (job_ix ? job_end_ray[job_ix-1] : 0));
+				cast_light_ray(b, params[job_ix], args[job_ix], n, deltas[i]);
+			}
+#pragma omp critical(indir_light_reduce)
+			{
+				ray_done[i] = 1;
+				// apply all completed rays that come next in the fixed order, and report each light once all of its rays have been applied
+				for (; next_to_apply < num_items && ray_done[next_to_apply]; ++next_to_apply) {
+					lmgr.apply_delta(deltas[next_to_apply]);
+					lmap_delta_t().swap(deltas[next_to_apply]); // free the memory
 				}
-				if (light_radius == 0.0 || dist_xy_less_than(origin, light_center, light_radius)) break; // done/success
-			} // for N
-			init_cpos = origin; // init value
-			bool const hit(b.ray_cast_interior(origin, pri_dir, args, init_cpos, init_cnorm, ccolor, &rgen));
-
-			// room lights already contribute direct lighting, so we skip this ray; however, windows don't, so we add their primary ray contribution
-			if (is_window && /*!is_skylight_dir*/!is_skylight && init_cpos != origin) {
-				lmgr.add_path_to_lmcs(origin, init_cpos, weight, ray_lcolor*NUM_PRI_SPLITS); // scale color based on splits
-			}
-			if (!hit) continue; // done
-			colorRGBA const init_color(ray_lcolor.modulate_with(ccolor));
-			if (init_color.get_luminance() < lum_thresh) continue; // done (Note: get_weighted_luminance() will discard too much blue light)
-			vector3d const v_ref(get_reflect_dir(pri_dir, init_cnorm));
-
-			for (unsigned splits = 0; splits < NUM_PRI_SPLITS; ++splits) {
-				point pos(origin);
-				vector3d dir(pri_dir);
-				colorRGBA cur_color(init_color);
-				calc_reflect_ray(pos, init_cpos, dir, init_cnorm, v_ref, dir_ix, tolerance);
-
-				for (unsigned bounce = 1; bounce < MAX_RAY_BOUNCES; ++bounce) { // allow up to MAX_RAY_BOUNCES bounces
-					cpos = pos; // init value
-					bool const hit(b.ray_cast_interior(pos, dir, args, cpos, cnorm, ccolor, &rgen));
-					// accumulate light along the ray from pos to cpos (which is always valid) with color cur_color
-					if (cpos != pos) {lmgr.add_path_to_lmcs(pos, cpos, weight, cur_color);}
-					if (!hit || bounce+1 == MAX_RAY_BOUNCES) break; // done on hit or last iteration
-					cur_color = cur_color.modulate_with(ccolor);
-					if (cur_color.get_luminance() < lum_thresh) break; // done
-					calc_reflect_ray(pos, cpos, dir, cnorm, get_reflect_dir(dir, cnorm), dir_ix, tolerance);
-				} // for bounce
-			} // for splits
-		} // for n
+				for (; next_job < jobs.size() && job_end_ray[next_job] <= next_to_apply; ++next_job) {mark_job_applied(jobs[next_job]);}
+			}
+		} // for i
+		for (; next_job < jobs.size(); ++next_job) {mark_job_applied(jobs[next_job]);} // lights with no rays
 		register_reflection_update(); // sets some flags; should be thread safe
 	}
+	void mark_job_applied(light_job_t const &job) {
+		if (USE_BKG_THREAD) {lights_done.push(job);}
+		lighting_updated = 1;
+	}
 	void wait_for_finish(bool force_kill) {
 		// Note: for now the time taken to process a light should be pretty fast so we just block until finished; set kill_thread=1 to be faster
 		if (force_kill) {kill_thread = 1;}
@@ -1117,7 +1194,7 @@ class building_indir_light_mgr_t {
 		if (!incremental) {lighting_updated = 0;} // keep updating until done running
 	}
 	void maybe_join_thread() {
-		if (needs_to_join) {rt_thread.join(); needs_to_join = 0;}
+		if (needs_to_join) {rt_job.wait(); needs_to_join = 0;}
 	}
 	void add_to_remove_queue(unsigned light_ix) {
 		for (unsigned v : remove_queue) {
@@ -1171,13 +1248,14 @@ public:
 	void clear() {
 		lighting_updated = need_bvh_rebuild = update_windows = target_in_extb = 0;
 		num_to_remove    = 0;
-		cur_bix   = cur_floor = last_room_id = -1;
+		cur_bix   = cur_floor = -1;
 		timer_val = 0;
 		invalidate_lighting();
 		light_ids.clear();
 		lights_to_sort.clear();
 		windows.clear();
 		bvh.clear();
+		room_bvhs.clear();
 	}
 	void end_rt_job() {
 		wait_for_finish(1); // force_kill=1
@@ -1256,9 +1334,9 @@ public:
 			}
 			if (!timer_val) {timer_val = GET_TIME_MS();} // start a new block of lights
 			init_lmgr(b);
-			assert(!needs_to_join); // must have joined previous thread
+			assert(!needs_to_join); // must have joined previous job
 			is_running = 1;
-			rt_thread  = std::thread(&building_indir_light_mgr_t::run_light_batch, this, b);
+			get_job_system().run_async([this, b] {run_light_batch(b);}, JOB_PRI_BKG, &rt_job); // b is copied into the job
 		}
 		else { // serial mode
 			mark_light_done(cur_job);
@@ -1267,7 +1345,7 @@ public:
 			init_lmgr(b);
 			lighting_updated = 1;
 			highres_timer_t timer("Ray Cast Building Light"); // 2354 in mall with 368 lights
-			cast_light_rays(b);
+			cast_light_rays(b, vector<light_job_t>(1, cur_job));
 		}
 	}
 	unsigned add_light_jobs(building_t const &b, point const &target) {
@@ -1287,10 +1365,14 @@ public:
 		return num_added;
 	}
 	void run_light_batch(building_t const &b) { // background thread task
-		while (light_queue.try_pop(cur_job)) {
-			cast_light_rays(b);
-			lights_done.push(cur_job);
-			lighting_updated = 1;
+		vector<light_job_t> jobs;
+
+		while (1) { // process all queued lights together so that their rays can be cast in parallel
+			jobs.clear();
+			light_job_t job;
+			while (light_queue.try_pop(job)) {jobs.push_back(job);}
+			if (jobs.empty()) break; // done
+			cast_light_rays(b, jobs);
 		}
 		is_running    = 0; // thread job is done
 		needs_to_join = 1;
@@ -1337,7 +1419,7 @@ public:
 			return;
 		}
 		unsigned const num_erased(lights_complete.erase(light_ix)); // light is no longer completed; erase its state
-		bool const is_cur_light((int)light_ix == cur_job.lix && is_running);
+		bool const is_cur_light(is_running && lights_pend.find(light_ix) != lights_pend.end()); // queued or in progress in the background thread
 		// Note: we can't just stop in the middle, because that will leave cur_light in an invalid/incomplete state
 		// Note: if door state changed since this light was turned on, removing it may leave some light
 		if ((geom_changed || !light_is_on || (in_elevator && num_erased)) && (num_erased || is_cur_light)) {add_to_remove_queue(light_ix);} // must remove the light instead
@@ -1428,7 +1510,7 @@ public:
 		//highres_timer_t timer("Build BVH");
 		bvh.build_tree_top(0); // verbose=0
 		need_bvh_rebuild = 0;
-		last_room_id     = -1;
+		room_bvhs.clear(); // room BVHs refer to the old BVH contents
 	}
 	void invalidate_bvh    () {need_bvh_rebuild = 1;} // Note: can't directly clear bvh because a thread may be using it
 	void invalidate_windows() {update_windows   = 1;}
@@ -4,6 +4,7 @@
 #include "function_registry.h"
 #include "buildings.h"
 #include "city_model.h"
+#include <mutex>
 
 bool const EXT_MALL_ELEV_TO_CITY = 1;
 bool const ADD_MALL_SKYLIGHTS    = 1;
@@ -26,6 +27,8 @@ void count_sign_rows_cols(string const &text, unsigned &nrows, unsigned &ncols);
 
 extern object_model_loader_t building_obj_model_loader;
 
+std::mutex city_placement_mutex; // city state is shared across buildings generated in parallel
+
 
 void building_t::select_mall_wall_color() {
 	assert(has_mall());
@@ -231,8 +234,11 @@ void building_t::setup_mall_concourse(cube_t const &room, bool dim, bool dir, ra
 					elevator.z2() += floor_spacing;
 					entrance.z2()  = elevator.z2();
 					entrance.z1()  = ground_floor_z1; // at city level
-					add_city_plot_cut(elevator);
-					add_city_ug_elevator_entrance(ug_elev_info_t(entrance, (ground_floor_z1 + window_vspace), dim, !edir));
+					{
+						std::lock_guard<std::mutex> lock(city_placement_mutex);
+						add_city_plot_cut(elevator);
+						add_city_ug_elevator_entrance(ug_elev_info_t(entrance, (ground_floor_z1 + window_vspace), dim, !edir));
+					}
 					interior->mall_info->city_elevator_ix = interior->elevators.size();
 				}
 				else { // try the other dir
@@ -267,7 +273,10 @@ void building_t::setup_mall_concourse(cube_t const &room, bool dim, bool dir, ra
 				} // for n
 			}
 			skylight.z2() -= window_vspace; // subtract back off
-			add_city_plot_cut(skylight);
+			{
+				std::lock_guard<std::mutex> lock(city_placement_mutex);
+				add_city_plot_cut(skylight);
+			}
 			interior->mall_info->skylights.push_back(skylight);
 		} // for opening
 	}
@@ -288,12 +297,16 @@ bool building_t::top_of_mall_elevator_visible(point const &camera_bs, vector3d c
 
 bool building_t::is_cube_city_placement_invalid(cube_t const &c) const { // for mall skylights, elevator, etc.
 	if (!is_basement_room_not_int_bldg(c, nullptr, 1)) return 1; // check for buildings above; no exclude, allow_outside_grid=1
+	std::lock_guard<std::mutex> lock(city_placement_mutex);
 	return is_invalid_city_placement_for_cube(c); // Note: city objects may not have been placed yet
 }
 bool building_t::is_store_placement_invalid(cube_t const &store) const {
 	if (is_in_city) { // mall room must be inside city bounds
 		static vect_cube_t city_bcubes;
-		if (city_bcubes.empty()) {get_city_bcubes(city_bcubes);}
+		{
+			std::lock_guard<std::mutex> lock(city_placement_mutex);
+			if (city_bcubes.empty()) {get_city_bcubes(city_bcubes);}
+		}
 		bool contained(0);
 
 		for (cube_t const &c : city_bcubes) {
@@ -8,6 +8,7 @@
 #include "profiler.h"
 #include "nav_grid.h"
 #include "openal_wrap.h"
+#include "job_system.h"
 #include <queue>
 
 
@@ -18,11 +19,14 @@ float const COLL_RADIUS_SCALE   = 0.75; // somewhat smaller than radius, but lar
 int player_hiding_frame(0);
 building_dest_t cur_player_building_loc, prev_player_building_loc;
 room_object_t player_hiding_obj;
-vect_cube_t reused_avoid_cubes[2]; // temporary that's reused across frames and people
-bool debug_mode(0);
+thread_local vect_cube_t reused_avoid_cubes[2]; // temporary that's reused across frames and people
+thread_local bool debug_mode(0);
+// side effects on global state such as sounds are queued per building when buildings are updated in parallel, then run in building order
+thread_local vector<std::function<void()>> *ai_deferred_actions(nullptr);
 
 extern bool player_is_hiding, player_on_escalator, player_in_tunnel;
 extern int frame_counter, display_mode, animate2, player_in_elevator;
+extern unsigned NUM_THREADS;
 extern float fticks;
 extern building_params_t global_building_params;
 extern building_t const *player_building;
@@ -38,6 +42,10 @@ unsigned get_shower_cubes(room_object_t const &c, cube_t sides[2]);
 void resize_cubes_xy(vect_cube_t &cubes, float val);
 void get_sphere_boundary_pts(point const &center, float radius, point *pts, bool skip_z=0);
 unsigned get_L_stairs_first_flight_count(stairs_landing_base_t const &s, float landing_width);
+
+template<typename F> void run_or_defer_ai_action(F const &f) {
+	if (ai_deferred_actions) {ai_deferred_actions->emplace_back(f);} else {f();}
+}
 void get_L_stairs_entrances(stairs_landing_base_t const &s, float doorway_width, bool for_placement, cube_t entrances[2]);
 bool bed_is_wide(room_object_t const &c);
 
@@ -1097,8 +1105,8 @@ bool building_t::are_rooms_connected_without_using_room_or_door(unsigned room1,
 	assert(room_exclude != room1 && room_exclude != room2);
 	if (room1 == room2) return 1;
 	bool const use_bit_mask(num_rooms <= 64); // almost always true, except for buildings with malls
-	static vector<unsigned> pend; // reused across calls
-	static vector<uint8_t> seen; // reused across calls
+	static thread_local vector<unsigned> pend; // reused across calls
+	static thread_local vector<uint8_t> seen; // reused across calls
 	uint64_t seen_mask(0);
 	pend.clear();
 	pend.push_back(room1);
@@ -3023,7 +3031,8 @@ int building_t::ai_room_update(person_t &person, float delta_dir, unsigned perso
 			
 			if (play_sound) { // alert other zombies if in the same room and floor as player, except in backrooms/parking garage/retail/mall/restaurant, unless player is visible
 				bool const alert_other_zombies(same_room_and_floor && (!is_single_large_room(person.cur_room) || is_player_visible(person, 1)));
-				maybe_play_zombie_sound(person.pos, person_ix, alert_other_zombies);
+				point const sound_pos(person.pos);
+				run_or_defer_ai_action([=] {maybe_play_zombie_sound(sound_pos, person_ix, alert_other_zombies);});
 			}
 		}
 	}
@@ -3569,13 +3578,50 @@ void building_t::move_person_to_not_collide(person_t &person, person_t const &ot
 	}
 }
 
+bool building_t::ai_can_interact_with_player() const { // player collisions, hiding spots, footsteps, and splashes can only happen in these buildings
+	if (this == player_building) return 1;
+	if (!cur_player_building_loc.is_valid() || !has_people()) return 0;
+	if (interior->people.front().cur_bldg == cur_player_building_loc.building_ix) return 1;
+	return (has_conn_info() && player_building != nullptr && player_building->has_conn_info()); // zombies can follow the player into connected buildings
+}
+
 // Note: non-const because this updates room lights
 void vect_building_t::ai_room_update(float delta_dir, float dmax, point const &camera_bs, rand_gen_t &rgen) {
 	//timer_t timer("Building People Update"); // 0.25ms, mostly iteration overhead, for sparse update with 2-6 people per building (avg for 2 calls city + secondary)
+	static vector<unsigned> serial_bixs, parallel_bixs; // reused across frames
+	static vector<vector<std::function<void()>>> deferred; // one per parallel building
+	serial_bixs  .clear();
+	parallel_bixs.clear();
 
 	for (iterator b = begin(); b != end(); ++b) {
 		if (!b->has_people() || !b->bcube.closest_dist_less_than(camera_bs, dmax)) continue; // no people or too far away, no updates
-		b->all_ai_room_update(rgen, delta_dir);
+		(b->ai_can_interact_with_player() ? serial_bixs : parallel_bixs).push_back(b - begin());
+	}
+	if (serial_bixs.empty() && parallel_bixs.empty()) return;
+	// each building gets its own random stream based on its index and one shared draw per frame, so results don't depend on thread count or timing
+	unsigned const frame_seed(rgen.rand());
+
+	auto update_building = [&](unsigned bix) {
+		rand_gen_t building_rgen;
+		building_rgen.set_state(frame_seed, bix+1);
+		operator[](bix).all_ai_room_update(building_rgen, delta_dir);
+	};
+	for (unsigned bix : serial_bixs) {update_building(bix);} // buildings that interact with the player are updated serially, without deferral
+
+	if (parallel_bixs.size() == 1) { // no need to use the thread pool
+		update_building(parallel_bixs.front());
+		return;
+	}
+	if (deferred.size() < parallel_bixs.size()) {deferred.resize(parallel_bixs.size());}
+
+	get_job_system().parallel_for(parallel_bixs.size(), [&](unsigned task) { // one building per task
+		ai_deferred_actions = &deferred[task];
+		update_building(parallel_bixs[task]);
+		ai_deferred_actions = nullptr;
+	}, JOB_PRI_FRAME, max(NUM_THREADS, 1U)); // up to num_threads threads, including this one
+	for (unsigned task = 0; task < parallel_bixs.size(); ++task) { // apply deferred actions in building order
+		for (auto const &action : deferred[task]) {action();}
+		deferred[task].clear();
 	}
 }
 
@@ -3653,16 +3699,21 @@ int building_t::room_or_adj_room_has_stairs(int room_ix, float zval, bool inc_ad
 	return 0;
 }
 
-void building_t::building_person_hurt_sound(unsigned person_ix, bool is_steam) const {
+void play_person_hurt_sound(point const &pos, unsigned person_ix, bool is_female, bool is_steam) {
 	if (is_steam) { // play less frequently since steam damage is continuous
 		static double next_time(0.0);
 		static rand_gen_t rgen;
 		if (tfticks < next_time) return; // too soon
 		next_time = tfticks + double(rgen.rand_uniform(1.0, 1.5))*TICKS_PER_SECOND; 
 	}
-	person_t &person(interior->people[person_ix]);
-	if (in_building_gameplay_mode()) {maybe_play_zombie_sound(person.pos, person_ix, !is_steam, 1, 1.0, 1.25);} // zombie
-	else {gen_sound_thread_safe((person.is_female ? SOUND_SCREAM3 : SOUND_SCREAM1), (person.pos + get_camera_coord_space_xlate()), 1.0, 1.0, 1.0, is_steam);} // human
+	if (in_building_gameplay_mode()) {maybe_play_zombie_sound(pos, person_ix, !is_steam, 1, 1.0, 1.25);} // zombie
+	else {gen_sound_thread_safe((is_female ? SOUND_SCREAM3 : SOUND_SCREAM1), (pos + get_camera_coord_space_xlate()), 1.0, 1.0, 1.0, is_steam);} // human
+}
+void building_t::building_person_hurt_sound(unsigned person_ix, bool is_steam) const {
+	person_t const &person(interior->people[person_ix]);
+	point const pos(person.pos);
+	bool const is_female(person.is_female);
+	run_or_defer_ai_action([=] {play_person_hurt_sound(pos, person_ix, is_female, is_steam);}); // people may be removed before this runs, so copy the data we need
 }
 bool building_t::maybe_zombie_retreat(unsigned person_ix, point const &hit_pos, unsigned hit_obj_type) {
 	bool const play_hurt_sound(hit_obj_type == TYPE_HANDGUN);
@@ -1497,7 +1497,7 @@ bool building_t::add_sprinkler_pipes(vect_cube_t const &obstacles, vect_cube_t c
 				end_to_move = last_added_conn_pipe_pos;
 
 				for (unsigned i = pipe_obj_ix+1; i < pipe_obj_ix+3; ++i) { // check both end caps
-					if (objs[i].d[dim][!dir] == pipe_end) {objs[i].translate_dim(dim, xlate);}
+					if (objs[i].d[dim][!dir] == pipe_end) {interior->room_geom->get_placed_obj_for_edit(i).translate_dim(dim, xlate);} // moved, not shrunk
 				}
 				for (unsigned i = pipe_obj_ix+3; i < pri_pipe_end_ix; ++i) { // remove end caps no longer covering shortened pipe
 					room_object_t &obj(objs[i]);
@@ -2538,26 +2538,143 @@ bool building_t::check_cube_on_or_near_stairs(cube_t const &c) const {
 }
 
 // Note: for procedural object placement; no expanded_objs, but includes blockers
+bool room_obj_overlaps_placement(room_object_t const &obj, cube_t const &c, bool check_all) {
+	room_object const type(obj.type);
+	if (type == TYPE_POOL_TILE) return 0; // always excluded, since it's thin and objects can be mounted over it
+	if (obj.is_a_drink() && obj.is_on_floor() && obj.intersects_no_adj(c)) return 1; // bottles and cans on the floor do count
+	// Note: light switches/outlets/vents/pipes/TVs/monitors don't collide with the player or AI, but they collide with other placed objects to avoid blocking them;
+	// however, it's okay to block outlets with furniture
+	if ((type == TYPE_SWITCH || type == TYPE_OUTLET || type == TYPE_VENT) && obj.intersects(c)) return 1; // inc adj as these objects may shrink to zero area far from origin
+	if ((check_all || !obj.no_coll() || type == TYPE_PIPE || type == TYPE_FALSE_DOOR || type == TYPE_FIRE_EXT || type == TYPE_TV || type == TYPE_MONITOR ||
+		type == TYPE_US_FLAG || type == TYPE_CLOCK || type == TYPE_SHOE || obj.is_pet_container()) && obj.intersects_no_adj(c)) return 1;
+	if (type == TYPE_DESK && obj.shape == SHAPE_TALL && obj.intersects_xy_no_adj(c) && c.intersects_no_adj(get_desk_top_back(obj))) return 1; // check tall desk back
+	if (type == TYPE_BOOK && (obj.flags & RO_FLAG_ON_FLOOR) && obj.intersects_no_adj(c)) return 1; // books on floors count
+	return 0;
+}
 bool building_t::overlaps_other_room_obj(cube_t const &c, unsigned objs_start, bool check_all, unsigned const *objs_end) const {
 	assert(has_room_geom());
 	vect_room_object_t &objs(interior->room_geom->objs);
-	auto start(objs.begin()+objs_start), end((objs_end == nullptr) ? objs.end() : (objs.begin()+*objs_end));
-	assert(objs_start <= objs.size() && start <= end);
-
-	for (auto i = start; i != end; ++i) {
-		room_object const type(i->type);
-		if (type == TYPE_POOL_TILE) continue; // always excluded, since it's thin and objects can be mounted over it
-		if (i->is_a_drink() && i->is_on_floor() && i->intersects_no_adj(c)) return 1; // bottles and cans on the floor do count
-		// Note: light switches/outlets/vents/pipes/TVs/monitors don't collide with the player or AI, but they collide with other placed objects to avoid blocking them;
-		// however, it's okay to block outlets with furniture
-		if ((type == TYPE_SWITCH || type == TYPE_OUTLET || type == TYPE_VENT) && i->intersects(c)) return 1; // inc adj as these objects may shrink to zero area far from origin
-		if ((check_all || !i->no_coll() || type == TYPE_PIPE || type == TYPE_FALSE_DOOR || type == TYPE_FIRE_EXT || type == TYPE_TV || type == TYPE_MONITOR ||
-			type == TYPE_US_FLAG || type == TYPE_CLOCK || type == TYPE_SHOE || i->is_pet_container()) && i->intersects_no_adj(c)) return 1;
-		if (type == TYPE_DESK && i->shape == SHAPE_TALL && i->intersects_xy_no_adj(c) && c.intersects_no_adj(get_desk_top_back(*i))) return 1; // check tall desk back
-		if (type == TYPE_BOOK && (i->flags & RO_FLAG_ON_FLOOR) && i->intersects_no_adj(c)) return 1; // books on floors count
-	} // for i
+	unsigned const end((objs_end == nullptr) ? objs.size() : *objs_end);
+	assert(objs_start <= end && end <= objs.size());
+	vector<unsigned> const *cands(nullptr);
+	unsigned linear_start(objs_start);
+
+	bool overlaps(0);
+
+	if (interior->room_geom->place_index.get_candidates(objs, c, objs_start, end, cands, linear_start)) { // large range during generation
+		for (unsigned ix : *cands) {
+			if (room_obj_overlaps_placement(objs[ix], c, check_all)) {overlaps = 1; break;}
+		}
+#ifdef _DEBUG // check that the index wasn't made stale by an in-place edit that didn't use get_placed_obj_for_edit()
+		bool overlaps_linear(0);
+		for (unsigned i = objs_start; i < end && !overlaps_linear; ++i) {overlaps_linear = room_obj_overlaps_placement(objs[i], c, check_all);}
+		for (unsigned i = linear_start; i < end && !overlaps; ++i) {overlaps = room_obj_overlaps_placement(objs[i], c, check_all);}
+		assert(overlaps == overlaps_linear);
+#endif
+		if (overlaps) return 1;
+	}
+	for (unsigned i = linear_start; i < end; ++i) {
+		if (room_obj_overlaps_placement(objs[i], c, check_all)) return 1;
+	}
 	return 0;
 }
+
+unsigned const PLACE_INDEX_MIN_OBJS   = 64; // use a linear scan for smaller ranges
+unsigned const PLACE_INDEX_TAIL_OBJS  = 16; // the most recently added objects aren't indexed, since they're often modified or removed right after being placed
+unsigned const PLACE_INDEX_MAX_CELLS  = 64; // objects spanning more cells than this are stored in large_objs
+unsigned const PLACE_INDEX_NUM_BUCKETS= 4096; // must be a power of 2
+
+void room_obj_place_index_t::init(float cell_sz_xy, float cell_sz_z) {
+	assert(cell_sz_xy > 0.0 && cell_sz_z > 0.0);
+	inv_cell_xy = 1.0/cell_sz_xy;
+	inv_cell_z  = 1.0/cell_sz_z;
+	buckets.resize(PLACE_INDEX_NUM_BUCKETS);
+	reset();
+}
+void room_obj_place_index_t::clear() { // free all memory and disable
+	buckets = vector<vector<unsigned>>();
+	large_objs.clear();
+	obj_stamps.clear();
+	cands.clear();
+	num_indexed = ctx_start = 0;
+	dirty = 0;
+}
+void room_obj_place_index_t::reset() {
+	for (vector<unsigned> &b : buckets) {b.clear();}
+	large_objs.clear();
+	obj_stamps.clear();
+	num_indexed = ctx_start;
+}
+bool room_obj_place_index_t::get_cell_range(cube_t const &c, int lo[3], int hi[3]) const { // returns 1 if the number of cells is <= PLACE_INDEX_MAX_CELLS
+	float const inv_sz[3] = {inv_cell_xy, inv_cell_xy, inv_cell_z};
+	unsigned num_cells(1);
+
+	for (unsigned d = 0; d < 3; ++d) {
+		lo[d] = (int)floor(c.d[d][0]*inv_sz[d]);
+		hi[d] = (int)floor(c.d[d][1]*inv_sz[d]);
+		num_cells *= min(unsigned(hi[d] - lo[d] + 1), PLACE_INDEX_MAX_CELLS+1); // clamp to avoid overflow
+	}
+	return (num_cells <= PLACE_INDEX_MAX_CELLS);
+}
+unsigned room_obj_place_index_t::get_bucket(int x, int y, int z) const {
+	return ((73856093U*unsigned(x)) ^ (19349663U*unsigned(y)) ^ (83492791U*unsigned(z))) & (PLACE_INDEX_NUM_BUCKETS-1);
+}
+void room_obj_place_index_t::sync(vect_room_object_t const &objs, unsigned start) {
+	if (start != ctx_start || dirty) {ctx_start = start; dirty = 0; reset();} // new range (likely a new room), or objects were edited in place; rebuild
+	// objects may have been removed with resize()/pop_back() and others added in their place since the last query; if so, rebuild the index
+	else if (num_indexed > objs.size() || (num_indexed > ctx_start && (!(objs[num_indexed-1] == last_obj) || objs[num_indexed-1].type != last_obj.type))) {reset();}
+	unsigned const target((objs.size() > PLACE_INDEX_TAIL_OBJS) ? (objs.size() - PLACE_INDEX_TAIL_OBJS) : 0);
+	if (num_indexed >= target) return; // nothing to add
+	obj_stamps.resize(target, 0);
+	int lo[3], hi[3];
+
+	for (unsigned i = num_indexed; i < target; ++i) {
+		room_object_t const &obj(objs[i]);
+		cube_t bc(obj);
+		if (obj.type == TYPE_DESK && obj.shape == SHAPE_TALL) {bc.z2() += 1.8*obj.dz();} // include the desk top back; see get_desk_top_back()
+		if (!get_cell_range(bc, lo, hi)) {large_objs.push_back(i); continue;}
+
+		for (int z = lo[2]; z <= hi[2]; ++z) {
+			for (int y = lo[1]; y <= hi[1]; ++y) {
+				for (int x = lo[0]; x <= hi[0]; ++x) {
+					vector<unsigned> &bucket(buckets[get_bucket(x, y, z)]);
+					if (bucket.empty() || bucket.back() != i) {bucket.push_back(i);} // skip duplicate hash collisions within this object
+				}
+			}
+		}
+	} // for i
+	num_indexed = target;
+	last_obj    = objs[target-1];
+}
+bool room_obj_place_index_t::get_candidates(vect_room_object_t const &objs, cube_t const &c, unsigned start, unsigned end,
+	vector<unsigned> const *&cands_out, unsigned &linear_start)
+{
+	if (!enabled() || end < start + PLACE_INDEX_MIN_OBJS) return 0;
+	int lo[3], hi[3];
+	if (!get_cell_range(c, lo, hi)) return 0; // query cube is too large
+	sync(objs, start);
+	if (num_indexed <= start) return 0; // nothing in range is indexed
+	cands.clear();
+	++query_stamp;
+
+	for (int z = lo[2]; z <= hi[2]; ++z) {
+		for (int y = lo[1]; y <= hi[1]; ++y) {
+			for (int x = lo[0]; x <= hi[0]; ++x) {
+				for (unsigned ix : buckets[get_bucket(x, y, z)]) {
+					if (ix < start || ix >= end || obj_stamps[ix] == query_stamp) continue;
+					obj_stamps[ix] = query_stamp;
+					cands.push_back(ix);
+				}
+			}
+		}
+	}
+	for (unsigned ix : large_objs) {
+		if (ix >= start && ix < end) {cands.push_back(ix);}
+	}
+	cands_out    = &cands;
+	linear_start = max(start, num_indexed);
+	return 1;
+}
 bool building_t::overlaps_obj_or_placement_blocked(cube_t const &c, cube_t const &room, unsigned objs_start, bool check_all, float dmin) const {
 	return (overlaps_other_room_obj(c, objs_start, check_all) || is_obj_placement_blocked(c, room, 1, 0, dmin)); // inc_open_doors=1, check_open_dir=0
 }
@@ -245,8 +245,8 @@ bool building_t::add_retail_room_objs(rand_gen_t rgen, room_t const &room, float
 					} // for rack
 					if (!pillars.empty()) { // raise office pillar outer cubes above upper level
 						for (unsigned i = objs_start; i < objs_end; ++i) {
-							room_object_t &obj(objs[i]);
-							if (obj.type == TYPE_OFF_PILLAR && upper_place_area.intersects_xy(obj)) {max_eq(obj.z2(), min_pillar_z2);}
+							room_object_t const &obj(objs[i]);
+							if (obj.type == TYPE_OFF_PILLAR && upper_place_area.intersects_xy(obj)) {max_eq(interior->room_geom->get_placed_obj_for_edit(i).z2(), min_pillar_z2);}
 						}
 					}
 					// re-enable this floor on any elevator passing through it; add short beams under elevator entrances
@@ -1536,6 +1536,21 @@ void building_t::draw_room_geom(brg_batch_draw_t *bbd, shader_t &s, shader_t &am
 	//glDisable(GL_CULL_FACE);
 	//s.set_cur_color(colorRGBA(1.0, 0.0, 0.0, 0.5)); // for use with debug visualization
 }
+void building_t::gen_room_geom_if_needed(unsigned building_ix) {
+	if (!interior || has_room_geom()) return;
+	interior->room_geom.reset(new building_room_geom_t(bcube.get_llc()));
+	// capture state before generating backrooms, which may add more doors
+	interior->room_geom->init_num_doors   = interior->doors      .size();
+	interior->room_geom->init_num_dstacks = interior->door_stacks.size();
+	interior->room_geom->init_num_details = details.size();
+	rand_gen_t rgen;
+	rgen.set_state(building_ix, (parts.size() + 17*interior->rgen_seed_ix)); // set to something canonical per building
+	interior->room_geom->decal_manager.rgen = rgen; // copy rgen for use with decals
+	interior->room_geom->place_index.init(get_window_vspace(), get_window_vspace()); // cell size of one floor
+	gen_room_details(rgen, building_ix);
+	assert(has_room_geom());
+	interior->room_geom->place_index.clear(); // objects may be moved or removed by the player and AI after this point
+}
 void building_t::gen_and_draw_room_geom(brg_batch_draw_t *bbd, shader_t &s, shader_t &amask_shader, occlusion_checker_noncity_t &oc, vector3d const &xlate,
 	unsigned building_ix, bool shadow_only, bool reflection_pass, unsigned inc_small, bool player_in_building, bool ext_basement_conn_visible, bool mall_visible)
 {
@@ -1562,18 +1577,7 @@ void building_t::gen_and_draw_room_geom(brg_batch_draw_t *bbd, shader_t &s, shad
 			return;
 		}
 	}
-	if (!has_room_geom()) {
-		interior->room_geom.reset(new building_room_geom_t(bcube.get_llc()));
-		// capture state before generating backrooms, which may add more doors
-		interior->room_geom->init_num_doors   = interior->doors      .size();
-		interior->room_geom->init_num_dstacks = interior->door_stacks.size();
-		interior->room_geom->init_num_details = details.size();
-		rand_gen_t rgen;
-		rgen.set_state(building_ix, (parts.size() + 17*interior->rgen_seed_ix)); // set to something canonical per building
-		interior->room_geom->decal_manager.rgen = rgen; // copy rgen for use with decals
-		gen_room_details(rgen, building_ix); // generate so that we can draw it
-		assert(has_room_geom());
-	}
+	gen_room_geom_if_needed(building_ix); // generate so that we can draw it
 	if (has_room_geom() && (inc_small == 2 || inc_small == 3)) {add_wall_and_door_trim_if_needed();} // gen trim (exterior and interior) when close to the player
 	draw_room_geom(bbd, s, amask_shader, oc, xlate, building_ix, shadow_only, reflection_pass, inc_small, player_in_building, mall_visible);
 }
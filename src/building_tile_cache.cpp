@@ -0,0 +1,205 @@
+// 3D World - Building Tile Disk Cache Serialization
+
+#include "function_registry.h"
+#include "buildings.h"
+#include "binary_file_io.h"
+#include <type_traits>
+
+unsigned const BUILDING_CACHE_VERSION = 1; // increment when building_t or building_interior_t data members change
+unsigned const MAX_CACHE_VECT_SIZE    = (1U << 26); // sanity check for corrupted files
+
+
+// symmetric visitors: the same io_*() calls write a const building and read into a non-const building, so the two formats can't get out of sync
+class bldg_stream_writer_t {
+	ostream &out;
+
+	template<typename T> void io_one(T const &v) {
+		static_assert(std::is_trivially_copyable<T>::value, "building cache values must be trivially copyable");
+		out.write((const char *)&v, sizeof(T)); // Note: not write_val(), which would decay arrays to pointers
+	}
+public:
+	bldg_stream_writer_t(ostream &out_) : out(out_) {}
+	bool good() const {return out.good();}
+
+	template<typename... T> void io(T const &... v) {int dummy[] = {(io_one(v), 0)...}; (void)dummy;}
+	void io_str(string const &s) {write_string(out, s);}
+
+	template<typename T> void io_vect(vector<T> const &v) {
+		static_assert(std::is_trivially_copyable<T>::value, "building cache vector elements must be trivially copyable");
+		write_vector(out, v);
+	}
+	template<typename T, typename F> void io_vect(vector<T> const &v, T const &proto, F const &io_elem) { // elements with nested containers
+		write_uint(out, (unsigned)v.size());
+		for (T const &e : v) {io_elem(e);}
+	}
+	template<typename P, typename F> bool io_ptr(P const &p, F const &alloc) {
+		bool const valid(p != nullptr);
+		io_one(valid);
+		return valid;
+	}
+};
+
+class bldg_stream_reader_t {
+	istream &in;
+
+	template<typename T> void io_one(T &v) {
+		static_assert(std::is_trivially_copyable<T>::value, "building cache values must be trivially copyable");
+		in.read((char *)&v, sizeof(T));
+	}
+	unsigned read_size() {
+		unsigned const sz(read_uint(in));
+		if (!in.good() || sz > MAX_CACHE_VECT_SIZE) {in.setstate(std::ios::failbit); return 0;}
+		return sz;
+	}
+public:
+	bldg_stream_reader_t(istream &in_) : in(in_) {}
+	bool good() const {return in.good();}
+
+	template<typename... T> void io(T &... v) {int dummy[] = {(io_one(v), 0)...}; (void)dummy;}
+
+	void io_str(string &s) {
+		s.resize(read_size());
+		if (!s.empty()) {in.read(&s[0], s.size());}
+	}
+	template<typename T> void io_vect(vector<T> &v) { // read as a block; T may not be default constructible
+		static_assert(std::is_trivially_copyable<T>::value, "building cache vector elements must be trivially copyable");
+		unsigned const sz(read_size());
+		vector<char> buf(sz*sizeof(T));
+		if (sz > 0) {in.read(buf.data(), buf.size());}
+		T const *const data((T const *)buf.data());
+		v.assign(data, data+sz);
+	}
+	template<typename T, typename F> void io_vect(vector<T> &v, T const &proto, F const &io_elem) {
+		v.assign(read_size(), proto);
+		for (T &e : v) {io_elem(e);}
+	}
+	template<typename P, typename F> bool io_ptr(P &p, F const &alloc) {
+		bool valid(0);
+		io_one(valid);
+		if (valid) {p.reset(alloc());} else {p.reset();}
+		return valid;
+	}
+};
+
+template<typename B, typename D> typename std::conditional<std::is_const<D>::value, B const, B>::type &as_base(D &d) {return d;}
+
+template<typename S, typename E> void io_elevator(S &s, E &e) {
+	// Note: call_requests is runtime state and is required to be empty when caching
+	s.io(as_base<oriented_cube_t>(e), e.at_edge, e.going_up, e.at_dest, e.stop_on_passing_floor, e.hold_doors, e.hold_movement, e.under_skylight,
+		e.is_moving, e.interior_room, e.in_backrooms, e.no_buttons, e.has_equip_room, e.in_mall, e.adj_pair_ix, e.room_id, e.car_obj_id, e.light_obj_id,
+		e.button_id_start, e.button_id_end, e.num_occupants, e.skip_floors_mask, e.at_dest_frame, e.adj_elevator_ix, e.open_amt);
+	s.io_vect(e.all_room_ids);
+}
+template<typename S, typename T> void io_tunnel_seg(S &s, T &t) {
+	s.io(t.dim, t.room_conn, t.room_dir, t.has_gate, t.conns_added, t.closed_ends, t.conn_ix, t.conn_room_ix, t.tseg_ix, t.add_bend_dir,
+		t.radius, t.gate_pos, t.water_level, t.water_flow, t.p, t.bcube, t.bcube_ext, t.bcube_draw);
+	s.io_vect(t.conns);
+}
+template<typename S, typename C> void io_ceiling_space(S &s, C &c) {
+	s.io(as_base<cube_t>(c), c.room_ix, c.nx, c.ny, c.space);
+	s.io_vect(c.light);
+}
+template<typename S, typename I> void io_ind_info(S &s, I &i) {
+	s.io(i.entrance_dim, i.entrance_dir, i.entrance_pos, i.floor_space, i.entrance_area, i.non_window_walls, i.rgen, i.machine_row_spacing);
+	s.io_vect(i.sub_rooms);
+	s.io_vect(i.pg_extended_pipes);
+	s.io_vect(i.smoke_emitters);
+}
+template<typename S, typename D> void io_dc_info(S &s, D &d) {
+	s.io(d.se_dir, d.skip_sr_util_windows, d.cw_pipe_side, d.drain_pipe_side, d.ac_pipe_end, d.gen_pipe_side, d.gen_dir, d.xg_side,
+		d.office_pos, d.util_pos, d.bath_pos, d.ac_height, d.ac_width, d.ac_depth, d.intake_ducts);
+	s.io_vect(d.pipe_conn);
+}
+
+template<typename S, typename I> void io_interior(S &s, I &i) {
+	// Note: room_geom and nav_graph are created lazily when the player approaches; conn_info, mall_info, and people are required to be empty when caching
+	s.io_vect(i.floors);
+	s.io_vect(i.ceilings);
+	s.io_vect(i.fc_occluders);
+	s.io_vect(i.exclusion);
+	s.io_vect(i.open_walls);
+	s.io_vect(i.split_window_walls);
+	s.io_vect(i.prison_halls);
+	s.io_vect(i.wall_clip_cubes);
+	for (unsigned d = 0; d < 2; ++d) {s.io_vect(i.walls[d]);}
+	s.io_vect(i.int_windows);
+	s.io_vect(i.parking_str_walls);
+	s.io_vect(i.missing_ceil_tiles);
+	s.io_vect(i.missing_wall_segs);
+	s.io_vect(i.stairwells);
+	s.io_vect(i.tunnels, tunnel_seg_t(point(0.0, 0.0, 0.0), point(1.0, 0.0, 0.0), 0.0), [&s](auto &t) {io_tunnel_seg(s, t);});
+	s.io_vect(i.doors);
+	s.io_vect(i.door_stacks);
+	s.io_vect(i.landings);
+	s.io_vect(i.rooms);
+	s.io_vect(i.elevators, elevator_t(cube_t(0.0, 1.0, 0.0, 1.0, 0.0, 1.0), 0, 0, 0, 0, 0), [&s](auto &e) {io_elevator(s, e);});
+	s.io_vect(i.escalators);
+	s.io_vect(i.ceiling_spaces, ceiling_space_t(cube_t(), 0, 0, 0, vector2d()), [&s](auto &c) {io_ceiling_space(s, c);});
+	if (s.io_ptr(i.ind_info, [] {return new bldg_industrial_info_t(0, 0, 0.0, cube_t(), cube_t());})) {io_ind_info(s, *i.ind_info);}
+	if (s.io_ptr(i.dc_info,  [] {return new bldg_datacenter_info_t(0, 0.0, 0.0, 0.0, 0);}))             {io_dc_info (s, *i.dc_info );}
+	s.io(i.pg_ramp, i.attic_access, i.parking_entrance, i.pool, i.basement_ext_bcube, i.elevator_equip_room, i.ps_bathroom, i.draw_range, i.room_type_count,
+		i.extb_walls_start, i.mall_hall_walls_start, i.gen_room_details_pass, i.rgen_seed_ix, i.backrooms_tid, i.room_geom_rseed, i.garage_room,
+		i.ext_basement_hallway_room_id, i.ext_basement_door_stack_ix, i.last_active_door_ix, i.security_room_ix, i.furnace_type, i.attic_type, i.restaurant_orient);
+	s.io(i.door_state_updated, i.is_unconnected, i.ignore_ramp_placement, i.placed_people, i.elevators_disabled, i.attic_access_open, i.has_backrooms,
+		i.elevator_dir, i.extb_wall_dim, i.extb_wall_dir, i.conn_room_in_extb_hallway, i.has_sec_hallways, i.has_jail, i.num_extb_floors, i.water_zval, i.int_door_width);
+}
+
+template<typename S, typename B> void io_building(S &s, B &b) {
+	// Note: walkways are required to be empty when caching; player_visited is stats state and isn't saved
+	s.io(as_base<building_geom_t>(b), b.mat_ix, b.hallway_dim, b.real_num_parts, b.roof_type, b.roof_dims, b.street_dir, b.open_door_ix, b.basement_part_ix,
+		b.has_chimney, b.city_ix, b.floor_ext_door_mask, b.next_unit_id, b.next_room_num, b.btype);
+	s.io(b.is_house, b.has_garage, b.has_shed, b.has_int_garage, b.has_courtyard, b.has_complex_floorplan, b.has_helipad, b.has_ac, b.has_fake_roof_door,
+		b.has_tline_conn, b.has_smokestack, b.has_antenna, b.has_radiators, b.was_custom_placed, b.mw_restroom_side, b.street_side, b.has_attic_window,
+		b.multi_family, b.has_int_fplace, b.has_parking_garage, b.has_small_part, b.has_basement_door, b.has_basement_pipes, b.parts_generated, b.is_in_city,
+		b.has_skylight_light, b.pri_hall_stairs_to_pg, b.have_walkway_ext_door, b.have_hall_side_stairs, b.has_missing_stairs, b.retail_floor_levels,
+		b.has_clipped_wall, b.courtyard_door_ix);
+	s.io(b.side_color, b.roof_color, b.detail_color, b.door_color, b.wall_color);
+	s.io(b.bcube, b.coll_bcube, b.pri_hall, b.driveway, b.porch, b.assigned_plot, b.exterior_flag, b.ladder, b.deck_bounds, b.city_driveway, b.city_walkway);
+	s.io_vect(b.parts);
+	s.io_vect(b.fences);
+	s.io_vect(b.skylights);
+	s.io_vect(b.gutters);
+	s.io_vect(b.roof_lights);
+	s.io_vect(b.details);
+	s.io_vect(b.roof_tquads);
+	s.io_vect(b.doors);
+	s.io_vect(b.ext_lights);
+	s.io_vect(b.per_part_ext_verts, vect_point(), [&s](auto &v) {s.io_vect(v);});
+	s.io_vect(b.ext_steps);
+	if (s.io_ptr(b.interior, [] {return new building_interior_t;})) {io_interior(s, *b.interior);}
+	s.io_str(b.name);
+	s.io_str(b.address);
+	s.io(b.ext_side_qv_range, b.tree_pos, b.ao_bcz2, b.ground_floor_z1, b.interior_z2, b.water_damage, b.crack_damage);
+}
+
+// returns 1 if all building state is captured by io_building(); cross-building pointers and runtime state can't be cached
+bool can_cache_buildings(vector<building_t> const &buildings) {
+	for (building_t const &b : buildings) {
+		if (!b.walkways.empty()) return 0;
+		if (!b.interior) continue;
+		building_interior_t const &i(*b.interior);
+		if (i.room_geom || i.conn_info || i.mall_info || !i.people.empty()) return 0;
+
+		for (elevator_t const &e : i.elevators) {
+			if (e.was_called()) return 0;
+		}
+	}
+	return 1;
+}
+void write_buildings_to_stream(ostream &out, vector<building_t> const &buildings) {
+	assert(can_cache_buildings(buildings));
+	bldg_stream_writer_t s(out);
+	s.io(BUILDING_CACHE_VERSION);
+	s.io_vect(buildings, building_t(), [&s](building_t const &b) {io_building(s, b);});
+}
+bool read_buildings_from_stream(istream &in, vector<building_t> &buildings) {
+	bldg_stream_reader_t s(in);
+	unsigned version(0);
+	s.io(version);
+	if (!s.good() || version != BUILDING_CACHE_VERSION) return 0;
+	s.io_vect(buildings, building_t(), [&s](building_t &b) {io_building(s, b);});
+	if (s.good()) return 1;
+	buildings.clear(); // partial read
+	return 0;
+}
+
@@ -746,6 +746,33 @@ struct particle_source_t {
 	particle_source_t(point const &p, vector3d const v, float radius_, int pid_=-1) : pos(p), velocity(v), radius(radius_), pid(pid_) {}
 };
 
+// spatial hash of placed room objects, used to accelerate overlaps_other_room_obj() during room object generation;
+// objects in [ctx_start, objs.size()) are added lazily as objs grows, and the index is rebuilt when a query uses a different start (usually a new room);
+// generation code that moves or enlarges an object that may already be indexed must get it with building_room_geom_t::get_placed_obj_for_edit(), which invalidates
+// the index; shrinking, removing, or changing the type/flags of objects is safe because candidates are tested against the current objects;
+// debug builds check every indexed query against a linear scan
+class room_obj_place_index_t {
+	float inv_cell_xy=0.0, inv_cell_z=0.0;
+	unsigned num_indexed=0, query_stamp=0, ctx_start=0;
+	bool dirty=0;
+	room_object_t last_obj; // copy of the last indexed object, used to detect objects that were removed and replaced
+	vector<vector<unsigned>> buckets;
+	vector<unsigned> large_objs, obj_stamps, cands; // obj_stamps is for removing duplicates across buckets
+
+	bool get_cell_range(cube_t const &c, int lo[3], int hi[3]) const;
+	unsigned get_bucket(int x, int y, int z) const;
+	void reset();
+	void sync(vect_room_object_t const &objs, unsigned start);
+public:
+	bool enabled() const {return !buckets.empty();}
+	void init(float cell_sz_xy, float cell_sz_z);
+	void clear();
+	void invalidate() {dirty = 1;} // rebuilt on the next query
+	// returns 0 if the index can't be used for this query; otherwise cands_out contains the indexed objects in [start, end) that may intersect c,
+	// and objects in [max(start, num_indexed), end) must be tested by the caller
+	bool get_candidates(vect_room_object_t const &objs, cube_t const &c, unsigned start, unsigned end, vector<unsigned> const *&cands_out, unsigned &linear_start);
+};
+
 struct building_room_geom_t {
 
 	bool has_pictures=0, has_garage_car=0, modified_by_player=0, have_clock=0, have_conv_belt=0, glass_floor_split=0, mall_geom_drawn=0, has_locker=0;
@@ -788,6 +815,7 @@ struct building_room_geom_t {
 	particle_manager_t particle_manager;
 	fire_manager_t fire_manager;
 	vector<droplet_spawner_t> droplet_spawners[2]; // {flooded extended basement/backrooms, basement pipes}
+	room_obj_place_index_t place_index; // only enabled during room object generation
 
 	building_room_geom_t(point const &tex_origin_=all_zeros) : tex_origin(tex_origin_), wood_color(WHITE) {}
 	bool empty() const {return objs.empty();}
@@ -1089,6 +1117,11 @@ struct building_room_geom_t {
 	void get_path_nodes_for_pt_and_room(cube_t const &path_area, float zval, float max_dz, unsigned room_id, vector<point> &cand_nodes) const;
 	void next_frame(building_t &building, point const &player_pos);
 	
+	room_object_t &get_placed_obj_for_edit(unsigned obj_id) { // for room object generation code that moves or enlarges an object in place
+		assert(obj_id < objs.size());
+		place_index.invalidate();
+		return objs[obj_id];
+	}
 	room_object_t &get_room_object_by_index(unsigned obj_id) { // inlined for performance
 		if (obj_id < objs.size()) {return objs[obj_id];}
 		unsigned const exp_obj_id(obj_id - objs.size());
@@ -2058,6 +2091,7 @@ struct building_t : public building_geom_t {
 	void handle_vert_cylin_tape_collision(point &cur_pos, point const &prev_pos, float z1, float z2, float radius, bool is_player) const;
 	void draw_room_geom(brg_batch_draw_t *bbd, shader_t &s, shader_t &amask_shader, occlusion_checker_noncity_t &oc, vector3d const &xlate,
 		unsigned building_ix, bool shadow_only, bool reflection_pass, unsigned inc_small, bool player_in_building, bool mall_visible);
+	void gen_room_geom_if_needed(unsigned building_ix);
 	void gen_and_draw_room_geom(brg_batch_draw_t *bbd, shader_t &s, shader_t &amask_shader, occlusion_checker_noncity_t &oc, vector3d const &xlate, unsigned building_ix,
 		bool shadow_only, bool reflection_pass, unsigned inc_small, bool player_in_building, bool ext_basement_conn_visible, bool mall_visible);
 	bool has_glass_floor() const {return (has_room_geom() && !interior->room_geom->glass_floors.empty());}
@@ -2106,6 +2140,7 @@ struct building_t : public building_geom_t {
 	void place_random_people(unsigned num_people, unsigned building_ix, float radius, rand_gen_t &rgen) const;
 	void place_people_in_beds(float radius, rand_gen_t &rgen) const;
 	void all_ai_room_update(rand_gen_t &rgen, float delta_dir);
+	bool ai_can_interact_with_player() const;
 	int ai_room_update(person_t &person, float delta_dir, unsigned person_ix, rand_gen_t &rgen);
 	int run_ai_elevator_logic(person_t &person, float delta_dir, rand_gen_t &rgen);
 	bool run_ai_pool_logic  (person_t &person, float &speed_mult) const;
@@ -2845,6 +2880,9 @@ public:
 };
 
 bool city_single_cube_visible_check(point const &pos, cube_t const &c);
+bool can_cache_buildings(vector<building_t> const &buildings);
+void write_buildings_to_stream(std::ostream &out, vector<building_t> const &buildings);
+bool read_buildings_from_stream(std::istream &in, vector<building_t> &buildings);
 void add_city_building_signs(cube_t const &region_bcube, vector<sign_t     > &signs);
 void add_city_building_flags(cube_t const &region_bcube, vector<city_flag_t> &flags);
 bool get_wall_quad_window_area(vect_vnctcc_t const &wall_quad_verts, unsigned i, cube_t &c, float &tx1, float &tx2, float &tz1, float &tz2);
@@ -783,7 +783,7 @@ struct pedestrian_t : public person_base_t { // city pedestrian
 	bool check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force);
 	void run_collision_avoid(point const &ipos, vector3d const &ivel, float r2, float dist_sq, bool is_player, vector3d &force);
 	bool overlaps_player_in_z(point const &player_pos) const;
-	bool check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir);
+	bool check_ped_ped_coll(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir);
 	bool check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid);
 	bool check_inside_plot(ped_manager_t &ped_mgr, point const &prev_pos, cube_t &plot_bcube, cube_t &next_plot_bcube);
 	bool check_road_coll(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube, cube_t &coll_cube) const;
@@ -935,6 +935,11 @@ class ped_manager_t { // pedestrians
 		city_ixs_t() : ped_ix(0), plot_ix(0) {}
 		void assign(unsigned ped_ix_, unsigned plot_ix_) {ped_ix = ped_ix_; plot_ix = plot_ix_;}
 	};
+	struct city_update_t { // per-city state for parallel updates; only accessed by the thread updating this city
+		rand_gen_t rgen;
+		vector<pair<point, unsigned>> zombie_sounds; // {pos, ssn}; played after the update
+		vector<float> player_colls; // heights of peds colliding with the player; applied after the update
+	};
 	city_road_gen_t const &road_gen;
 	car_manager_t const &car_manager; // used for ped road crossing safety and dest car selection
 	ped_model_loader_t ped_model_loader;
@@ -942,6 +947,7 @@ class ped_manager_t { // pedestrians
 	vector<city_ixs_t> by_city; // first ped/plot index for each city
 	vector<unsigned> by_plot;
 	vector<unsigned char> need_to_sort_city;
+	vector<city_update_t> city_updates;
 	car_city_vect_t empty_cars_vect;
 	vector<car_city_vect_t> cars_by_city;
 	vector<person_t const *> to_draw;
@@ -967,9 +973,9 @@ class ped_manager_t { // pedestrians
 	car_city_vect_t const &get_cars_for_city(unsigned city) const {return ((city < cars_by_city.size()) ? cars_by_city[city] : empty_cars_vect);}
 public:
 	friend class city_spectate_manager_t;
-	// for use in pedestrian_t, mostly for collisions and path finding
-	path_finder_t path_finder;
-	ai_path_t grid_path;
+	// for use in pedestrian_t, mostly for collisions and path finding; these are per-thread since cities are updated in parallel
+	static path_finder_t &get_path_finder();
+	static ai_path_t     &get_grid_path();
 
 	ped_manager_t(city_road_gen_t const &road_gen_, car_manager_t const &car_manager_);
 	ped_manager_t (ped_manager_t const &) = delete; // forbidden
@@ -987,11 +993,13 @@ public:
 	cube_t get_expanded_city_plot_bcube_for_peds(unsigned city_ix, unsigned plot_ix) const;
 	bool is_city_residential(unsigned city_ix) const;
 	car_manager_t const &get_car_manager() const {return car_manager;}
-	void choose_new_ped_plot_pos(pedestrian_t &ped);
+	void choose_new_ped_plot_pos(pedestrian_t &ped, rand_gen_t &rgen_);
 	bool check_isec_sphere_coll       (pedestrian_t const &ped, cube_t &coll_cube) const;
 	bool check_streetlight_sphere_coll(pedestrian_t const &ped, cube_t &coll_cube) const;
 	bool mark_crosswalk_in_use(pedestrian_t const &ped);
-	bool choose_dest_building_or_parked_car(pedestrian_t &ped);
+	bool choose_dest_building_or_parked_car(pedestrian_t &ped, rand_gen_t &rgen_);
+	void defer_zombie_sound(pedestrian_t const &ped);
+	void defer_player_coll (pedestrian_t const &ped);
 	unsigned get_tot_num_plots() const {return tot_num_plots;}
 	unsigned get_next_plot(pedestrian_t &ped, int exclude_plot=-1) const;
 	void move_ped_to_next_plot(pedestrian_t &ped);
@@ -1002,7 +1010,7 @@ public:
 	bool has_car_at_pt(point const &pos, unsigned city, bool is_parked) const;
 	bool has_parked_car_on_path(point const &p1, point const &p2, unsigned city) const;
 	void get_parked_car_bcubes_for_plot(cube_t const &plot, unsigned city, vect_cube_t &car_bcubes) const;
-	bool choose_dest_parked_car(unsigned city_id, unsigned &plot_id, unsigned &car_ix, point &car_center);
+	bool choose_dest_parked_car(unsigned city_id, unsigned &plot_id, unsigned &car_ix, point &car_center, rand_gen_t &rgen_);
 	void next_animation();
 	static float get_ped_radius();
 	void clear();
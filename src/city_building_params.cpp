@@ -344,6 +344,19 @@ void building_params_t::init_kw_maps() {
 }
 
 bool building_params_t::parse_buildings_option(FILE *fp) {
+	long const start_pos(ftell(fp));
+	bool const ret(parse_buildings_option_int(fp));
+	long const end_pos(ftell(fp));
+
+	if (start_pos >= 0 && end_pos > start_pos) { // hash the raw option text so that any change to the building config invalidates cached tiles
+		vector<uint8_t> text(end_pos - start_pos);
+		fseek(fp, start_pos, SEEK_SET);
+		if (fread(text.data(), 1, text.size(), fp) != text.size()) {fseek(fp, end_pos, SEEK_SET);}
+		config_hash = 31*config_hash + jenkins_one_at_a_time_hash(text.data(), text.size());
+	}
+	return ret;
+}
+bool building_params_t::parse_buildings_option_int(FILE *fp) {
 
 	char strc[MAX_CHARS] = {0};
 	if (!read_str(fp, strc)) return 0;
@@ -446,6 +459,10 @@ bool building_params_t::parse_buildings_option(FILE *fp) {
 			if (nm_tid > 0) {tid_to_nmap_tid[last_read_tid] = nm_tid;}
 		}
 	}
+	else if (str == "tile_cache_dir") {
+		if (!read_str(fp, strc)) {buildings_file_err(str, read_error);}
+		tile_cache_dir = strc;
+	}
 	// special commands
 	else if (str == "add_material") {add_cur_mat();}
 	else {
@@ -3444,15 +3444,15 @@ void ped_manager_t::setup_occluders() {
 }
 
 // path finding
-bool ped_manager_t::choose_dest_building_or_parked_car(pedestrian_t &ped) { // modifies rgen, non-const
+bool ped_manager_t::choose_dest_building_or_parked_car(pedestrian_t &ped, rand_gen_t &rgen_) { // modifies rgen_; may be called from multiple threads for different cities
 	unsigned const prev_dest_plot(ped.dest_plot);
 	ped.clear_current_dest(); // will choose a new dest
 
-	if (city_params.num_cars == 0 || (rgen.rand() & 3) != 0) { // choose a dest building 75% of the time, 100% of the time if there are no cars
-		ped.has_dest_bldg = road_gen.choose_dest_building(ped.city, ped.dest_plot, ped.dest_bldg, rgen);
+	if (city_params.num_cars == 0 || (rgen_.rand() & 3) != 0) { // choose a dest building 75% of the time, 100% of the time if there are no cars
+		ped.has_dest_bldg = road_gen.choose_dest_building(ped.city, ped.dest_plot, ped.dest_bldg, rgen_);
 	}
 	if (city_params.num_cars > 0 && !ped.has_dest_bldg) { // chose a dest parked car 25% of the time, or if choosing a dest building failed
-		ped.has_dest_car = choose_dest_parked_car(ped.city, ped.dest_plot, ped.dest_bldg, ped.dest_car_center);
+		ped.has_dest_car = choose_dest_parked_car(ped.city, ped.dest_plot, ped.dest_bldg, ped.dest_car_center, rgen_);
 		if (ped.has_dest_car) {ped.dest_plot = road_gen.get_city(ped.city).encode_plot_id(ped.dest_plot);}
 	}
 	bool const has_valid_dest(ped.has_dest_bldg || ped.has_dest_car);
@@ -3460,11 +3460,11 @@ bool ped_manager_t::choose_dest_building_or_parked_car(pedestrian_t &ped) { // m
 	ped.next_plot = get_next_plot(ped);
 	return has_valid_dest;
 }
-void ped_manager_t::choose_new_ped_plot_pos(pedestrian_t &ped) {
+void ped_manager_t::choose_new_ped_plot_pos(pedestrian_t &ped, rand_gen_t &rgen_) {
 	if (city_params.ped_respawn_at_dest) { // respawn
 		for (unsigned n = 0; n < 100; ++n) { // keep respawning until it's not visible by the camera
 			float const prev_zval(ped.pos.z);
-			bool const ret(road_gen.get_city(ped.city).gen_ped_pos(ped, rgen));
+			bool const ret(road_gen.get_city(ped.city).gen_ped_pos(ped, rgen_));
 			ped.pos.z = prev_zval; // restore orig zval - don't want to change this (zval was set from ped radius post-model scale but should be pre-model scale)
 			if (!ret) break; // failed to respawn, leave at current pos (should be very rare)
 			float const draw_dist(500.0*get_ped_radius());
@@ -3472,7 +3472,7 @@ void ped_manager_t::choose_new_ped_plot_pos(pedestrian_t &ped) {
 		}
 		register_ped_new_plot(ped);
 	}
-	choose_dest_building_or_parked_car(ped);
+	choose_dest_building_or_parked_car(ped, rgen_);
 }
 unsigned ped_manager_t::get_next_plot(pedestrian_t &ped, int exclude_plot) const {return road_gen.get_next_plot(ped.city, ped.plot, ped.dest_plot, exclude_plot);}
 
@@ -4,15 +4,28 @@
 
 #include "3DWorld.h"
 #include "cobj_bsp_tree.h"
+#include "binary_file_io.h" // for read_vector()/write_vector()
+#include "job_system.h"
+#include <chrono>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COBJ_TREE_SSE
+#include <xmmintrin.h> // SSE is always available on x64
+#endif
 
 
 unsigned const MAX_LEAF_SIZE = 2;
 float const POLY_TOLER       = 1.0E-6;
 float const OVERLAP_AMT      = 0.02;
+float const REFIT_MAX_SAH_INC= 1.5; // rebuild refitted trees when their SAH cost has grown by this factor since the last build
+unsigned const WIDE_LEAF_BIT   = (1U << 31);
+unsigned const WIDE_STACK_SIZE = 256; // each wide node level can add at most 3 entries to the stack
+unsigned const LINE_PACKET_SIZE= 4;
 
 
-extern bool mt_cobj_tree_build, begin_motion;
+extern bool mt_cobj_tree_build, begin_motion, use_wide_cobj_bvh;
 extern int display_mode, frame_counter, cobj_counter;
+extern unsigned cobj_bvh_benchmark_rays;
 extern coll_obj_group coll_objects;
 extern vector<unsigned> falling_cobjs;
 extern set<unsigned> moving_cobjs;
@@ -110,6 +123,161 @@ bool cobj_tree_base::node_ix_mgr::check_node(unsigned &nix) const {
 	return ret;
 }
 
+void cobj_tree_base::get_node_kids(unsigned nix, vector<unsigned> &kids) const {
+
+	tree_node const &n(nodes[nix]);
+	assert(!n.is_leaf());
+	kids.clear();
+
+	for (unsigned kid = nix+1; kid < n.next_node_id; kid = nodes[kid].next_node_id) { // kids are contiguous and end at our next_node_id
+		if (nodes[kid].is_gap()) break; // end of used nodes for this subtree
+		assert(nodes[kid].next_node_id > kid);
+		kids.push_back(kid);
+	}
+}
+
+// collapses branch nix and some of its descendants into a wide node, keeping the depth first order of the kids so that queries
+// visit leaves in the same order as the binary tree and return identical results
+unsigned cobj_tree_base::build_wide_subtree(unsigned nix) {
+
+	vector<unsigned> kids, sub_kids;
+	get_node_kids(nix, kids);
+
+	while (kids.size() < 4) { // pull up the kids of the largest branch kid that fits
+		int best(-1);
+		float best_area(0.0);
+
+		for (unsigned i = 0; i < kids.size(); ++i) {
+			tree_node const &k(nodes[kids[i]]);
+			if (k.is_leaf()) continue;
+			get_node_kids(kids[i], sub_kids);
+			if (kids.size() + sub_kids.size() > 5) continue; // too many kids
+			float const area(k.get_area());
+			if (best < 0 || area > best_area) {best = i; best_area = area;}
+		}
+		if (best < 0) break; // nothing more to collapse
+		get_node_kids(kids[best], sub_kids);
+		kids.erase(kids.begin()+best);
+		kids.insert(kids.begin()+best, sub_kids.begin(), sub_kids.end());
+	} // end while
+	vector<wide_kid_t> entries;
+
+	for (unsigned k : kids) {
+		tree_node const &n(nodes[k]);
+		entries.emplace_back((n.is_leaf() ? (k | WIDE_LEAF_BIT) : build_wide_subtree(k)), n);
+	}
+	return add_wide_node(entries);
+}
+
+unsigned cobj_tree_base::add_wide_node(vector<wide_kid_t> entries) {
+
+	while (entries.size() > 4) { // too many kids (MT build top level): group them in order into extra wide nodes
+		vector<wide_kid_t> groups;
+
+		for (unsigned i = 0; i < entries.size(); i += 4) {
+			vector<wide_kid_t> const group(entries.begin()+i, entries.begin()+min((unsigned)entries.size(), i+4));
+			cube_t bcube(group.front().second);
+			for (wide_kid_t const &e : group) {bcube.union_with_cube(e.second);}
+			groups.emplace_back(add_wide_node(group), bcube);
+		}
+		entries.swap(groups);
+	}
+	wide_node_t w;
+	w.num_kids = entries.size();
+
+	for (unsigned k = 0; k < w.num_kids; ++k) {
+		w.kids[k] = entries[k].first;
+		UNROLL_3X(w.b[i_][0][k] = entries[k].second.d[i_][0]; w.b[i_][1][k] = entries[k].second.d[i_][1];)
+	}
+	wide_nodes.push_back(w);
+	return (wide_nodes.size() - 1);
+}
+
+unsigned cobj_tree_base::get_wide_depth(unsigned wix) const {
+
+	wide_node_t const &w(wide_nodes[wix]);
+	unsigned depth(0);
+
+	for (unsigned k = 0; k < w.num_kids; ++k) {
+		if (!(w.kids[k] & WIDE_LEAF_BIT)) {max_eq(depth, get_wide_depth(w.kids[k]));}
+	}
+	return depth + 1;
+}
+
+// returns 1 if the wide tree was built; it's left empty if the tree is too deep for the query stack
+bool cobj_tree_base::build_wide_nodes() {
+
+	wide_nodes.clear();
+	if (nodes.empty()) return 0;
+	if (nodes[0].is_leaf()) {wide_root = add_wide_node(vector<wide_kid_t>(1, wide_kid_t((0 | WIDE_LEAF_BIT), nodes[0])));}
+	else {wide_root = build_wide_subtree(0);}
+	if (3*get_wide_depth(wide_root) + 1 <= WIDE_STACK_SIZE) return 1;
+	wide_nodes.clear();
+	return 0;
+}
+
+// calls leaf_func(start, end) for each leaf intersecting the line in nixm, in the same order and with the same bbox tests as the binary
+// tree traversal; leaf_func can clip the line by updating nixm.dinv; returns 1 if leaf_func returns 1 to end the query early
+template<typename F> bool cobj_tree_base::check_line_wide(node_ix_mgr const &nixm, F const &leaf_func) const {
+
+	if (wide_nodes.empty()) return 0;
+	point const &p1(nixm.p1);
+	vector3d dinv(nixm.dinv);
+	unsigned const neg[3] = {(dinv.x < 0.0), (dinv.y < 0.0), (dinv.z < 0.0)}; // select the near and far planes, as in get_line_clip()
+	unsigned stack[WIDE_STACK_SIZE], stack_clip_ix[WIDE_STACK_SIZE];
+	unsigned num(1), clip_ix(0); // clip_ix is incremented each time the line is clipped
+	stack[0] = wide_root;
+	stack_clip_ix[0] = 0;
+#ifdef COBJ_TREE_SSE
+	__m128 const px(_mm_set1_ps(p1.x)), py(_mm_set1_ps(p1.y)), pz(_mm_set1_ps(p1.z)), zero(_mm_setzero_ps()), one(_mm_set1_ps(1.0f));
+	__m128 dx(_mm_set1_ps(dinv.x)), dy(_mm_set1_ps(dinv.y)), dz(_mm_set1_ps(dinv.z));
+#endif
+
+	while (num > 0) {
+		--num;
+		unsigned const ix(stack[num]);
+
+		if (ix & WIDE_LEAF_BIT) {
+			tree_node const &n(nodes[ix & ~WIDE_LEAF_BIT]);
+			// the line was clipped after this leaf was tested, so retest it; wide nodes don't need this because their kids are tested below
+			if (stack_clip_ix[num] != clip_ix && !nixm.get_line_clip_func(p1, dinv, n.d)) continue;
+			if (leaf_func(n.start, n.end)) return 1;
+			if (nixm.dinv == dinv) continue; // not clipped
+			dinv = nixm.dinv;
+			++clip_ix;
+#ifdef COBJ_TREE_SSE
+			dx = _mm_set1_ps(dinv.x); dy = _mm_set1_ps(dinv.y); dz = _mm_set1_ps(dinv.z);
+#endif
+			continue;
+		}
+		wide_node_t const &w(wide_nodes[ix]);
+		unsigned mask(0);
+#ifdef COBJ_TREE_SSE // slab test of all 4 kids at once; max()/min() operand order matches std::max()/std::min() for NaNs
+		__m128 const tx0(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(w.b[0][neg[0]]), px), dx)), tx1(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(w.b[0][!neg[0]]), px), dx));
+		__m128 const ty0(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(w.b[1][neg[1]]), py), dy)), ty1(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(w.b[1][!neg[1]]), py), dy));
+		__m128 const tz0(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(w.b[2][neg[2]]), pz), dz)), tz1(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(w.b[2][!neg[2]]), pz), dz));
+		__m128 const t0(_mm_max_ps(_mm_max_ps(zero, tz0), _mm_max_ps(ty0, tx0)));
+		__m128 const t1(_mm_min_ps(_mm_min_ps(one, tz1), _mm_min_ps(ty1, tx1)));
+		mask = (_mm_movemask_ps(_mm_cmplt_ps(t0, t1)) & ((1U << w.num_kids) - 1));
+#else
+		for (unsigned k = 0; k < w.num_kids; ++k) {
+			float const tx0((w.b[0][neg[0]][k] - p1.x)*dinv.x), tx1((w.b[0][!neg[0]][k] - p1.x)*dinv.x);
+			float const ty0((w.b[1][neg[1]][k] - p1.y)*dinv.y), ty1((w.b[1][!neg[1]][k] - p1.y)*dinv.y);
+			float const tz0((w.b[2][neg[2]][k] - p1.z)*dinv.z), tz1((w.b[2][!neg[2]][k] - p1.z)*dinv.z);
+			if (max(max(tx0, ty0), max(tz0, 0.0f)) < min(min(tx1, ty1), min(tz1, 1.0f))) {mask |= (1 << k);}
+		}
+#endif
+		for (int k = w.num_kids-1; k >= 0; --k) { // push in reverse order so that the first kid is visited first
+			if (!(mask & (1 << k))) continue;
+			assert(num < WIDE_STACK_SIZE);
+			stack[num] = w.kids[k];
+			stack_clip_ix[num] = clip_ix;
+			++num;
+		}
+	} // end while
+	return 0;
+}
+
 
 // *** cobj_tree_simple_type_t ***
 
@@ -238,6 +406,34 @@ void cobj_tree_tquads_t::add_cobjs(coll_obj_group const &cobjs, bool verbose) {
 }
 
 
+// nodes and objects are written as-is, so that a tree built offline can be read back without rebuilding
+bool cobj_tree_tquads_t::write(ostream &out) const {
+	write_vector(out, nodes);
+	write_vector(out, objects);
+	return out.good();
+}
+bool cobj_tree_tquads_t::read(istream &in) {
+	clear();
+	read_vector(in, nodes);
+	read_vector(in, objects);
+	if (!in.good()) {clear(); return 0;}
+	unsigned const num_nodes((unsigned)nodes.size()), num_objs((unsigned)objects.size());
+	if (nodes.empty() || nodes[0].next_node_id != num_nodes) {clear(); return 0;} // root must span all nodes
+	unsigned next_obj(0);
+
+	// reject corrupt trees, since traversal doesn't check the ranges; leaves must cover the objects in order, as build_tree() creates them
+	for (unsigned nix = 0; nix < num_nodes; ++nix) {
+		tree_node const &n(nodes[nix]);
+		if (n.next_node_id <= nix || n.next_node_id > num_nodes) {clear(); return 0;}
+		if (n.start == n.end) continue; // branch node, or empty root
+		if (n.start != next_obj || n.start > n.end || n.end > num_objs) {clear(); return 0;}
+		next_obj = n.end;
+	}
+	if (next_obj != num_objs) {clear(); return 0;}
+	return 1;
+}
+
+
 bool cobj_tree_tquads_t::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA *color, int *cindex, int ignore_cobj, bool exact) const {
 
 	if (nodes.empty()) return 0;
@@ -307,20 +503,24 @@ void cobj_tree_sphere_t::get_ids_int_sphere(point const &center, float radius, v
 // *** cobj_bvh_tree ***
 
 
-bool cobj_bvh_tree::create_cixs() {
+void cobj_bvh_tree::get_cobj_ids(vector<unsigned> &ids) const {
 
 	if (is_dynamic && !is_static) { // use dynamic_ids
 		for (cobj_id_set_t::const_iterator i = cobjs->dynamic_ids.begin(); i != cobjs->dynamic_ids.end(); ++i) {
 			assert(*i < cobjs->size());
 			assert((*cobjs)[*i].status == COLL_DYNAMIC);
-			add_cobj(*i);
+			add_cobj(*i, ids);
 		}
 	}
 	else {
-		if (is_static && !occluders_only && !cubes_only) {cixs.reserve(cobjs->size());} // normal static mode
-		for (unsigned i = 0; i < cobjs->size(); ++i) {add_cobj(i);}
+		if (is_static && !occluders_only && !cubes_only) {ids.reserve(cobjs->size());} // normal static mode
+		for (unsigned i = 0; i < cobjs->size(); ++i) {add_cobj(i, ids);}
 	}
-	assert(cixs.size() < (1 << 29));
+	assert(ids.size() < (1 << 29));
+}
+
+bool cobj_bvh_tree::create_cixs() {
+	get_cobj_ids(cixs);
 	return !cixs.empty();
 }
 
@@ -334,6 +534,8 @@ void cobj_bvh_tree::calc_node_bbox(tree_node &n) const {
 void cobj_bvh_tree::clear() {
 	cobj_tree_base::clear();
 	cixs.clear();
+	refit_ids.clear(); // no longer refittable
+	moved_cixs.clear();
 }
 
 void cobj_bvh_tree::add_cobjs(bool verbose) {
@@ -343,10 +545,11 @@ void cobj_bvh_tree::add_cobjs(bool verbose) {
 	if (!create_cixs()) return; // nothing to be done
 	bool const do_mt_build(mt_cobj_tree_build && cixs.size() > 10000);
 	build_tree_from_cixs(do_mt_build);
+	if (use_wide_cobj_bvh) {build_wide_nodes();}
 
 	if (verbose) {
 		PRINT_TIME(" Cobj Tree Create");
-		cout << "cobjs: " << cobjs->size() << ", leaves: " << cixs.size() << ", nodes: " << nodes.size()
+		cout << "cobjs: " << cobjs->size() << ", leaves: " << cixs.size() << ", nodes: " << nodes.size() << ", wide_nodes: " << wide_nodes.size()
 				<< ", depth: " << max_depth << ", max_leaves: " << max_leaf_count << ", leaf_nodes: " << num_leaf_nodes << endl;
 	}
 }
@@ -370,6 +573,108 @@ void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
 	nodes[root].next_node_id = (unsigned)nodes.size();
 }
 
+// records the node parents, the leaf containing each cobj, and the SAH cost; requires a single threaded build,
+// since the MT build leaves gaps of unused nodes that can't be distinguished from branch nodes
+void cobj_bvh_tree::setup_refit(vector<unsigned> const &ids) {
+
+	unsigned const num_nodes((unsigned)nodes.size());
+	refit_ids = ids;
+	refit_dynamic_ids_version = cobjs->dynamic_ids_version;
+	node_parents.resize(num_nodes);
+	cix_leaf.resize(cixs.size());
+	cix_moved.assign(cixs.size(), 0);
+	moved_cixs.clear();
+	cid_to_cix.assign((*max_element(cixs.begin(), cixs.end()) + 1), ~0U);
+	for (unsigned i = 0; i < cixs.size(); ++i) {cid_to_cix[cixs[i]] = i;}
+	node_parents[0] = 0; // root is its own parent
+	sah_area_sum    = 0.0;
+
+	for (unsigned nix = 0; nix < num_nodes; ++nix) {
+		tree_node const &n(nodes[nix]);
+		sah_area_sum += get_node_sah_weight(n)*n.get_area();
+
+		if (n.start < n.end) { // leaf
+			for (unsigned i = n.start; i < n.end; ++i) {cix_leaf[i] = nix;}
+		}
+		else { // branch: kids are contiguous, starting with the next node and ending at our next_node_id
+			for (unsigned kid = nix+1; kid < n.next_node_id; kid = nodes[kid].next_node_id) {
+				assert(nodes[kid].next_node_id > kid);
+				node_parents[kid] = nix;
+			}
+		}
+	}
+	float const root_area(nodes[0].get_area());
+	build_sah_cost = ((root_area > 0.0) ? sah_area_sum/root_area : 0.0);
+}
+
+// called when a cobj in this tree has been moved, rotated, or re-created; its leaf is updated in the next refit
+void cobj_bvh_tree::mark_cobj_moved(unsigned cid) {
+
+	if (refit_ids.empty() || cid >= cid_to_cix.size()) return; // not refittable, or not in the tree
+	unsigned const cix(cid_to_cix[cid]);
+	if (cix == ~0U || cix_moved[cix]) return; // not in the tree, or already marked
+	cix_moved[cix] = 1;
+	moved_cixs.push_back(cix);
+}
+
+// updates node bounds bottom-up from the leaves of cobjs marked as moved, keeping the tree topology;
+// returns 0 if the tree must be rebuilt because the SAH cost has degraded too much
+bool cobj_bvh_tree::refit() {
+
+	if (nodes.empty() || refit_ids.empty()) return 0; // not refittable
+
+	for (unsigned i : moved_cixs) {
+		cix_moved[i] = 0;
+
+		for (unsigned nix = cix_leaf[i]; ; nix = node_parents[nix]) { // walk up to the root
+			tree_node &n(nodes[nix]);
+			cube_t const prev(n);
+
+			if (n.start < n.end) {calc_node_bbox(n);} // leaf
+			else { // branch: union of kids
+				n.copy_from(nodes[nix+1]);
+				for (unsigned kid = nodes[nix+1].next_node_id; kid < n.next_node_id; kid = nodes[kid].next_node_id) {n.union_with_cube(nodes[kid]);}
+			}
+			if (n == prev) break; // unchanged, so parents are unchanged as well
+			sah_area_sum += get_node_sah_weight(n)*(n.get_area() - prev.get_area());
+			if (nix == 0) break; // root
+		} // for nix
+	} // for i
+	moved_cixs.clear();
+	float const root_area(nodes[0].get_area());
+	if (root_area > 0.0 && sah_area_sum/root_area > REFIT_MAX_SAH_INC*build_sah_cost) return 0; // tree quality has degraded, rebuild
+	return 1;
+}
+
+void cobj_bvh_tree::rebuild(vector<unsigned> const &ids, bool verbose) {
+
+	RESET_TIME;
+	clear();
+	if (ids.empty()) return;
+	add_cobj_ids(ids);
+	build_tree_from_cixs(0); // must be single threaded
+	setup_refit(ids);
+	if (verbose) {PRINT_TIME(" Cobj Tree Rebuild");}
+}
+
+// refits the tree if it was last built from the same cobj IDs, otherwise rebuilds it; returns 1 if rebuilt
+bool cobj_bvh_tree::refit_or_rebuild(vector<unsigned> const &ids, bool verbose) {
+
+	if (ids == refit_ids && refit()) return 0;
+	rebuild(ids, verbose);
+	return 1;
+}
+
+bool cobj_bvh_tree::refit_or_rebuild(bool verbose) {
+
+	if (is_dynamic && !is_static && !refit_ids.empty() && cobjs->dynamic_ids_version == refit_dynamic_ids_version) { // no dynamic cobjs added or removed
+		if (refit()) return 0;
+	}
+	temp_ids.clear();
+	get_cobj_ids(temp_ids);
+	return refit_or_rebuild(temp_ids, verbose);
+}
+
 // test_alpha: 0 = allow any alpha value, 1 = require alpha = 1.0, 2 = get intersected cobj with max alpha, 3 = require alpha >= MIN_SHADOW_ALPHA
 bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex,
 	int ignore_cobj, bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const
@@ -377,14 +682,9 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 	if (nodes.empty()) return 0;
 	bool ret(0);
 	float t(0.0), tmax(1.0), max_alpha(0.0);
-	node_ix_mgr nixm(nodes, p1, p2);
-	unsigned const num_nodes((unsigned)nodes.size());
 
-	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
-		if (!nixm.check_node(nix)) continue; // Note: modifies nix
-
-		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+	auto check_leaves = [&](unsigned start, unsigned end) { // returns 1 when done
+		for (unsigned i = start; i < end; ++i) { // check leaves
 			// Note: we test cobj against the original (unclipped) p1 and p2 so that t is correct
 			// Note: we probably don't need to return cnorm and cpos in inexact mode, but it shouldn't be too expensive to do so
 			if (ignore_cobj >= 0 && (int)cixs[i] == ignore_cobj) continue;
@@ -402,15 +702,218 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 			//if (c.type == COLL_POLYGON && dot_product((p2 - p1), c.norm) < 0.0) {} // back-facing polygon test
 			if (!exact && test_alpha != 2) return 1; // return first hit
 			max_alpha = c.cp.color.alpha; // we need all intersections to find the max alpha
-			nixm.dinv = vector3d(cpos - p1);
-			nixm.dinv.invert();
 			tmax = t;
 			ret  = 1;
 		}
+		return 0;
+	};
+	node_ix_mgr nixm(nodes, p1, p2);
+
+	auto check_leaves_clip = [&](unsigned start, unsigned end) {
+		float const prev_tmax(tmax);
+		if (check_leaves(start, end)) return 1;
+
+		if (tmax < prev_tmax) { // clip the line to the closest hit
+			nixm.dinv = vector3d(cpos - p1);
+			nixm.dinv.invert();
+		}
+		return 0;
+	};
+	if (!wide_nodes.empty()) {return (check_line_wide(nixm, check_leaves_clip) || ret);}
+	unsigned const num_nodes((unsigned)nodes.size());
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		tree_node const &n(nodes[nix]);
+		if (!nixm.check_node(nix)) continue; // Note: modifies nix
+		if (check_leaves_clip(n.start, n.end)) return 1;
 	}
 	return ret;
 }
 
+// traces up to 4 lines with the same direction signs through the tree together, testing each node's bbox against all of them with one SIMD slab test;
+// each line visits the same nodes and leaves in the same order as in check_coll_line() with exact=1 and test_alpha=0, so the hits are identical
+void cobj_bvh_tree::check_coll_line_packet(line_query_t *const *const queries, unsigned num) const {
+
+	assert(num > 0 && num <= LINE_PACKET_SIZE);
+	unsigned const num_nodes((unsigned)nodes.size());
+	float pv[3][4] = {}, dv[3][4] = {}, tmax[4] = {1.0, 1.0, 1.0, 1.0}; // SoA line starts and clipped inverse dirs
+	unsigned skip_to[4] = {num_nodes, num_nodes, num_nodes, num_nodes}; // each line is inactive until it reaches this node
+
+	for (unsigned k = 0; k < num; ++k) {
+		line_query_t const &q(*queries[k]);
+		vector3d dinv(q.p2 - q.p1);
+		dinv.invert();
+		UNROLL_3X(pv[i_][k] = q.p1[i_]; dv[i_][k] = dinv[i_];)
+		skip_to[k] = 0;
+	}
+	unsigned const neg[3] = {(dv[0][0] < 0.0), (dv[1][0] < 0.0), (dv[2][0] < 0.0)}; // same for all lines
+	float t(0.0);
+#ifdef COBJ_TREE_SSE
+	__m128 const px(_mm_loadu_ps(pv[0])), py(_mm_loadu_ps(pv[1])), pz(_mm_loadu_ps(pv[2])), zero(_mm_setzero_ps()), one(_mm_set1_ps(1.0f));
+#endif
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		tree_node const &n(nodes[nix]);
+		unsigned active(0), hit_mask(0);
+		for (unsigned k = 0; k < num; ++k) {if (skip_to[k] <= nix) {active |= (1 << k);}}
+#ifdef COBJ_TREE_SSE // same math and min/max operand order as get_line_clip()
+		__m128 const tx0(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.d[0][neg[0]]), px), _mm_loadu_ps(dv[0]))), tx1(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.d[0][!neg[0]]), px), _mm_loadu_ps(dv[0])));
+		__m128 const ty0(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.d[1][neg[1]]), py), _mm_loadu_ps(dv[1]))), ty1(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.d[1][!neg[1]]), py), _mm_loadu_ps(dv[1])));
+		__m128 const tz0(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.d[2][neg[2]]), pz), _mm_loadu_ps(dv[2]))), tz1(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.d[2][!neg[2]]), pz), _mm_loadu_ps(dv[2])));
+		__m128 const t0(_mm_max_ps(_mm_max_ps(zero, tz0), _mm_max_ps(ty0, tx0)));
+		__m128 const t1(_mm_min_ps(_mm_min_ps(one, tz1), _mm_min_ps(ty1, tx1)));
+		hit_mask = (_mm_movemask_ps(_mm_cmplt_ps(t0, t1)) & active);
+#else
+		for (unsigned k = 0; k < num; ++k) {
+			if (!(active & (1 << k))) continue;
+			float const tx0((n.d[0][neg[0]] - pv[0][k])*dv[0][k]), tx1((n.d[0][!neg[0]] - pv[0][k])*dv[0][k]);
+			float const ty0((n.d[1][neg[1]] - pv[1][k])*dv[1][k]), ty1((n.d[1][!neg[1]] - pv[1][k])*dv[1][k]);
+			float const tz0((n.d[2][neg[2]] - pv[2][k])*dv[2][k]), tz1((n.d[2][!neg[2]] - pv[2][k])*dv[2][k]);
+			if (max(max(tx0, ty0), max(tz0, 0.0f)) < min(min(tx1, ty1), min(tz1, 1.0f))) {hit_mask |= (1 << k);}
+		}
+#endif
+		unsigned next_nix(num_nodes);
+
+		for (unsigned k = 0; k < num; ++k) {
+			if ((active & ~hit_mask) & (1 << k)) {skip_to[k] = n.next_node_id;} // failed the bbox test, skip this subtree
+			min_eq(next_nix, skip_to[k]);
+		}
+		if (!hit_mask) {nix = next_nix; continue;} // skip to the next node any line is waiting on
+		++nix;
+		if (!n.is_leaf()) continue;
+
+		for (unsigned k = 0; k < num; ++k) {
+			if (!(hit_mask & (1 << k))) continue;
+			line_query_t &q(*queries[k]);
+			bool hit(0);
+
+			for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+				if (q.ignore_cobj >= 0 && (int)cixs[i] == q.ignore_cobj) continue;
+				coll_obj const &c(get_cobj(i));
+				if (!obj_ok(c)) continue;
+				if (q.skip_init_colls && c.contains_pt(q.p1) && c.contains_point(q.p1)) continue;
+				if (!c.line_int_exact(q.p1, q.p2, t, q.cnorm, 0.0, tmax[k])) continue; // tmin=0.0
+				q.cindex = cixs[i];
+				q.cpos   = q.p1 + (q.p2 - q.p1)*t;
+				tmax[k]  = t;
+				hit      = 1;
+			}
+			if (!hit) continue;
+			vector3d dinv(q.cpos - q.p1); // clip the line to the closest hit
+			dinv.invert();
+			UNROLL_3X(dv[i_][k] = dinv[i_];)
+		} // for k
+	} // for nix
+}
+
+inline unsigned spread_morton_bits(unsigned v) { // 10 bits => 30 bits
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v <<  8)) & 0x0300F00F;
+	v = (v | (v <<  4)) & 0x030C30C3;
+	v = (v | (v <<  2)) & 0x09249249;
+	return v;
+}
+
+// finds the closest hit for each query, as in check_coll_line() with exact=1 and test_alpha=0; lines are sorted by direction signs,
+// start position, and direction, then traced in packets of coherent lines that share node traversal
+void cobj_bvh_tree::check_coll_lines(vector<line_query_t> &queries) const {
+
+	for (line_query_t &q : queries) {q.cindex = -1;}
+	if (nodes.empty() || queries.empty()) return;
+	cube_t const &bcube(nodes[0]);
+	vector3d const bcube_sz(bcube.get_size());
+	vector<pair<unsigned long long, unsigned>> order(queries.size());
+
+	for (unsigned i = 0; i < queries.size(); ++i) {
+		line_query_t const &q(queries[i]);
+		vector3d dinv(q.p2 - q.p1);
+		dinv.invert();
+		vector3d const dir((q.p2 - q.p1).get_norm());
+		unsigned const octant((dinv.x < 0.0) | ((dinv.y < 0.0) << 1) | ((dinv.z < 0.0) << 2)); // must be the same within a packet
+		unsigned pos_bits(0), dir_bits(0);
+
+		for (unsigned d = 0; d < 3; ++d) {
+			float const v((bcube_sz[d] > 0.0) ? CLIP_TO_01((q.p1[d] - bcube.d[d][0])/bcube_sz[d]) : 0.0f);
+			pos_bits |= (spread_morton_bits(unsigned(1023*v)) << d);
+			dir_bits |= (unsigned(127*CLIP_TO_01(0.5f*(dir[d] + 1.0f))) << 7*d);
+		}
+		order[i] = make_pair(((((unsigned long long)octant) << 51) | (((unsigned long long)pos_bits) << 21) | dir_bits), i);
+	} // for i
+	sort(order.begin(), order.end());
+
+	for (unsigned i = 0; i < order.size();) {
+		line_query_t *packet[LINE_PACKET_SIZE];
+		unsigned const octant(order[i].first >> 51);
+		unsigned num(0);
+		for (; i < order.size() && num < LINE_PACKET_SIZE && (order[i].first >> 51) == octant; ++i) {packet[num++] = &queries[order[i].second];}
+		check_coll_line_packet(packet, num);
+	}
+}
+
+// measures rays/sec of random line queries through the scene for the binary and wide trees and for packets of coherent lines,
+// and checks that they all return the same hits
+void cobj_bvh_tree::run_line_query_benchmark(unsigned num_rays) {
+
+	if (nodes.empty() || num_rays == 0) return;
+	bool const had_wide_nodes(!wide_nodes.empty());
+
+	if (!had_wide_nodes && !build_wide_nodes()) {
+		cout << "Error: Failed to build wide cobj BVH for benchmark" << endl;
+		return;
+	}
+	rand_gen_t rgen;
+	vector<pair<point, point>> lines(num_rays);
+
+	for (auto i = lines.begin(); i != lines.end(); ++i) {
+		i->first  = rgen.gen_rand_cube_point(nodes[0]);
+		i->second = rgen.gen_rand_cube_point(nodes[0]);
+	}
+	vector<int> hit_cixs[2];
+	vector<point> hit_pos[2];
+	vector<wide_node_t> saved_wide_nodes;
+	double rays_per_sec[2] = {};
+
+	for (unsigned pass = 0; pass < 2; ++pass) { // {wide, binary}
+		hit_cixs[pass].resize(num_rays, -1);
+		hit_pos [pass].resize(num_rays);
+		auto const start_time(std::chrono::high_resolution_clock::now());
+
+		get_job_system().parallel_for((num_rays + 255)/256, [&](unsigned block) { // blocks of 256 rays
+			for (unsigned i = 256*block; i < min(num_rays, 256*(block+1)); ++i) {
+				vector3d cnorm;
+				check_coll_line(lines[i].first, lines[i].second, hit_pos[pass][i], cnorm, hit_cixs[pass][i], -1, 1, 0, 0, 0, 0);
+			}
+		});
+		double const secs(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count());
+		rays_per_sec[pass] = num_rays/max(secs, 1.0E-6);
+		if (pass == 0) {saved_wide_nodes.swap(wide_nodes);} // disable the wide tree for the binary pass
+	} // for pass
+	if (had_wide_nodes) {wide_nodes.swap(saved_wide_nodes);} // restore
+	// packet pass: each slice of lines is sorted and traced in packets by one thread, as a caller with its own batch of rays would
+	unsigned const slice_sz(16384), num_slices((num_rays + slice_sz - 1)/slice_sz);
+	vector<line_query_t> queries(num_rays);
+	for (unsigned i = 0; i < num_rays; ++i) {queries[i] = line_query_t(lines[i].first, lines[i].second, -1, 0);}
+	auto const start_time(std::chrono::high_resolution_clock::now());
+
+	get_job_system().parallel_for(num_slices, [&](unsigned s) {
+		vector<line_query_t> slice(queries.begin() + s*slice_sz, queries.begin() + min(num_rays, (s+1)*slice_sz));
+		check_coll_lines(slice);
+		std::copy(slice.begin(), slice.end(), queries.begin() + s*slice_sz);
+	});
+	double const packet_secs(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count());
+	double const packet_rays_per_sec(num_rays/max(packet_secs, 1.0E-6));
+	unsigned num_mismatches(0), num_packet_mismatches(0);
+
+	for (unsigned i = 0; i < num_rays; ++i) {
+		if (hit_cixs[0][i] != hit_cixs[1][i] || (hit_cixs[0][i] >= 0 && hit_pos[0][i] != hit_pos[1][i])) {++num_mismatches;}
+		if (queries[i].cindex != hit_cixs[1][i] || (queries[i].cindex >= 0 && queries[i].cpos != hit_pos[1][i])) {++num_packet_mismatches;}
+	}
+	cout << "Cobj BVH line queries: " << num_rays << " rays, binary: " << rays_per_sec[1] << " rays/s, wide: " << rays_per_sec[0]
+		 << " rays/s, speedup: " << rays_per_sec[0]/rays_per_sec[1] << ", mismatches: " << num_mismatches << endl;
+	cout << "Cobj BVH packet line queries: " << packet_rays_per_sec << " rays/s, speedup: " << packet_rays_per_sec/rays_per_sec[1]
+		 << ", mismatches: " << num_packet_mismatches << endl;
+}
+
 bool cobj_bvh_tree::check_point_contained(point const &p, int &cindex) const {
 
 	unsigned const num_nodes((unsigned)nodes.size());
@@ -594,7 +1097,10 @@ void cobj_bvh_tree::build_tree_top_level_omp() { // single octtree level
 		build_tree(kid, ((count == num) ? 7 : 0), 1, ptd); // if all in one bin, make that bin a leaf
 		unsigned const next_kid(ptd.get_next_node_ix());
 		assert(next_kid <= end_nix);
-		if (next_kid < end_nix) {nodes[next_kid].next_node_id = end_nix;} // close the gap of unused nodes
+		if (next_kid < end_nix) { // close the gap of unused nodes
+			nodes[next_kid] = tree_node(1, 1); // mark as a gap
+			nodes[next_kid].next_node_id = end_nix;
+		}
 		nodes[kid].next_node_id = end_nix;
 	}
 	nodes.resize(cur_nix);
@@ -685,9 +1191,15 @@ cobj_bvh_tree &get_tree(bool dynamic) {
 	return (dynamic ? cobj_tree_dynamic : cobj_tree_static);
 }
 
+// must be called after changing the geometry of a cobj in coll_objects so that the refittable trees containing it are updated
+void mark_cobj_moved(coll_obj const &cobj) {
+	if (cobj.id < 0 || cobj.id >= (int)coll_objects.size() || &coll_objects[cobj.id] != &cobj) return; // not in coll_objects (a temporary copy)
+	cobj_tree_dynamic.mark_cobj_moved(cobj.id);
+	cobj_tree_static_moving.mark_cobj_moved(cobj.id);
+}
+
 void build_static_moving_cobj_tree() {
 
-	cobj_tree_static_moving.clear();
 	vector<unsigned> moving_cids(falling_cobjs);
 		
 	for (auto i = moving_cobjs.begin(); i != moving_cobjs.end(); ++i) {
@@ -696,10 +1208,7 @@ void build_static_moving_cobj_tree() {
 	for (platform_cont::const_iterator i = platforms.begin(); i != platforms.end(); ++i) {
 		copy(i->cobjs.begin(), i->cobjs.end(), back_inserter(moving_cids));
 	}
-	if (!moving_cids.empty()) {
-		cobj_tree_static_moving.add_cobj_ids(moving_cids);
-		cobj_tree_static_moving.build_tree_from_cixs(0);
-	}
+	cobj_tree_static_moving.refit_or_rebuild(moving_cids, 0); // most frames only move platforms, so refit
 }
 
 void build_cobj_tree(bool dynamic, bool verbose) {
@@ -707,10 +1216,11 @@ void build_cobj_tree(bool dynamic, bool verbose) {
 	if (!dynamic) { // static
 		get_tree(0).add_cobjs(verbose);
 		cobj_tree_occlude.add_cobjs(verbose);
+		if (cobj_bvh_benchmark_rays > 0) {get_tree(0).run_line_query_benchmark(cobj_bvh_benchmark_rays);}
 		//cobj_tree_triangles.add_cobjs(coll_objects, verbose);
 	}
 	else { // dynamic
-		if (begin_motion) {get_tree(1).add_cobjs(verbose);}
+		if (begin_motion) {get_tree(1).refit_or_rebuild(verbose);} // refit in place if the set of dynamic cobjs hasn't changed
 		//build_static_moving_cobj_tree();
 	}
 }
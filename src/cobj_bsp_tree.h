@@ -4,6 +4,20 @@
 #pragma once
 
 #include "physics_objects.h"
+#include <iosfwd>
+
+
+struct line_query_t { // one line of a batched collision query
+	point p1, p2, cpos;
+	vector3d cnorm;
+	int ignore_cobj=-1, cindex=-1;
+	bool skip_init_colls=0;
+
+	line_query_t() {}
+	line_query_t(point const &p1_, point const &p2_, int ignore_cobj_, bool skip_init_colls_) :
+		p1(p1_), p2(p2_), ignore_cobj(ignore_cobj_), skip_init_colls(skip_init_colls_) {}
+	bool has_hit() const {return (cindex >= 0);}
+};
 
 
 class cobj_tree_base {
@@ -15,9 +29,18 @@ protected:
 
 		tree_node(unsigned s=0, unsigned e=0, cube_t const &cube=cube_t()) : cube_t(cube), start(s), end(e) {}
 		unsigned size() const {return (end - start);}
+		bool is_leaf() const {return (start < end);}
+		bool is_gap () const {return (start == end && start > 0);} // unused nodes left between subtrees by the MT build
+	};
+	struct wide_node_t { // collapsed BVH4 node with SoA kid bounds for a single SIMD slab test; size = 116
+		float b[3][2][4]={}; // {x,y,z} x {lo,hi} x kid
+		unsigned kids[4]={}; // wide node index, or binary tree leaf node index | WIDE_LEAF_BIT
+		unsigned num_kids=0;
 	};
+	typedef pair<unsigned, cube_t> wide_kid_t;
 	vector<tree_node> nodes;
-	unsigned max_depth=0, max_leaf_count=0, num_leaf_nodes=0;
+	vector<wide_node_t> wide_nodes; // optional, built from nodes for faster line queries
+	unsigned max_depth=0, max_leaf_count=0, num_leaf_nodes=0, wide_root=0;
 
 	inline void register_leaf(unsigned num) {
 		++num_leaf_nodes;
@@ -25,6 +48,10 @@ protected:
 	}
 	bool check_for_leaf(unsigned num, unsigned skip_dims);
 	unsigned get_conservative_num_nodes(unsigned num) const {return (3*num/2 + 8);}
+	void get_node_kids(unsigned nix, vector<unsigned> &kids) const;
+	unsigned build_wide_subtree(unsigned nix);
+	unsigned add_wide_node(vector<wide_kid_t> entries);
+	unsigned get_wide_depth(unsigned wix) const;
 
 	struct node_ix_mgr {
 		point p1;
@@ -35,10 +62,12 @@ protected:
 		bool check_node(unsigned &nix) const;
 		bool (* get_line_clip_func) (point const &p1, vector3d const &dinv, float const d[3][2]); // function pointer
 	};
+	template<typename F> bool check_line_wide(node_ix_mgr const &nixm, F const &leaf_func) const;
 public:
 	bool is_empty() const {return nodes.empty();}
-	void clear() {nodes.clear();}
+	void clear() {nodes.clear(); wide_nodes.clear();}
 	bool get_root_bcube(cube_t &bc) const;
+	bool build_wide_nodes();
 };
 
 
@@ -66,6 +95,8 @@ class cobj_tree_tquads_t : public cobj_tree_simple_type_t<coll_tquad> {
 public:
 	vector<coll_tquad> &get_tquads_ref() {return objects;}
 	void add_cobjs(coll_obj_group const &cobjs, bool verbose);
+	bool write(std::ostream &out) const;
+	bool read (std::istream &in);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA *color, int *cindex, int ignore_cobj, bool exact) const;
 
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj, bool exact) const {
@@ -99,6 +130,13 @@ class cobj_bvh_tree : public cobj_tree_base {
 	vector<unsigned> cixs;
 	vector<float> right_costs;
 	bool is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs;
+	// refit state, only valid when the tree was built by refit_or_rebuild()
+	vector<unsigned> refit_ids, node_parents, cix_leaf, temp_ids;
+	vector<unsigned> cid_to_cix, moved_cixs; // cobj ID => index into cixs, or ~0U if not in the tree; cixs of cobjs moved since the last refit
+	vector<unsigned char> cix_moved; // 1 if in moved_cixs
+	unsigned refit_dynamic_ids_version=0; // cobjs->dynamic_ids_version at the last build
+	double sah_area_sum=0.0; // sum of node area * node cost; divide by root area to get the SAH cost
+	float build_sah_cost=0.0;
 
 	struct per_thread_data {
 		vector<unsigned> temp_bins[3];
@@ -111,10 +149,16 @@ class cobj_bvh_tree : public cobj_tree_base {
 		unsigned get_next_node_ix() const {assert(cur_nix < end_nix); return cur_nix;}
 		void increment_node_ix() {assert(cur_nix >= start_nix); cur_nix++;}
 	};
-	void add_cobj(unsigned ix) {if (obj_ok((*cobjs)[ix])) {cixs.push_back(ix);}}
+	void add_cobj(unsigned ix, vector<unsigned> &ids) const {if (obj_ok((*cobjs)[ix])) {ids.push_back(ix);}}
 	coll_obj const &get_cobj(unsigned ix) const {return (*cobjs)[cixs[ix]];}
+	void get_cobj_ids(vector<unsigned> &ids) const;
 	bool create_cixs();
 	void calc_node_bbox(tree_node &n) const;
+	float get_node_sah_weight(tree_node const &n) const {return ((n.start < n.end) ? n.size() : 1.0);} // leaf: one test per cobj; branch: one traversal step
+	void setup_refit(vector<unsigned> const &ids);
+	bool refit();
+	void rebuild(vector<unsigned> const &ids, bool verbose);
+	void check_coll_line_packet(line_query_t *const *const queries, unsigned num) const;
 	void build_tree_top_level_omp();
 	void build_tree(unsigned nix, unsigned skip_dims, unsigned depth, per_thread_data &ptd);
 
@@ -131,8 +175,13 @@ public:
 	void add_cobj_ids(vector<unsigned> const &cids) {assert(cixs.empty() && !cids.empty()); cixs = cids;}
 	void add_cobjs(bool verbose);
 	void build_tree_from_cixs(bool do_mt_build);
+	bool refit_or_rebuild(vector<unsigned> const &ids, bool verbose);
+	bool refit_or_rebuild(bool verbose);
+	void mark_cobj_moved(unsigned cid);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	void check_coll_lines(vector<line_query_t> &queries) const;
+	void run_line_query_benchmark(unsigned num_rays);
 	bool check_point_contained(point const &p, int &cindex) const;
 	void get_intersecting_cobjs(cube_t const &cube, vector<unsigned> &cobjs, int ignore_cobj, float toler, bool check_ccounter, int id_for_cobj_int) const;
 	bool is_cobj_contained(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj) const;
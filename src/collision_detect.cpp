@@ -842,7 +842,8 @@ void coll_obj_group::set_coll_obj_props(int index, int type, float radius, float
 	cobj.is_billboard= 0;
 	cobj.falling     = 0;
 	cobj.setup_internal_state();
-	if (cparams.flags & COBJ_DYNAMIC) {dynamic_ids.must_insert(index);}
+	mark_cobj_moved(cobj); // may reuse the ID of a cobj in a refittable tree
+	if (cparams.flags & COBJ_DYNAMIC) {dynamic_ids.must_insert(index); ++dynamic_ids_version;}
 	if (cparams.draw    ) {drawn_ids.must_insert   (index);}
 	if (platform_id >= 0) {platform_ids.must_insert(index);}
 	if ((type == COLL_CUBE || type == COLL_SPHERE) && cparams.light_atten != 0.0) {has_lt_atten = 1;}
@@ -855,7 +856,7 @@ void coll_obj_group::remove_index_from_ids(int index) {
 	if (index < 0)  return;
 	coll_obj &cobj(at(index));
 	if (cobj.fixed) return; // won't actually be freed
-	if (cobj.status == COLL_DYNAMIC) {coll_objects.dynamic_ids.must_erase (index);}
+	if (cobj.status == COLL_DYNAMIC) {coll_objects.dynamic_ids.must_erase (index); ++coll_objects.dynamic_ids_version;}
 	if (cobj.cp.draw               ) {coll_objects.drawn_ids.must_erase   (index);}
 	if (cobj.platform_id >= 0      ) {coll_objects.platform_ids.must_erase(index);}
 	if (cobj.cgroup_id >= 0)         {cobj_groups.remove_cobj(cobj.cgroup_id, index);}
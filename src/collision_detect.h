@@ -297,6 +297,7 @@ class coll_obj_group : public vector<coll_obj> {
 
 public:
 	bool has_lt_atten=0, has_voxel_cobjs=0;
+	unsigned dynamic_ids_version=0; // incremented when dynamic_ids changes
 	cobj_id_set_t dynamic_ids, drawn_ids, platform_ids;
 	vector<vector<unsigned>> to_draw_streams;
 	unsigned cur_draw_stream_id=0;
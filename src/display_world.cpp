@@ -787,6 +787,7 @@ void display() {
 	}
 	if (frame_counter == 2) {cout << format_green("Time to first completed frame: " + to_string(GET_TIME_MS() - program_start_time)) << endl;} // 16s for config_heightmap
 	RESET_TIME;
+	profiler_next_frame(); // aggregate profiler events from the previous frame
 	static int init(0), tticks(0);
 	static point old_spos(0.0, 0.0, 0.0);
 	++cur_display_iter;
@@ -4,12 +4,76 @@
 
 #include "3DWorld.h"
 #include "mesh.h"
+#include "job_system.h"
 #include <cfloat> // for FLT_EPSILON
 
 
 extern float erode_amount, water_plane_z;
 
 
+// Droplets are simulated in fixed size batches. Every droplet in a batch reads the heightmap as it was at the start of the batch, plus its own changes,
+// which are kept in a small per-droplet overlay. At the end of each batch, the changes are added to the heightmap in droplet order.
+// This makes the result depend only on the inputs and not on the number of threads or the order in which droplets are scheduled.
+unsigned const NUM_EROSION_BANDS = 16; // heightmap row bands used to apply a batch's changes in parallel
+
+class erosion_overlay_t { // sparse height deltas for one droplet; open addressing hash table keyed by heightmap index
+	static unsigned const EMPTY = ~0U;
+	vector<unsigned> keys, used; // used: indices in insertion order
+	vector<float> vals;
+	unsigned bits=0;
+
+	unsigned find_slot(unsigned ix) const {
+		unsigned const mask((1U << bits) - 1);
+		for (unsigned s = ((ix*0x9E3779B1U) >> (32 - bits)); ; s = ((s + 1) & mask)) {if (keys[s] == ix || keys[s] == EMPTY) return s;}
+	}
+	void alloc(unsigned bits_) {
+		bits = bits_;
+		keys.assign((1U << bits), EMPTY);
+		vals.assign((1U << bits), 0.0f);
+	}
+	void grow() { // double the capacity and re-insert all entries
+		vector<float> old_vals;
+		for (unsigned ix : used) {old_vals.push_back(vals[find_slot(ix)]);}
+		alloc(bits + 1);
+
+		for (unsigned i = 0; i < used.size(); ++i) {
+			unsigned const s(find_slot(used[i]));
+			keys[s] = used[i];
+			vals[s] = old_vals[i];
+		}
+	}
+public:
+	erosion_overlay_t() {alloc(10);}
+	float get(unsigned ix) const {unsigned const s(find_slot(ix)); return ((keys[s] == ix) ? vals[s] : 0.0f);}
+
+	void add(unsigned ix, float delta) {
+		unsigned s(find_slot(ix));
+
+		if (keys[s] == EMPTY) { // new entry
+			if (2*(used.size() + 1) > keys.size()) {grow(); s = find_slot(ix);} // keep the load factor below 50%
+			keys[s] = ix;
+			used.push_back(ix);
+		}
+		vals[s] += delta;
+	}
+	// moves all entries in insertion order to the delta list of the band containing their index, then clears the overlay
+	void flush(vector<pair<unsigned, float>> *band_deltas, unsigned band_size) {
+		for (unsigned b = 0; b < NUM_EROSION_BANDS; ++b) {band_deltas[b].clear();}
+
+		for (unsigned &ix : used) {
+			unsigned const s(find_slot(ix));
+			band_deltas[ix/band_size].emplace_back(ix, vals[s]);
+			ix = s; // slots can only be cleared after all lookups are done, since clearing breaks the probe sequences of later entries
+		}
+		if (bits > 12) {alloc(10);} // shrink after an unusually long path
+		else {
+			for (unsigned s : used) {keys[s] = EMPTY; vals[s] = 0.0f;}
+		}
+		used.clear();
+	}
+};
+
+
 // see http://ranmantaru.com/blog/2011/10/08/water-erosion-on-heightmap-terrain/
 void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
 
@@ -24,8 +88,11 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	float const Kq=10, Kw=0.001f, Kr=0.9f, Kd=0.02f, Ki=0.1f, minSlope=0.05f, g=20, Kg=g*2;
 	int const PAD(4), NX(xsize+2*PAD), NY(ysize+2*PAD);
 	unsigned const MAX_PATH_LEN(4*NX*NY);
-	vector<vector2d> erosion(NX*NY, vector2d(0.0, 0.0));
+	// droplets in the same batch don't see each other's changes, so use smaller batches for smaller heightmaps
+	unsigned const batch_size(max(64U, min(4096U, unsigned(NX*NY/256))));
 	vector<float> mh_padded(NX*NY);
+	unsigned const band_size((NX*NY + NUM_EROSION_BANDS - 1)/NUM_EROSION_BANDS);
+	vector<vector<pair<unsigned, float>>> batch_deltas(min(num_iters, batch_size)*NUM_EROSION_BANDS); // {index, delta} per droplet and band in the current batch
 
 	// pad mesh by 1 unit on each side to create a buffer of trash around the edges that can be discarded
 	for (int y = 0; y < NY; ++y) {
@@ -37,13 +104,11 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	}
 
 #define HMAP_INDEX(x, y) (NX*max(min(y, NY-1), 0) + max(min(x, NX-1), 0))
-#define HMAP(x, y) mh_padded[HMAP_INDEX(x, y)]
+#define HMAP(x, y) (mh_padded[HMAP_INDEX(x, y)] + overlay.get(HMAP_INDEX(x, y)))
 
 #define DEPOSIT_AT(X, Z, W) { \
 	float const delta = ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	erosion[ix].y += delta; \
-	if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {mh_padded[ix] += delta;} \
+	if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {overlay.add(HMAP_INDEX((X), (Z)), delta);} \
 }
 
 #define DEPOSIT(H) \
@@ -55,104 +120,111 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 
 #define ERODE(X, Z, W) { \
 	float const delta=ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	mh_padded[ix]-=delta; \
-	vector2d &e=erosion[ix]; \
-	float r=e.x, d=e.y; \
-	if (delta<=d) {d-=delta;} else {r+=delta-d; d=0;} \
-	e.x=r; e.y=d; \
+	overlay.add(HMAP_INDEX((X), (Z)), -delta); \
 }
 
-#pragma omp parallel for schedule(dynamic,1)
-	for (int iter=0; iter < (int)num_iters; ++iter) {
-		rand_gen_t rgen;
-		rgen.set_state(iter+11, 79*iter+121);
-		int xi = PAD + (rgen.rand()%xsize);
-		int zi = PAD + (rgen.rand()%ysize);
-		float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
-		float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
-
-		unsigned numMoves=0;
-		for (; numMoves<MAX_PATH_LEN; ++numMoves) {
-			// calc gradient
-			float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
-			// calc next pos
-			dx=(dx-gx)*Ki+gx;
-			dz=(dz-gz)*Ki+gz;
-
-			float dl=sqrtf(dx*dx+dz*dz);
-			if (dl<=FLT_EPSILON) { // pick random dir
-				float a=rgen.rand_float()*TWO_PI;
-				dx=cosf(a); dz=sinf(a);
-			}
-			else {
-				dx/=dl; dz/=dl;
-			}
-			float nxp=xp+dx, nzp=zp+dz;
-			// sample next height
-			int nxi=floor(nxp), nzi=floor(nzp);
-			float nxf=nxp-nxi, nzf=nzp-nzi;
-			float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
-			float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
-			// adjust by HALF_DXY = average mesh texel size - this is river depth
-			if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
-
-			// if higher than current, try to deposit sediment up to neighbour height
-			bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
-			if (nh>=h || outside) {
-				float ds=(nh-h)+0.001f;
-
-				if (ds>=s || outside) {
-					ds=s;
-					DEPOSIT(h) // deposit all sediment
-					s=0;
-					break; // stop
+	for (unsigned batch_start = 0; batch_start < num_iters; batch_start += batch_size) {
+		unsigned const num_in_batch(min(batch_size, (num_iters - batch_start)));
+
+		get_job_system().parallel_for(num_in_batch, [&](unsigned n) {
+			thread_local erosion_overlay_t overlay; // reused across droplets and batches; empty after each flush
+			int const iter(batch_start + n);
+			rand_gen_t rgen;
+			rgen.set_state(iter+11, 79*iter+121);
+			int xi = PAD + (rgen.rand()%xsize);
+			int zi = PAD + (rgen.rand()%ysize);
+			float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
+			float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
+
+			unsigned numMoves=0;
+			for (; numMoves<MAX_PATH_LEN; ++numMoves) {
+				// calc gradient
+				float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
+				// calc next pos
+				dx=(dx-gx)*Ki+gx;
+				dz=(dz-gz)*Ki+gz;
+
+				float dl=sqrtf(dx*dx+dz*dz);
+				if (dl<=FLT_EPSILON) { // pick random dir
+					float a=rgen.rand_float()*TWO_PI;
+					dx=cosf(a); dz=sinf(a);
 				}
-				DEPOSIT(h)
-				s-=ds;
-				v=0;
-			}
-			// compute transport capacity
-			float dh=h-nh;
-			float slope=dh;
-			//float slope=dh/sqrtf(dh*dh+1);
-			float q=max(slope, minSlope)*v*w*Kq;
-
-			// deposit/erode (don't erode more than dh)
-			float ds=s-q;
-			if (ds>=0) { // deposit
-				ds*=Kd;
-				//ds=minval(ds, 1.0f);
-				DEPOSIT(dh)
-				s-=ds;
-			}
-			else { // erode
-				ds*=-Kr;
-				ds=min(ds, dh*0.99f);
-				ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
-
-				for (int z=zi-1; z<=zi+2; ++z) {
-					float zo=z-zp, zo2=zo*zo;
-
-					for (int x=xi-1; x<=xi+2; ++x) {
-						float xo=x-xp;
-						float w=1-(xo*xo+zo2)*0.25f;
-						if (w<=0) continue;
-						w*=0.1591549430918953f;
-						ERODE(x, z, w)
+				else {
+					dx/=dl; dz/=dl;
+				}
+				float nxp=xp+dx, nzp=zp+dz;
+				// sample next height
+				int nxi=floor(nxp), nzi=floor(nzp);
+				float nxf=nxp-nxi, nzf=nzp-nzi;
+				float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
+				float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
+				// adjust by HALF_DXY = average mesh texel size - this is river depth
+				if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
+
+				// if higher than current, try to deposit sediment up to neighbour height
+				bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
+				if (nh>=h || outside) {
+					float ds=(nh-h)+0.001f;
+
+					if (ds>=s || outside) {
+						ds=s;
+						DEPOSIT(h) // deposit all sediment
+						s=0;
+						break; // stop
+					}
+					DEPOSIT(h)
+					s-=ds;
+					v=0;
+				}
+				// compute transport capacity
+				float dh=h-nh;
+				float slope=dh;
+				//float slope=dh/sqrtf(dh*dh+1);
+				float q=max(slope, minSlope)*v*w*Kq;
+
+				// deposit/erode (don't erode more than dh)
+				float ds=s-q;
+				if (ds>=0) { // deposit
+					ds*=Kd;
+					//ds=minval(ds, 1.0f);
+					DEPOSIT(dh)
+					s-=ds;
+				}
+				else { // erode
+					ds*=-Kr;
+					ds=min(ds, dh*0.99f);
+					ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
+
+					for (int z=zi-1; z<=zi+2; ++z) {
+						float zo=z-zp, zo2=zo*zo;
+
+						for (int x=xi-1; x<=xi+2; ++x) {
+							float xo=x-xp;
+							float w=1-(xo*xo+zo2)*0.25f;
+							if (w<=0) continue;
+							w*=0.1591549430918953f;
+							ERODE(x, z, w)
+						}
 					}
+					dh-=ds;
+					s+=ds;
 				}
-				dh-=ds;
-				s+=ds;
+				// move to the neighbor
+				v=sqrtf(v*v+Kg*dh);
+				w*=1-Kw;
+				xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
+				h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
+			} // for numMoves
+			if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
+			overlay.flush(&batch_deltas[n*NUM_EROSION_BANDS], band_size);
+		}); // for n
+		// apply deltas in droplet order; each band of rows is independent, and its cells receive their deltas in the same order for any number of threads
+		get_job_system().parallel_for(NUM_EROSION_BANDS, [&](unsigned b) {
+			for (unsigned n = 0; n < num_in_batch; ++n) {
+				for (auto const &d : batch_deltas[n*NUM_EROSION_BANDS + b]) {mh_padded[d.first] += d.second;}
 			}
-			// move to the neighbor
-			v=sqrtf(v*v+Kg*dh);
-			w*=1-Kw;
-			xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
-			h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
-		} // for numMoves
-		if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
-	} // for iter
+		}); // for b
+	} // for batch_start
 
 	// remove padding and clamp to min_zval
 	for (int y = 0; y < ysize; ++y) {
@@ -273,6 +273,7 @@ float get_max_sea_level();
 bool using_tiled_terrain_hmap_tex();
 float get_tiled_terrain_height_tex(float xval, float yval, bool nearest_texel=0);
 vector3d get_tiled_terrain_height_tex_norm(int x, int y);
+uint32_t hash_tiled_terrain_hmap_area(cube_t const &area);
 bool write_default_hmap_modmap();
 float update_tiled_terrain(float &min_camera_dist);
 void pre_draw_tiled_terrain();
@@ -283,6 +284,7 @@ void end_tiled_terrain_lightning();
 void draw_tiled_terrain_clouds(bool reflection_pass);
 void draw_tiled_terrain_decid_tree_shadows();
 void clear_tiled_terrain(bool no_regen_buildings=0);
+void gen_tiled_terrain_headless(int tile_radius);
 void reset_tiled_terrain_state();
 void clear_tiled_terrain_shaders();
 float get_tiled_terrain_water_level();
@@ -457,6 +459,7 @@ void post_rt_bvh_build_hook();
 void free_cobj_draw_group_vbos();
 
 // function prototypes - coll_cell_search
+void mark_cobj_moved(coll_obj const &cobj);
 void build_static_moving_cobj_tree();
 void build_cobj_tree(bool dynamic=0, bool verbose=1);
 bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
@@ -1014,6 +1017,7 @@ void apply_dim_mirror(unsigned dim, float val);
 // function prototypes - gen_buildings
 bool parse_buildings_option(FILE *fp);
 void gen_buildings();
+void gen_all_building_room_geom();
 void draw_buildings(int shadow_only, int reflection_pass, vector3d const &xlate);
 void draw_building_lights(vector3d const &xlate);
 void set_buildings_pos_range(cube_t const &pos_range);
@@ -1032,6 +1036,7 @@ size_t get_buildings_gpu_mem_usage();
 vector3d get_buildings_max_extent();
 void clear_building_vbos();
 int create_buildings_tile(int x, int y, bool allow_flatten);
+void prefetch_buildings_tile(int x, int y);
 bool remove_buildings_tile(int x, int y);
 void free_building_indir_texture();
 void end_building_rt_job();
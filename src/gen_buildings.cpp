@@ -12,13 +12,20 @@
 #include "tree_3dw.h" // for tree_placer_t
 #include "profiler.h"
 #include "lightmap.h" // for light_source
+#include "binary_file_io.h" // for building tile cache
 #include <cfloat>
+#include "job_system.h"
+#include <mutex>
+#include <condition_variable>
 
 using std::string;
 
 bool const ADD_ROOM_SHADOWS        = 1; // for room lights
 bool const DRAW_EXT_REFLECTIONS    = 1; // draw building exteriors in mirror reflections; slower, but looks better; not shadowed
 bool const DRAW_WALKWAY_INTERIORS  = 1;
+bool const ASYNC_BUILDING_TILES    = 1; // generate building tiles in streaming jobs
+unsigned const MAX_TILE_GEN_JOBS   = 2; // tiles generated at the same time, so that tile jobs never take all of the workers
+uint32_t const TILE_CACHE_VERSION   = 1; // increment when the building_creator_t tile cache format changes
 float const WIND_LIGHT_ON_RAND     = 0.08;
 unsigned const NO_SHADOW_WHITE_TEX = BLACK_TEX; // alias to differentiate shadowed    vs. unshadowed untextured objects
 unsigned const SHADOW_ONLY_TEX     = RED_TEX;   // alias to differentiate shadow only vs. other      untextured objects
@@ -3292,6 +3299,65 @@ class building_creator_t {
 			if (expand_by_one && ixr[1][d]+1 < grid_sz) {++ixr[1][d];}
 		}
 	}
+	// Group buildings into levels for parallel gen_geometry(). A building can only interact with others through its extended basement queries,
+	// which are limited to its grid bcube (plus a margin for malls). Each building is placed in a level above every lower index building it may
+	// interact with, and buildings in the same level can't interact, so the results match serial generation in building index order.
+	void get_gen_geometry_levels(vector<vector<unsigned>> &levels, bool serial) const {
+		levels.clear();
+		if (buildings.empty()) return;
+
+		if (serial) { // one building per level
+			levels.resize(buildings.size());
+			for (unsigned i = 0; i < buildings.size(); ++i) {levels[i].push_back(i);}
+			return;
+		}
+		if (!global_building_params.gen_building_interiors) { // no interiors, so no extended basements; all buildings are independent
+			levels.resize(1);
+			for (unsigned i = 0; i < buildings.size(); ++i) {levels[0].push_back(i);}
+			return;
+		}
+		float margin(0.0);
+		for (building_t const &b : buildings) {max_eq(margin, b.get_window_vspace());}
+		margin *= 16.0; // conservative distance that mall stores, elevators, and skylights can extend past the grid bcube
+		unsigned const num_grid(grid.size());
+		vect_cube_t grid_exp(num_grid);
+		vector<vector<unsigned>> grid_conflicts(num_grid); // other grids that can be reached from each grid
+
+		for (unsigned g = 0; g < num_grid; ++g) {
+			if (grid[g].empty()) continue;
+			grid_exp[g] = grid[g].bcube;
+			grid_exp[g].expand_by_xy(margin);
+		}
+		for (unsigned g1 = 0; g1 < num_grid; ++g1) {
+			if (grid[g1].empty()) continue;
+
+			for (unsigned g2 = 0; g2 < num_grid; ++g2) {
+				if (!grid[g2].empty() && grid_exp[g1].intersects_xy(grid_exp[g2])) {grid_conflicts[g1].push_back(g2);}
+			}
+		}
+		vector<unsigned> grid_next_level(num_grid, 0); // first level that doesn't conflict with buildings already assigned to each grid
+		unsigned ixr[2][2];
+
+		for (unsigned i = 0; i < buildings.size(); ++i) {
+			building_t const &b(buildings[i]);
+			unsigned level(0);
+
+			if (b.is_valid()) { // invalid buildings are skipped by gen_geometry() and can go in any level
+				get_grid_range(b.bcube, ixr);
+
+				for (unsigned y = ixr[0][1]; y <= ixr[1][1]; ++y) {
+					for (unsigned x = ixr[0][0]; x <= ixr[1][0]; ++x) {
+						for (unsigned g : grid_conflicts[y*grid_sz + x]) {max_eq(level, grid_next_level[g]);}
+					}
+				}
+				for (unsigned y = ixr[0][1]; y <= ixr[1][1]; ++y) {
+					for (unsigned x = ixr[0][0]; x <= ixr[1][0]; ++x) {grid_next_level[y*grid_sz + x] = level+1;}
+				}
+			}
+			if (level >= levels.size()) {levels.resize(level+1);}
+			levels[level].push_back(i);
+		} // for i
+	}
 	void add_to_grid(cube_t const &bcube, unsigned bix, bool is_road_seg=0) {
 		unsigned ixr[2][2];
 		get_grid_range(bcube, ixr);
@@ -3487,7 +3553,7 @@ public:
 			ret.init(params, rgen);
 			return ret;
 		}
-		city_prob_t const &get(unsigned bix) {
+		city_prob_t const &get(unsigned bix) const {
 			if (!enabled) return def_prob;
 			assert(bix < city_for_building.size());
 			assert(city_for_building[bix] < cps.size());
@@ -3498,7 +3564,7 @@ public:
 		}
 	};
 
-	void gen(building_params_t const &params, bool city_only, bool non_city_only, bool is_tile, bool allow_flatten, int rseed=123) {
+	void gen(building_params_t const &params, bool city_only, bool non_city_only, bool is_tile, bool allow_flatten, int rseed=123, bool defer_vbos=0) {
 		assert(!(city_only && non_city_only));
 		clear();
 		if (params.tt_only && world_mode != WMODE_INF_TERRAIN)    return;
@@ -3602,7 +3668,7 @@ public:
 				rand_gen_t &rgen_sz (CP.same_size_per_block[residential] ? group_rgen : rgen); // for size, height, and orient
 				b.mat_ix = params.choose_rand_mat(rgen_mat, city_only, non_city_only, residential); // set material
 				building_mat_t const &mat(b.get_material());
-				if (!use_city_plots) {pos_range = mat.pos_range + delta_range;} // select pos range by material
+				if (!use_city_plots) {pos_range = params.get_material(b.mat_ix).pos_range + delta_range;} // select pos range by material; params may have a tile pos_range
 				vector2d const pos_range_sz(pos_range.get_size_xy());
 				assert(pos_range_sz.x > 0.0 && pos_range_sz.y > 0.0);
 				point const place_center(pos_range.get_cube_center());
@@ -3736,13 +3802,22 @@ public:
 		} // if flatten_mesh
 		{ // open a scope
 			timer_t timer2("Gen Building Geometry", !is_tile); // 160ms/900ms
-
-			for (unsigned i = 0; i < buildings.size(); ++i) {
-				building_t &b(buildings[i]);
-				unsigned const rs_ix(city_prob.get(i).same_geom_per_mat[b.is_house] ? b.mat_ix : i); // same material, maybe from same block/city; could also use city_ix
-				b.gen_geometry(rs_ix, 1337*rs_ix+rseed);
-				grid[get_grid_ix(b.bcube.get_cube_center())].update_extb_bcube(b); // required to avoid overlapping extended basements
-			}
+			vector<vector<unsigned>> gen_levels;
+			get_gen_geometry_levels(gen_levels, is_tile);
+
+			for (vector<unsigned> const &level : gen_levels) {
+				// tiles have one building per level, so tile gen jobs run this serially on their own thread
+				get_job_system().parallel_for(level.size(), [&](unsigned n) {
+					unsigned const i(level[n]);
+					building_t &b(buildings[i]);
+					unsigned const rs_ix(city_prob.get(i).same_geom_per_mat[b.is_house] ? b.mat_ix : i); // same material, maybe from same block/city; could also use city_ix
+					b.gen_geometry(rs_ix, 1337*rs_ix+rseed); // per-building seeds, so the result doesn't depend on thread assignment
+				});
+				for (unsigned i : level) { // deferred serial merge, before any later level can query these grids
+					building_t const &b(buildings[i]);
+					grid[get_grid_ix(b.bcube.get_cube_center())].update_extb_bcube(b); // required to avoid overlapping extended basements
+				}
+			} // for level
 			if (city_only && global_building_params.gen_building_interiors && global_building_params.max_ext_basement_room_depth > 0) {
 				try_join_city_building_ext_basements(buildings);
 			}
@@ -3793,9 +3868,64 @@ public:
 			for (cube_t const &c : city_bcubes) {connect_buildings_with_walkways(c);}
 		}
 		build_grid_by_tile(is_tile);
-		if (!city_only) {create_vbos(is_tile);} // city VBOs are created later, after skyways are added
+		if (!city_only && !defer_vbos) {create_vbos(is_tile);} // city VBOs are created later, after skyways are added; tile VBOs are created on the main thread
 	} // end gen()
 
+	// tile disk cache; bix_by_plot and walkways are only used for cities, and VBOs are created after reading
+	bool can_write_tile_cache() const {return (!is_city && bix_by_plot.empty() && all_walkways.empty() && can_cache_buildings(buildings));}
+
+	void write_tile_cache(ostream &out) const {
+		write_val(out, range);
+		write_val(out, range_sz);
+		write_val(out, range_sz_inv);
+		write_val(out, max_extent);
+		write_val(out, buildings_bcube);
+		write_val(out, rgen);
+		write_val(out, has_interior_geom);
+		write_uint(out, grid_sz);
+
+		for (grid_elem_t const &g : grid) {
+			write_vector(out, g.bc_ixs);
+			write_vector(out, g.road_segs);
+			write_val(out, g.bcube);
+			write_val(out, g.extb_bcube);
+			write_val(out, g.ext_vis_bcube);
+		}
+		write_buildings_to_stream(out, buildings);
+	}
+	bool read_tile_cache(istream &in) {
+		clear();
+		read_val(in, range);
+		read_val(in, range_sz);
+		read_val(in, range_sz_inv);
+		read_val(in, max_extent);
+		read_val(in, buildings_bcube);
+		read_val(in, rgen);
+		read_val(in, has_interior_geom);
+		grid_sz = read_uint(in);
+		if (!in.good() || grid_sz == 0 || grid_sz > 64) {clear(); return 0;} // tiles use a 4x4 grid
+
+		grid.resize(grid_sz*grid_sz);
+
+		for (grid_elem_t &g : grid) {
+			read_vector(in, g.bc_ixs);
+			read_vector(in, g.road_segs);
+			read_val(in, g.bcube);
+			read_val(in, g.extb_bcube);
+			read_val(in, g.ext_vis_bcube);
+			if (!in.good()) {clear(); return 0;}
+		}
+		if (!read_buildings_from_stream(in, buildings)) {clear(); return 0;}
+
+		for (grid_elem_t const &g : grid) {
+			for (cube_with_ix_t const &c : g.bc_ixs) {
+				if (c.ix >= buildings.size()) {clear(); return 0;} // corrupted file
+			}
+		}
+		build_grid_by_tile(1); // single_tile=1
+		return 1;
+	}
+
 	bool place_building_at(building_t const &bldg, unsigned plot_ix, rand_gen_t rgen) { // Note: rgen passed by value
 		// Note: assumes caller has checked that bcube is a valid pos
 		if (buildings.size() == buildings.capacity()) return 0; // can't add a building as it will resize and invalidate conn pointers
@@ -4984,6 +5114,25 @@ public:
 		update_mem_usage(1); // is_tile=1 (assumed - no printout)
 		building_draw_wind_lights.upload_to_vbos();
 	}
+	void gen_all_room_geom() { // normally room geom is generated on demand when drawn; this is used for headless generation
+		vector<unsigned> by_type[NUM_BUILDING_TYPES]; // batched by building type so that there's one timer event per type rather than per building
+
+		for (unsigned bix = 0; bix < buildings.size(); ++bix) {
+			building_t const &b(buildings[bix]);
+			if (!b.interior || (!global_building_params.enable_rotated_room_geom && b.is_rotated())) continue; // same as gen_and_draw_room_geom()
+			assert(unsigned(b.btype) < NUM_BUILDING_TYPES);
+			by_type[b.btype].push_back(bix);
+		}
+		for (unsigned t = 0; t < NUM_BUILDING_TYPES; ++t) {
+			if (by_type[t].empty()) continue;
+			highres_timer_t timer("Gen Room Geom " + btype_names[t], 1, 1, 1); // tracked per building type to benchmark large buildings
+
+			for (unsigned bix : by_type[t]) {
+				buildings[bix].gen_room_geom_if_needed(bix);
+				has_room_geom |= buildings[bix].has_room_geom();
+			}
+		} // for t
+	}
 	void clear_room_geom(bool even_if_player_modified=0) {
 		if (!has_room_geom) return;
 		has_room_geom = 0;
@@ -5277,7 +5426,7 @@ public:
 		return buildings[building_id].check_sphere_coll(pos, radius, xy_only);
 	}
 	bool check_building_point_or_cylin_contained(point const &pos, float radius, bool inc_details, unsigned building_id) const { // for pedestrian grid
-		static vector<point> points; // reused across calls
+		static thread_local vector<point> points; // reused across calls; called from parallel per-city pedestrian updates
 		assert(building_id < buildings.size());
 		return buildings[building_id].check_point_or_cylin_contained(pos, radius, points, 0, 0, 0, inc_details, 1); // attic=0, extb=0, roof=0, for_pedestrian=1
 	}
@@ -5291,7 +5440,7 @@ public:
 		unsigned const gix(get_grid_ix(pos));
 		grid_elem_t const &ge(grid[gix]);
 		if (ge.bc_ixs.empty() || !ge.bcube.contains_pt(pos)) return -1; // skip empty or non-containing grid
-		static vector<point> points; // reused across calls
+		static thread_local vector<point> points; // reused across calls; called from parallel per-city pedestrian updates
 
 		for (auto b = ge.bc_ixs.begin(); b != ge.bc_ixs.end(); ++b) {
 			if (b->contains_pt(pos)) {return b->ix;} // found
@@ -5311,7 +5460,7 @@ public:
 		vector<unsigned> const &bixes(bix_by_plot[plot_id]); // should be populated in gen()
 		if (bixes.empty()) return 0;
 		cube_t bcube; bcube.set_from_sphere(pos, bcube_radius);
-		static vector<point> points; // reused across calls
+		static thread_local vector<point> points; // reused across calls; called from parallel per-city pedestrian updates
 
 		// Note: assumes buildings are separated so that only one ped collision can occur
 		for (auto b = bixes.begin(); b != bixes.end(); ++b) {
@@ -5765,6 +5914,9 @@ public:
 	}
 }; // building_creator_t
 
+// set while a tile is being generated, possibly on a worker thread; the tile isn't in building_tiles yet, so queries from its buildings must go here
+thread_local building_creator_t const *tile_being_generated(nullptr);
+
 
 class building_tiles_t {
 	typedef pair<int, int> xy_pair;
@@ -5773,6 +5925,22 @@ class building_tiles_t {
 	//set<xy_pair> generated; // only used in heightmap terrain mode, and generally limited to the size of the heightmap in tiles
 	vector3d max_extent;
 
+	struct tile_gen_job_t {
+		std::unique_ptr<building_creator_t> bc;
+		std::unique_ptr<building_params_t> params; // copied on the main thread so that workers never read the global pos_range
+		float priority=0.0; // smaller values are generated first
+		bool non_city_only=0, started=0, done=0, canceled=0;
+	};
+	typedef map<xy_pair, tile_gen_job_t> job_map_t;
+	job_map_t gen_jobs; // guarded by gen_mutex
+	std::mutex gen_mutex;
+	std::condition_variable job_done_cv;
+	job_group_t gen_group;
+	unsigned num_running=0, num_gen_jobs=0; // num_gen_jobs is the number of run_gen_jobs() calls that are queued or running
+	int travel_frame=-1;
+	point last_camera_bs;
+	vector3d travel_dir;
+
 	tile_map_t::const_iterator get_tile_by_pos_cs(point const &pos) const { // Note: pos is in camera space
 		vector3d const xlate(get_camera_coord_space_xlate());
 		int const x(round_fp(0.5f*(pos.x - xlate.x)/X_SCENE_SIZE)), y(round_fp(0.5f*(pos.y - xlate.y)/Y_SCENE_SIZE));
@@ -5782,34 +5950,201 @@ class building_tiles_t {
 		int const x(round_fp(0.5f*pos.x/X_SCENE_SIZE)), y(round_fp(0.5f*pos.y/Y_SCENE_SIZE));
 		return tiles.find(make_pair(x, y));
 	}
+	static cube_t get_tile_bcube(int x, int y, bool allow_flatten) {
+		int const border(allow_flatten ? 1 : 0); // add a 1 pixel border around the tile to avoid creating a seam when an adjacent tile's edge height is modified
+		cube_t bcube;
+		bcube.x1() = get_xval(x*MESH_X_SIZE + border);
+		bcube.y1() = get_yval(y*MESH_Y_SIZE + border);
+		bcube.x2() = get_xval((x+1)*MESH_X_SIZE - border);
+		bcube.y2() = get_yval((y+1)*MESH_Y_SIZE - border);
+		return bcube;
+	}
+	static uint32_t get_tile_cache_key(building_params_t const &params, cube_t const &tile_bcube, int rseed, bool non_city_only) {
+		// key includes everything the tile depends on: the building config, seeds, city mode, and the terrain under the tile
+		vector<uint32_t> key_vals = {TILE_CACHE_VERSION, params.config_hash, params.buildings_rand_seed, (uint32_t)rseed, (uint32_t)rand_gen_index, non_city_only};
+		// heightmap and mod map edits can be anywhere in the tile, so hash every heightmap texel under it
+		if (using_tiled_terrain_hmap_tex()) {key_vals.push_back(hash_tiled_terrain_hmap_area(tile_bcube));}
+		unsigned const num_samples(5); // 5x5 grid of terrain heights; procedural terrain is a function of the config, so this catches changes to it
+
+		for (unsigned yi = 0; yi < num_samples; ++yi) {
+			for (unsigned xi = 0; xi < num_samples; ++xi) {
+				float const zval(get_exact_zval(tile_bcube.x1() + xi*tile_bcube.dx()/(num_samples-1), tile_bcube.y1() + yi*tile_bcube.dy()/(num_samples-1), 1)); // no_xyoff=1
+				uint32_t zbits(0);
+				memcpy(&zbits, &zval, sizeof(float));
+				key_vals.push_back(zbits);
+			}
+		}
+		return jenkins_one_at_a_time_hash(key_vals.data(), key_vals.size());
+	}
+	static std::string get_tile_cache_fn(building_params_t const &params, int x, int y) {
+		std::ostringstream oss;
+		oss << params.tile_cache_dir << "/btile_" << x << "_" << y << ".bin"; // one file per tile; a stale file is overwritten when the key changes
+		return oss.str();
+	}
+	static bool read_tile_cache_file(building_creator_t &bc, std::string const &fn, uint32_t key) {
+		std::ifstream in(fn, std::ios::in | std::ios::binary);
+		if (!in.good()) return 0; // not cached
+		uint32_t file_key(0);
+		read_val(in, file_key);
+		if (!in.good() || file_key != key) return 0; // stale
+		return bc.read_tile_cache(in);
+	}
+	static void write_tile_cache_file(building_creator_t const &bc, std::string const &fn, uint32_t key) {
+		if (!bc.can_write_tile_cache()) return;
+		std::string const tmp_fn(fn + ".tmp"); // write to a temp file and rename so that a partially written file is never read
+		{
+			std::ofstream out(tmp_fn, std::ios::out | std::ios::binary);
+			if (!out.good()) {std::cerr << "Error: Failed to open building tile cache file " << tmp_fn << " for writing" << endl; return;}
+			write_val(out, key);
+			bc.write_tile_cache(out);
+			if (!out.good()) {out.close(); remove(tmp_fn.c_str()); return;}
+		}
+		remove(fn.c_str()); // required for rename() on Windows
+		rename(tmp_fn.c_str(), fn.c_str());
+	}
+	// thread safe, as long as params is not shared with the main thread; the tile is independent of other tiles, so the result is the same on any thread
+	static void gen_tile(building_creator_t &bc, building_params_t &params, int x, int y, bool allow_flatten, bool non_city_only) {
+		assert(bc.empty());
+		cube_t const tile_bcube(get_tile_bcube(x, y, allow_flatten));
+		params.set_pos_range(tile_bcube);
+		int const rseed(x + (y << 16) + 12345); // should not be zero
+		// flattened tiles modify the terrain, so they must always be generated
+		bool const use_cache(!params.tile_cache_dir.empty() && !allow_flatten);
+		uint32_t const key(use_cache ? get_tile_cache_key(params, tile_bcube, rseed, non_city_only) : 0);
+		std::string const cache_fn(use_cache ? get_tile_cache_fn(params, x, y) : std::string());
+		if (use_cache && read_tile_cache_file(bc, cache_fn, key)) return; // loaded from cache
+		tile_being_generated = &bc;
+		bc.gen(params, 0, non_city_only, 1, allow_flatten, rseed, 1); // if there are cities, then tiles are non-city/secondary buildings; defer_vbos=1
+		tile_being_generated = nullptr;
+		if (use_cache) {write_tile_cache_file(bc, cache_fn, key);}
+	}
+	void add_tile(xy_pair const &loc, building_creator_t &bc) { // main thread only
+		building_creator_t &tile(tiles.emplace(loc, std::move(bc)).first->second);
+		tile.create_vbos(1); // is_tile=1
+		max_extent = max_extent.max(tile.get_max_extent());
+	}
+	float get_tile_priority(xy_pair const &loc) {
+		if (travel_frame != frame_counter) { // update travel direction once per frame
+			point const camera_bs(get_camera_building_space());
+			if (travel_frame >= 0 && camera_bs != last_camera_bs) {travel_dir = (camera_bs - last_camera_bs).get_norm();}
+			last_camera_bs = camera_bs;
+			travel_frame   = frame_counter;
+		}
+		vector3d const delta(get_tile_bcube(loc.first, loc.second, 0).get_cube_center() - last_camera_bs);
+		float const dist(delta.xy_mag());
+		if (dist == 0.0) return 0.0;
+		float const dp((travel_dir.x*delta.x + travel_dir.y*delta.y)/dist);
+		return dist*(1.0 - 0.5*dp); // prefer tiles in the direction of travel
+	}
+	void start_gen_job() { // gen_mutex must be locked
+		if (num_gen_jobs >= MAX_TILE_GEN_JOBS) return; // a running job will pick up the new tile
+		++num_gen_jobs;
+		get_job_system().run_async([this] {run_gen_jobs();}, JOB_PRI_STREAM, &gen_group);
+	}
+	void run_gen_jobs() { // generates tiles, highest priority first, until there are none left
+		std::unique_lock<std::mutex> lock(gen_mutex);
+
+		while (1) {
+			job_map_t::iterator const job(get_next_job());
+			if (job == gen_jobs.end()) {--num_gen_jobs; break;} // under the lock, so a tile added after this will start a new job
+			tile_gen_job_t &J(job->second);
+			J.started = 1;
+			++num_running;
+			lock.unlock();
+			gen_tile(*J.bc, *J.params, job->first.first, job->first.second, 0, J.non_city_only); // allow_flatten=0
+			lock.lock();
+			J.done = 1;
+			--num_running;
+			if (J.canceled) {gen_jobs.erase(job);} // tile was removed while being generated
+			job_done_cv.notify_all();
+		} // end while
+	}
+	job_map_t::iterator get_next_job() { // gen_mutex must be locked
+		job_map_t::iterator best(gen_jobs.end());
+
+		for (auto i = gen_jobs.begin(); i != gen_jobs.end(); ++i) {
+			if (i->second.started || i->second.canceled) continue;
+			if (best == gen_jobs.end() || i->second.priority < best->second.priority) {best = i;}
+		}
+		return best;
+	}
+	int request_async_tile(xy_pair const &loc, bool claim) { // returns 1 if the tile was claimed
+		float const priority(get_tile_priority(loc));
+		std::unique_ptr<building_creator_t> bc;
+		{
+			std::lock_guard<std::mutex> lock(gen_mutex);
+			auto it(gen_jobs.find(loc));
+
+			if (it == gen_jobs.end()) { // new job
+				tile_gen_job_t &J(gen_jobs[loc]);
+				J.bc.reset(new building_creator_t);
+				J.params.reset(new building_params_t(global_building_params));
+				J.priority      = priority;
+				J.non_city_only = have_cities();
+				start_gen_job();
+			}
+			else if (!it->second.done) { // update priority for camera movement
+				it->second.priority = priority;
+				it->second.canceled = 0; // requested again before the worker finished
+			}
+			else if (claim) { // generated and ready to be added
+				bc.swap(it->second.bc);
+				gen_jobs.erase(it);
+			}
+		}
+		if (!bc) return 0; // not yet ready
+		add_tile(loc, *bc);
+		return 1;
+	}
+	void cancel_job(xy_pair const &loc) {
+		std::lock_guard<std::mutex> lock(gen_mutex);
+		auto it(gen_jobs.find(loc));
+		if (it == gen_jobs.end()) return;
+		if (it->second.started && !it->second.done) {it->second.canceled = 1;} // let the job erase it when done
+		else {gen_jobs.erase(it);}
+	}
+	void cancel_all_jobs() { // and wait for running jobs to finish
+		std::unique_lock<std::mutex> lock(gen_mutex);
+		for (auto &j : gen_jobs) {j.second.canceled = 1;}
+		job_done_cv.wait(lock, [this] {return (num_running == 0);});
+		gen_jobs.clear();
+	}
 public:
+	~building_tiles_t() {
+		{
+			std::lock_guard<std::mutex> lock(gen_mutex);
+			for (auto &j : gen_jobs) {j.second.canceled = 1;} // don't start any more tiles
+		}
+		gen_group.wait();
+	}
 	bool     empty() const {return tiles.empty();}
 	unsigned size()  const {return tiles.size();}
 	vector3d get_max_extent() const {return max_extent;}
 
-	int create_tile(int x, int y, bool allow_flatten) { // return value: 0=already exists, 1=newly generaged, 2=re-generated
+	int create_tile(int x, int y, bool allow_flatten) { // return value: 0=already exists or not ready, 1=newly generaged, 2=re-generated
 		xy_pair const loc(x, y);
 		auto it(tiles.find(loc));
 		if (it != tiles.end()) return 0; // already exists
 		//cout << "Create building tile " << x << "," << y << ", tiles: " << tiles.size() << endl; // 299 tiles
-		building_creator_t &bc(tiles[make_pair(x, y)]); // insert it
-		assert(bc.empty());
-		int const border(allow_flatten ? 1 : 0); // add a 1 pixel border around the tile to avoid creating a seam when an adjacent tile's edge height is modified
-		cube_t bcube;
-		bcube.x1() = get_xval(x*MESH_X_SIZE + border);
-		bcube.y1() = get_yval(y*MESH_Y_SIZE + border);
-		bcube.x2() = get_xval((x+1)*MESH_X_SIZE - border);
-		bcube.y2() = get_yval((y+1)*MESH_Y_SIZE - border);
-		global_building_params.set_pos_range(bcube);
-		int const rseed(x + (y << 16) + 12345); // should not be zero
-		bc.gen(global_building_params, 0, have_cities(), 1, allow_flatten, rseed); // if there are cities, then tiles are non-city/secondary buildings
-		global_building_params.restore_prev_pos_range();
-		max_extent = max_extent.max(bc.get_max_extent());
+		// flattening modifies the heightmap used for terrain tiles, so it must be done synchronously before the tile's zvals are generated
+		if (ASYNC_BUILDING_TILES && !allow_flatten) return request_async_tile(loc, 1); // claim=1
+		cancel_job(loc);
+		building_creator_t bc;
+		building_params_t params(global_building_params);
+		gen_tile(bc, params, x, y, allow_flatten, have_cities());
+		add_tile(loc, bc);
 		//if (allow_flatten) {return (generated.insert(loc).second ? 1 : 2);} // Note: caller no longer uses this value, so don't need to maintain generated
 		return 1;
 	}
+	void prefetch_tile(int x, int y) { // start generating a tile ahead of the camera so that it's ready when needed
+		xy_pair const loc(x, y);
+		if (!ASYNC_BUILDING_TILES || tiles.find(loc) != tiles.end()) return;
+		request_async_tile(loc, 0); // claim=0
+	}
 	bool remove_tile(int x, int y) {
-		auto it(tiles.find(make_pair(x, y)));
+		xy_pair const loc(x, y);
+		cancel_job(loc);
+		auto it(tiles.find(loc));
 		if (it == tiles.end()) return 0; // not found
 		//cout << "Remove building tile " << x << "," << y << ", tiles: " << tiles.size() << endl;
 		it->second.clear_vbos(); // free VBOs/VAOs
@@ -5820,6 +6155,7 @@ public:
 		for (auto i = tiles.begin(); i != tiles.end(); ++i) {i->second.clear_vbos();}
 	}
 	void clear() {
+		cancel_all_jobs();
 		clear_vbos();
 		tiles.clear();
 	}
@@ -5963,6 +6299,10 @@ int create_buildings_tile(int x, int y, bool allow_flatten) { // return value: 0
 	if (!global_building_params.gen_inf_buildings()) return 0;
 	return building_tiles.create_tile(x, y, allow_flatten);
 }
+void prefetch_buildings_tile(int x, int y) {
+	if (!global_building_params.gen_inf_buildings()) return;
+	building_tiles.prefetch_tile(x, y);
+}
 bool remove_buildings_tile(int x, int y) {
 	if (!global_building_params.gen_inf_buildings()) return 0;
 	return building_tiles.remove_tile(x, y);
@@ -5980,6 +6320,11 @@ void gen_buildings() {
 		if (global_building_params.add_secondary_buildings) {building_creator.gen(global_building_params, 0, 1, 0, 1);} // non-city secondary buildings
 	} else {building_creator .gen(global_building_params, 0, 0, 0, 1);} // mixed/non-city buildings
 }
+void gen_all_building_room_geom() { // for headless mode
+	timer_t timer("Gen Room Geom");
+	building_creator_city.gen_all_room_geom();
+	building_creator     .gen_all_room_geom();
+}
 void regen_buildings() {
 	if (world_mode != WMODE_INF_TERRAIN || !have_cities()) return; // no cities/buildings
 	static int regen_rseed = 1000;
@@ -6044,9 +6389,11 @@ void get_building_grass_coll_cubes(cube_t const &region, vect_cube_t &out) { //
 	for (auto c = out.begin()+out_start; c != out.end(); ++c) {*c += xlate;} // convert back to camera space
 }
 bool check_buildings_cube_coll(cube_t const &c, bool xy_only, bool inc_basement, building_t const *exclude1, building_t const *exclude2) {
-	return (building_creator_city.check_cube_coll(c, xy_only, inc_basement, exclude1, exclude2) ||
-		building_creator.check_cube_coll(c, xy_only, inc_basement, exclude1, exclude2) ||
-		building_tiles.check_cube_coll(c, xy_only, inc_basement, exclude1, exclude2));
+	if (building_creator_city.check_cube_coll(c, xy_only, inc_basement, exclude1, exclude2)) return 1;
+	if (building_creator     .check_cube_coll(c, xy_only, inc_basement, exclude1, exclude2)) return 1;
+	// a tile being generated can only intersect its own buildings, and must not access building_tiles, which may be modified by the main thread
+	if (tile_being_generated) return tile_being_generated->check_cube_coll(c, xy_only, inc_basement, exclude1, exclude2);
+	return building_tiles.check_cube_coll(c, xy_only, inc_basement, exclude1, exclude2);
 }
 void get_road_segs_in_region(cube_t const &region, vect_cube_t &out) { // for tiled terrain mode; pos is in local space
 	building_creator.get_road_segs_in_region(region, &out);
@@ -6111,6 +6458,7 @@ cube_t get_grid_bcube_for_building(building_t const &b) {
 	if (!ret.is_all_zeros()) return ret; // city building
 	ret = building_creator.get_grid_bcube_for_building(b);
 	if (!ret.is_all_zeros()) return ret; // secondary building
+	if (tile_being_generated) return tile_being_generated->get_grid_bcube_for_building(b);
 	ret = building_tiles.get_grid_bcube_for_building(b);
 	return ret;
 }
@@ -8,6 +8,9 @@
 #include "file_utils.h"
 #include "sinf.h"
 #include "mesh.h"
+#include "binary_file_io.h" // for read_val()/write_val()
+#include "job_system.h"
+#include <zlib.h>
 
 using namespace std;
 
@@ -15,10 +18,10 @@ using namespace std;
 bool const APPLY_2X_EROSION_DOWNSAMPLE = 0; // faster, but more noise
 unsigned const TEX_EDGE_MODE = 2; // 0 = clamp, 1 = cliff/underwater, 2 = mirror
 
-extern unsigned hmap_filter_width, erosion_iters_tt;
+extern unsigned hmap_filter_width, erosion_iters_tt, tiled_hmap_cache_mb;
 extern int display_mode;
 extern float mesh_scale, dxdy;
-extern string hmap_out_fn;
+extern string hmap_out_fn, tiled_hmap_out_fn;
 
 void get_heightmap_z_range(vector<float> const &heights, float &min_z, float &max_z);
 void set_mesh_height_scales_for_zval_range(float min_z, float dz);
@@ -215,12 +218,300 @@ void heightmap_t::from_floats(vector<float> const &vals) {
 }
 
 
+// *** tiled_heightmap_t ***
+
+unsigned const TILED_HMAP_SIG     = 0x314d4854; // "THM1"
+unsigned const TILED_HMAP_VERSION = 1;
+
+bool is_tiled_hmap_fn(string const &fn) {return endswith(fn, ".thm");}
+
+bool tiled_heightmap_t::open(string const &fn, unsigned cache_mb) {
+
+	static unsigned next_instance_id(0);
+	close();
+	in.open(fn, ios::in | ios::binary);
+
+	if (!in.good()) {
+		cerr << "Error opening tiled heightmap " << fn << " for read" << endl;
+		return 0;
+	}
+	unsigned sig(0), version(0), src_bytes_per_pixel(0);
+	read_val(in, sig);
+	read_val(in, version);
+	read_val(in, width);
+	read_val(in, height);
+	read_val(in, tile_size);
+	read_val(in, src_bytes_per_pixel);
+
+	if (!in.good() || sig != TILED_HMAP_SIG || version != TILED_HMAP_VERSION) {
+		cerr << "Error: invalid header or unsupported version in tiled heightmap " << fn << endl;
+		return 0;
+	}
+	if (width <= 0 || height <= 0 || tile_size == 0 || (src_bytes_per_pixel != 1 && src_bytes_per_pixel != 2)) {
+		cerr << "Error: invalid size or format in tiled heightmap " << fn << endl;
+		return 0;
+	}
+	tiles_x     = (width  + tile_size - 1)/tile_size;
+	tiles_y     = (height + tile_size - 1)/tile_size;
+	pixel_scale = ((src_bytes_per_pixel == 1) ? 256 : 1);
+	vector<file_tile_t> tiles(tiles_x*tiles_y);
+
+	for (file_tile_t &t : tiles) {
+		read_val(in, t.offset);
+		read_val(in, t.comp_size);
+	}
+	if (!in.good()) {
+		cerr << "Error reading tile index from tiled heightmap " << fn << endl;
+		return 0;
+	}
+	file_tiles.swap(tiles);
+	tile_gens   = vector<std::atomic<unsigned>>(file_tiles.size());
+	spill_fn    = fn + ".spill";
+	uint64_t const tile_bytes(tile_size*tile_size*sizeof(pixel_t));
+	max_cached_tiles = max(16U, unsigned(((uint64_t)cache_mb << 20)/tile_bytes));
+	instance_id = ++next_instance_id; // invalidates per-thread cached tiles from any previously opened file
+	cout << "Opened tiled heightmap " << fn << " of size " << width << "x" << height << " with " << file_tiles.size() << " tiles" << endl;
+	return 1;
+}
+
+void tiled_heightmap_t::close() { // must not be called while other threads are accessing tiles
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	if (in.is_open()) {in.close();}
+	in.clear();
+
+	if (spill.is_open()) { // modified tiles are discarded
+		spill.close();
+		remove(spill_fn.c_str());
+	}
+	spill.clear();
+	cache.clear();
+	file_tiles.clear();
+	tile_gens.clear();
+	width = height = 0;
+}
+
+unsigned tiled_heightmap_t::get_tile_ix(unsigned x, unsigned y) const {
+	assert(x < (unsigned)width && y < (unsigned)height);
+	return ((y/tile_size)*tiles_x + (x/tile_size));
+}
+
+tiled_heightmap_t::p_tile_t tiled_heightmap_t::read_tile(unsigned tile_ix) const { // called without cache_mutex locked
+
+	assert(tile_ix < file_tiles.size());
+	vector<unsigned char> comp_data;
+	bool read_ok(0);
+	{
+		std::lock_guard<std::mutex> lock(file_mutex); // only the file read is serialized; decompression runs in parallel
+		file_tile_t const &ft(file_tiles[tile_ix]);
+		std::istream &file(ft.spilled ? (std::istream &)spill : (std::istream &)in);
+		comp_data.resize(ft.comp_size);
+		file.seekg(ft.offset);
+		file.read((char *)comp_data.data(), comp_data.size());
+		read_ok = file.good();
+	}
+	p_tile_t tile(new vector<pixel_t>(tile_size*tile_size));
+	uLongf dest_len(tile->size()*sizeof(pixel_t));
+
+	if (!read_ok || uncompress((Bytef *)tile->data(), &dest_len, comp_data.data(), comp_data.size()) != Z_OK || dest_len != tile->size()*sizeof(pixel_t)) {
+		cerr << "Error reading tile " << tile_ix << " of tiled heightmap" << endl;
+		exit(1); // can't continue without height values
+	}
+	return tile;
+}
+
+void tiled_heightmap_t::spill_tile(unsigned tile_ix, vector<pixel_t> const &data) const { // called without cache_mutex locked
+
+	uLongf comp_len(compressBound(data.size()*sizeof(pixel_t)));
+	vector<unsigned char> comp_data(comp_len);
+	int const ret(compress2(comp_data.data(), &comp_len, (Bytef const *)data.data(), data.size()*sizeof(pixel_t), Z_BEST_SPEED));
+	assert(ret == Z_OK);
+	std::lock_guard<std::mutex> lock(file_mutex);
+	if (!spill.is_open()) {spill.open(spill_fn, ios::in | ios::out | ios::binary | ios::trunc);}
+	spill.seekp(0, ios::end); // rewritten tiles are appended, and their previous data is left unused
+	file_tile_t &ft(file_tiles[tile_ix]);
+	ft.offset    = spill.tellp();
+	ft.comp_size = comp_len;
+	ft.spilled   = 1;
+	spill.write((char const *)comp_data.data(), comp_len);
+
+	if (!spill.good()) {
+		cerr << "Error writing tile " << tile_ix << " to tiled heightmap spill file " << spill_fn << endl;
+		exit(1); // modified heights would be lost
+	}
+}
+
+// Note: a modified tile can only be evicted once max_cached_tiles other tiles have been used after it, so the caller's pointer stays current for
+// the few pixels it modifies
+tiled_heightmap_t::p_tile_t tiled_heightmap_t::get_tile(unsigned tile_ix, bool mark_modified) const { // threadsafe
+
+	std::unique_lock<std::mutex> lock(cache_mutex);
+	auto it(cache.find(tile_ix));
+
+	while (it != cache.end() && it->second.busy) { // another thread is reading or spilling this tile
+		tile_ready.wait(lock);
+		it = cache.find(tile_ix);
+	}
+	if (it != cache.end()) {
+		it->second.last_used = ++use_counter;
+		if (mark_modified) {it->second.modified = 1;}
+		return it->second.data;
+	}
+	// not cached: evict least recently used tiles to stay within the budget, then read from the file, with the IO done outside the lock
+	vector<pair<unsigned, p_tile_t>> to_spill;
+	unsigned num_busy(0);
+	for (auto const &e : cache) {num_busy += e.second.busy;}
+
+	while (cache.size() >= max_cached_tiles + num_busy) { // tiles being spilled or read by other threads don't count toward the budget
+		auto lru(cache.end());
+
+		for (auto i = cache.begin(); i != cache.end(); ++i) {
+			if (!i->second.busy && (lru == cache.end() || i->second.last_used < lru->second.last_used)) {lru = i;}
+		}
+		if (lru == cache.end()) break; // all tiles are busy, allow the cache to grow
+
+		if (lru->second.modified) { // keep the entry until its data is in the spill file so that other threads wait for it rather than reading the old data
+			lru->second.busy = 1;
+			++num_busy;
+			to_spill.emplace_back(lru->first, lru->second.data);
+		}
+		else {
+			++tile_gens[lru->first];
+			cache.erase(lru);
+		}
+	}
+	cache[tile_ix].busy = 1;
+	lock.unlock();
+	for (auto const &s : to_spill) {spill_tile(s.first, *s.second);}
+	p_tile_t const tile(read_tile(tile_ix));
+	lock.lock();
+
+	for (auto const &s : to_spill) {
+		++tile_gens[s.first];
+		cache.erase(s.first);
+	}
+	cache_entry_t &e(cache[tile_ix]);
+	e.data      = tile;
+	e.busy      = 0;
+	e.last_used = ++use_counter;
+	if (mark_modified) {e.modified = 1;}
+	tile_ready.notify_all();
+	return tile;
+}
+
+tiled_heightmap_t::pixel_t const *tiled_heightmap_t::get_tile_data(unsigned tile_ix) const {
+
+	// each thread keeps a reference to the last tile it accessed so that most lookups don't need to lock the cache;
+	// the reference is dropped if that tile has been evicted since, because it may have been reloaded and modified
+	struct last_tile_t {
+		unsigned instance_id=0, tile_ix=0, gen=0;
+		p_tile_t data;
+	};
+	static thread_local last_tile_t last;
+	assert(tile_ix < tile_gens.size());
+	unsigned const gen(tile_gens[tile_ix]); // read before the lookup so that a concurrent eviction isn't missed
+
+	if (last.instance_id != instance_id || last.tile_ix != tile_ix || last.gen != gen) {
+		last.gen         = gen;
+		last.data        = get_tile(tile_ix, 0);
+		last.instance_id = instance_id;
+		last.tile_ix     = tile_ix;
+	}
+	return last.data->data();
+}
+
+void tiled_heightmap_t::modify_heightmap_value(unsigned x, unsigned y, int val, bool val_is_delta) { // val is in source image units
+	p_tile_t const tile(get_tile(get_tile_ix(x, y), 1)); // mark_modified=1
+	pixel_t &pixel((*tile)[get_tile_offset(x, y)]);
+	val *= pixel_scale;
+	if (val_is_delta) {val += pixel;}
+	pixel = max(0, min(65535, val)); // clamp
+}
+
+void tiled_heightmap_t::set_heightmap_value(unsigned x, unsigned y, float val) {
+	p_tile_t const tile(get_tile(get_tile_ix(x, y), 1)); // mark_modified=1
+	(*tile)[get_tile_offset(x, y)] = max(0, min(65535, round_fp(256.0f*val))); // full 16-bit precision
+}
+
+// converts an in-memory heightmap to a tiled heightmap file; heights are stored as 16 bits, with any 8-bit filtering applied
+bool tiled_heightmap_t::write(string const &fn, heightmap_t const &hmap, unsigned tile_size) {
+
+	assert(hmap.is_allocated() && tile_size > 0);
+	timer_t timer("Tiled Heightmap Write");
+	ofstream out(fn, ios::out | ios::binary);
+
+	if (!out.good()) {
+		cerr << "Error opening tiled heightmap " << fn << " for write" << endl;
+		return 0;
+	}
+	int const width(hmap.width), height(hmap.height);
+	unsigned const tiles_x((width + tile_size - 1)/tile_size), tiles_y((height + tile_size - 1)/tile_size), num_tile_pixels(tile_size*tile_size);
+	vector<file_tile_t> tiles(tiles_x*tiles_y);
+	write_val(out, TILED_HMAP_SIG);
+	write_val(out, TILED_HMAP_VERSION);
+	write_val(out, width);
+	write_val(out, height);
+	write_val(out, tile_size);
+	write_val(out, hmap.bytes_per_channel());
+	uint64_t const index_pos(out.tellp());
+
+	for (file_tile_t const &t : tiles) { // placeholder index, filled in at the end
+		write_val(out, t.offset);
+		write_val(out, t.comp_size);
+	}
+	vector<vector<unsigned char>> comp_data(tiles_x);
+
+	for (unsigned ty = 0; ty < tiles_y; ++ty) { // compress one row of tiles at a time in parallel, then write them in order
+		get_job_system().parallel_for(tiles_x, [&](unsigned tx) {
+			vector<pixel_t> pixels(num_tile_pixels);
+
+			for (unsigned y = 0; y < tile_size; ++y) {
+				unsigned const yy(min(ty*tile_size + y, unsigned(height-1))); // partial edge tiles are padded by clamping
+
+				for (unsigned x = 0; x < tile_size; ++x) {
+					unsigned const xx(min(tx*tile_size + x, unsigned(width-1)));
+					pixels[y*tile_size + x] = max(0, min(65535, round_fp(256.0f*hmap.get_heightmap_value(xx, yy))));
+				}
+			}
+			uLongf comp_len(compressBound(num_tile_pixels*sizeof(pixel_t)));
+			vector<unsigned char> &cd(comp_data[tx]);
+			cd.resize(comp_len);
+			int const ret(compress2(cd.data(), &comp_len, (Bytef const *)pixels.data(), num_tile_pixels*sizeof(pixel_t), Z_DEFAULT_COMPRESSION));
+			assert(ret == Z_OK);
+			cd.resize(comp_len);
+		}); // for tx
+		for (unsigned tx = 0; tx < tiles_x; ++tx) {
+			file_tile_t &t(tiles[ty*tiles_x + tx]);
+			t.offset    = out.tellp();
+			t.comp_size = comp_data[tx].size();
+			out.write((char const *)comp_data[tx].data(), comp_data[tx].size());
+		}
+	} // for ty
+	out.seekp(index_pos);
+
+	for (file_tile_t const &t : tiles) {
+		write_val(out, t.offset);
+		write_val(out, t.comp_size);
+	}
+	if (!out.good()) {
+		cerr << "Error writing tiled heightmap " << fn << endl;
+		return 0;
+	}
+	cout << "Wrote tiled heightmap " << fn << " with " << tiles.size() << " tiles" << endl;
+	return 1;
+}
+
+
 void tex_mod_map_manager_t::add_mod(tex_mod_vect_t const &mod) { // vector (could use a template function)
 	for (tex_mod_vect_t::const_iterator i = mod.begin(); i != mod.end(); ++i) {add_mod(*i);}
 }
 
-void tex_mod_map_manager_t::add_mod(tex_mod_map_t const &mod) { // map (could use a template function)
-	for (tex_mod_map_t::const_iterator i = mod.begin(); i != mod.end(); ++i) {add_mod(mod_elem_t(*i));}
+void tex_mod_map_manager_t::add_mod(tex_mod_map_t const &mod) {mod_map.add(mod);}
+
+void tex_mod_map_manager_t::tex_mod_map_t::add(tex_mod_map_t const &mod) { // merge chunk by chunk
+	for (auto const &c : mod.chunks) {
+		chunk_t &chunk(chunks[c.first]);
+		for (unsigned i = 0; i < CHUNK_PIXELS; ++i) {chunk.vals[i] += c.second.vals[i];}
+	}
 }
 
 bool tex_mod_map_manager_t::pop_last_brush(hmap_brush_t &last_brush) {
@@ -240,8 +531,10 @@ bool tex_mod_map_manager_t::undo_last_brush() {
 	return 1;
 }
 
-unsigned const header_sig  = 0xdeadbeef;
-unsigned const trailer_sig = 0xbeefdead;
+unsigned const header_sig         = 0xdeadbeef; // original format: list of {x, y, delta} elements
+unsigned const chunked_header_sig = 0xdeadbee2; // chunked format: per chunk, a bit mask of modified points followed by their deltas
+unsigned const trailer_sig        = 0xbeefdead;
+unsigned const MOD_CHUNK_MASK_WORDS = tex_mod_map_manager_t::tex_mod_map_t::CHUNK_PIXELS/32;
 
 bool tex_mod_map_manager_t::read_mod(string const &fn) {
 
@@ -253,17 +546,46 @@ bool tex_mod_map_manager_t::read_mod(string const &fn) {
 		cerr << "Error opening terrain height mod map " << fn << " for read" << endl;
 		return 0;
 	}
-	if (read_binary_uint(fp) != header_sig) {
-		cerr << "Error: incorrect header found in terrain height mod map " << fn << "." << endl;
-		return 0;
+	unsigned const sig(read_binary_uint(fp));
+
+	if (sig == header_sig) { // read the original format, for backwards compatibility
+		unsigned const sz(read_binary_uint(fp));
+		vector<mod_elem_t> elems(sz);
+		unsigned const elem_read(fread(elems.data(), sizeof(mod_elem_t), elems.size(), fp));
+		assert(elem_read == elems.size()); // add error checking?
+		for (mod_elem_t const &elem : elems) {mod_map.add(elem);}
 	}
-	unsigned const sz(read_binary_uint(fp));
+	else if (sig == chunked_header_sig) {
+		unsigned const chunk_size(read_binary_uint(fp)), num_chunks(read_binary_uint(fp));
 
-	for (unsigned i = 0; i < sz; ++i) {
-		mod_elem_t elem;
-		unsigned const elem_read(fread(&elem, sizeof(mod_elem_t), 1, fp)); // use a larger block?
-		assert(elem_read == 1); // add error checking?
-		mod_map.add(elem);
+		if (chunk_size != tex_mod_map_t::CHUNK_SIZE) {
+			cerr << "Error: unsupported chunk size of " << chunk_size << " in terrain height mod map " << fn << "." << endl;
+			checked_fclose(fp);
+			return 0;
+		}
+		unsigned mask[MOD_CHUNK_MASK_WORDS];
+		hmap_val_t vals[tex_mod_map_t::CHUNK_PIXELS];
+
+		for (unsigned n = 0; n < num_chunks; ++n) {
+			unsigned const key(read_binary_uint(fp));
+			unsigned const mask_read(fread(mask, sizeof(unsigned), MOD_CHUNK_MASK_WORDS, fp));
+			assert(mask_read == MOD_CHUNK_MASK_WORDS); // add error checking?
+			unsigned num_vals(0);
+			for (unsigned i = 0; i < tex_mod_map_t::CHUNK_PIXELS; ++i) {num_vals += ((mask[i >> 5] >> (i & 31)) & 1);}
+			unsigned const vals_read(fread(vals, sizeof(hmap_val_t), num_vals, fp));
+			assert(vals_read == num_vals); // add error checking?
+			tex_mod_map_t::chunk_t &chunk(mod_map.get_chunk(key));
+			unsigned vix(0);
+
+			for (unsigned i = 0; i < tex_mod_map_t::CHUNK_PIXELS; ++i) {
+				if (mask[i >> 5] & (1U << (i & 31))) {chunk.vals[i] += vals[vix++];}
+			}
+		} // for n
+	}
+	else {
+		cerr << "Error: incorrect header found in terrain height mod map " << fn << "." << endl;
+		checked_fclose(fp);
+		return 0;
 	}
 	unsigned const bsz(read_binary_uint(fp));
 	brush_vect.resize(bsz);
@@ -288,13 +610,25 @@ bool tex_mod_map_manager_t::write_mod(string const &fn) const {
 		cerr << "Error opening terrain height mod map " << fn << " for write" << endl;
 		return 0;
 	}
-	write_binary_uint(fp, header_sig);
-	write_binary_uint(fp, mod_map.size());
-
-	for (tex_mod_map_t::const_iterator i = mod_map.begin(); i != mod_map.end(); ++i) {
-		mod_elem_t const elem(*i); // could use *i directly?
-		unsigned const elem_write(fwrite(&elem, sizeof(mod_elem_t), 1, fp)); // use a larger block?
-		assert(elem_write == 1); // add error checking?
+	write_binary_uint(fp, chunked_header_sig);
+	write_binary_uint(fp, tex_mod_map_t::CHUNK_SIZE);
+	write_binary_uint(fp, mod_map.get_chunks().size());
+	unsigned mask[MOD_CHUNK_MASK_WORDS];
+	hmap_val_t vals[tex_mod_map_t::CHUNK_PIXELS];
+
+	for (auto const &c : mod_map.get_chunks()) { // Note: chunks with all zero deltas are still written
+		unsigned num_vals(0);
+		for (unsigned w = 0; w < MOD_CHUNK_MASK_WORDS; ++w) {mask[w] = 0;}
+
+		for (unsigned i = 0; i < tex_mod_map_t::CHUNK_PIXELS; ++i) {
+			if (c.second.vals[i] == 0) continue; // unmodified
+			mask[i >> 5] |= (1U << (i & 31));
+			vals[num_vals++] = c.second.vals[i];
+		}
+		write_binary_uint(fp, c.first);
+		unsigned const mask_write(fwrite(mask, sizeof(unsigned), MOD_CHUNK_MASK_WORDS, fp));
+		unsigned const vals_write(fwrite(vals, sizeof(hmap_val_t), num_vals, fp));
+		assert(mask_write == MOD_CHUNK_MASK_WORDS && vals_write == num_vals); // add error checking?
 	}
 	write_binary_uint(fp, brush_vect.size());
 
@@ -315,25 +649,26 @@ bool terrain_hmap_manager_t::clamp_xy(int &x, int &y, float fract_x, float fract
 
 bool terrain_hmap_manager_t::clamp_no_scale(int &x, int &y, bool allow_wrap) const {
 
-	assert(hmap.width > 0 && hmap.height > 0);
-	x += hmap.width /2; // scale and offset (0,0) to texture center
-	y += hmap.height/2;
-	if (x >= 0 && y >= 0 && x < hmap.width && y < hmap.height) return 1; // nothing to do (optimization)
+	int const width(get_width()), height(get_height());
+	assert(width > 0 && height > 0);
+	x += width /2; // scale and offset (0,0) to texture center
+	y += height/2;
+	if (x >= 0 && y >= 0 && x < width && y < height) return 1; // nothing to do (optimization)
 	unsigned tex_edge_mode(TEX_EDGE_MODE);
 	if (!allow_wrap && tex_edge_mode == 2) {tex_edge_mode = 0;} // replace mirror with clamp
 
 	switch (tex_edge_mode) {
 	case 0: // clamp
-		x = max(0, min(hmap.width -1, x));
-		y = max(0, min(hmap.height-1, y));
+		x = max(0, min(width -1, x));
+		y = max(0, min(height-1, y));
 		break;
 	case 1: // cliff/underwater
 		return 0; // off the texture
 	case 2: // mirror
 		{
-			int const xmod(abs(x)%hmap.width), ymod(abs(y)%hmap.height), xdiv(x/hmap.width), ydiv(y/hmap.height);
-			x = ((xdiv & 1) ? (hmap.width  - xmod - 1) : xmod);
-			y = ((ydiv & 1) ? (hmap.height - ymod - 1) : ymod);
+			int const xmod(abs(x)%width), ymod(abs(y)%height), xdiv(x/width), ydiv(y/height);
+			x = ((xdiv & 1) ? (width  - xmod - 1) : xmod);
+			y = ((ydiv & 1) ? (height - ymod - 1) : ymod);
 		}
 		break;
 	}
@@ -344,7 +679,15 @@ void terrain_hmap_manager_t::load(char const *const fn, bool invert_y) {
 	assert(fn != nullptr);
 	cout << "Loading terrain heightmap file " << fn << endl;
 	timer_t timer("Heightmap Load");
-	assert(!hmap.is_allocated()); // can only call once
+	assert(!enabled()); // can only call once
+
+	if (is_tiled_hmap_fn(fn)) { // only the tile index is read here; erosion, etc. must be applied before conversion
+		if (!tiled_hmap.open(fn, tiled_hmap_cache_mb)) {exit(1);} // fatal
+		if (invert_y) {cerr << "Warning: invert_y is ignored for tiled heightmaps and must be applied before conversion" << endl;}
+		if (erosion_iters_tt > 0 || have_cities()) {cerr << "Warning: erosion and city generation are not supported for tiled heightmaps" << endl;}
+		post_load();
+		return;
+	}
 	hmap = heightmap_t(0, 7, 0, 0, fn, invert_y);
 	hmap.load(-1, 0, 1, 1);
 	timer.end();
@@ -364,6 +707,9 @@ void terrain_hmap_manager_t::proc_gen_heightmap(unsigned size) {
 
 void terrain_hmap_manager_t::post_load() {
 	if (!hmap_out_fn.empty()) {write_png(hmap_out_fn);}
+	if (tiled_hmap_out_fn.empty()) return;
+	if (tiled_hmap.is_open()) {cerr << "Error: write_tiled_heightmap " << tiled_hmap_out_fn << " is not supported when a tiled heightmap is loaded; skipping" << endl;}
+	else {tiled_heightmap_t::write(tiled_hmap_out_fn, hmap);}
 }
 
 bool terrain_hmap_manager_t::maybe_load(char const *const fn, bool invert_y) {
@@ -373,13 +719,14 @@ bool terrain_hmap_manager_t::maybe_load(char const *const fn, bool invert_y) {
 }
 
 void terrain_hmap_manager_t::write_png(std::string const &fn) const {
+	if (!hmap.is_allocated()) {cerr << "Error: can't write a tiled heightmap to PNG" << endl; return;}
 	timer_t timer("Heightmap PNG Write");
 	hmap.write_to_png(fn);
 }
 
 tex_mod_map_manager_t::hmap_val_t terrain_hmap_manager_t::get_clamped_pixel_value(int x, int y, bool allow_wrap) const {
 	if (!clamp_xy(x, y, allow_wrap)) return 0; // not sure what to do in this case - can we ever get here?
-	return hmap.get_pixel_value(x, y);
+	return (tiled_hmap.is_open() ? tiled_hmap.get_pixel_value(x, y) : hmap.get_pixel_value(x, y));
 }
 
 float terrain_hmap_manager_t::get_clamped_height(int x, int y) const { // translate so that (0,0) is in the center of the heightmap texture
@@ -406,18 +753,46 @@ float terrain_hmap_manager_t::get_nearest_height(float x, float y) const {
 	return (clamp_no_scale(xv, yv) ? get_raw_height(xv, yv) : scale_mh_texture_val(0.0));
 }
 
+// hashes the heights used for the area {x1,y1}-{x2,y2} in the index space of interpolate_height(), which includes mod map and brush edits
+uint32_t terrain_hmap_manager_t::hash_area(float x1, float y1, float x2, float y2) const {
+	assert(enabled());
+	int const px1(floor(mesh_scale*x1) - 1), py1(floor(mesh_scale*y1) - 1), px2(ceil(mesh_scale*x2) + 1), py2(ceil(mesh_scale*y2) + 1); // add a border for interpolation
+	vector<uint32_t> vals;
+	vals.reserve(max(0, (px2 - px1 + 1)*(py2 - py1 + 1)));
+
+	for (int y = py1; y <= py2; ++y) {
+		for (int x = px1; x <= px2; ++x) {
+			int xv(x), yv(y);
+			float const h(clamp_no_scale(xv, yv) ? get_raw_height(xv, yv) : 0.0f);
+			uint32_t hbits(0);
+			memcpy(&hbits, &h, sizeof(float));
+			vals.push_back(hbits);
+		}
+	}
+	return jenkins_one_at_a_time_hash(vals.data(), vals.size());
+}
+
 vector3d terrain_hmap_manager_t::get_norm(int x, int y) const {
 	float const h0(get_clamped_height(x, y));
 	return vector3d(DY_VAL*(h0 - get_clamped_height(x+1, y)), DX_VAL*(h0 - get_clamped_height(x, y+1)), dxdy).get_norm();
 }
 
+void terrain_hmap_manager_t::modify_pixel_value(unsigned x, unsigned y, int val, bool is_delta) {
+	if (tiled_hmap.is_open()) {tiled_hmap.modify_heightmap_value(x, y, val, is_delta);} else {hmap.modify_heightmap_value(x, y, val, is_delta);}
+}
+
+void terrain_hmap_manager_t::set_heightmap_value(unsigned x, unsigned y, float val) {
+	if (tiled_hmap.is_open()) {tiled_hmap.set_heightmap_value(x, y, val);} else {hmap.set_heightmap_value(x, y, val);}
+}
+
 void terrain_hmap_manager_t::modify_height(mod_elem_t const &elem, bool is_delta) {
-	assert((unsigned)max(hmap.width, hmap.height) <= max_tex_ix());
-	hmap.modify_heightmap_value(elem.x, elem.y, elem.delta, is_delta);
+	assert((unsigned)max(get_width(), get_height()) <= max_tex_ix());
+	modify_pixel_value(elem.x, elem.y, elem.delta, is_delta);
 }
 
 tex_mod_map_manager_t::hmap_val_t terrain_hmap_manager_t::scale_delta(float delta) const {
-	int const scale_factor(1 << (hmap.bytes_per_channel() << 3));
+	unsigned const bytes_per_channel(tiled_hmap.is_open() ? tiled_hmap.bytes_per_channel() : hmap.bytes_per_channel());
+	int const scale_factor(1 << (bytes_per_channel << 3));
 	return scale_factor*CLIP_TO_pm1(delta);
 }
 
@@ -428,11 +803,24 @@ bool terrain_hmap_manager_t::read_and_apply_mod(string const &fn) {
 	return 1;
 }
 
-void terrain_hmap_manager_t::apply_cur_mod_map() {
-	for (tex_mod_map_t::const_iterator i = mod_map.begin(); i != mod_map.end(); ++i) { // apply the mod to the current texture
-		assert(i->first.x < hmap.width && i->first.y < hmap.height); // ensure the mod values fit within the texture
-		hmap.modify_heightmap_value(i->first.x, i->first.y, i->second.val, 1); // no clamping
-	}
+void terrain_hmap_manager_t::apply_cur_mod_map() { // apply the mod to the current texture
+	tex_mod_map_t::chunk_map_t const &chunks(mod_map.get_chunks());
+	vector<tex_mod_map_t::chunk_map_t::const_iterator> chunk_its;
+	chunk_its.reserve(chunks.size());
+	for (auto i = chunks.begin(); i != chunks.end(); ++i) {chunk_its.push_back(i);}
+	int const width(get_width()), height(get_height());
+
+	get_job_system().parallel_for(chunk_its.size(), [&](unsigned n) { // chunks modify disjoint sets of pixels
+		tex_xy_t const llc(tex_mod_map_t::get_chunk_llc(chunk_its[n]->first));
+		tex_mod_map_t::chunk_t const &chunk(chunk_its[n]->second);
+
+		for (unsigned i = 0; i < tex_mod_map_t::CHUNK_PIXELS; ++i) {
+			if (chunk.vals[i] == 0) continue; // unmodified
+			int const x(llc.x + (i & (tex_mod_map_t::CHUNK_SIZE-1))), y(llc.y + (i >> tex_mod_map_t::CHUNK_BITS));
+			assert(x < width && y < height); // ensure the mod values fit within the texture
+			modify_pixel_value(x, y, chunk.vals[i], 1); // no clamping
+		}
+	});
 }
 
 void terrain_hmap_manager_t::apply_cur_brushes() { // apply the brushes to the current texture
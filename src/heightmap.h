@@ -4,6 +4,12 @@
 #pragma once
 
 #include "3DWorld.h"
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 
 float const HMAP_DETAIL_SCALE = 16.0;
 float const HMAP_DETAIL_MAG   = 0.01;
@@ -34,6 +40,60 @@ public:
 };
 
 
+// out-of-core heightmap for very large terrains: 16-bit values split into square tiles that are individually zlib compressed;
+// only the header and tile index are read on open, and tiles are read and decompressed on first access and cached with an LRU memory budget;
+// modified tiles that are evicted are compressed into a spill file next to the source file, which is never written
+class tiled_heightmap_t {
+public:
+	typedef unsigned short pixel_t;
+	typedef std::shared_ptr<vector<pixel_t>> p_tile_t;
+private:
+	struct file_tile_t {
+		uint64_t offset=0;
+		unsigned comp_size=0;
+		bool spilled=0; // offset and comp_size are in the spill file rather than the source file
+	};
+	struct cache_entry_t {
+		p_tile_t data;
+		unsigned last_used=0;
+		bool modified=0; // modified tiles are written to the spill file when evicted
+		bool busy=0; // being read or spilled by some thread without cache_mutex held; wait on tile_ready
+	};
+	mutable std::ifstream in;
+	mutable std::fstream spill;
+	mutable std::mutex cache_mutex, file_mutex; // file_mutex protects in, spill, and file_tiles
+	mutable std::condition_variable tile_ready;
+	mutable std::unordered_map<unsigned, cache_entry_t> cache;
+	mutable unsigned use_counter=0;
+	mutable vector<std::atomic<unsigned>> tile_gens; // incremented when a tile is evicted, which invalidates per-thread references to it
+	mutable vector<file_tile_t> file_tiles;
+	std::string spill_fn;
+	unsigned instance_id=0, tile_size=0, tiles_x=0, tiles_y=0, pixel_scale=1, max_cached_tiles=0;
+	int width=0, height=0;
+
+	p_tile_t read_tile(unsigned tile_ix) const;
+	void spill_tile(unsigned tile_ix, vector<pixel_t> const &data) const;
+	p_tile_t get_tile(unsigned tile_ix, bool mark_modified) const;
+	pixel_t const *get_tile_data(unsigned tile_ix) const;
+	unsigned get_tile_ix(unsigned x, unsigned y) const;
+	unsigned get_tile_offset(unsigned x, unsigned y) const {return ((y % tile_size)*tile_size + (x % tile_size));}
+public:
+	~tiled_heightmap_t() {close();}
+	bool open(std::string const &fn, unsigned cache_mb);
+	void close();
+	bool is_open() const {return !file_tiles.empty();}
+	int get_width () const {return width;}
+	int get_height() const {return height;}
+	unsigned bytes_per_channel() const {return ((pixel_scale == 1) ? 2U : 1U);} // of the source image
+	// pixel values are in the units of the source image so that brushes and mod maps work the same as with the original image
+	unsigned get_pixel_value(unsigned x, unsigned y) const {return (get_tile_data(get_tile_ix(x, y))[get_tile_offset(x, y)] + pixel_scale/2)/pixel_scale;}
+	float get_heightmap_value(unsigned x, unsigned y) const {return get_tile_data(get_tile_ix(x, y))[get_tile_offset(x, y)]/256.0f;} // returns values from 0 to 256
+	void modify_heightmap_value(unsigned x, unsigned y, int val, bool val_is_delta);
+	void set_heightmap_value(unsigned x, unsigned y, float val);
+	static bool write(std::string const &fn, heightmap_t const &hmap, unsigned tile_size=256);
+};
+
+
 class tex_mod_map_manager_t {
 public:
 	typedef unsigned short tex_ix_t;
@@ -48,21 +108,34 @@ public:
 		bool operator< (tex_xy_t const &t) const {return ((x == t.x) ? (y < t.y) : (x < t.x));}
 	};
 
-	struct mod_map_val_t {
-		hmap_val_t val;
-		mod_map_val_t(hmap_val_t v=0) : val(v) {} // init to zero
-	};
-
 	struct mod_elem_t : public tex_xy_t {
 		hmap_val_t delta;
 		mod_elem_t() : delta(0) {}
 		mod_elem_t(tex_ix_t x_, tex_ix_t y_, hmap_val_t d) : tex_xy_t(x_, y_), delta(d) {}
-		mod_elem_t(pair<tex_xy_t, mod_map_val_t> const &v) : tex_xy_t(v.first), delta(v.second.val) {}
 	};
 
-	struct tex_mod_map_t : public map<tex_xy_t, mod_map_val_t> { // for uniquing/combining modifications to the same xy point
+	// for uniquing/combining modifications to the same xy point; edits are spatially coherent, so deltas are stored in dense square chunks
+	// rather than one map node per point; a zero delta is treated as no modification
+	class tex_mod_map_t {
+	public:
+		static unsigned const CHUNK_BITS = 5, CHUNK_SIZE = (1 << CHUNK_BITS), CHUNK_PIXELS = CHUNK_SIZE*CHUNK_SIZE;
+		struct chunk_t {
+			hmap_val_t vals[CHUNK_PIXELS] = {}; // indexed by (y*CHUNK_SIZE + x) within the chunk
+		};
+		typedef std::unordered_map<unsigned, chunk_t> chunk_map_t; // key is {x_chunk, y_chunk} packed into 16 bits each
+	private:
+		chunk_map_t chunks;
+	public:
+		static unsigned get_key(tex_ix_t x, tex_ix_t y) {return (((x >> CHUNK_BITS) << 16) | (y >> CHUNK_BITS));}
+		static unsigned get_chunk_ix(tex_ix_t x, tex_ix_t y) {return (((y & (CHUNK_SIZE-1)) << CHUNK_BITS) + (x & (CHUNK_SIZE-1)));}
+		static tex_xy_t get_chunk_llc(unsigned key) {return tex_xy_t(tex_ix_t((key >> 16) << CHUNK_BITS), tex_ix_t((key & 0xFFFF) << CHUNK_BITS));}
 		// Note: this isn't entirely correct due to the clamping in the height texture update
-		void add(mod_elem_t const &elem) {operator[](elem).val += elem.delta;}
+		void add(mod_elem_t const &elem) {chunks[get_key(elem.x, elem.y)].vals[get_chunk_ix(elem.x, elem.y)] += elem.delta;}
+		void add(tex_mod_map_t const &mod);
+		void clear() {chunks.clear();}
+		bool empty() const {return chunks.empty();}
+		chunk_map_t const &get_chunks() const {return chunks;}
+		chunk_t &get_chunk(unsigned key) {return chunks[key];}
 	};
 
 	struct hmap_brush_t {
@@ -106,6 +179,12 @@ public:
 class terrain_hmap_manager_t : public tex_mod_map_manager_t {
 protected:
 	heightmap_t hmap;
+	tiled_heightmap_t tiled_hmap; // used in place of hmap when a tiled heightmap file is loaded
+
+	int get_width () const {return (tiled_hmap.is_open() ? tiled_hmap.get_width () : hmap.width );}
+	int get_height() const {return (tiled_hmap.is_open() ? tiled_hmap.get_height() : hmap.height);}
+	void modify_pixel_value(unsigned x, unsigned y, int val, bool is_delta);
+	void set_heightmap_value(unsigned x, unsigned y, float val);
 public:
 	void load(char const *const fn, bool invert_y=0);
 	void proc_gen_heightmap(unsigned size);
@@ -115,11 +194,12 @@ public:
 	bool clamp_xy(int &x, int &y, float fract_x=0.0, float fract_y=0.0, bool allow_wrap=1) const;
 	bool clamp_no_scale(int &x, int &y, bool allow_wrap=1) const;
 	hmap_val_t get_clamped_pixel_value(int x, int y, bool allow_wrap=1) const;
-	float get_raw_height(int x, int y) const {return scale_mh_texture_val(hmap.get_heightmap_value(x, y));}
+	float get_raw_height(int x, int y) const {return scale_mh_texture_val(tiled_hmap.is_open() ? tiled_hmap.get_heightmap_value(x, y) : hmap.get_heightmap_value(x, y));}
 	float get_clamped_height(int x, int y) const;
 	float interpolate_height(float x, float y) const;
 	float get_nearest_height(float x, float y) const;
 	vector3d get_norm(int x, int y) const;
+	uint32_t hash_area(float x1, float y1, float x2, float y2) const;
 
 	virtual bool modify_height_value(int x, int y, hmap_val_t val, bool is_delta, float fract_x=0.0, float fract_y=0.0, bool allow_wrap=1) { // unused
 		assert(fract_x == 0.0 && fract_y == 0.0);
@@ -131,7 +211,7 @@ public:
 	bool read_and_apply_mod(std::string const &fn);
 	void apply_cur_mod_map();
 	void apply_cur_brushes();
-	bool enabled() const {return hmap.is_allocated();}
+	bool enabled() const {return (hmap.is_allocated() || tiled_hmap.is_open());}
 	~terrain_hmap_manager_t() {hmap.free_data();}
 };
 
@@ -0,0 +1 @@
+#include "../dependencies/meshoptimizer/src/indexcodec.cpp"
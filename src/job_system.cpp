@@ -0,0 +1,180 @@
+// 3D World - Work-Stealing Job Scheduler
+
+#include "job_system.h"
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+
+using std::max;
+
+extern unsigned NUM_THREADS;
+
+unsigned const MAX_JOB_SLEEP_MS = 1; // bounds the wait when the only queued jobs can't be run by this thread
+
+thread_local int cur_worker_ix(-1); // -1 for non-worker threads
+
+
+void job_group_t::add_job(int pri) {
+	++num_pending;
+	int prev(max_pri);
+	while (pri > prev && !max_pri.compare_exchange_weak(prev, pri)) {}
+}
+
+void job_group_t::job_done() {
+	std::lock_guard<std::mutex> lock(mutex); // decrement under the lock so that the group can't be destroyed by a waiter before we notify
+	if (--num_pending == 0) {done_cv.notify_all();}
+}
+
+void job_group_t::wait() {
+	while (!is_done()) {
+		// help with jobs that are at least as important as the ones we're waiting on, so that a frame-critical wait doesn't run a light bake
+		if (get_job_system().run_one(max_pri)) continue;
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cv.wait_for(lock, std::chrono::milliseconds(MAX_JOB_SLEEP_MS), [&] {return is_done();});
+	}
+	std::lock_guard<std::mutex> lock(mutex); // wait for job_done() to release the lock
+	canceled = 0;
+	max_pri  = JOB_PRI_FRAME;
+}
+
+
+job_system_t::job_system_t(unsigned num_workers_) : num_workers(max(num_workers_, 1U)), num_queued(0), num_bkg_running(0) {
+	for (unsigned i = 0; i <= num_workers; ++i) {queues.emplace_back(new worker_queue_t);}
+	for (unsigned i = 0; i < num_workers; ++i) {threads.emplace_back(&job_system_t::worker_loop, this, i);} // never joined
+}
+
+job_handle_t job_system_t::create_job(std::function<void()> func, int priority, job_group_t *group) {
+	assert(priority >= 0 && priority < NUM_JOB_PRI);
+	return std::make_shared<job_t>(std::move(func), priority, group);
+}
+
+void job_system_t::add_dependency(job_handle_t const &job, job_handle_t const &prereq) {
+	assert(job && prereq && job != prereq);
+	std::lock_guard<std::mutex> lock(prereq->mutex);
+	if (prereq->done) return; // already finished
+	++job->num_blockers;
+	prereq->dependents.push_back(job);
+}
+
+void job_system_t::submit(job_handle_t const &job) {
+	assert(job);
+	if (job->group) {job->group->add_job(job->priority);}
+	if (--job->num_blockers == 0) {enqueue(job);} // else enqueued when the last prereq finishes
+}
+
+job_handle_t job_system_t::run_async(std::function<void()> func, int priority, job_group_t *group) {
+	job_handle_t job(create_job(std::move(func), priority, group));
+	submit(job);
+	return job;
+}
+
+void job_system_t::enqueue(job_handle_t const &job) {
+	worker_queue_t &q(*queues[(cur_worker_ix >= 0) ? cur_worker_ix : num_workers]);
+	{
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.jobs[job->priority].push_back(job);
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex); // prevent a lost wakeup between a worker's check and its wait
+		++num_queued;
+	}
+	work_cv.notify_one();
+}
+
+job_handle_t job_system_t::pop_job(unsigned qix, int pri, bool steal) {
+	worker_queue_t &q(*queues[qix]);
+	std::lock_guard<std::mutex> lock(q.mutex);
+	std::deque<job_handle_t> &jobs(q.jobs[pri]);
+	if (jobs.empty()) return nullptr;
+	job_handle_t job;
+	// the owner takes the most recently added job, which is likely still in the cache; others take the oldest, which tends to be the largest
+	if (steal) {job = std::move(jobs.front()); jobs.pop_front();}
+	else       {job = std::move(jobs.back ()); jobs.pop_back ();}
+	--num_queued;
+	return job;
+}
+
+job_handle_t job_system_t::find_job(int worker_ix, int max_pri) {
+	unsigned const num_queues(queues.size()), ext_qix(num_workers);
+
+	for (int pri = 0; pri <= max_pri; ++pri) { // higher priority jobs first, from any queue
+		bool const is_bkg(pri == JOB_PRI_BKG);
+
+		if (is_bkg) { // reserve a slot before taking the job so that workers racing for background jobs can't take the last free worker
+			unsigned const num_running(num_bkg_running++);
+			// a thread waiting on background jobs can always help with them
+			if (worker_ix >= 0 && num_workers > 1 && num_running + 1 >= num_workers) {--num_bkg_running; break;}
+		}
+		unsigned const own_qix((worker_ix >= 0) ? worker_ix : ext_qix);
+		job_handle_t job(pop_job(own_qix, pri, (own_qix == ext_qix))); // the external queue is FIFO
+		if (job) return job;
+
+		for (unsigned n = 1; n < num_queues; ++n) { // steal, starting with the next queue
+			unsigned const qix((own_qix + n) % num_queues);
+			job = pop_job(qix, pri, 1);
+			if (job) return job;
+		}
+		if (is_bkg) {--num_bkg_running;} // no job found; release the slot
+	} // for pri
+	return nullptr;
+}
+
+void job_system_t::run_job(job_handle_t const &job) { // job must come from find_job()
+	if (!(job->group && job->group->is_canceled())) {job->func();}
+	job->func = nullptr; // free any captured data
+	if (job->priority == JOB_PRI_BKG) {--num_bkg_running;} // release the slot reserved in find_job()
+	std::vector<job_handle_t> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = 1;
+		dependents.swap(job->dependents);
+	}
+	for (job_handle_t const &d : dependents) {
+		if (--d->num_blockers == 0) {enqueue(d);}
+	}
+	if (job->group) {job->group->job_done();} // must be last, since the group may be destroyed after this
+}
+
+bool job_system_t::run_one(int max_pri) {
+	job_handle_t const job(find_job(cur_worker_ix, max_pri));
+	if (!job) return 0;
+	run_job(job);
+	return 1;
+}
+
+void job_system_t::worker_loop(unsigned worker_ix) {
+	cur_worker_ix = worker_ix;
+
+	while (1) {
+		if (run_one(NUM_JOB_PRI-1)) continue;
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		// if there are queued jobs we can't take (background jobs at the limit), poll until a running one finishes
+		if (num_queued > 0) {work_cv.wait_for(lock, std::chrono::milliseconds(MAX_JOB_SLEEP_MS));}
+		else {work_cv.wait(lock, [&] {return (num_queued > 0);});}
+	} // end while
+}
+
+void job_system_t::parallel_for(unsigned num, std::function<void(unsigned)> const &func, int priority, unsigned max_jobs) {
+	if (num == 0) return;
+
+	if (num == 1 || max_jobs == 1) { // serial
+		for (unsigned i = 0; i < num; ++i) {func(i);}
+		return;
+	}
+	job_group_t group;
+	std::atomic<unsigned> next_ix(0);
+	unsigned num_jobs(std::min(num, num_workers+1)); // each job takes the next unclaimed index, which balances the load
+	if (max_jobs > 0) {num_jobs = std::min(num_jobs, max_jobs);}
+
+	for (unsigned n = 0; n < num_jobs; ++n) {
+		run_async([&] {for (unsigned i = next_ix++; i < num; i = next_ix++) {func(i);}}, priority, &group);
+	}
+	group.wait();
+}
+
+
+job_system_t &get_job_system() {
+	static job_system_t *job_system(new job_system_t(max(NUM_THREADS, 2U))); // never freed; at least one worker is kept free of background jobs
+	return *job_system;
+}
+
@@ -0,0 +1,88 @@
+// 3D World - Work-Stealing Job Scheduler
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+enum {JOB_PRI_FRAME=0, JOB_PRI_STREAM, JOB_PRI_BKG, NUM_JOB_PRI}; // frame-critical, streaming (tiles, textures), background (light bakes); lower runs first
+
+
+// a set of jobs that can be waited on or canceled together; must not be destroyed while it has pending jobs, so the destructor waits
+class job_group_t {
+	friend class job_system_t;
+	std::atomic<unsigned> num_pending;
+	std::atomic<int> max_pri;
+	std::atomic<bool> canceled;
+	std::mutex mutex;
+	std::condition_variable done_cv;
+
+	void add_job(int pri);
+	void job_done();
+public:
+	job_group_t() : num_pending(0), max_pri(JOB_PRI_FRAME), canceled(0) {}
+	job_group_t(job_group_t const &) = delete; // forbidden
+	void operator=(job_group_t const &) = delete; // forbidden
+	~job_group_t() {wait();}
+	bool is_done    () const {return (num_pending == 0);}
+	bool is_canceled() const {return canceled;} // may be polled by long running jobs
+	void cancel() {canceled = 1;} // jobs that haven't started yet are skipped
+	void wait(); // runs other queued jobs while waiting; clears the canceled state when done
+};
+
+
+struct job_t {
+	std::function<void()> func;
+	job_group_t *group;
+	int priority;
+	std::atomic<unsigned> num_blockers; // unfinished prerequisite jobs, plus one until submitted
+	std::mutex mutex; // protects dependents and done
+	std::vector<std::shared_ptr<job_t>> dependents;
+	bool done=0;
+
+	job_t(std::function<void()> &&func_, int priority_, job_group_t *group_) : func(std::move(func_)), group(group_), priority(priority_), num_blockers(1) {}
+};
+typedef std::shared_ptr<job_t> job_handle_t;
+
+
+// persistent worker threads, each with one deque per priority; a worker pushes and pops its own jobs at the back and steals from the front of other
+// workers' deques when it runs out; a thread waiting on a job group also runs jobs; background jobs never take the last free worker
+class job_system_t {
+	struct worker_queue_t {
+		std::mutex mutex;
+		std::deque<job_handle_t> jobs[NUM_JOB_PRI];
+	};
+	unsigned num_workers;
+	std::vector<std::unique_ptr<worker_queue_t>> queues; // one per worker, plus one for jobs submitted from other threads
+	std::vector<std::thread> threads;
+	std::mutex sleep_mutex;
+	std::condition_variable work_cv;
+	std::atomic<unsigned> num_queued, num_bkg_running;
+
+	void enqueue(job_handle_t const &job);
+	job_handle_t pop_job(unsigned qix, int pri, bool steal);
+	job_handle_t find_job(int worker_ix, int max_pri);
+	void run_job(job_handle_t const &job);
+	void worker_loop(unsigned worker_ix);
+public:
+	job_system_t(unsigned num_workers_);
+	job_system_t(job_system_t const &) = delete; // forbidden
+	void operator=(job_system_t const &) = delete; // forbidden
+	unsigned get_num_workers() const {return num_workers;}
+	job_handle_t create_job(std::function<void()> func, int priority, job_group_t *group=nullptr);
+	void add_dependency(job_handle_t const &job, job_handle_t const &prereq); // job runs after prereq finishes; must be called before submit(job)
+	void submit(job_handle_t const &job);
+	job_handle_t run_async(std::function<void()> func, int priority, job_group_t *group=nullptr);
+	bool run_one(int max_pri); // runs one queued job with priority <= max_pri from the calling thread; returns false if there were none
+	// calls func(i) for i in [0, num) and waits; at most max_jobs threads (including the caller) are used, or all workers if zero
+	void parallel_for(unsigned num, std::function<void(unsigned)> const &func, int priority=JOB_PRI_FRAME, unsigned max_jobs=0);
+};
+
+job_system_t &get_job_system(); // created on first use with NUM_THREADS workers
+
+
@@ -33,6 +33,8 @@ class mesh_xy_grid_cache_t {
 
 	void run_gpu_simplex();
 	void cache_gpu_simplex_vals();
+	void cache_sine_vals();
+	void cache_noise_vals();
 public:
 	~mesh_xy_grid_cache_t() {clear_context();}
 	bool build_arrays(float x0, float y0, float dx, float dy, unsigned nx, unsigned ny, bool cache_values=0, bool force_sine_mode=0, bool no_wait=0);
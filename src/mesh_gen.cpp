@@ -8,8 +8,22 @@
 #include "sinf.h"
 #include "heightmap.h"
 #include "shaders.h"
+#include "job_system.h"
 #include <glm/gtc/noise.hpp>
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MESH_GEN_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET // MSVC allows AVX2 intrinsics without a special target, and doesn't contract them into FMAs
+#define AVX2_NO_FMA_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX2_NO_FMA_TARGET __attribute__((target("avx2"))) // prevents the compiler from contracting mul+add into FMA, for exact results
+#endif
+#endif
+
 
 int      const NUM_FREQ_COMP      = 9;
 float    const MESH_SCALE_Z_EXP   = 0.7;
@@ -25,6 +39,7 @@ bool     const AUTOSCALE_HEIGHT   = 1;
 bool     const DEF_GLACIATE       = 1;
 float    const DEF_GLACIATE_EXP   = 3.0;
 bool     const GEN_SCROLLING_MESH = 1;
+bool     const BENCHMARK_CPU_NOISE = 0; // compares the row and scalar CPU noise evaluation times for each cached grid (single threaded)
 float    const S_GEN_ATTEN_DIST   = 128.0;
 
 int   const F_TABLE_SIZE = NUM_FREQ_COMP*N_RAND_SIN2;
@@ -585,6 +600,122 @@ void gen_rx_ry(float &rx, float &ry) {
 	ry = rgen.rand_float() + 1.0;
 }
 
+// sine table grid evaluation: vals[y*nx + x] = sum(xterms[x*F + k]*yterms[y*F + k]) for k in [start_ix, F) is a small (ny x F)*(F x nx) matrix product;
+// the x terms are transposed to k-major order so that each row can be accumulated across contiguous x values, in the same k order as eval_index()
+unsigned const SINE_GRID_ROWS = 4, SINE_GRID_COLS = 16; // block size for the AVX2 kernel: 4 rows x 2 vectors = 8 accumulators
+
+void eval_sine_grid_rows_scalar(float const *xt, unsigned xt_stride, float const *yterms, unsigned nx, unsigned y_start, unsigned y_end, int start_ix, float *vals) {
+	for (unsigned y = y_start; y < y_end; ++y) {
+		float const *const yptr(yterms + y*F_TABLE_SIZE);
+		float *const row(vals + y*nx);
+		for (unsigned x = 0; x < nx; ++x) {row[x] = 0.0;}
+
+		for (int k = start_ix; k < F_TABLE_SIZE; ++k) {
+			float const yval(yptr[k]);
+			float const *const xk(xt + k*xt_stride);
+			for (unsigned x = 0; x < nx; ++x) {row[x] += yval*xk[x];} // vectorized by the compiler
+		}
+	}
+}
+
+#ifdef MESH_GEN_AVX2
+bool cpu_supports_avx2() {
+#ifdef _MSC_VER
+	int info[4] = {};
+	__cpuid(info, 0);
+	if (info[0] < 7) return 0;
+	__cpuid(info, 1);
+	bool const has_fma((info[2] & (1<<12)) != 0), has_osxsave((info[2] & (1<<27)) != 0);
+	if (!has_fma || !has_osxsave || (_xgetbv(0) & 6) != 6) return 0; // OS must save YMM registers
+	__cpuidex(info, 7, 0);
+	return ((info[1] & (1<<5)) != 0);
+#else
+	__builtin_cpu_init();
+	return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+#endif
+}
+
+template<unsigned NUM_ROWS> AVX2_TARGET void eval_sine_grid_block_avx2(float const *xt, unsigned xt_stride, float const *yptr, unsigned nx, int start_ix, float *vals) {
+	for (unsigned x = 0; x < nx; x += SINE_GRID_COLS) { // xt is zero padded to a multiple of SINE_GRID_COLS
+		__m256 acc[NUM_ROWS][2];
+		for (unsigned r = 0; r < NUM_ROWS; ++r) {acc[r][0] = acc[r][1] = _mm256_setzero_ps();}
+
+		for (int k = start_ix; k < F_TABLE_SIZE; ++k) {
+			float const *const xk(xt + k*xt_stride + x);
+			__m256 const xv0(_mm256_loadu_ps(xk)), xv1(_mm256_loadu_ps(xk + 8));
+
+			for (unsigned r = 0; r < NUM_ROWS; ++r) {
+				__m256 const yv(_mm256_broadcast_ss(yptr + r*F_TABLE_SIZE + k));
+				acc[r][0] = _mm256_fmadd_ps(yv, xv0, acc[r][0]);
+				acc[r][1] = _mm256_fmadd_ps(yv, xv1, acc[r][1]);
+			}
+		}
+		for (unsigned r = 0; r < NUM_ROWS; ++r) {
+			float *const out(vals + r*nx + x);
+
+			if (x + SINE_GRID_COLS <= nx) {
+				_mm256_storeu_ps(out, acc[r][0]);
+				_mm256_storeu_ps(out + 8, acc[r][1]);
+			}
+			else { // partial block at the end of the row
+				float tmp[SINE_GRID_COLS];
+				_mm256_storeu_ps(tmp, acc[r][0]);
+				_mm256_storeu_ps(tmp + 8, acc[r][1]);
+				for (unsigned i = 0; i < nx - x; ++i) {out[i] = tmp[i];}
+			}
+		} // for r
+	} // for x
+}
+
+AVX2_TARGET void eval_sine_grid_rows_avx2(float const *xt, unsigned xt_stride, float const *yterms, unsigned nx, unsigned y_start, unsigned y_end, int start_ix, float *vals) {
+	assert((xt_stride % SINE_GRID_COLS) == 0);
+	unsigned y(y_start);
+
+	for (; y + SINE_GRID_ROWS <= y_end; y += SINE_GRID_ROWS) {
+		eval_sine_grid_block_avx2<SINE_GRID_ROWS>(xt, xt_stride, yterms + y*F_TABLE_SIZE, nx, start_ix, vals + y*nx);
+	}
+	// remaining rows use the same kernel with fewer rows, so that every row gets the same FMA results as it would in a full block
+	float const *const yptr(yterms + y*F_TABLE_SIZE);
+
+	switch (y_end - y) {
+	case 0: break;
+	case 1: eval_sine_grid_block_avx2<1>(xt, xt_stride, yptr, nx, start_ix, vals + y*nx); break;
+	case 2: eval_sine_grid_block_avx2<2>(xt, xt_stride, yptr, nx, start_ix, vals + y*nx); break;
+	case 3: eval_sine_grid_block_avx2<3>(xt, xt_stride, yptr, nx, start_ix, vals + y*nx); break;
+	default: assert(0);
+	}
+}
+#endif
+
+void eval_sine_grid(float const *xterms, float const *yterms, unsigned nx, unsigned ny, int start_ix, float *vals) {
+	unsigned const xt_stride(SINE_GRID_COLS*((nx + SINE_GRID_COLS - 1)/SINE_GRID_COLS));
+	vector<float> xt(F_TABLE_SIZE*xt_stride, 0.0); // k-major x terms, zero padded
+	
+	for (unsigned x = 0; x < nx; ++x) {
+		for (int k = start_ix; k < F_TABLE_SIZE; ++k) {xt[k*xt_stride + x] = xterms[x*F_TABLE_SIZE + k];}
+	}
+#ifdef MESH_GEN_AVX2
+	static bool const use_avx2(cpu_supports_avx2());
+#endif
+	unsigned const num_blocks((ny + SINE_GRID_ROWS - 1)/SINE_GRID_ROWS);
+
+	get_job_system().parallel_for(num_blocks, [&](unsigned b) {
+		unsigned const y_start(b*SINE_GRID_ROWS), y_end(min(ny, y_start+SINE_GRID_ROWS));
+#ifdef MESH_GEN_AVX2
+		if (use_avx2) {eval_sine_grid_rows_avx2(xt.data(), xt_stride, yterms, nx, y_start, y_end, start_ix, vals); return;}
+#endif
+		eval_sine_grid_rows_scalar(xt.data(), xt_stride, yterms, nx, y_start, y_end, start_ix, vals);
+	});
+}
+
+void mesh_xy_grid_cache_t::cache_sine_vals() { // same as eval_index(x, y, 0, 0) for every x and y up to float rounding (the AVX2 path uses FMA), but much faster
+
+	assert(gen_mode == MGEN_SINE);
+	cached_vals.resize(cur_nx*cur_ny);
+	eval_sine_grid(xyterms.data(), (xyterms.data() + yterms_start), cur_nx, cur_ny, start_eval_sin, cached_vals.data());
+	for (float &v : cached_vals) {apply_noise_shape_final(v, gen_shape);}
+}
+
 bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy, unsigned nx, unsigned ny, bool cache_values, bool force_sine_mode, bool no_wait) {
 	assert(nx > 0 && ny > 0);
 	assert(start_eval_sin <= F_TABLE_SIZE);
@@ -624,15 +755,8 @@ bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy,
 			}
 		}
 	}
-	if (cache_values) {
-		cached_vals.resize(cur_nx*cur_ny);
-		
-#pragma omp parallel for schedule(static,1)
-		for (int y = 0; y < (int)cur_ny; ++y) {
-			for (unsigned x = 0; x < cur_nx; ++x) {
-				cached_vals[y*cur_nx + x] = eval_index(x, y, 0, 0); // Note: no glaciate, min_start_sin=0, use_cache=0
-			}
-		}
+	if (cache_values) { // GPU modes have already returned
+		if (gen_mode == MGEN_SINE) {cache_sine_vals();} else {cache_noise_vals();}
 	}
 	return 1; // results are available
 }
@@ -703,21 +827,33 @@ void mesh_xy_grid_cache_t::free_cshader() { // don't make any GPU calls - hard r
 }
 
 
+#ifdef _MSC_VER
+// the project uses /fp:fast with /arch:AVX2, which allows the scalar noise code to be contracted into FMAs; use strict FP for the noise functions
+// so that the scalar and 8-wide noise paths produce the same values
+#pragma float_control(precise, on, push)
+#pragma fp_contract(off)
+#endif
+
+// Note: constants in the noise functions are floats to match the GPU shaders (simplex_noise.part), and the 8-wide versions below
+bool is_simplex_mode(int mode) {return (mode == MGEN_SIMPLEX || mode == MGEN_SIMPLEX_GPU || mode == MGEN_DWARP_GPU);}
+unsigned get_noise_end_octave() {return (NUM_FREQ_COMP - start_eval_sin/N_RAND_SIN2);}
+float const NOISE_LACUNARITY(1.92), NOISE_GAIN(0.5), DWARP_SCALE(0.2);
+
 float gen_noise(float xv, float yv, int mode, int shape) {
 
 	float zval(0.0), mag(1.0), freq(1.0), rx, ry;
-	unsigned const end_octave(NUM_FREQ_COMP - start_eval_sin/N_RAND_SIN2);
-	float const lacunarity(1.92), gain(0.5);
+	unsigned const end_octave(get_noise_end_octave());
+	float const lacunarity(NOISE_LACUNARITY), gain(NOISE_GAIN);
 	gen_rx_ry(rx, ry);
 
 	//#pragma omp parallel for schedule(static,1)
 	for (unsigned i = 0; i < end_octave; ++i) {
 		glm::vec2 const pos((freq*xv + rx), (freq*yv + ry));
-		float noise((mode == MGEN_SIMPLEX || mode == MGEN_SIMPLEX_GPU || mode == MGEN_DWARP_GPU) ? glm::simplex(pos) : glm::perlin(pos));
+		float noise(is_simplex_mode(mode) ? glm::simplex(pos) : glm::perlin(pos));
 		switch (shape) {
 		case 0: break; // linear - do nothing
-		case 1: noise = fabs(noise) - 0.40; break; // billowy
-		case 2: noise = 0.45 - fabs(noise); break; // ridged
+		case 1: noise = fabs(noise) - 0.40f; break; // billowy
+		case 2: noise = 0.45f - fabs(noise); break; // ridged
 		//abs(0.5-abs(noise)*2.0)*2.0-0.5
 		}
 		zval += mag*noise;
@@ -738,11 +874,11 @@ float get_noise_zval(float xval, float yval, int mode, int shape) {
 	float xv(xy_scale*xval), yv(xy_scale*yval);
 
 	if (mode == MGEN_DWARP_GPU) { // domain warping
-		float const scale(0.2);
-		float const dx1(gen_noise(xv+0.0, yv+0.0, mode, shape));
-		float const dy1(gen_noise(xv+5.2, yv+1.3, mode, shape));
-		float const dx2(gen_noise((xv + scale*dx1 + 1.7), (yv + scale*dy1 + 9.2), mode, shape));
-		float const dy2(gen_noise((xv + scale*dx1 + 8.3), (yv + scale*dy1 + 2.8), mode, shape));
+		float const scale(DWARP_SCALE);
+		float const dx1(gen_noise(xv, yv, mode, shape));
+		float const dy1(gen_noise(xv+5.2f, yv+1.3f, mode, shape));
+		float const dx2(gen_noise((xv + scale*dx1 + 1.7f), (yv + scale*dy1 + 9.2f), mode, shape));
+		float const dy2(gen_noise((xv + scale*dx1 + 8.3f), (yv + scale*dy1 + 2.8f), mode, shape));
 		xv += scale*dx2; yv += scale*dy2;
 	}
 	float zval(gen_noise(xv, yv, mode, shape));
@@ -750,6 +886,169 @@ float get_noise_zval(float xval, float yval, int mode, int shape) {
 	return zval*get_hmap_scale(mode);
 }
 
+#ifdef MESH_GEN_AVX2
+// 8-wide versions of glm::simplex(vec2), glm::perlin(vec2), and gen_noise(); these use the same sequence of float operations
+// with no FMAs, so they produce bit identical values to the scalar versions; they use the same formulas as the GPU shaders,
+// but GPU results can differ slightly due to FMA contraction and rounding
+#define NOISE8 static inline AVX2_NO_FMA_TARGET __m256
+NOISE8 set8  (float v) {return _mm256_set1_ps(v);}
+NOISE8 add8  (__m256 a, __m256 b) {return _mm256_add_ps(a, b);}
+NOISE8 sub8  (__m256 a, __m256 b) {return _mm256_sub_ps(a, b);}
+NOISE8 mul8  (__m256 a, __m256 b) {return _mm256_mul_ps(a, b);}
+NOISE8 floor8(__m256 a) {return _mm256_floor_ps(a);}
+NOISE8 fract8(__m256 a) {return sub8(a, floor8(a));}
+NOISE8 abs8  (__m256 a) {return _mm256_andnot_ps(set8(-0.0f), a);}
+NOISE8 mod8  (__m256 a, float b) {return sub8(a, mul8(set8(b), floor8(_mm256_div_ps(a, set8(b)))));} // glm::mod()
+NOISE8 mod289_8 (__m256 x) {return sub8(x, mul8(floor8(mul8(x, set8(1.0f/289.0f))), set8(289.0f)));}
+NOISE8 permute8 (__m256 x) {return mod289_8(mul8(add8(mul8(x, set8(34.0f)), set8(1.0f)), x));}
+NOISE8 mix8  (__m256 x, __m256 y, __m256 a) {return add8(x, mul8(a, sub8(y, x)));}
+NOISE8 dot2_8(__m256 ax, __m256 ay, __m256 bx, __m256 by) {return add8(mul8(ax, bx), mul8(ay, by));}
+
+NOISE8 simplex8(__m256 vx, __m256 vy) {
+	__m256 const c0(set8(0.211324865405187f)), c1(set8(0.366025403784439f)), c2(set8(-0.577350269189626f)), cw(set8(0.024390243902439f));
+	__m256 const one(set8(1.0f)), half(set8(0.5f));
+	// first corner
+	__m256 const s(dot2_8(vx, vy, c1, c1));
+	__m256 ix(floor8(add8(vx, s))), iy(floor8(add8(vy, s)));
+	__m256 const t(dot2_8(ix, iy, c0, c0));
+	__m256 const x0x(add8(sub8(vx, ix), t)), x0y(add8(sub8(vy, iy), t));
+	// other corners
+	__m256 const i1_is_x(_mm256_cmp_ps(x0x, x0y, _CMP_GT_OQ));
+	__m256 const i1x(_mm256_and_ps(i1_is_x, one)), i1y(_mm256_andnot_ps(i1_is_x, one));
+	__m256 const x1x(sub8(add8(x0x, c0), i1x)), x1y(sub8(add8(x0y, c0), i1y)), x2x(add8(x0x, c2)), x2y(add8(x0y, c2));
+	// permutations
+	ix = mod8(ix, 289.0f);
+	iy = mod8(iy, 289.0f);
+	__m256 const p[3] = {permute8(add8(add8(permute8(iy), ix), _mm256_setzero_ps())),
+		                 permute8(add8(add8(permute8(add8(iy, i1y)), ix), i1x)),
+		                 permute8(add8(add8(permute8(add8(iy, one)), ix), one))};
+	__m256 const cx[3] = {x0x, x1x, x2x}, cy[3] = {x0y, x1y, x2y};
+	__m256 sum(_mm256_setzero_ps());
+
+	for (unsigned c = 0; c < 3; ++c) { // gradients: 41 points uniformly over a line, mapped onto a diamond
+		__m256 m(_mm256_max_ps(sub8(half, dot2_8(cx[c], cy[c], cx[c], cy[c])), _mm256_setzero_ps()));
+		m = mul8(m, m);
+		m = mul8(m, m);
+		__m256 const x(sub8(mul8(set8(2.0f), fract8(mul8(p[c], cw))), one));
+		__m256 const h(sub8(abs8(x), half)), a0(sub8(x, floor8(add8(x, half))));
+		m = mul8(m, sub8(set8(1.79284291400159f), mul8(set8(0.85373472095314f), dot2_8(a0, h, a0, h))));
+		__m256 const g(dot2_8(a0, h, cx[c], cy[c]));
+		sum = ((c == 0) ? mul8(m, g) : add8(sum, mul8(m, g)));
+	}
+	return mul8(set8(130.0f), sum);
+}
+
+NOISE8 fade8(__m256 t) {return mul8(mul8(mul8(t, t), t), add8(mul8(t, sub8(mul8(t, set8(6.0f)), set8(15.0f))), set8(10.0f)));}
+
+NOISE8 perlin8(__m256 vx, __m256 vy) {
+	__m256 const one(set8(1.0f)), half(set8(0.5f));
+	__m256 const fx0(fract8(vx)), fy0(fract8(vy)), fx1(sub8(fx0, one)), fy1(sub8(fy0, one));
+	__m256 const ix0(mod8(floor8(vx), 289.0f)), iy0(mod8(floor8(vy), 289.0f)), ix1(mod8(add8(floor8(vx), one), 289.0f)), iy1(mod8(add8(floor8(vy), one), 289.0f));
+	__m256 const cix[4] = {ix0, ix1, ix0, ix1}, ciy[4] = {iy0, iy0, iy1, iy1}, cfx[4] = {fx0, fx1, fx0, fx1}, cfy[4] = {fy0, fy0, fy1, fy1}; // 00, 10, 01, 11
+	__m256 n[4];
+
+	for (unsigned c = 0; c < 4; ++c) {
+		__m256 const i(permute8(add8(permute8(cix[c]), ciy[c])));
+		__m256 gx(sub8(mul8(set8(2.0f), fract8(_mm256_div_ps(i, set8(41.0f)))), one));
+		__m256 const gy(sub8(abs8(gx), half));
+		gx = sub8(gx, floor8(add8(gx, half)));
+		__m256 const norm(sub8(set8(1.79284291400159f), mul8(set8(0.85373472095314f), dot2_8(gx, gy, gx, gy))));
+		n[c] = dot2_8(mul8(gx, norm), mul8(gy, norm), cfx[c], cfy[c]);
+	}
+	__m256 const fade_x(fade8(fx0)), fade_y(fade8(fy0));
+	return mul8(set8(2.3f), mix8(mix8(n[0], n[1], fade_x), mix8(n[2], n[3], fade_x), fade_y));
+}
+
+NOISE8 gen_noise8(__m256 xv, __m256 yv, bool simplex, int shape, float rx, float ry, unsigned end_octave) {
+	__m256 zval(_mm256_setzero_ps());
+	float mag(1.0), freq(1.0);
+
+	for (unsigned i = 0; i < end_octave; ++i) {
+		__m256 const px(add8(mul8(set8(freq), xv), set8(rx))), py(add8(mul8(set8(freq), yv), set8(ry)));
+		__m256 noise(simplex ? simplex8(px, py) : perlin8(px, py));
+		if      (shape == 1) {noise = sub8(abs8(noise), set8(0.40f));} // billowy
+		else if (shape == 2) {noise = sub8(set8(0.45f), abs8(noise));} // ridged
+		zval  = ((i == 0) ? mul8(set8(mag), noise) : add8(zval, mul8(set8(mag), noise)));
+		mag  *= NOISE_GAIN;
+		freq *= NOISE_LACUNARITY;
+		rx   *= 1.5;
+		ry   *= 1.5;
+	}
+	return zval;
+}
+#undef NOISE8
+
+AVX2_NO_FMA_TARGET void get_noise_zvals_avx2(float const *xvals, float yval, unsigned num, int mode, int shape, float *zvals) {
+	float const xy_scale(MESH_SCALE_FACTOR*mesh_scale), zscale(get_hmap_scale(mode));
+	unsigned const end_octave(get_noise_end_octave());
+	bool const simplex(is_simplex_mode(mode));
+	float rx, ry;
+	gen_rx_ry(rx, ry);
+	__m256 const yv(set8(xy_scale*yval)), scale(set8(DWARP_SCALE));
+
+	for (unsigned i = 0; i < num; i += 8) {
+		float xin[8] = {}, zout[8];
+		unsigned const n(min(8U, num - i));
+		for (unsigned j = 0; j < n; ++j) {xin[j] = xy_scale*xvals[i+j];}
+		__m256 xv(_mm256_loadu_ps(xin)), yv2(yv);
+
+		if (mode == MGEN_DWARP_GPU) { // domain warping
+			__m256 const dx1(gen_noise8(xv, yv2, simplex, shape, rx, ry, end_octave));
+			__m256 const dy1(gen_noise8(add8(xv, set8(5.2f)), add8(yv2, set8(1.3f)), simplex, shape, rx, ry, end_octave));
+			__m256 const wx(add8(xv, mul8(scale, dx1))), wy(add8(yv2, mul8(scale, dy1)));
+			__m256 const dx2(gen_noise8(add8(wx, set8(1.7f)), add8(wy, set8(9.2f)), simplex, shape, rx, ry, end_octave));
+			__m256 const dy2(gen_noise8(add8(wx, set8(8.3f)), add8(wy, set8(2.8f)), simplex, shape, rx, ry, end_octave));
+			xv  = add8(xv,  mul8(scale, dx2));
+			yv2 = add8(yv2, mul8(scale, dy2));
+		}
+		_mm256_storeu_ps(zout, gen_noise8(xv, yv2, simplex, shape, rx, ry, end_octave));
+
+		for (unsigned j = 0; j < n; ++j) {
+			postproc_noise_zval(zout[j]);
+			zvals[i+j] = zout[j]*zscale;
+		}
+	}
+}
+#endif
+
+// evaluates get_noise_zval(xvals[i], yval, mode, shape) for a row of points, 8 at a time when supported
+void get_noise_zvals(float const *xvals, float yval, unsigned num, int mode, int shape, float *zvals) {
+#ifdef MESH_GEN_AVX2
+	static bool const use_avx2(cpu_supports_avx2());
+	if (use_avx2) {get_noise_zvals_avx2(xvals, yval, num, mode, shape, zvals); return;}
+#endif
+	for (unsigned i = 0; i < num; ++i) {zvals[i] = get_noise_zval(xvals[i], yval, mode, shape);}
+}
+
+void mesh_xy_grid_cache_t::cache_noise_vals() { // same results as eval_index(x, y, 0, 0) for every x and y in CPU noise modes
+
+	assert(gen_mode != MGEN_SINE && gen_mode < MGEN_SIMPLEX_GPU);
+	cached_vals.resize(cur_nx*cur_ny);
+	vector<float> xvals(cur_nx);
+	for (unsigned x = 0; x < cur_nx; ++x) {xvals[x] = (x*mdx + mx0)*DX_VAL_INV;}
+
+	if (BENCHMARK_CPU_NOISE) {
+		int const start_time(GET_TIME_MS());
+		for (unsigned y = 0; y < cur_ny; ++y) {get_noise_zvals(xvals.data(), (y*mdy + my0)*DY_VAL_INV, cur_nx, gen_mode, gen_shape, &cached_vals[y*cur_nx]);}
+		int const mid_time(GET_TIME_MS());
+		float max_err(0.0);
+
+		for (unsigned y = 0; y < cur_ny; ++y) {
+			for (unsigned x = 0; x < cur_nx; ++x) {max_err = max(max_err, fabs(cached_vals[y*cur_nx + x] - eval_index(x, y, 0, 0)));}
+		}
+		cout << "CPU noise " << cur_nx << "x" << cur_ny << ": row: " << (mid_time - start_time) << "ms, scalar: " << (GET_TIME_MS() - mid_time) << "ms, max error: " << max_err << endl;
+		return;
+	}
+	get_job_system().parallel_for(cur_ny, [&](unsigned y) {
+		get_noise_zvals(xvals.data(), (y*mdy + my0)*DY_VAL_INV, cur_nx, gen_mode, gen_shape, &cached_vals[y*cur_nx]);
+	});
+}
+
+#ifdef _MSC_VER
+#pragma fp_contract(on)
+#pragma float_control(pop) // end of strict FP noise functions
+#endif
+
 
 float mesh_xy_grid_cache_t::eval_index(unsigned x, unsigned y, int min_start_sin, bool use_cache) const {
 
@@ -13,9 +13,19 @@
 #include "meshoptimizer.h"
 #include "format_text.h"
 #include "binary_file_io.h"
+#include "job_system.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 
+#ifdef _WIN32
+#include <windows.h> // for CreateFileMapping()/MapViewOfFile()
+#else // linux
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 bool const ENABLE_BUMP_MAPS  = 1;
 bool const ENABLE_SPEC_MAPS  = 1;
 bool const ENABLE_INTER_REFLECTIONS = 1;
@@ -24,11 +34,18 @@ bool const ENABLE_ANIMATION_SHADOWS = 1;
 bool const USE_ANIM_MODEL_TANGENTS  = 1;
 unsigned const MAGIC_NUMBER      = 42987143; // arbitrary file signature; no   animations
 unsigned const MAGIC_NUMBER_ANIM = 42987144; // arbitrary file signature; with animations
+unsigned const MAGIC_NUMBER_V2      = 42987147; // v2 format with mappable vertex/index data, precomputed blocks, and optional collision BVH; no   animations
+unsigned const MAGIC_NUMBER_V2_ANIM = 42987148; // v2 format with mappable vertex/index data, precomputed blocks, and optional collision BVH; with animations
+unsigned const MODEL3D_PAGE_SIZE = 4096; // alignment of the data section in v2 files
+unsigned const MODEL3D_DATA_ALIGN= 16;   // alignment of each array in the data section
 unsigned const BLOCK_SIZE        = 32768; // in vertex indices
 unsigned const BONE_IDS_LOC      = 4;
 unsigned const BONE_WEIGHTS_LOC  = 5;
+bool const VERIFY_MODEL3D_FILE_DATA = 0; // recompute the bounding volumes and blocks read from v2 model3d files and compare them; for debugging
 
 bool model_calc_tan_vect(1); // slower and more memory but sometimes better quality/smoother transitions
+bool compress_model3d_files(0); // use meshoptimizer vertex/index codecs when writing model3d files; smaller files, but slower to read and can't be mapped
+bool write_model3d_coll_tree(0); // build the collision BVH when writing model3d files if it hasn't been built yet, so that it can be read rather than built on first use
 
 extern bool group_back_face_cull, enable_model3d_tex_comp, disable_shader_effects, texture_alpha_in_red_comp, use_model3d_tex_mipmaps, enable_model3d_bump_maps;
 extern bool two_sided_lighting, have_indir_smoke_tex, use_core_context, model3d_wn_normal, invert_model_nmap_bscale, use_z_prepass, all_model3d_ref_update;
@@ -180,8 +197,7 @@ void texture_manager::add_work_item(int tid, bool is_nm) {
 void texture_manager::load_work_items_mt() {
 	if (to_load.empty()) return; // nothing to do
 	sort_and_unique(to_load);
-#pragma omp parallel for schedule(dynamic)
-	for (int i = 0; i < (int)to_load.size(); ++i) {ensure_texture_loaded(to_load[i].tid, to_load[i].is_nm);}
+	get_job_system().parallel_for(to_load.size(), [&](unsigned i) {ensure_texture_loaded(to_load[i].tid, to_load[i].is_nm);}, JOB_PRI_STREAM);
 	to_load.clear();
 }
 
@@ -222,28 +238,48 @@ template<typename T> void vntc_vect_t<T>::clear() {
 	
 	clear_vbos();
 	vector<T>::clear();
+	mapped_verts     = nullptr;
+	num_mapped_verts = 0;
 	finalized = has_tangents = 0;
 	bsphere.radius = 0.0;
 }
 
+template<typename T> void vntc_vect_t<T>::unmap_verts() {
+	if (!is_mapped()) return;
+	this->assign(mapped_verts, mapped_verts+num_mapped_verts);
+	mapped_verts     = nullptr;
+	num_mapped_verts = 0;
+}
+
 
 template<typename T> void vntc_vect_t<T>::calc_bounding_volumes() {
 
-	assert(!empty());
+	T const *const verts(get_vert_data());
+	unsigned const nverts(get_num_vert_data());
+	assert(nverts > 0);
 	bsphere.pos = zero_vector;
-	for (unsigned i = 0; i < size(); ++i) {bsphere.pos += (*this)[i].v;}
-	bsphere.pos /= size();
+	for (unsigned i = 0; i < nverts; ++i) {bsphere.pos += verts[i].v;}
+	bsphere.pos /= nverts;
 	bsphere.radius = 0.0;
 	bcube = cube_t(bsphere.pos, bsphere.pos);
 	
-	for (unsigned i = 0; i < size(); ++i) {
-		bsphere.radius = max(bsphere.radius, p2p_dist_sq(bsphere.pos, (*this)[i].v));
-		bcube.union_with_pt((*this)[i].v);
+	for (unsigned i = 0; i < nverts; ++i) {
+		bsphere.radius = max(bsphere.radius, p2p_dist_sq(bsphere.pos, verts[i].v));
+		bcube.union_with_pt(verts[i].v);
 	}
 	bsphere.radius = sqrt(bsphere.radius);
 }
 
 
+template<typename T> void indexed_vntc_vect_t<T>::unmap_data() {
+	if (!is_mapped()) return;
+	indices.assign(mapped_ixs, mapped_ixs+num_mapped_ixs);
+	mapped_ixs     = nullptr;
+	num_mapped_ixs = 0;
+	this->unmap_verts();
+}
+
+
 template<typename T> void indexed_vntc_vect_t<T>::subdiv_recur(vector<unsigned> const &ixs, unsigned npts, unsigned skip_dims, cube_t *bcube_in) {
 
 	unsigned const num(ixs.size());
@@ -287,6 +323,7 @@ template<typename T> void indexed_vntc_vect_t<T>::optimize(unsigned npts) {
 
 	if (optimized) return;
 	optimized = 1;
+	unmap_data();
 	vntc_vect_t<T>::optimize(npts);
 
 	if (vert_opt_flags[0]) { // only if not subdivided?
@@ -346,6 +383,7 @@ template<typename T> void indexed_vntc_vect_t<T>::gen_lod_blocks(unsigned npts)
 
 template<typename T> void indexed_vntc_vect_t<T>::finalize(unsigned npts) { // Note: called when reading obj files, not model3d files
 
+	unmap_data();
 	optimize(npts);
 
 	if (need_normalize) {
@@ -371,6 +409,7 @@ template<typename T> void indexed_vntc_vect_t<T>::finalize(unsigned npts) { // N
 
 template<typename T> void indexed_vntc_vect_t<T>::finalize_lod_blocks(unsigned npts) {
 
+	unmap_data(); // indices may be reordered
 	assert((num_verts() % npts) == 0); // triangles or quads
 	assert(blocks.empty() && lod_blocks.empty());
 
@@ -432,6 +471,7 @@ template<typename T> void indexed_vntc_vect_t<T>::simplify(vector<unsigned> &out
 
 	RESET_TIME;
 	assert(target < 1.0 && target > 0.0);
+	assert(!is_mapped()); // unmapped data only
 	out.clear();
 	unsigned const num_verts(size()), num_ixs(indices.size()), target_num_verts(unsigned(target*num_verts));
 	if (target_num_verts <= 3) {out = indices; return;} // can't simplify
@@ -527,10 +567,10 @@ template<typename T> void indexed_vntc_vect_t<T>::simplify_meshoptimizer(vector<
 	timer_t timer("Meshoptimizer Simplify");
 	assert(target < 1.0 && target > 0.0);
 	float const target_error = 0.01;
-	unsigned const num_verts(size()), num_ixs(indices.size()), target_num_ixs(max(3U, unsigned(target*num_ixs)));
+	unsigned const num_verts(get_num_vert_data()), num_ixs(get_num_ixs()), target_num_ixs(max(3U, unsigned(target*num_ixs)));
 	if (num_ixs < 3) return; // no triangles to simplify
 	out.resize(num_ixs); // allocate space
-	size_t const num_ixs_out(meshopt_simplify(out.data(), indices.data(), num_ixs, &this->front().v.x, num_verts, sizeof(T), target_num_ixs, target_error));
+	size_t const num_ixs_out(meshopt_simplify(out.data(), get_ix_data(), num_ixs, &get_vert_data()->v.x, num_verts, sizeof(T), target_num_ixs, target_error));
 	cout << TXT(num_ixs) << TXT(target_num_ixs) << TXT(num_ixs_out) << endl;
 	assert(num_ixs_out > 0 && num_ixs_out <= num_ixs);
 	out.resize(num_ixs_out); // truncate to correct size
@@ -539,11 +579,13 @@ template<typename T> void indexed_vntc_vect_t<T>::simplify_meshoptimizer(vector<
 template<typename T> void indexed_vntc_vect_t<T>::simplify_indices(float reduce_target) {
 	vector<unsigned> simplified_indices;
 	simplify_meshoptimizer(simplified_indices, reduce_target);
+	unmap_data();
 	indices.swap(simplified_indices);
 }
 
 template<typename T> void indexed_vntc_vect_t<T>::reverse_winding_order(unsigned npts) {
-	if (indices.empty()) return; // unsupported (error?)
+	if (!indexing_enabled()) return; // unsupported (error?)
+	unmap_data();
 	unsigned const nverts(num_verts());
 	assert((nverts%npts) == 0);
 	for (unsigned i = 0; i < nverts; i += npts) {reverse(indices.begin()+i, indices.begin()+i+npts);}
@@ -553,6 +595,8 @@ template<typename T> void indexed_vntc_vect_t<T>::reverse_winding_order(unsigned
 template<typename T> void indexed_vntc_vect_t<T>::clear() {
 	vntc_vect_t<T>::clear();
 	indices.clear();
+	mapped_ixs     = nullptr;
+	num_mapped_ixs = 0;
 	clear_blocks();
 	need_normalize = 0;
 }
@@ -565,6 +609,7 @@ template<> void indexed_vntc_vect_t<vert_norm_tc_tan>::calc_tangents(unsigned np
 
 	if (has_tangents) return; // already computed
 	has_tangents = 1;
+	unmap_data();
 	assert(npts >= 3); // at least triangles
 	unsigned const nverts(num_verts());
 	assert((nverts%npts) == 0);
@@ -596,7 +641,7 @@ template<typename T> void vntc_vect_t<T>::read(istream &in) {
 	// so we would have to read the model3d material headers, then read the material file, then read the polygon data into the correct geometry type,
 	// which would also require writing out the model3d file in two passes and smaller blocks of data at a time
 	read_vector(in, *this);
-	has_tangents = (sizeof(T) == sizeof(vert_norm_tc_tan)); // HACK to get the type
+	has_tangents = vert_has_tangents<T>::value;
 	calc_bounding_volumes();
 }
 
@@ -719,22 +764,24 @@ template<typename T> void indexed_vntc_vect_t<T>::setup_bones(shader_t &shader,
 
 	if (this->vaos[is_shadow_pass].vao) return; // already set
 	this->vaos[is_shadow_pass].ensure_vao_bound();
-	vector<T> const &data(*this);
-	size_t const vert_mem(data.size()*sizeof(T));
+	size_t const vert_mem(get_num_vert_data()*sizeof(T));
 
-	if (this->vbo) {indexed_vbo_manager_t::pre_render(!indices.empty());}
+	if (this->vbo) {indexed_vbo_manager_t::pre_render(indexing_enabled());}
 	else {
 		this->vbo = create_vbo();
 		check_bind_vbo(this->vbo);
 		unsigned const bone_mem(bone_data.vertex_to_bones.size()*sizeof(vertex_bone_data_t)), tot_mem(vert_mem + bone_mem);
 		upload_vbo_data(nullptr, tot_mem); // allocate space
-		upload_vbo_sub_data(data.data(), 0, vert_mem); // vertex data
+		upload_vbo_sub_data(get_vert_data(), 0, vert_mem); // vertex data
 		upload_vbo_sub_data(bone_data.vertex_to_bones.data(), vert_mem, bone_mem); // bone data
 		this->gpu_mem += tot_mem;
 
-		if (!this->ivbo && !indices.empty()) {
-			create_vbo_and_upload(this->ivbo, indices, 1); // is_index=1
-			this->gpu_mem += indices.size()*sizeof(index_type_t);
+		if (!this->ivbo && indexing_enabled()) {
+			size_t const ix_mem(get_num_ixs()*sizeof(index_type_t));
+			this->ivbo = create_vbo();
+			check_bind_vbo(this->ivbo, 1); // is_index=1
+			upload_vbo_data(get_ix_data(), ix_mem, 1); // is_index=1
+			this->gpu_mem += ix_mem;
 		}
 	}
 	T::set_vbo_arrays();
@@ -749,10 +796,25 @@ template<typename T> void indexed_vntc_vect_t<T>::unset_bone_attrs() {
 	glDisableVertexAttribArray(BONE_WEIGHTS_LOC);
 }
 
+// creates the VBOs from the mapped file data, which is then uploaded directly without a copy; ixs replaces the mapped indices if nonempty
+template<typename T> void indexed_vntc_vect_t<T>::create_vbos_from_mapped_data(vector<unsigned> const &ixs) {
+	if (!is_mapped() || this->vbo) return; // not mapped or already created
+	size_t const vert_mem(this->num_mapped_verts*sizeof(T)), ix_mem((ixs.empty() ? num_mapped_ixs : ixs.size())*sizeof(unsigned));
+	this->vbo = create_vbo();
+	check_bind_vbo(this->vbo);
+	upload_vbo_data(this->mapped_verts, vert_mem);
+	this->gpu_mem += vert_mem;
+	if (this->ivbo || ix_mem == 0) return;
+	this->ivbo = create_vbo();
+	check_bind_vbo(this->ivbo, 1); // is_index=1
+	upload_vbo_data((ixs.empty() ? mapped_ixs : ixs.data()), ix_mem, 1); // is_index=1
+	this->gpu_mem += ix_mem;
+}
+
 // Note: non-const due to VBO caching
 template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool is_shadow_pass, point const *const xlate, unsigned npts, bool no_vfc) {
 
-	if (empty()) return;
+	if (get_num_vert_data() == 0) return;
 	assert(npts == 3 || npts == 4);
 	//if (is_shadow_pass && this->vbo == 0 && world_mode == WMODE_GROUND) return; // don't create the vbo on the shadow pass (voxel terrain problems - works now?)
 	no_vfc |= has_bones(); // disable VFC if animated because animations may move verts outside of the original bcube (should we use a conservative bcube?)
@@ -767,13 +829,13 @@ template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool
 		if (!camera_pdu.sphere_and_cube_visible_test(bsphere.pos, bsphere.radius, bcube)) return; // view frustum culling
 		
 		// Note: null xlate implies there are transforms other than translate, so skip occlusion culling
-		if (world_mode == WMODE_GROUND && indices.size() >= 100 && xlate != nullptr && (display_mode & 0x08) != 0) {
+		if (world_mode == WMODE_GROUND && get_num_ixs() >= 100 && xlate != nullptr && (display_mode & 0x08) != 0) {
 			if (cube_cobj_occluded((camera_pdu.pos + *xlate), (bcube + *xlate))) return; // occlusion culling
 		}
 	}
-	assert(!indices.empty()); // now always using indexed drawing
+	assert(indexing_enabled()); // now always using indexed drawing
 	int prim_type(GL_TRIANGLES);
-	unsigned ixn(1), ixd(1), end_ix(indices.size());
+	unsigned ixn(1), ixd(1), end_ix(get_num_ixs());
 
 	if (!is_shadow_pass && !lod_blocks.empty()) { // block LOD
 		float const dmin(2.0*bsphere.radius), dist(p2p_dist(camera_pdu.pos, bsphere.pos));
@@ -782,7 +844,7 @@ template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool
 			float const area_thresh((dist - dmin)*(dist - dmin)/(1.0E5f*model_mat_lod_thresh));
 			if      (area_thresh > amax) {return;} // draw none
 			else if (area_thresh > amin) {end_ix = lod_blocks[get_block_ix(area_thresh)].get_end_ix();}
-			assert(end_ix <= indices.size());
+			assert(end_ix <= get_num_ixs());
 		}
 	}
 	if (npts == 4 && prev_ucc != use_core_context) { // need to rebuild VBOs on core context mode change
@@ -794,7 +856,9 @@ template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool
 	if (use_core_context && npts == 4) {
 		if (!this->ivbo || !this->is_vao_setup(is_shadow_pass)) { // have to setup IVBO once (okay to redo for shadow pass), and VAO for both passes
 			vector<unsigned> tixs;
-			convert_quad_ixs_to_tri_ixs(indices, tixs);
+			if (is_mapped()) {convert_quad_ixs_to_tri_ixs(vector<unsigned>(mapped_ixs, mapped_ixs+num_mapped_ixs), tixs);}
+			else {convert_quad_ixs_to_tri_ixs(indices, tixs);}
+			create_vbos_from_mapped_data(tixs);
 			this->create_and_upload(*this, tixs, is_shadow_pass, 0, 1); // dynamic_level=0, setup_pointers=1
 		}
 		ixn = 6; ixd = 4; // convert quads to 2 triangles
@@ -802,18 +866,21 @@ template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool
 	else {
 		if (npts == 4) {prim_type = GL_QUADS;}
 		if (has_bones()) {setup_bones(shader, is_shadow_pass);}
-		else {this->create_and_upload(*this, indices, is_shadow_pass, 0, 1);} // dynamic_level=0, setup_pointers=1
+		else {
+			create_vbos_from_mapped_data(vector<unsigned>()); // use the mapped indices
+			this->create_and_upload(*this, indices, is_shadow_pass, 0, 1); // dynamic_level=0, setup_pointers=1
+		}
 	}
 	this->pre_render(is_shadow_pass);
 	check_mvm_update();
 	
 	if (is_shadow_pass || blocks.empty() || no_vfc || camera_pdu.sphere_completely_visible_test(bsphere.pos, bsphere.radius)) { // draw the entire range
-		draw_indexed_tri_verts(size(), (ixn*end_ix/ixd), prim_type);
+		draw_indexed_tri_verts(get_num_vert_data(), (ixn*end_ix/ixd), prim_type);
 	}
 	else { // draw each block independently
 		// could use glDrawElementsIndirect(), but the draw calls don't seem to add any significant overhead for the current set of models
 		for (auto i = blocks.begin(); i != blocks.end(); ++i) {
-			if (camera_pdu.cube_visible(i->bcube)) {draw_indexed_tri_verts(size(), (ixn*i->num/ixd), prim_type, (void *)((ixn*i->start_ix/ixd)*sizeof(unsigned)));}
+			if (camera_pdu.cube_visible(i->bcube)) {draw_indexed_tri_verts(get_num_vert_data(), (ixn*i->num/ixd), prim_type, (void *)((ixn*i->start_ix/ixd)*sizeof(unsigned)));}
 		}
 	}
 	this->post_render();
@@ -842,16 +909,11 @@ template<typename T> unsigned indexed_vntc_vect_t<T>::add_vertex(T const &v, ver
 
 	T v2(v);
 	if (vmap.get_average_normals()) {v2.n = zero_vector;}
-	auto it(vmap.find(v2));
-	unsigned ix;
+	bool inserted(0);
+	unsigned const ix(vmap.find_or_insert(v2, (unsigned)size(), inserted));
 
-	if (it == vmap.end()) { // not found
-		ix = (unsigned)size();
-		this->push_back(v);
-		vmap[v2] = ix;
-	}
+	if (inserted) {this->push_back(v);} // not found
 	else { // found
-		ix = it->second;
 		assert(ix < size());
 
 		if (vmap.get_average_normals()) {
@@ -893,9 +955,9 @@ struct shared_vertex_t {
 
 template<typename T> void indexed_vntc_vect_t<T>::get_polygons(get_polygon_args_t &args, unsigned npts) const {
 
-	if (args.lod_level > 1 && !indices.empty()) {
+	if (args.lod_level > 1 && indexing_enabled()) {
 		indexed_vntc_vect_t<T> simplified_this;
-		simplified_this.insert(simplified_this.begin(), begin(), end()); // copy only vertex data; indices will be filled in below, and other fields are unused
+		simplified_this.insert(simplified_this.begin(), get_vert_data(), get_vert_data()+get_num_vert_data()); // copy only vertex data; indices will be filled in below, and other fields are unused
 		//simplify(simplified_this.indices, 1.0/args.lod_level);
 		simplify_meshoptimizer(simplified_this.indices, 1.0/args.lod_level);
 		get_polygon_args_t args2(args);
@@ -960,19 +1022,218 @@ template<typename T> void invert_vert_tcy(T &vert) {vert.t[1] = 1.0 - vert.t[1];
 void invert_vert_tcy(vert_norm &v) {} // do nothing (no tcs)
 
 template<typename T> void indexed_vntc_vect_t<T>::invert_tcy() {
+	unmap_data();
 	for (auto i = begin(); i != end(); ++i) {invert_vert_tcy(*i);}
 }
 
-template<typename T> void indexed_vntc_vect_t<T>::write(ostream &out, bool inc_animations) const {
-	vntc_vect_t<T>::write(out);
-	write_vector(out, indices);
+// read-only memory mapped file; pages are shared with other processes mapping the same file through the OS file cache and are read on first access
+class mapped_file_t {
+	unsigned char const *data=nullptr;
+	uint64_t size=0;
+#ifdef _WIN32
+	HANDLE file=INVALID_HANDLE_VALUE, mapping=nullptr;
+#endif
+public:
+	mapped_file_t() {}
+	mapped_file_t(mapped_file_t const &) = delete; // forbidden
+	void operator=(mapped_file_t const &) = delete; // forbidden
+	~mapped_file_t() {close();}
+	unsigned char const *get_data() const {return data;}
+	uint64_t get_size() const {return size;}
+
+	bool open(string const &fn) {
+		close();
+#ifdef _WIN32
+		file = CreateFileA(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return 0;
+		LARGE_INTEGER fsize;
+		if (!GetFileSizeEx(file, &fsize) || fsize.QuadPart == 0) {close(); return 0;}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {close(); return 0;}
+		data = (unsigned char const *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data == nullptr) {close(); return 0;}
+		size = fsize.QuadPart;
+#else
+		int const fd(::open(fn.c_str(), O_RDONLY));
+		if (fd < 0) return 0;
+		struct stat st;
+
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *const ptr(mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0));
+			if (ptr != MAP_FAILED) {data = (unsigned char const *)ptr; size = st.st_size;}
+		}
+		::close(fd); // the mapping stays valid after the file is closed
+#endif
+		return (data != nullptr);
+	}
+	void close() {
+#ifdef _WIN32
+		if (data) {UnmapViewOfFile(data);}
+		if (mapping) {CloseHandle(mapping); mapping = nullptr;}
+		if (file != INVALID_HANDLE_VALUE) {CloseHandle(file); file = INVALID_HANDLE_VALUE;}
+#else
+		if (data) {munmap((void *)data, size);}
+#endif
+		data = nullptr;
+		size = 0;
+	}
+};
+
+uint64_t get_aligned_size(uint64_t sz, uint64_t align) {return (align*((sz + align - 1)/align));}
+
+void write_zero_pad(ostream &out, uint64_t num_bytes) {
+	char const zeros[MODEL3D_PAGE_SIZE] = {};
+	assert(num_bytes <= MODEL3D_PAGE_SIZE);
+	out.write(zeros, num_bytes);
+}
+
+uint64_t model3d_data_writer_t::add(void const *const data, size_t sz) {
+	if (sz == 0) return 0; // nothing to write
+	uint64_t const offset(size);
+	arrays.emplace_back(data, sz);
+	size += get_aligned_size(sz, MODEL3D_DATA_ALIGN);
+	return offset;
+}
+uint64_t model3d_data_writer_t::add_encoded(vector<unsigned char> &enc) {
+	encoded.emplace_back();
+	encoded.back().swap(enc);
+	return add(encoded.back().data(), encoded.back().size());
+}
+bool model3d_data_writer_t::write(ostream &out) const {
+	for (auto const &a : arrays) {
+		out.write((char const *)a.first, a.second);
+		write_zero_pad(out, (get_aligned_size(a.second, MODEL3D_DATA_ALIGN) - a.second));
+	}
+	return out.good();
+}
+
+enum {MODEL_BLOCK_VERTS_ENCODED=0x01, MODEL_BLOCK_IXS_ENCODED=0x02, MODEL_BLOCK_FINALIZED=0x04};
+enum {MODEL3D_FILE_LOD_BLOCKS=0x01, MODEL3D_FILE_NO_SUBDIV=0x02}; // settings the blocks were generated with
+
+// v2 format: header with the bounding volumes and blocks computed when the model was finalized, with vertices and indices (optionally meshoptimizer encoded) in the data section
+template<typename T> void indexed_vntc_vect_t<T>::write(ostream &out, unsigned npts, bool inc_animations, model3d_data_writer_t &data) const {
+	unsigned flags(finalized ? MODEL_BLOCK_FINALIZED : 0);
+	unsigned const nverts(get_num_vert_data()), nixs(get_num_ixs());
+	uint64_t verts_offset(0), ixs_offset(0), verts_size(nverts*sizeof(T)), ixs_size(nixs*sizeof(unsigned));
+
+	if (compress_model3d_files && nverts > 0) {
+		vector<unsigned char> enc;
+		enc.resize(meshopt_encodeVertexBufferBound(nverts, sizeof(T)));
+		enc.resize(meshopt_encodeVertexBuffer(enc.data(), enc.size(), get_vert_data(), nverts, sizeof(T)));
+		
+		if (!enc.empty()) { // else error, write unencoded
+			flags |= MODEL_BLOCK_VERTS_ENCODED;
+			verts_size   = enc.size();
+			verts_offset = data.add_encoded(enc);
+		}
+		if (npts == 3 && nixs > 0) { // the index codec only supports triangles, and may rotate their vertices
+			enc.resize(meshopt_encodeIndexBufferBound(nixs, nverts));
+			enc.resize(meshopt_encodeIndexBuffer(enc.data(), enc.size(), get_ix_data(), nixs));
+
+			if (!enc.empty()) {
+				flags     |= MODEL_BLOCK_IXS_ENCODED;
+				ixs_size   = enc.size();
+				ixs_offset = data.add_encoded(enc);
+			}
+		}
+	}
+	if (!(flags & MODEL_BLOCK_VERTS_ENCODED)) {verts_offset = data.add(get_vert_data(), verts_size);}
+	if (!(flags & MODEL_BLOCK_IXS_ENCODED  )) {ixs_offset   = data.add(get_ix_data  (), ixs_size  );}
+	write_uint(out, flags);
+	write_uint(out, nverts);
+	write_uint(out, nixs);
+	write_val(out, verts_offset);
+	write_val(out, verts_size);
+	write_val(out, ixs_offset);
+	write_val(out, ixs_size);
+	write_val(out, bsphere);
+	write_val(out, bcube);
+	write_val(out, amin);
+	write_val(out, amax);
+	write_vector(out, blocks);
+	write_vector(out, lod_blocks);
 	if (inc_animations) {write_vector(out, bone_data.vertex_to_bones);}
 }
-template<typename T> void indexed_vntc_vect_t<T>::read(istream &in, unsigned npts, bool inc_animations) {
-	vntc_vect_t<T>::read(in);
-	read_vector(in, indices);
-	finalize_lod_blocks(npts);
+template<typename T> void indexed_vntc_vect_t<T>::read(istream &in, unsigned npts, bool inc_animations, model3d_data_reader_t const &data) {
+	if (!data.is_v2) { // legacy format: recompute bounding volumes and blocks
+		vntc_vect_t<T>::read(in);
+		read_vector(in, indices);
+		finalize_lod_blocks(npts);
+		finalized = 1;
+		if (inc_animations) {read_vector(in, bone_data.vertex_to_bones);}
+		return;
+	}
+	unsigned const flags(read_uint(in)), nverts(read_uint(in)), nixs(read_uint(in));
+	uint64_t verts_offset(0), verts_size(0), ixs_offset(0), ixs_size(0);
+	read_val(in, verts_offset);
+	read_val(in, verts_size);
+	read_val(in, ixs_offset);
+	read_val(in, ixs_size);
+	read_val(in, bsphere);
+	read_val(in, bcube);
+	read_val(in, amin);
+	read_val(in, amax);
+	read_vector(in, blocks);
+	read_vector(in, lod_blocks);
 	if (inc_animations) {read_vector(in, bone_data.vertex_to_bones);}
+	if (!in.good()) return;
+	this->has_tangents = vert_has_tangents<T>::value;
+	void const *const verts_data(data.get(verts_offset, verts_size)), *const ixs_data(data.get(ixs_offset, ixs_size));
+	if ((nverts > 0 && verts_data == nullptr) || (nixs > 0 && ixs_data == nullptr)) {in.setstate(ios::failbit); return;} // past the end of the file
+	
+	if (flags & MODEL_BLOCK_VERTS_ENCODED) {
+		this->resize(nverts);
+		if (meshopt_decodeVertexBuffer(this->data(), nverts, sizeof(T), (unsigned char const *)verts_data, verts_size) != 0) {in.setstate(ios::failbit); return;}
+	}
+	else {
+		if (verts_size != nverts*sizeof(T)) {in.setstate(ios::failbit); return;}
+		this->mapped_verts     = (T const *)verts_data; // used in place
+		this->num_mapped_verts = nverts;
+	}
+	if (flags & MODEL_BLOCK_IXS_ENCODED) {
+		indices.resize(nixs);
+		if (meshopt_decodeIndexBuffer(indices.data(), nixs, (unsigned char const *)ixs_data, ixs_size) != 0) {in.setstate(ios::failbit); return;}
+	}
+	else {
+		if (ixs_size != nixs*sizeof(unsigned)) {in.setstate(ios::failbit); return;}
+		if (is_mapped()) {mapped_ixs = (unsigned const *)ixs_data; num_mapped_ixs = nixs;}
+		else {indices.assign((unsigned const *)ixs_data, (unsigned const *)ixs_data + nixs);} // vertices were decoded
+	}
+	if (nverts > 0) {this->ensure_bounding_volumes();} // in case the model wasn't finalized when written
+
+	if ((data.recompute_blocks || !(flags & MODEL_BLOCK_FINALIZED)) && nixs > 0) { // written with different block settings, or not finalized
+		clear_blocks();
+		finalize_lod_blocks(npts); // unmaps the data
+	}
+	finalized = 1;
+}
+
+// returns true if the bounding volumes and blocks read from a model3d file match the ones calculated by the legacy reader for the same data
+template<typename T> bool indexed_vntc_vect_t<T>::check_file_data(unsigned npts) const {
+	unsigned const nverts(get_num_vert_data());
+	if (nverts == 0 || !indexing_enabled()) return 1; // nothing to check
+	indexed_vntc_vect_t<T> calc;
+	calc.insert(calc.end(), get_vert_data(), get_vert_data()+nverts);
+	calc.indices.assign(get_ix_data(), get_ix_data()+get_num_ixs());
+	calc.calc_bounding_volumes();
+	calc.finalize_lod_blocks(npts);
+	bool valid(1);
+	// the data written is already sorted into blocks, and recomputing the blocks must produce the same split and order
+	if (calc.indices.size() != get_num_ixs() || !equal(calc.indices.begin(), calc.indices.end(), get_ix_data())) {valid = 0;}
+	if (calc.bsphere.pos != bsphere.pos || calc.bsphere.radius != bsphere.radius || calc.bcube != bcube) {valid = 0;}
+	if (calc.blocks.size() != blocks.size() || calc.lod_blocks.size() != lod_blocks.size()) {valid = 0;}
+	
+	if (!calc.lod_blocks.empty()) { // amin/amax are only used with lod_blocks
+		if (calc.amin != amin || calc.amax != amax) {valid = 0;}
+
+		for (unsigned i = 0; i < lod_blocks.size() && valid; ++i) {
+			if (calc.lod_blocks[i].start_ix != lod_blocks[i].start_ix || calc.lod_blocks[i].num != lod_blocks[i].num) {valid = 0;}
+		}
+	}
+	for (unsigned i = 0; i < blocks.size() && valid; ++i) {
+		if (calc.blocks[i].start_ix != blocks[i].start_ix || calc.blocks[i].num != blocks[i].num || calc.blocks[i].bcube != blocks[i].bcube) {valid = 0;}
+	}
+	return valid;
 }
 
 // Note: will also match vert_norm_tc_tan, but we don't write the tangent
@@ -985,19 +1246,21 @@ void write_vertex_to_obj_file(vert_norm_tc const &v, ostream &out) {
 template<typename T> void indexed_vntc_vect_t<T>::write_to_obj_file(ostream &out, unsigned &cur_vert_ix, unsigned npts) const {
 	unsigned const nv(num_verts());
 	assert((nv % npts) == 0);
-	unsigned const start_vert_ix(cur_vert_ix);
-	for (auto v = begin(); v != end(); ++v) {write_vertex_to_obj_file(*v, out);}
+	unsigned const start_vert_ix(cur_vert_ix), nverts(get_num_vert_data()), nixs(get_num_ixs());
+	T const *const verts(get_vert_data());
+	unsigned const *const ixs(get_ix_data());
+	for (unsigned v = 0; v < nverts; ++v) {write_vertex_to_obj_file(verts[v], out);}
 
-	for (unsigned i = 0; i < indices.size(); i += npts) {
+	for (unsigned i = 0; i < nixs; i += npts) {
 		out << "f";
 		
 		for (unsigned n = 0; n < npts; ++n) {
-			unsigned const ix(start_vert_ix + indices[i + n] + 1); // always the same index for v/vn/vt; starts at 1
+			unsigned const ix(start_vert_ix + ixs[i + n] + 1); // always the same index for v/vn/vt; starts at 1
 			out << " " << ix << "/" << ix << "/" << ix;
 		}
 		out << endl;
 	} // for i
-	cur_vert_ix += size();
+	cur_vert_ix += nverts;
 }
 
 
@@ -1082,7 +1345,7 @@ template<typename T> unsigned vntc_vect_block_t<T>::num_verts() const {
 
 template<typename T> unsigned vntc_vect_block_t<T>::num_unique_verts() const {
 	unsigned s(0);
-	for (auto i = begin(); i != end(); ++i) {s += (unsigned)i->size();}
+	for (auto i = begin(); i != end(); ++i) {s += i->get_num_vert_data();}
 	return s;
 }
 
@@ -1092,7 +1355,7 @@ template<typename T> float vntc_vect_block_t<T>::calc_draw_order_score() const {
 	unsigned count(0);
 
 	for (auto i = begin(); i != end(); ++i) {
-		count += i->size();
+		count += i->get_num_vert_data();
 		area  += i->get_bradius()*i->get_bradius();
 	}
 	return ((count == 0) ? 0.0 : -area/count);
@@ -1125,6 +1388,7 @@ template<typename T> void vntc_vect_block_t<T>::merge_into_single_vector() {
 	unsigned tot_verts(0), tot_ixs(0);
 
 	for (auto i = begin(); i != end(); ++i) {
+		i->unmap_data();
 		for (auto j = i->indices.begin(); j != i->indices.end(); ++j) {*j += tot_verts;} // offset indices by current vertex offset
 		tot_verts += i->size();
 		tot_ixs   += i->indices.size();
@@ -1143,18 +1407,24 @@ template<typename T> void vntc_vect_block_t<T>::merge_into_single_vector() {
 	this->resize(1); // remove all but the first block
 }
 
-template<typename T> bool vntc_vect_block_t<T>::write(ostream &out, bool inc_animations) const {
+template<typename T> bool vntc_vect_block_t<T>::write(ostream &out, unsigned npts, bool inc_animations, model3d_data_writer_t &data) const {
 	write_uint(out, (unsigned)this->size());
-	for (auto i = begin(); i != end(); ++i) {i->write(out, inc_animations);}
+	for (auto i = begin(); i != end(); ++i) {i->write(out, npts, inc_animations, data);}
 	return out.good();
 }
-template<typename T> bool vntc_vect_block_t<T>::read(istream &in, unsigned npts, bool inc_animations) {
+template<typename T> bool vntc_vect_block_t<T>::read(istream &in, unsigned npts, bool inc_animations, model3d_data_reader_t const &data) {
 	this->clear();
 	this->resize(read_uint(in));
-	for (auto i = begin(); i != end(); ++i) {i->read(in, npts, inc_animations);}
+	for (auto i = begin(); i != end(); ++i) {i->read(in, npts, inc_animations, data);}
 	if (merge_model_objects) {merge_into_single_vector();} // model was split per object, and we don't want that; merge into a single vector
 	return in.good();
 }
+template<typename T> bool vntc_vect_block_t<T>::check_file_data(unsigned npts) const {
+	for (auto i = begin(); i != end(); ++i) {
+		if (!i->check_file_data(npts)) return 0;
+	}
+	return 1;
+}
 
 template<typename T> bool vntc_vect_block_t<T>::write_to_obj_file(ostream &out, unsigned &cur_vert_ix, unsigned npts) const {
 	for (auto i = begin(); i != end(); ++i) {i->write_to_obj_file(out, cur_vert_ix, npts);}
@@ -1464,6 +1734,7 @@ template<typename T> unsigned geometry_t<T>::add_triangles(vector<vert_norm_tc>
 		return 0;
 	}
 	auto &dest(triangles.back());
+	dest.unmap_data();
 	assert(indices.empty() == dest.indices.empty()); // can't mix indexed with non-indexed triangles
 	unsigned const ixs_off(dest.size());
 	vector_add_to(verts, dest);
@@ -1488,17 +1759,17 @@ bool material_t::add_poly(polygon_t const &poly, vntc_map_t vmap[2], vntct_map_t
 }
 
 
-bool material_t::write(ostream &out, bool inc_animations) const {
+bool material_t::write(ostream &out, bool inc_animations, model3d_data_writer_t &data) const {
 	out.write((char const *)this, sizeof(material_params_t));
 	write_vector(out, name);
 	write_vector(out, filename);
-	return (geom.write(out, inc_animations) && geom_tan.write(out, inc_animations));
+	return (geom.write(out, inc_animations, data) && geom_tan.write(out, inc_animations, data));
 }
-bool material_t::read(istream &in, bool inc_animations) {
+bool material_t::read(istream &in, bool inc_animations, model3d_data_reader_t const &data) {
 	in.read((char *)this, sizeof(material_params_t));
 	read_vector(in, name);
 	read_vector(in, filename);
-	return (geom.read(in, inc_animations) && geom_tan.read(in, inc_animations));
+	return (geom.read(in, inc_animations, data) && geom_tan.read(in, inc_animations, data));
 }
 
 bool material_t::write_to_obj_file(ostream &out, unsigned &cur_vert_ix) const {
@@ -1547,30 +1818,31 @@ void coll_tquads_from_triangles(vector<triangle> const &triangles, vector<coll_t
 	for (unsigned i = 0; i < triangles.size(); ++i) ppts.push_back(coll_tquad(triangles[i], color));
 }
 
-unsigned model3d::add_polygon(polygon_t const &poly, vntc_map_t vmap[2], vntct_map_t vmap_tan[2], int mat_id, unsigned obj_id) {
+// may be called in parallel for different mat_ids if vmaps has been allocated for all materials and bcube_accum is per-thread
+unsigned model3d::add_polygon(polygon_t const &poly, model_vertex_maps_t &vmaps, int mat_id, unsigned obj_id, cube_t *bcube_accum) {
 	
-	for (unsigned d = 0; d < 2; ++d) {
-		vmap[d].check_for_clear(mat_id);
-		vmap_tan[d].check_for_clear(mat_id);
-	}
+	static thread_local vector<polygon_t> split_polygons_buffer;
+	model_vertex_maps_t::mat_maps_t &mm(vmaps.get(mat_id));
 	split_polygons_buffer.resize(0);
 	split_polygon(poly, split_polygons_buffer, 0.0, allow_model3d_quads);
 
 	for (polygon_t &p : split_polygons_buffer) {
-		if (mat_id < 0) {unbound_geom.add_poly(p, vmap, obj_id);}
+		if (mat_id < 0) {unbound_geom.add_poly(p, mm.vmap, obj_id);}
 		else {
 			assert((unsigned)mat_id < materials.size());
-			materials[mat_id].add_poly(p, vmap, vmap_tan, obj_id);
+			materials[mat_id].add_poly(p, mm.vmap, mm.vmap_tan, obj_id);
 		}
 	}
-	if (mat_id < 0 || !materials[mat_id].skip) {update_bbox(poly);} // don't include skipped materials in the bbox
+	if (mat_id < 0 || !materials[mat_id].skip) { // don't include skipped materials in the bbox
+		if (bcube_accum) {bcube_accum->assign_or_union_with_cube(get_polygon_bbox(poly));} else {update_bbox(poly);}
+	}
 	return (unsigned)split_polygons_buffer.size();
 }
 
-void model3d::add_triangle(polygon_t const &tri, vntc_map_t &vmap, int mat_id, unsigned obj_id) {
+void model3d::add_triangle(polygon_t const &tri, model_vertex_maps_t &vmaps, int mat_id, unsigned obj_id) {
 
 	assert(tri.size() == 3);
-	vmap.check_for_clear(mat_id);
+	vntc_map_t &vmap(vmaps.get(mat_id).vmap[0]);
 
 	if (mat_id < 0) {
 		unbound_geom.add_poly_to_polys(tri, unbound_geom.triangles, vmap, obj_id);
@@ -1872,6 +2144,9 @@ void model3d::clear() {
 	undef_materials.clear();
 	mat_map.clear();
 	coll_tree.clear();
+	coll_tree_fn.clear();
+	coll_tree_fpos = 0;
+	mapped_file.reset(); // after clearing the geometry that points into it
 	textures_loaded = 0;
 }
 
@@ -2471,8 +2746,19 @@ cube_t model3d::calc_bcube_including_transforms() { // non-const because bcube_x
 }
 
 
+bool model3d::read_cobj_tree_from_file() {
+	if (coll_tree_fn.empty()) return 0; // not from a v2 model3d file
+	ifstream in(coll_tree_fn, ios::in | ios::binary);
+	in.seekg(coll_tree_fpos);
+	if (in.good() && coll_tree.read(in)) return 1;
+	cerr << "Error reading collision tree from model3d file " << coll_tree_fn << "; rebuilding" << endl;
+	coll_tree_fn.clear(); // don't try again
+	return 0;
+}
+
 void model3d::build_cobj_tree(bool verbose) {
 	if (!coll_tree.is_empty() || has_cobjs) return; // already built or not needed because cobjs will be used instead
+	if (read_cobj_tree_from_file()) return;
 	RESET_TIME;
 	get_polygons(coll_tree.get_tquads_ref());
 	PRINT_TIME(" Get Model3d Polygons");
@@ -2667,18 +2953,46 @@ bool model3d::write_to_disk(string const &fn) const { // as model3d file; Note:
 	}
 	cout << "Writing model3d file " << fn << endl;
 	bool const inc_animations(has_animations());
-	write_uint(out, (inc_animations ? MAGIC_NUMBER_ANIM : MAGIC_NUMBER));
+	write_uint(out, (inc_animations ? MAGIC_NUMBER_V2_ANIM : MAGIC_NUMBER_V2));
+	// record the settings that the blocks were generated with so that the reader can regenerate them if its settings differ
+	write_uint(out, ((use_model_lod_blocks ? MODEL3D_FILE_LOD_BLOCKS : 0) | (no_subdiv_model ? MODEL3D_FILE_NO_SUBDIV : 0)));
+	uint64_t const offsets_pos(out.tellp());
+	uint64_t data_pos(0), coll_tree_pos(0); // filled in below
+	write_val(out, data_pos);
+	write_val(out, coll_tree_pos);
 	out.write((char const *)&bcube, sizeof(cube_t));
-	if (!unbound_geom.write(out, inc_animations)) return 0;
+	model3d_data_writer_t data;
+	if (!unbound_geom.write(out, inc_animations, data)) return 0;
 	write_uint(out, (unsigned)materials.size());
 	
 	for (material_t const &m : materials) {
-		if (!m.write(out, inc_animations)) {
+		if (!m.write(out, inc_animations, data)) {
 			cerr << "Error writing material " << m.name << endl;
 			return 0;
 		}
 	}
 	if (inc_animations && !model_anim_data.write(out)) {cerr << "Error writing animation data" << endl; return 0;}
+	// the data section starts on a page boundary so that it can be mapped and used in place
+	uint64_t const headers_end(out.tellp());
+	data_pos = get_aligned_size(headers_end, MODEL3D_PAGE_SIZE);
+	write_zero_pad(out, (data_pos - headers_end));
+	if (!data.write(out)) {cerr << "Error writing model data" << endl; return 0;}
+	// the collision tree goes last so that it can be read on demand; only written if it was already built or write_model3d_coll_tree is set
+	cobj_tree_tquads_t tree;
+
+	if (coll_tree.is_empty() && write_model3d_coll_tree) {
+		get_polygons(tree.get_tquads_ref());
+		tree.build_tree_top(0); // verbose=0
+	}
+	cobj_tree_tquads_t const &tree_to_write(coll_tree.is_empty() ? tree : coll_tree);
+
+	if (!tree_to_write.is_empty()) {
+		coll_tree_pos = out.tellp();
+		tree_to_write.write(out);
+	}
+	out.seekp(offsets_pos);
+	write_val(out, data_pos);
+	write_val(out, coll_tree_pos);
 	return out.good();
 }
 
@@ -2692,20 +3006,40 @@ bool model3d::read_from_disk(string const &fn) { // as model3d file; Note: trans
 	}
 	clear(); // may not be needed
 	unsigned const magic_number_comp(read_uint(in));
-	bool const inc_animations(magic_number_comp == MAGIC_NUMBER_ANIM);
+	bool const inc_animations(magic_number_comp == MAGIC_NUMBER_ANIM || magic_number_comp == MAGIC_NUMBER_V2_ANIM);
+	bool const is_v2(magic_number_comp == MAGIC_NUMBER_V2 || magic_number_comp == MAGIC_NUMBER_V2_ANIM); // precomputed bounding volumes, blocks, and collision BVH
 
-	if (!inc_animations && magic_number_comp != MAGIC_NUMBER) {
+	if (!inc_animations && !is_v2 && magic_number_comp != MAGIC_NUMBER) {
 		cerr << "Error reading model3d file " << fn << ": Invalid file format (magic number check failed)." << endl;
 		return 0;
 	}
 	cout << "Reading model3d file " << fn << endl;
 	from_model3d_file = 1;
+	model3d_data_reader_t data;
+	data.is_v2 = is_v2;
+	uint64_t data_pos(0), coll_tree_pos(0);
+
+	if (is_v2) {
+		unsigned const file_flags(read_uint(in));
+		data.recompute_blocks = (bool(file_flags & MODEL3D_FILE_LOD_BLOCKS) != use_model_lod_blocks || bool(file_flags & MODEL3D_FILE_NO_SUBDIV) != no_subdiv_model);
+		read_val(in, data_pos);
+		read_val(in, coll_tree_pos);
+		mapped_file = make_shared<mapped_file_t>();
+
+		if (!in.good() || !mapped_file->open(fn) || data_pos > mapped_file->get_size() || (coll_tree_pos > 0 && coll_tree_pos < data_pos)) {
+			cerr << "Error mapping model3d file " << fn << endl;
+			mapped_file.reset();
+			return 0;
+		}
+		data.data = mapped_file->get_data() + data_pos;
+		data.size = (coll_tree_pos ? coll_tree_pos : mapped_file->get_size()) - data_pos;
+	}
 	in.read((char *)&bcube, sizeof(cube_t));
-	if (!unbound_geom.read(in, inc_animations)) return 0;
+	if (!unbound_geom.read(in, inc_animations, data)) return 0;
 	materials.resize(read_uint(in));
 	
 	for (deque<material_t>::iterator m = materials.begin(); m != materials.end(); ++m) {
-		if (!m->read(in, inc_animations)) {
+		if (!m->read(in, inc_animations, data)) {
 			cerr << "Error reading material" << endl;
 			return 0;
 		}
@@ -2713,6 +3047,16 @@ bool model3d::read_from_disk(string const &fn) { // as model3d file; Note: trans
 	}
 	if (inc_animations && !model_anim_data.read(in)) {cerr << "Error reading animation data" << endl; return 0;}
 	//simplify_indices(0.1); // TESTING
+
+	if (VERIFY_MODEL3D_FILE_DATA && is_v2 && !merge_model_objects) { // merging invalidates the blocks
+		bool valid(unbound_geom.check_file_data());
+		for (material_t const &m : materials) {valid &= (m.geom.check_file_data() && m.geom_tan.check_file_data());}
+		if (!valid) {cerr << format_red("Error: Model3d file " + fn + " bounding volumes or blocks don't match the recomputed values") << endl;}
+	}
+	if (coll_tree_pos > 0 && in.good()) { // the collision tree is read in build_cobj_tree() if needed
+		coll_tree_fn   = fn;
+		coll_tree_fpos = coll_tree_pos;
+	}
 	return in.good();
 }
 
@@ -10,6 +10,7 @@
 #include "gl_ext_arb.h"
 
 #include <unordered_map>
+#include <memory> // for shared_ptr
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/quaternion.hpp>
@@ -161,26 +162,103 @@ struct weighted_normal : public vector3d { // size = 16
 	bool is_valid() const {return (weight > 0.0);}
 };
 
-//template<typename T> class vertex_map_t : public unordered_map<T, unsigned, hash_by_bytes<T>> {
-template<typename T> class vertex_map_t : public map<T, unsigned> {
-	int last_mat_id=-1;
-	unsigned last_obj_id=0;
+// open addressing hash map from vertex to index, used to weld identical vertices during model import;
+// keys and values are stored in insertion order, and slots only hold the hash and key index, so growing doesn't move any vertices
+template<typename T> class vertex_map_t {
+	struct slot_t {
+		unsigned hash=0, ix=0; // ix is the key index + 1, 0 = empty
+	};
+	vector<slot_t> slots; // power of 2 size, less than half full
+	vector<T> keys;
+	vector<unsigned> vals;
 	bool average_normals=0;
+
+	static unsigned hash_vertex(T const &v) { // murmur3 on the float values
+		static_assert((sizeof(T) % sizeof(float)) == 0, "vertex must be made of floats");
+		float const *const f((float const *)&v);
+		unsigned h(0);
+
+		for (unsigned i = 0; i < sizeof(T)/sizeof(float); ++i) {
+			unsigned k;
+			memcpy(&k, (f + i), sizeof(unsigned));
+			if ((k & 0x7FFFFFFF) == 0) {k = 0;} // -0.0 and 0.0 compare equal, so they must hash the same; masking the sign bit is immune to fast math
+			k *= 0xcc9e2d51; k = (k << 15) | (k >> 17); k *= 0x1b873593;
+			h ^= k; h = (h << 13) | (h >> 19); h = h*5 + 0xe6546b64;
+		}
+		h ^= h >> 16; h *= 0x85ebca6b; h ^= h >> 13; h *= 0xc2b2ae35; h ^= h >> 16;
+		return h;
+	}
+	static bool keys_equal(T const &a, T const &b) {return (!(a < b) && !(b < a));} // same equivalence as the std::map this replaced
+
+	void grow() {
+		vector<slot_t> new_slots(max(1024U, 2*(unsigned)slots.size()));
+		unsigned const mask(new_slots.size() - 1);
+
+		for (slot_t const &s : slots) {
+			if (s.ix == 0) continue;
+			unsigned i(s.hash & mask);
+			while (new_slots[i].ix != 0) {i = (i + 1) & mask;}
+			new_slots[i] = s;
+		}
+		slots.swap(new_slots);
+	}
 public:
 	vertex_map_t(bool average_normals_=0) : average_normals(average_normals_) {}
 	bool get_average_normals() const {return average_normals;}
-	
-	void check_for_clear(int mat_id) {
-		if (mat_id != last_mat_id || this->size() >= MAX_VMAP_SIZE) {
-			last_mat_id = mat_id;
-			this->clear();
-		}
+	size_t size () const {return keys.size();}
+	bool   empty() const {return keys.empty();}
+
+	void clear() { // keeps the memory for reuse
+		if (keys.empty()) return;
+		keys.clear();
+		vals.clear();
+		std::fill(slots.begin(), slots.end(), slot_t());
+	}
+	// returns the value for v if it's present; otherwise adds v with new_val and returns new_val
+	unsigned find_or_insert(T const &v, unsigned new_val, bool &inserted) {
+		if (2*(keys.size() + 1) > slots.size()) {grow();}
+		unsigned const h(hash_vertex(v)), mask(slots.size() - 1);
+
+		for (unsigned i = (h & mask); ; i = ((i + 1) & mask)) {
+			slot_t &s(slots[i]);
+
+			if (s.ix == 0) { // not found
+				s.hash = h;
+				s.ix   = keys.size() + 1;
+				keys.push_back(v);
+				vals.push_back(new_val);
+				inserted = 1;
+				return new_val;
+			}
+			if (s.hash == h && keys_equal(keys[s.ix-1], v)) {inserted = 0; return vals[s.ix-1];}
+		} // for i
+		return 0; // never gets here
 	}
 };
 
 typedef vertex_map_t<vert_norm_tc> vntc_map_t;
 typedef vertex_map_t<vert_norm_tc_tan> vntct_map_t;
 
+// vertex maps for model import, with one set per material so that vertices are still shared when materials are interleaved,
+// and so that polygons of different materials can be added in parallel
+class model_vertex_maps_t {
+public:
+	struct mat_maps_t {
+		vntc_map_t  vmap[2];     // {triangles, quads}
+		vntct_map_t vmap_tan[2]; // {triangles, quads}
+	};
+private:
+	vector<mat_maps_t> maps; // indexed by mat_id+1; first entry is for unbound geometry
+public:
+	void alloc(unsigned num_materials) {if (maps.size() < num_materials+1) {maps.resize(num_materials+1);}} // must be called before adding in parallel
+
+	mat_maps_t &get(int mat_id) {
+		unsigned const ix(mat_id + 1);
+		if (ix >= maps.size()) {maps.resize(ix+1);}
+		return maps[ix];
+	}
+};
+
 
 struct get_polygon_args_t {
 	vector<coll_tquad> &polygons;
@@ -274,11 +352,42 @@ public:
 }; // model_anim_t
 
 
+// the data section of a v2 model3d file, which holds the vertex and index arrays of all blocks after the headers, starting at a page aligned file offset;
+// the reader maps the file and uses the arrays in place
+struct model3d_data_writer_t {
+	vector<pair<void const *, size_t>> arrays; // not owned
+	deque<vector<unsigned char>> encoded; // meshoptimizer encoded arrays, owned here
+	uint64_t size=0;
+
+	uint64_t add(void const *const data, size_t sz); // returns the offset of the array in the data section
+	uint64_t add_encoded(vector<unsigned char> &enc); // takes the contents of enc
+	bool write(ostream &out) const;
+};
+
+class mapped_file_t; // read-only memory mapped file; defined in model3d.cpp
+
+struct model3d_data_reader_t { // the data section of a mapped v2 model3d file, or none for legacy files
+	bool is_v2=0, recompute_blocks=0; // recompute_blocks is set if the file was written with different block LOD/subdiv settings
+	unsigned char const *data=nullptr; // start of the data section in the mapped file
+	uint64_t size=0;
+
+	void const *get(uint64_t offset, uint64_t sz) const {return ((offset + sz <= size && data) ? (data + offset) : nullptr);} // returns null if out of range
+};
+
+
+template<typename T> struct vert_has_tangents {static bool const value = 0;};
+template<> struct vert_has_tangents<vert_norm_tc_tan> {static bool const value = 1;};
+
 template<typename T> class vntc_vect_t : public vector<T>, public indexed_vao_manager_with_shadow_t {
 protected:
 	bool has_tangents=0, finalized=0;
 	sphere_t bsphere;
 	cube_t bcube;
+	// vertex data in a memory mapped model3d file, used in place of the (empty) vector until the data is modified
+	T const *mapped_verts=nullptr;
+	unsigned num_mapped_verts=0;
+
+	void unmap_verts();
 public:
 	using vector<T>::empty;
 	using vector<T>::size;
@@ -289,10 +398,13 @@ public:
 	void make_private_copy() {vbo = ivbo = 0;} // Note: to be called *only* after a deep copy
 	void calc_bounding_volumes();
 	void ensure_bounding_volumes() {if (bsphere.radius == 0.0) {calc_bounding_volumes();}}
-	cube_t get_bcube () const {return get_polygon_bbox(*this);}
+	bool is_mapped() const {return (mapped_verts != nullptr);}
+	T const *get_vert_data() const {return (is_mapped() ? mapped_verts : this->data());}
+	unsigned get_num_vert_data() const {return (is_mapped() ? num_mapped_verts : (unsigned)size());}
+	cube_t get_bcube () const {return (is_mapped() ? bcube : get_polygon_bbox(*this));} // mapped bcube was calculated from all verts when written
 	point get_center () const {return bsphere.pos;}
 	float get_bradius() const {return bsphere.radius;}
-	size_t get_gpu_mem() const {return (vbo_valid() ? size()*sizeof(T) : 0);}
+	size_t get_gpu_mem() const {return (vbo_valid() ? get_num_vert_data()*sizeof(T) : 0);}
 	void optimize(unsigned npts) {remove_excess_cap();}
 	void remove_excess_cap() {if (20*size() < 19*this->capacity()) {this->shrink_to_fit();}}
 	void write(ostream &out) const;
@@ -303,12 +415,14 @@ public:
 template<typename T> class indexed_vntc_vect_t : public vntc_vect_t<T> {
 public:
 	typedef unsigned index_type_t;
-	vector<unsigned> indices; // needs to be public for merging operation
+	vector<unsigned> indices; // needs to be public for merging operation; empty when mapped
 	mesh_bone_data_t bone_data;
 	bool has_bones() const {return !bone_data.vertex_to_bones.empty();}
 private:
 	bool need_normalize=0, optimized=0, prev_ucc=0;
 	float avg_area_per_tri=0.0, amin=0.0, amax=0.0;
+	unsigned const *mapped_ixs=nullptr; // index data in a memory mapped model3d file, used along with mapped_verts
+	unsigned num_mapped_ixs=0;
 
 	struct geom_block_t {
 		unsigned start_ix=0, num=0;
@@ -338,9 +452,16 @@ public:
 	using vntc_vect_t<T>::finalized;
 	using vntc_vect_t<T>::bcube;
 	using vntc_vect_t<T>::bsphere;
+	using vntc_vect_t<T>::is_mapped;
+	using vntc_vect_t<T>::get_vert_data;
+	using vntc_vect_t<T>::get_num_vert_data;
 	
 	indexed_vntc_vect_t(unsigned obj_id_=0) : vntc_vect_t<T>(obj_id_) {}
 	void calc_tangents(unsigned npts) {assert(0);}
+	void unmap_data(); // copies mapped data into the vectors so that it can be modified
+	unsigned const *get_ix_data() const {return (is_mapped() ? mapped_ixs : indices.data());}
+	unsigned get_num_ixs() const {return (is_mapped() ? num_mapped_ixs : (unsigned)indices.size());}
+	void create_vbos_from_mapped_data(vector<unsigned> const &ixs);
 	void setup_bones(shader_t &shader, bool is_shadow_pass);
 	void unset_bone_attrs();
 	void render(shader_t &shader, bool is_shadow_pass, point const *const xlate, unsigned npts, bool no_vfc=0);
@@ -360,19 +481,20 @@ public:
 	void reverse_winding_order(unsigned npts);
 	void clear();
 	void clear_blocks() {blocks.clear(); lod_blocks.clear();}
-	unsigned num_verts() const {return unsigned(indices.empty() ? size() : indices.size());}
-	T       &get_vert(unsigned i)       {return (*this)[indices.empty() ? i : indices[i]];}
-	T const &get_vert(unsigned i) const {return (*this)[indices.empty() ? i : indices[i]];}
-	unsigned get_ix  (unsigned i) const {assert(i < indices.size()); return indices[i];}
+	unsigned num_verts() const {return (indexing_enabled() ? get_num_ixs() : get_num_vert_data());}
+	T       &get_vert(unsigned i)       {assert(!is_mapped()); return (*this)[indices.empty() ? i : indices[i]];}
+	T const &get_vert(unsigned i) const {return get_vert_data()[indexing_enabled() ? get_ix_data()[i] : i];}
+	unsigned get_ix  (unsigned i) const {assert(i < get_num_ixs()); return get_ix_data()[i];}
 	float get_prim_area(unsigned i, unsigned npts) const;
 	float calc_area(unsigned npts);
 	void get_polygons(get_polygon_args_t &args, unsigned npts) const;
-	size_t get_gpu_mem() const {return (vntc_vect_t<T>::get_gpu_mem() + (this->ivbo_valid() ? indices.size()*sizeof(unsigned) : 0));}
+	size_t get_gpu_mem() const {return (vntc_vect_t<T>::get_gpu_mem() + (this->ivbo_valid() ? get_num_ixs()*sizeof(unsigned) : 0));}
 	void invert_tcy();
-	void write(ostream &out, bool inc_animations) const;
-	void read (istream &in, unsigned npts, bool inc_animations);
+	void write(ostream &out, unsigned npts, bool inc_animations, model3d_data_writer_t &data) const;
+	void read (istream &in,  unsigned npts, bool inc_animations, model3d_data_reader_t const &data);
+	bool check_file_data(unsigned npts) const;
 	void write_to_obj_file(ostream &out, unsigned &cur_vert_ix, unsigned npts) const;
-	bool indexing_enabled() const {return !indices.empty();}
+	bool indexing_enabled() const {return (get_num_ixs() > 0);}
 	void mark_need_normalize() {need_normalize = 1;}
 }; // indexed_vntc_vect_t
 
@@ -396,8 +518,9 @@ template<typename T> struct vntc_vect_block_t : public deque<indexed_vntc_vect_t
 	void simplify_indices(float reduce_target);
 	void reverse_winding_order(unsigned npts);
 	void merge_into_single_vector();
-	bool write(ostream &out, bool inc_animations) const;
-	bool read (istream &in, unsigned npts, bool inc_animations);
+	bool write(ostream &out, unsigned npts, bool inc_animations, model3d_data_writer_t &data) const;
+	bool read (istream &in,  unsigned npts, bool inc_animations, model3d_data_reader_t const &data);
+	bool check_file_data(unsigned npts) const;
 	bool write_to_obj_file(ostream &out, unsigned &cur_vert_ix, unsigned npts) const;
 };
 
@@ -424,8 +547,9 @@ template<typename T> struct geometry_t {
 	void calc_area(float &area, unsigned &ntris);
 	void simplify_indices(float reduce_target);
 	void reverse_winding_order();
-	bool write(ostream &out, bool inc_animations) const {return (triangles.write(out,  inc_animations) && quads.write(out,  inc_animations));}
-	bool read (istream &in,  bool inc_animations)       {return (triangles.read(in, 3, inc_animations) && quads.read(in, 4, inc_animations));}
+	bool write(ostream &out, bool inc_animations, model3d_data_writer_t &data) const {return (triangles.write(out, 3, inc_animations, data) && quads.write(out, 4, inc_animations, data));}
+	bool read (istream &in,  bool inc_animations, model3d_data_reader_t const &data) {return (triangles.read(in, 3, inc_animations, data) && quads.read(in, 4, inc_animations, data));}
+	bool check_file_data() const {return (triangles.check_file_data(3) && quads.check_file_data(4));}
 	bool write_to_obj_file(ostream &out, unsigned &cur_vert_ix) const {return (triangles.write_to_obj_file(out, cur_vert_ix, 3) && quads.write_to_obj_file(out, cur_vert_ix, 4));}
 };
 
@@ -519,8 +643,8 @@ struct material_t : public material_params_t {
 		int enable_alpha_mask, bool is_bmap_pass, point const *const xlate, bool no_set_min_alpha=0);
 	colorRGBA get_ad_color() const;
 	colorRGBA get_avg_color(texture_manager const &tmgr, int default_tid=-1) const;
-	bool write(ostream &out, bool inc_animations) const;
-	bool read (istream &in,  bool inc_animations);
+	bool write(ostream &out, bool inc_animations, model3d_data_writer_t &data) const;
+	bool read (istream &in,  bool inc_animations, model3d_data_reader_t const &data);
 	bool write_to_obj_file(ostream &out, unsigned &cur_vert_ix) const;
 	void write_mtllib_entry(ostream &out, texture_manager const &tmgr) const;
 };
@@ -536,7 +660,6 @@ class model3d {
 	// geometry
 	geometry_t<vert_norm_tc> unbound_geom;
 	base_mat_t unbound_mat;
-	vector<polygon_t> split_polygons_buffer;
 	cube_t bcube, bcube_all_xf, occlusion_cube;
 	unsigned model_refl_tid=0, model_refl_tsize=0, model_refl_last_tsize=0, model_indir_tid=0;
 	int reflective=0; // reflective: 0=none, 1=planar, 2=cube map
@@ -549,6 +672,9 @@ class model3d {
 	string_map_t mat_map; // maps material names to materials indexes
 	set<string> undef_materials; // to reduce warning messages
 	cobj_tree_tquads_t coll_tree;
+	string coll_tree_fn; // model3d file containing a prebuilt coll_tree, which is read on first use
+	uint64_t coll_tree_fpos=0; // offset of the prebuilt coll_tree in coll_tree_fn
+	shared_ptr<mapped_file_t> mapped_file; // model3d file that block vertex and index data points into
 	colorRGBA cached_avg_color=ALPHA0; // used by get_and_cache_avg_color()
 	bool textures_loaded=0;
 	// transforms
@@ -595,8 +721,8 @@ public:
 	string const &get_filename() const {return filename;}
 	void set_has_cobjs() {has_cobjs = 1;}
 	void add_transform(model3d_xform_t const &xf) {transforms.push_back(xf);}
-	unsigned add_polygon(polygon_t const &poly, vntc_map_t vmap[2], vntct_map_t vmap_tan[2], int mat_id=-1, unsigned obj_id=0);
-	void add_triangle(polygon_t const &tri, vntc_map_t &vmap, int mat_id=-1, unsigned obj_id=0);
+	unsigned add_polygon(polygon_t const &poly, model_vertex_maps_t &vmaps, int mat_id=-1, unsigned obj_id=0, cube_t *bcube_accum=nullptr);
+	void add_triangle(polygon_t const &tri, model_vertex_maps_t &vmaps, int mat_id=-1, unsigned obj_id=0);
 	void get_polygons(vector<coll_tquad> &polygons, bool quads_only=0, bool apply_transforms=0, unsigned lod_level=0) const;
 	void get_transformed_bcubes(vector<cube_t> &bcubes) const;
 	void get_cubes(vector<cube_t> &cubes, model3d_xform_t const &xf) const;
@@ -649,6 +775,7 @@ public:
 	cube_t const &get_bcube() const {return bcube;}
 	cube_t calc_bcube_including_transforms();
 	void union_bcube_with(cube_t const &c) {bcube.assign_or_union_with_cube(c);}
+	bool read_cobj_tree_from_file();
 	void build_cobj_tree(bool verbose);
 	bool check_coll_line_cur_xf(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA &color, bool exact);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA &color, bool exact, bool build_bvh_if_needed=0);
@@ -578,6 +578,7 @@ void coll_obj::rotate_about(point const &pt, vector3d const &axis, float angle,
 	}
 	//if (cp.tscale != 0.0) {texture_offset -= (points[0] - prev_pts0);}
 	calc_bcube(); // may not always be needed
+	mark_cobj_moved(*this);
 	if (do_re_add) {re_add_coll_cobj(id, 0);}
 }
 
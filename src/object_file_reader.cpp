@@ -6,6 +6,7 @@
 #include "3DWorld.h"
 #include "model3d.h"
 #include "file_reader.h"
+#include "job_system.h"
 #include <stdint.h>
 #include <algorithm> // for transform()
 #include <cctype> // for tolower()
@@ -708,47 +709,66 @@ public:
 		size_t const num_blocks(pblocks.size());
 		model3d::proc_model_normals(vn, recalc_normals); // if recalc_normals
 
+		unsigned const num_mats(model.num_materials());
+
 		while (!pblocks.empty()) {
 			poly_data_block const &pd(pblocks.back());
-			unsigned pix(0);
-			polygon_t poly;
-			vntc_map_t vmap[2]; // {triangles, quads}
-			vntct_map_t vmap_tan[2]; // {triangles, quads}
-			colorRGBA color;
-
-			for (vector<poly_header_t>::const_iterator j = pd.polys.begin(); j != pd.polys.end(); ++j) {
-				poly.resize(j->npts);
-				
-				for (unsigned p = 0; p < j->npts; ++p) {
-					vntc_ix_t const &V(pd.pts[pix+p]);
-					vector3d normal;
-
-					if (recalc_normals) {
-						assert(V.vix < vn.size());
-						normal = ((j->n != zero_vector && !vn[V.vix].is_valid()) ? j->n : vn[V.vix]);
-					}
-					else {
-						assert(V.nix < n.size());
-						normal = n[V.nix];
-						if (normal == zero_vector) normal = j->n;
-					}
-					assert(V.vix < v.size() && V.tix < tc.size());
-					point2d<float> tcoord;
+			model_vertex_maps_t vmaps;
+			vmaps.alloc(num_mats);
+			// group polygons by material, keeping them in file order; each material has its own geometry and vertex maps, so they can be added in parallel
+			vector<vector<unsigned>> polys_by_mat(num_mats+1); // indexed by mat_id+1
+			vector<unsigned> poly_pix(pd.polys.size()); // index of each polygon's first point
+			vector<cube_t> mat_bcubes(polys_by_mat.size());
+			vector<unsigned> mat_faces(polys_by_mat.size(), 0);
+			unsigned num_pts(0);
+
+			for (unsigned j = 0; j < pd.polys.size(); ++j) {
+				poly_pix[j] = num_pts;
+				num_pts += pd.polys[j].npts;
+				assert(pd.polys[j].mat_id + 1 < (int)polys_by_mat.size());
+				polys_by_mat[pd.polys[j].mat_id + 1].push_back(j);
+			}
+			get_job_system().parallel_for(polys_by_mat.size(), [&](unsigned m) {
+				polygon_t poly;
+				colorRGBA color;
+
+				for (unsigned const pi : polys_by_mat[m]) {
+					auto const j(pd.polys.begin() + pi);
+					unsigned const pix(poly_pix[pi]);
+					poly.resize(j->npts);
+					
+					for (unsigned p = 0; p < j->npts; ++p) {
+						vntc_ix_t const &V(pd.pts[pix+p]);
+						vector3d normal;
+
+						if (recalc_normals) {
+							assert(V.vix < vn.size());
+							normal = ((j->n != zero_vector && !vn[V.vix].is_valid()) ? j->n : vn[V.vix]);
+						}
+						else {
+							assert(V.nix < n.size());
+							normal = n[V.nix];
+							if (normal == zero_vector) normal = j->n;
+						}
+						assert(V.vix < v.size() && V.tix < tc.size());
+						point2d<float> tcoord;
 
-					if (V.tix == 0 && model_auto_tc_scale > 0.0) { // generate tc since it wasn't read from the file
-						unsigned const dim(get_max_dim(normal)), dimx((dim == 0) ? 1 : 0), dimy((dim == 2) ? 1 : 2); // looks better for brick textures on walls
-						tcoord.x = model_auto_tc_scale*v[V.vix][dimx];
-						tcoord.y = model_auto_tc_scale*v[V.vix][dimy];
-					}
-					else {tcoord = tc[V.tix];}
-					poly[p] = vert_norm_tc(v[V.vix], normal, tcoord.x, tcoord.y);
-					if (!colors.empty()) {assert(V.vix < colors.size()); color += colors[V.vix];}
-				} // for p
-				if (!colors.empty()) {color = color/j->npts; color.A = 1.0;} // uses average vertex color for each face/polygon, with alpha=1.0
-				// Note: model3d doesn't support per-vertex colors, so color is unused here
-				num_faces += model.add_polygon(poly, vmap, vmap_tan, j->mat_id, j->obj_id);
-				pix += j->npts;
-			} // for j
+						if (V.tix == 0 && model_auto_tc_scale > 0.0) { // generate tc since it wasn't read from the file
+							unsigned const dim(get_max_dim(normal)), dimx((dim == 0) ? 1 : 0), dimy((dim == 2) ? 1 : 2); // looks better for brick textures on walls
+							tcoord.x = model_auto_tc_scale*v[V.vix][dimx];
+							tcoord.y = model_auto_tc_scale*v[V.vix][dimy];
+						}
+						else {tcoord = tc[V.tix];}
+						poly[p] = vert_norm_tc(v[V.vix], normal, tcoord.x, tcoord.y);
+						if (!colors.empty()) {assert(V.vix < colors.size()); color += colors[V.vix];}
+					} // for p
+					if (!colors.empty()) {color = color/j->npts; color.A = 1.0;} // uses average vertex color for each face/polygon, with alpha=1.0
+					// Note: model3d doesn't support per-vertex colors, so color is unused here
+					mat_faces[m] += model.add_polygon(poly, vmaps, j->mat_id, j->obj_id, &mat_bcubes[m]);
+				} // for pi
+			}, JOB_PRI_STREAM); // for m
+			for (cube_t const &c : mat_bcubes) {model.union_bcube_with(c);}
+			for (unsigned nf : mat_faces) {num_faces += nf;}
 			pblocks.pop_back();
 		}
 		model.finalize(); // optimize vertices, remove excess capacity, compute bounding cube, subdivide, generate LOD blocks
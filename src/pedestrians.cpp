@@ -7,6 +7,7 @@
 #include "shaders.h"
 #include "nav_grid.h"
 #include "profiler.h"
+#include "job_system.h"
 #include <fstream>
 #include <unordered_map>
 #include <unordered_set>
@@ -22,7 +23,7 @@ bool some_person_has_idle_animation(0);
 
 extern bool tt_fire_button_down, camera_in_building, player_on_moving_ww;
 extern int display_mode, game_mode, camera_mode, animate2, frame_counter, camera_surf_collide;
-extern unsigned num_peds_drawn;
+extern unsigned num_peds_drawn, NUM_THREADS;
 extern float fticks, FAR_CLIP;
 extern double camera_zh;
 extern point pre_smap_player_pos, actual_player_pos;
@@ -373,7 +374,7 @@ public:
 		if (s != nullptr) {grid.debug_draw(*s);} // debug visualization
 		point plot_dest(p2);
 		plot_bcube.clamp_pt_xy(plot_dest); // closest point to our destination within the current plot
-		ai_path_t &path(ped_mgr.grid_path);
+		ai_path_t &path(ped_mgr.get_grid_path());
 		path.clear();
 		path.push_back(p1); // add the starting point
 		bool const ret(grid.find_path(p1, plot_dest, path, dest_building));
@@ -382,6 +383,12 @@ public:
 		path.erase(path.begin()); // remove the starting point, which is no longer needed
 		return ret;
 	}
+	void init_grids(unsigned num_plots) { // allocate grids up front so that find_path() never resizes them during parallel ped updates
+		for (unsigned g = 0; g < 4; ++g) {
+			vector<city_cube_nav_grid> &grids(plot_grids[g>>1][g&1]);
+			if (grids.empty()) {grids.resize(num_plots);}
+		}
+	}
 	void invalidate_nav_grid(unsigned plot_ix) { // not needed, because cars entering or leaving driveways will trigger invalidate() when blocker count changes?
 		for (unsigned g = 0; g < 4; ++g) { // check all 4 grids
 			vector<city_cube_nav_grid> &grids(plot_grids[g>>1][g&1]);
@@ -393,6 +400,15 @@ public:
 ped_manager_t::ped_manager_t(city_road_gen_t const &road_gen_, car_manager_t const &car_manager_) : road_gen(road_gen_), car_manager(car_manager_) {}
 ped_manager_t::~ped_manager_t() {} // required for city_cube_nav_grid_manager
 
+path_finder_t &ped_manager_t::get_path_finder() {
+	static thread_local path_finder_t path_finder;
+	return path_finder;
+}
+ai_path_t &ped_manager_t::get_grid_path() {
+	static thread_local ai_path_t grid_path;
+	return grid_path;
+}
+
 city_cube_nav_grid_manager &ped_manager_t::get_nav_grid_mgr() {
 	if (!nav_grid_mgr) {nav_grid_mgr.reset(new city_cube_nav_grid_manager);}
 	return *nav_grid_mgr;
@@ -638,7 +654,7 @@ bool pedestrian_t::check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned
 	} // for i
 	return 0;
 }
-bool pedestrian_t::check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir) { // and player coll
+bool pedestrian_t::check_ped_ped_coll(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir) { // and player coll
 	assert(pid < peds.size());
 	float const lookahead_dist(LOOKAHEAD_TICKS*speed); // how far we can travel in 2s
 	float const prox_radius(1.2*radius + lookahead_dist); // assume other ped has a similar radius
@@ -654,12 +670,8 @@ bool pedestrian_t::check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedes
 
 			if (overlaps_player_in_z(player_pos)) { // check height
 				if (dist_sq < 4.0*r_sum*r_sum && is_zombie && zombies_can_target_player()) { // near collision
-					maybe_play_zombie_sound(pos, ssn); // moan
-
-					if (dist_sq < r_sum*r_sum) { // collision
-						uint8_t has_key(0); // final valid is unused
-						register_ai_player_coll(has_key, get_height()); // has_key=0; return value: 0=no effect, 1=player is killed, 2=this person is killed
-					}
+					ped_mgr.defer_zombie_sound(*this); // moan
+					if (dist_sq < r_sum*r_sum) {ped_mgr.defer_player_coll(*this);} // collision
 				}
 				if (dist_sq < r_sum*r_sum) { // collision
 					if (!follow_player) return 1; // only treat this as a collision if we're not trying to collide with the player
@@ -1045,7 +1057,7 @@ void pedestrian_t::get_avoid_cubes(ped_manager_t const &ped_mgr, vect_cube_t con
 	bool const is_home_plot(plot == dest_plot); // plot contains our destination
 	if (is_home_plot && !follow_player) {assert(plot_bcube == next_plot_bcube);} // doesn't hold when following the player?
 	cube_t const region(get_plot_coll_region(cur_plot));
-	static vect_cube_t car_bcubes; // reused across calls
+	static thread_local vect_cube_t car_bcubes; // reused across calls; per-thread because cities are updated in parallel
 	car_bcubes.clear();
 	if (!in_the_road) {ped_mgr.get_parked_car_bcubes_for_plot(plot_bcube, city, car_bcubes);} // get collider bcubes for cars parked in house driveways or parking lots
 	bool keep_cur_dest(0);
@@ -1153,7 +1165,7 @@ void pedestrian_t::get_avoid_cubes(ped_manager_t const &ped_mgr, vect_cube_t con
 bool pedestrian_t::check_path_blocked(ped_manager_t &ped_mgr, point const &dest, bool check_buildings) { // Note: ped_mgr is non-const due to avoid
 	float const height(get_height()), expand(0.1*radius); // almost no expand
 	cube_t const check_area(pos, dest); // area between pos and dest
-	vect_cube_t &avoid(ped_mgr.path_finder.get_avoid_vector());
+	vect_cube_t &avoid(ped_mgr.get_path_finder().get_avoid_vector());
 	avoid.clear();
 	if (check_buildings) {get_building_bcubes(check_area, avoid);}
 	road_plot_t const &cur_plot(ped_mgr.get_city_plot_for_peds(city, plot));
@@ -1264,7 +1276,7 @@ void pedestrian_t::move(ped_manager_t const &ped_mgr, cube_t const &plot_bcube,
 
 void pedestrian_t::run_path_finding(ped_manager_t &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube, vect_cube_t const &colliders, vector3d &dest_pos) {
 	bool in_illegal_area(0), avoid_entire_plot(0), found_path(0), full_path(0);
-	vect_cube_t &avoid(ped_mgr.path_finder.get_avoid_vector());
+	vect_cube_t &avoid(ped_mgr.get_path_finder().get_avoid_vector());
 	get_avoid_cubes(ped_mgr, colliders, plot_bcube, next_plot_bcube, dest_pos, avoid, in_illegal_area, avoid_entire_plot);
 
 	for (unsigned attempt = 0; attempt < 2; ++attempt) { // make two attempts using two different path finding algorithms
@@ -1272,15 +1284,16 @@ void pedestrian_t::run_path_finding(ped_manager_t &ped_mgr, cube_t const &plot_b
 			int const bix(has_dest_bldg ? (int)dest_bldg : -1);
 			city_cube_nav_grid_manager &nav_grid_mgr(ped_mgr.get_nav_grid_mgr());
 			found_path = full_path = nav_grid_mgr.find_path(plot_bcube, avoid, radius, is_female, plot, pos, dest_pos, ped_mgr, bix);
-			if (found_path) {assert(!ped_mgr.grid_path.empty()); dest_pos = ped_mgr.grid_path.front();}
+			if (found_path) {assert(!ped_mgr.get_grid_path().empty()); dest_pos = ped_mgr.get_grid_path().front();}
 		}
 		else { // run path finding between pos and dest_pos using avoid cubes
 			cube_t union_plot_bcube(plot_bcube);
 			union_plot_bcube.union_with_cube(next_plot_bcube); // this is the area the ped is constrained to (both plots + road in between)
 			// return values: 0=failed, 1=valid path, 2=init contained, 3=straight path (no collisions)
-			unsigned const ret(ped_mgr.path_finder.run(pos, dest_pos, target_pos, union_plot_bcube, PATH_GAP_FACTOR*radius, dest_pos));
+			path_finder_t &path_finder(ped_mgr.get_path_finder());
+			unsigned const ret(path_finder.run(pos, dest_pos, target_pos, union_plot_bcube, PATH_GAP_FACTOR*radius, dest_pos));
 			found_path = (ret > 0);
-			full_path  = (ret == 3 || ped_mgr.path_finder.found_complete_path());
+			full_path  = (ret == 3 || path_finder.found_complete_path());
 		}
 		if (full_path) break; // success
 		if (attempt == 0) {using_nav_grid ^= 1;} // switch path finding algorithm and try again
@@ -1311,9 +1324,9 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 	// navigation with destination
 	if (at_dest) {
 		register_at_dest();
-		ped_mgr.choose_new_ped_plot_pos(*this);
+		ped_mgr.choose_new_ped_plot_pos(*this, rgen);
 	}
-	else if (!has_dest_bldg && !has_dest_car) {ped_mgr.choose_dest_building_or_parked_car(*this);}
+	else if (!has_dest_bldg && !has_dest_car) {ped_mgr.choose_dest_building_or_parked_car(*this, rgen);}
 	if (at_crosswalk) {ped_mgr.mark_crosswalk_in_use(*this);}
 	cube_t plot_bcube, next_plot_bcube;
 	get_plot_bcubes_inc_sidewalks(ped_mgr, plot_bcube, next_plot_bcube);
@@ -1374,7 +1387,7 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 					if (!check_path_blocked(ped_mgr, player_pos, check_buildings)) { // check fences, walls, hedges, trees, etc.
 						next_follow_player = 1;
 						dest_pos = point(player_pos.x, player_pos.y, pos.z);
-						if (!follow_player) {maybe_play_zombie_sound(pos, ssn);} // moan if newly following the player
+						if (!follow_player) {ped_mgr.defer_zombie_sound(*this);} // moan if newly following the player
 					}
 				}
 			}
@@ -1599,6 +1612,7 @@ void ped_manager_t::clear() {
 	by_city.clear();
 	by_plot.clear();
 	need_to_sort_city.clear();
+	city_updates.clear();
 	cars_by_city.clear();
 	nav_grid_mgr.reset();
 }
@@ -1671,6 +1685,8 @@ void ped_manager_t::sort_by_city_and_plot() {
 		unsigned const num_cities(peds.back().city + 1);
 		by_city.resize(num_cities + 1); // one per city + terminator
 		need_to_sort_city.resize(num_cities, 0);
+		city_updates.resize(num_cities);
+		for (unsigned city = 0; city < num_cities; ++city) {city_updates[city].rgen.set_state(city+1, rgen.rand());} // independent random stream per city
 
 		for (unsigned city = 0, pix = 0; city < num_cities; ++city) {
 			while (pix < peds.size() && peds[pix].city == city) {++pix;}
@@ -1772,8 +1788,16 @@ void ped_manager_t::remove_destroyed_peds() {
 }
 
 void ped_manager_t::register_ped_new_plot(pedestrian_t const &ped) {
-	if (!need_to_sort_city.empty()) {need_to_sort_city[ped.city] = 1;}
-	need_to_sort_peds = 1;
+	// only write the per-city flag when it exists, since cities are updated in parallel; need_to_sort_peds is set from these flags after the update
+	if (!need_to_sort_city.empty()) {need_to_sort_city[ped.city] = 1;} else {need_to_sort_peds = 1;}
+}
+void ped_manager_t::defer_zombie_sound(pedestrian_t const &ped) {
+	if (ped.city < city_updates.size()) {city_updates[ped.city].zombie_sounds.emplace_back(ped.pos, ped.ssn);}
+	else {maybe_play_zombie_sound(ped.pos, ped.ssn);} // not yet sorted, so not updated in parallel
+}
+void ped_manager_t::defer_player_coll(pedestrian_t const &ped) {
+	if (ped.city < city_updates.size()) {city_updates[ped.city].player_colls.push_back(ped.get_height());}
+	else {uint8_t has_key(0); register_ai_player_coll(has_key, ped.get_height());}
 }
 void ped_manager_t::move_ped_to_next_plot(pedestrian_t &ped) {
 	if (ped.next_plot == ped.plot) return; // already there (error?)
@@ -1802,17 +1826,38 @@ void ped_manager_t::next_frame() {
 		point const camera_bs(get_camera_building_space());
 
 		if (first_frame) { // choose initial ped destinations (must be after building setup, etc.)
-			for (auto i = peds.begin(); i != peds.end(); ++i) {choose_dest_building_or_parked_car(*i);}
+			for (auto i = peds.begin(); i != peds.end(); ++i) {choose_dest_building_or_parked_car(*i, rgen);}
 		}
+		vector<unsigned> active_cities;
+
 		for (unsigned city = 0; city+1 < by_city.size(); ++city) {
-			if (!get_expanded_city_bcube_for_peds(city).closest_dist_less_than(camera_bs, enable_ai_dist)) continue; // too far from the player
-			unsigned const ped_start(by_city[city].ped_ix), ped_end(by_city[city+1].ped_ix);
-			assert(ped_start <= ped_end && ped_end <= peds.size());
+			if (get_expanded_city_bcube_for_peds(city).closest_dist_less_than(camera_bs, enable_ai_dist)) {active_cities.push_back(city);} // skip if too far from the player
+		}
+		if (!active_cities.empty()) {
+			// peds only interact with other peds in the same city, so each city can be updated by a different thread;
+			// the nav grids are allocated here, and player-visible side effects (sounds, player damage) are queued and applied below in city order
+			assert(city_updates.size()+1 == by_city.size());
+			get_nav_grid_mgr().init_grids(tot_num_plots);
+			get_job_system().parallel_for(active_cities.size(), [&](unsigned task) { // one city per task
+				unsigned const city(active_cities[task]), ped_start(by_city[city].ped_ix), ped_end(by_city[city+1].ped_ix);
+				assert(ped_start <= ped_end && ped_end <= peds.size());
+				rand_gen_t &city_rgen(city_updates[city].rgen);
+
+				for (unsigned pid = ped_start; pid < ped_end; ++pid) {peds[pid].next_frame(*this, peds, pid, city_rgen, delta_dir);}
+			});
+			for (unsigned city : active_cities) {
+				city_update_t &cu(city_updates[city]);
+				for (auto const &s : cu.zombie_sounds) {maybe_play_zombie_sound(s.first, s.second);}
 				
-			for (auto i = peds.begin()+ped_start; i != peds.begin()+ped_end; ++i) {
-				i->next_frame(*this, peds, (i - peds.begin()), rgen, delta_dir);
+				for (float height : cu.player_colls) {
+					uint8_t has_key(0); // final valid is unused
+					register_ai_player_coll(has_key, height); // has_key=0; return value: 0=no effect, 1=player is killed, 2=this person is killed
+				}
+				cu.zombie_sounds.clear();
+				cu.player_colls .clear();
+				if (need_to_sort_city[city]) {need_to_sort_peds = 1;}
 			}
-		} // for city
+		}
 		if (need_to_sort_peds) {
 #pragma omp critical(access_pedestrian_data)
 			sort_by_city_and_plot();
@@ -1995,10 +2040,10 @@ void ped_manager_t::get_parked_car_bcubes_for_plot(cube_t const &plot, unsigned
 	}
 }
 
-bool ped_manager_t::choose_dest_parked_car(unsigned city_id, unsigned &plot_id, unsigned &car_ix, point &car_center) {
+bool ped_manager_t::choose_dest_parked_car(unsigned city_id, unsigned &plot_id, unsigned &car_ix, point &car_center, rand_gen_t &rgen_) {
 	car_city_vect_t const &cv(get_cars_for_city(city_id));
 	if (cv.parked_car_bcubes.empty()) return 0; // no parked cars; excludes sleeping cars in driveways
-	car_ix     = rgen.rand() % cv.parked_car_bcubes.size(); // Note: car_ix is stored in ped dest_bldg and doesn't get used after that
+	car_ix     = rgen_.rand() % cv.parked_car_bcubes.size(); // Note: car_ix is stored in ped dest_bldg and doesn't get used after that
 	plot_id    = cv.parked_car_bcubes[car_ix].ix;
 	car_center = cv.parked_car_bcubes[car_ix].get_cube_center();
 	return 1;
@@ -2045,7 +2090,7 @@ void pedestrian_t::debug_draw(ped_manager_t &ped_mgr) const {
 	get_avoid_cubes(ped_mgr, colliders, plot_bcube, next_plot_bcube, dest_pos, avoid, in_illegal_area, avoid_entire_plot);
 	cube_t union_plot_bcube(plot_bcube);
 	union_plot_bcube.union_with_cube(next_plot_bcube);
-	ai_path_t &path(ped_mgr.grid_path);
+	ai_path_t &path(ped_mgr.get_grid_path());
 	path.clear();
 	// ret: 0=failed, 1=valid path, 2=init contained, 3=straight path (no coll)
 	unsigned const ret(path_finder.run(pos, dest_pos, target_pos, union_plot_bcube, PATH_GAP_FACTOR*radius, dest_pos));
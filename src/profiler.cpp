@@ -4,65 +4,411 @@
 
 #include "3DWorld.h"
 #include "profiler.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <fstream>
+#include <unordered_map>
+#include <memory>
 
 using std::string;
+using std::unordered_map;
+using std::unique_ptr;
+
+unsigned const PROF_BUF_SIZE     = (1<<13); // events per thread ring buffer; must be a power of 2
+unsigned const PROF_MAX_DEPTH    = 64; // max nesting depth of scopes per thread
+unsigned const PROF_FRAME_HIST   = 256; // number of frames tracked per scope for percentiles
+unsigned const MAX_TRACE_EVENTS  = (1<<20);
+unsigned const PROF_DRAIN_MS     = 5; // period for background draining; must be short enough that no thread fills its ring buffer in this time
+char const *const PROF_TRACE_FN  = "profile_trace.json";
+
+bool global_profiler_enabled(0);
 
 void maybe_update_loading_screen(const char *str);
 int omp_get_thread_num_3dw();
 
 
-template <typename T> class timing_profiler {
+struct prof_event_t {
+	unsigned id=0, parent=0; // parent is 0 for top level scopes
+	uint64_t start_ns=0, end_ns=0;
+};
+
+// one ring buffer entry; the words are atomics so that the consumer can read a slot while the owner overwrites it, and seq tells it if that happened
+struct prof_slot_t {
+	std::atomic<uint64_t> seq, ids, start_ns, end_ns; // seq is 2*pos+1 while event pos is being written and 2*pos+2 when it's complete; ids is {parent, id}
 
-	struct entry_t {
+	prof_slot_t() : seq(0), ids(0), start_ns(0), end_ns(0) {}
+	void write(uint64_t pos, prof_event_t const &e) {
+		seq.store(2*pos+1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release); // the data stores can't move before the odd seq store
+		ids     .store(((uint64_t)e.parent << 32) | e.id, std::memory_order_relaxed);
+		start_ns.store(e.start_ns, std::memory_order_relaxed);
+		end_ns  .store(e.end_ns,   std::memory_order_relaxed);
+		seq.store(2*pos+2, std::memory_order_release);
+	}
+	bool read(uint64_t pos, prof_event_t &e) const { // returns false if the event was overwritten or is being overwritten
+		if (seq.load(std::memory_order_acquire) != 2*pos+2) return 0;
+		uint64_t const v(ids.load(std::memory_order_relaxed));
+		e.id       = uint32_t(v);
+		e.parent   = uint32_t(v >> 32);
+		e.start_ns = start_ns.load(std::memory_order_relaxed);
+		e.end_ns   = end_ns  .load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire); // the data loads can't move after the second seq load
+		return (seq.load(std::memory_order_relaxed) == 2*pos+2);
+	}
+};
+
+struct prof_thread_buf_t { // written only by its owner thread, read only by the main thread in profiler_next_frame()
+	prof_slot_t events[PROF_BUF_SIZE];
+	std::atomic<uint64_t> write_pos;
+	uint64_t read_pos=0; // consumer only
+	unsigned stack[PROF_MAX_DEPTH] = {}, depth=0, thread_ix=0; // owner only
+
+	prof_thread_buf_t(unsigned thread_ix_) : write_pos(0), thread_ix(thread_ix_) {}
+	unsigned get_parent() const {return (depth ? stack[depth-1] : 0);}
+
+	void push(prof_event_t const &e) { // single producer; the oldest events are overwritten if the consumer falls behind
+		uint64_t const wpos(write_pos.load(std::memory_order_relaxed));
+		events[wpos & (PROF_BUF_SIZE-1)].write(wpos, e);
+		write_pos.store(wpos+1, std::memory_order_release);
+	}
+	void enter(unsigned id) {
+		if (depth < PROF_MAX_DEPTH) {stack[depth] = id;}
+		++depth; // track depth past the max so that enter/exit stay balanced
+	}
+	void exit(unsigned id) {
+		if (depth == 0) return; // unbalanced; shouldn't get here
+		if (depth <= PROF_MAX_DEPTH && stack[depth-1] != id) { // out of order exit, for example a highres_timer_t with an early end() call
+			for (unsigned d = depth-1; d > 0; --d) {
+				if (stack[d-1] == id) {depth = d-1; return;} // unwind to this scope's parent, popping it and any scopes entered after it
+			}
+			return; // not found, leave the stack as is
+		}
+		--depth;
+	}
+};
+
+
+class frame_profiler_t {
+
+	struct node_t { // one per {parent, scope} pair
 		unsigned count=0;
-		T time=0, tmax=0;
-		void add(T t) {++count; time += t; tmax = max(tmax, t);}
+		double total_ms=0.0, max_ms=0.0;
+		void add(double t) {++count; total_ms += t; max_ms = max(max_ms, t);}
 	};
-	map<string, entry_t> entries;
-public:
-	bool enabled=0;
+	struct scope_stats_t { // one per scope ID
+		double cur_frame_ms=0.0;
+		vector<float> frame_ms; // ring buffer of per-frame totals for frames where this scope was recorded
+		unsigned frame_pos=0;
+
+		void end_frame() {
+			if (cur_frame_ms == 0.0) return; // not recorded this frame
+			if (frame_ms.size() < PROF_FRAME_HIST) {frame_ms.push_back(cur_frame_ms);} else {frame_ms[frame_pos] = cur_frame_ms;}
+			frame_pos = (frame_pos + 1) % PROF_FRAME_HIST;
+			cur_frame_ms = 0.0;
+		}
+		float get_percentile(float p) const {
+			if (frame_ms.empty()) return 0.0;
+			vector<float> sorted(frame_ms);
+			unsigned const ix(min(unsigned(p*sorted.size()), unsigned(sorted.size()-1)));
+			std::nth_element(sorted.begin(), sorted.begin()+ix, sorted.end());
+			return sorted[ix];
+		}
+	};
+	struct trace_event_t {
+		prof_event_t e;
+		unsigned thread_ix;
+		trace_event_t(prof_event_t const &e_, unsigned tix) : e(e_), thread_ix(tix) {}
+	};
+	std::mutex names_mutex, bufs_mutex, agg_mutex;
+	vector<string> names; // indexed by scope ID; ID 0 is the root
+	unordered_map<string, unsigned> name_to_id;
+	vector<unique_ptr<prof_thread_buf_t>> thread_bufs; // never freed, since threads may still be writing to them
+	map<pair<unsigned, unsigned>, node_t> nodes; // {parent, scope}
+	vector<scope_stats_t> scope_stats;
+	vector<trace_event_t> trace;
+	vector<prof_event_t> temp_events;
+	uint64_t num_dropped=0;
 
-	void clear() {entries.clear();}
+	void print_children(vector<string> const &names_, unsigned parent, unsigned depth, unsigned max_name) const {
+		vector<pair<double, unsigned>> children; // {-total time, ID}
 
-	void register_time(const char *str, T delta_time, bool no_loading_screen, bool track_not_print=0) {
-#pragma omp critical(timer_update)
+		for (auto i = nodes.lower_bound(make_pair(parent, 0U)); i != nodes.end() && i->first.first == parent; ++i) {
+			children.emplace_back(-i->second.total_ms, i->first.second);
+		}
+		sort(children.begin(), children.end()); // largest total time first
+
+		for (auto const &c : children) {
+			if (depth > PROF_MAX_DEPTH) break; // recursive scope; shouldn't get here
+			node_t const &n(nodes.find(make_pair(parent, c.second))->second);
+			scope_stats_t const &ss(scope_stats[c.second]);
+			string const &name(names_[c.second]);
+			string const indent(2*depth, ' '), spaces((max_name - min(max_name, unsigned(name.size() + indent.size()))), ' ');
+			cout << indent << name << spaces << ": " << n.count << "\t" << n.total_ms << "\t" << n.max_ms << "\t" << float(n.total_ms/n.count)
+				 << "\t" << ss.get_percentile(0.5) << "\t" << ss.get_percentile(0.99) << endl;
+			if (c.second != parent) {print_children(names_, c.second, depth+1, max_name);}
+		}
+	}
+public:
+	unsigned get_id(string const &name) {
+		std::lock_guard<std::mutex> lock(names_mutex);
+		auto it(name_to_id.find(name));
+		if (it != name_to_id.end()) return it->second;
+		if (names.empty()) {names.push_back("<root>");} // reserve ID 0
+		unsigned const id(names.size());
+		names.push_back(name);
+		name_to_id[name] = id;
+		return id;
+	}
+	prof_thread_buf_t *register_thread() {
+		std::lock_guard<std::mutex> lock(bufs_mutex);
+		thread_bufs.emplace_back(new prof_thread_buf_t(thread_bufs.size()));
+		return thread_bufs.back().get();
+	}
+	void drain(bool end_frame) { // called by the main thread
+		std::lock_guard<std::mutex> lock(agg_mutex);
+		vector<prof_thread_buf_t *> bufs;
+		{
+			std::lock_guard<std::mutex> lock2(bufs_mutex);
+			for (auto const &b : thread_bufs) {bufs.push_back(b.get());}
+		}
 		{
-			if (enabled || track_not_print) {entries[str].add(delta_time);}
-			else {cout << str << " time = " << delta_time << endl;}
+			std::lock_guard<std::mutex> lock3(names_mutex);
+			if (scope_stats.size() < names.size()) {scope_stats.resize(names.size());}
+		}
+		for (prof_thread_buf_t *b : bufs) {
+			uint64_t const wpos(b->write_pos.load(std::memory_order_acquire));
+			if (wpos - b->read_pos > PROF_BUF_SIZE) {num_dropped += (wpos - b->read_pos - PROF_BUF_SIZE); b->read_pos = wpos - PROF_BUF_SIZE;}
+			temp_events.clear();
+
+			for (uint64_t i = b->read_pos; i < wpos; ++i) {
+				prof_event_t e;
+				if (b->events[i & (PROF_BUF_SIZE-1)].read(i, e)) {temp_events.push_back(e);}
+				else {++num_dropped;} // overwritten by the producer while we were reading
+			}
+			b->read_pos = wpos;
+
+			for (auto e = temp_events.begin(); e != temp_events.end(); ++e) {
+				if (e->id >= scope_stats.size() || e->parent >= scope_stats.size()) continue; // ID registered after the resize above; drop
+				double const time_ms(1.0E-6*(e->end_ns - e->start_ns));
+				nodes[make_pair(e->parent, e->id)].add(time_ms);
+				scope_stats[e->id].cur_frame_ms += time_ms;
+				if (global_profiler_enabled && trace.size() < MAX_TRACE_EVENTS) {trace.emplace_back(*e, b->thread_ix);}
+			}
+		} // for b
+		if (end_frame) {
+			for (scope_stats_t &ss : scope_stats) {ss.end_frame();}
 		}
-		if (!no_loading_screen && delta_time > 0 && omp_get_thread_num_3dw() == 0) {maybe_update_loading_screen(str);} // only call on main thread when time has elapsed
 	}
-	void stats() const {
-		if (entries.empty()) return;
-		cout << "# name count total max average" << endl;
+	void stats() {
+		drain(1); // end_frame=1
+		std::lock_guard<std::mutex> lock(agg_mutex);
+		if (nodes.empty()) return;
+		vector<string> names_copy;
+		{
+			std::lock_guard<std::mutex> lock2(names_mutex);
+			names_copy = names;
+		}
 		unsigned max_name(0);
-		for (auto i = entries.begin(); i != entries.end(); ++i) {max_name = max(max_name, (unsigned)i->first.size());}
+		for (auto const &n : nodes) {max_name = max(max_name, unsigned(names_copy[n.first.second].size()));}
+		max_name += 16; // add space for indenting nested scopes
+		cout << "# name count total max average p50 p99 (in ms; p50 and p99 are per-frame)" << endl;
+		print_children(names_copy, 0, 0, max_name);
+		if (num_dropped > 0) {cout << "Warning: " << num_dropped << " profiler events were dropped" << endl;}
+	}
+	void clear() {
+		std::lock_guard<std::mutex> lock(agg_mutex);
+		nodes.clear();
+		scope_stats.clear();
+		num_dropped = 0;
+	}
+	bool write_trace(string const &fn) {
+		drain(0);
+		std::lock_guard<std::mutex> lock(agg_mutex);
+		if (trace.empty()) return 0;
+		std::ofstream out(fn);
+		if (!out.good()) {std::cerr << "Error: Failed to open profile trace file " << fn << " for writing" << endl; return 0;}
+		vector<string> names_copy;
+		{
+			std::lock_guard<std::mutex> lock2(names_mutex);
+			names_copy = names;
+		}
+		uint64_t start_ns(trace.front().e.start_ns);
+		for (trace_event_t const &t : trace) {start_ns = min(start_ns, t.e.start_ns);}
+		out << "{\"traceEvents\":[" << endl;
+
+		for (auto t = trace.begin(); t != trace.end(); ++t) {
+			string name;
 
-		for (auto i = entries.begin(); i != entries.end(); ++i) {
-			string const spaces((max_name - i->first.size()), ' ');
-			cout << i->first << spaces << ": " << i->second.count << "\t" << i->second.time << "\t"
-				 << i->second.tmax << "\t" << float(i->second.time)/float(i->second.count) << endl;
+			for (char c : names_copy[t->e.id]) { // escape for JSON
+				if (c == '"' || c == '\\') {name.push_back('\\');}
+				if (c >= 32) {name.push_back(c);}
+			}
+			out << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << t->thread_ix << ",\"ts\":" << 0.001*(t->e.start_ns - start_ns)
+				<< ",\"dur\":" << 0.001*(t->e.end_ns - t->e.start_ns) << "}" << ((t+1 == trace.end()) ? "" : ",") << endl;
 		}
+		out << "]}" << endl;
+		cout << "Wrote " << trace.size() << " profiler events to " << fn << endl;
+		trace.clear();
+		return 1;
 	}
 };
 
-timing_profiler<int  > global_profiler;
-timing_profiler<float> global_highres_profiler;
+frame_profiler_t frame_profiler;
+thread_local prof_thread_buf_t *prof_thread_buf(nullptr);
+
+prof_thread_buf_t &get_prof_thread_buf() {
+	if (prof_thread_buf == nullptr) {prof_thread_buf = frame_profiler.register_thread();} // first use by this thread
+	return *prof_thread_buf;
+}
+
+unsigned get_profile_scope_id(string const &name) {
+	thread_local unordered_map<string, unsigned> cache; // avoid taking the lock for names that were already seen by this thread
+	auto it(cache.find(name));
+	if (it != cache.end()) return it->second;
+	unsigned const id(frame_profiler.get_id(name));
+	cache[name] = id;
+	return id;
+}
+unsigned get_profile_scope_id(char const *const name) {return get_profile_scope_id(string(name));}
+
+unsigned get_timer_scope_id(char const *const name) { // for timer names, which are usually string literals, so the pointer is fixed for each call site
+	struct entry_t {
+		unsigned id=0;
+		string name;
+	};
+	thread_local unordered_map<char const *, entry_t> cache;
+	entry_t &e(cache[name]);
+	if (e.id == 0 || e.name != name) {e.id = get_profile_scope_id(name); e.name = name;} // new, or a temporary string reusing the same address
+	return e.id;
+}
 
-void toggle_timing_profiler() {global_profiler.enabled ^= 1; global_highres_profiler.enabled ^= 1;}
-void register_timing_value(const char *str, int delta_time, bool no_loading_screen) {global_profiler.register_time(str, delta_time, no_loading_screen);}
+void profile_scope_enter(unsigned id) {get_prof_thread_buf().enter(id);}
+
+void profile_scope_exit(unsigned id, uint64_t start_ns, bool force_record) {
+	prof_thread_buf_t &buf(get_prof_thread_buf());
+	buf.exit(id);
+	if (!global_profiler_enabled && !force_record) return;
+	prof_event_t e;
+	e.id       = id;
+	e.parent   = buf.get_parent();
+	e.start_ns = start_ns;
+	e.end_ns   = get_profile_time_ns();
+	buf.push(e);
+}
+
+void profiler_next_frame() {frame_profiler.drain(1);} // end_frame=1
+
+class profiler_drain_thread_t {
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable stop_cv;
+	bool stop=0;
+
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (!stop) {
+			stop_cv.wait_for(lock, std::chrono::milliseconds(PROF_DRAIN_MS));
+			frame_profiler.drain(0); // end_frame=0, since there are no frames
+		}
+	}
+public:
+	void start() {
+		if (thread.joinable()) return; // already started
+		stop   = 0;
+		thread = std::thread(&profiler_drain_thread_t::run, this);
+	}
+	void end() {
+		if (!thread.joinable()) return; // not started
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = 1;
+		}
+		stop_cv.notify_one();
+		thread.join();
+	}
+};
+profiler_drain_thread_t profiler_drain_thread;
+
+void profiler_start_bkg_drain() {profiler_drain_thread.start();}
+void profiler_stop_bkg_drain () {profiler_drain_thread.end  ();}
+bool write_profile_trace(string const &fn) {return frame_profiler.write_trace(fn);}
+
+void toggle_timing_profiler() {
+	global_profiler_enabled ^= 1;
+	if (!global_profiler_enabled) {write_profile_trace(PROF_TRACE_FN);} // write the trace captured while the profiler was enabled
+}
+
+void register_timing_value(const char *str, int delta_time, bool no_loading_screen) { // for timer_t, in ms
+	if (global_profiler_enabled) {
+		uint64_t const end_ns(get_profile_time_ns());
+		prof_thread_buf_t &buf(get_prof_thread_buf());
+		prof_event_t e;
+		e.id       = get_timer_scope_id(str);
+		e.parent   = buf.get_parent(); // Note: timer_t doesn't push onto the scope stack, so it can't be a parent itself
+		e.start_ns = end_ns - 1000000ULL*max(delta_time, 0);
+		e.end_ns   = end_ns;
+		buf.push(e);
+	}
+	else {
+#pragma omp critical(timer_update)
+		cout << str << " time = " << delta_time << endl;
+	}
+	if (!no_loading_screen && delta_time > 0 && omp_get_thread_num_3dw() == 0) {maybe_update_loading_screen(str);} // only call on main thread when time has elapsed
+}
+
+#ifdef _DEBUG
+bool profiler_self_test() { // checks the scope stack unwinding; returns 1 on success
+	unique_ptr<prof_thread_buf_t> buf(new prof_thread_buf_t(0));
+	unsigned const A(1), B(2), C(3);
+	bool pass(1);
+	// out of order exit: exiting A also ends B, which was entered after it
+	buf->enter(A); buf->enter(B); buf->exit(A);
+	pass &= (buf->depth == 0 && buf->get_parent() == 0);
+	// the same, nested inside C: C is the parent of later scopes
+	buf->enter(C); buf->enter(A); buf->enter(B); buf->exit(A);
+	pass &= (buf->depth == 1 && buf->get_parent() == C);
+	buf->exit(C);
+	pass &= (buf->depth == 0);
+	// in order exits
+	buf->enter(A); buf->enter(B); buf->exit(B);
+	pass &= (buf->depth == 1 && buf->get_parent() == A);
+	buf->exit(A);
+	pass &= (buf->depth == 0);
+	// exit of a scope that was never entered leaves the stack unchanged
+	buf->enter(A); buf->exit(B);
+	pass &= (buf->depth == 1 && buf->get_parent() == A);
+	if (!pass) {std::cerr << "Error: profiler scope stack self test failed" << endl;}
+	return pass;
+}
+#endif
 
 void timing_profiler_stats() {
-	global_profiler.stats();
-	global_profiler.clear();
-	global_highres_profiler.stats();
-	global_highres_profiler.clear();
+	frame_profiler.stats();
+	frame_profiler.clear();
 }
 
+void highres_timer_t::start() {
+	if (!enabled) return;
+
+	if (global_profiler_enabled || track_not_print) {
+		id = get_profile_scope_id(name);
+		profile_scope_enter(id);
+	}
+	start_ns = get_profile_time_ns();
+}
 void highres_timer_t::end() {
 	if (!enabled || name.empty()) return;
-	float const elapsed(get_delta_secs(clock.now(), timer1));
-	global_highres_profiler.register_time(name.c_str(), 1000.0*elapsed, no_loading_screen, track_not_print); // print in ms
+
+	if (id) {profile_scope_exit(id, start_ns, track_not_print);} // force_record if tracking
+	else {
+		float const elapsed_ms(1.0E-6*(get_profile_time_ns() - start_ns));
+#pragma omp critical(timer_update)
+		cout << name << " time = " << elapsed_ms << endl; // print in ms
+	}
+	if (!no_loading_screen && omp_get_thread_num_3dw() == 0) {maybe_update_loading_screen(name.c_str());} // only call on main thread
 	name.clear(); // make sure we don't double count this
 }
 
@@ -5,17 +5,52 @@
 
 #include <string>
 #include <chrono>
+#include <cstdint>
 
 using namespace std::chrono;
 
+// Hierarchical scope profiler: each thread records completed scopes into its own lock-free ring buffer,
+// and the main thread aggregates them once per frame into a parent/child tree with per-frame percentiles
+extern bool global_profiler_enabled;
+
+unsigned get_profile_scope_id(char const *const name); // interns the name; thread safe
+unsigned get_profile_scope_id(std::string const &name);
+void profile_scope_enter(unsigned id);
+void profile_scope_exit (unsigned id, uint64_t start_ns, bool force_record=0);
+void profiler_next_frame(); // called once per frame by the main thread
+void profiler_start_bkg_drain(); // for headless mode, which has no frames: drains the thread ring buffers periodically from a helper thread
+void profiler_stop_bkg_drain();
+#ifdef _DEBUG
+bool profiler_self_test(); // debug builds only
+#endif
+bool write_profile_trace(std::string const &fn); // Chrome trace event JSON, viewable in chrome://tracing or Perfetto
+
+inline uint64_t get_profile_time_ns() {return duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count();}
+
+class profile_scope_t { // use with PROFILE_SCOPE()
+	unsigned id;
+	uint64_t start_ns=0;
+public:
+	profile_scope_t(unsigned id_) : id(global_profiler_enabled ? id_ : 0) {if (id) {profile_scope_enter(id); start_ns = get_profile_time_ns();}}
+	~profile_scope_t() {if (id) {profile_scope_exit(id, start_ns);}}
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+// the name is interned once per call site, so this is cheap enough to leave in hot code paths
+#define PROFILE_SCOPE(name) static unsigned const PROFILE_CONCAT(prof_id_, __LINE__)(get_profile_scope_id(name)); \
+	profile_scope_t PROFILE_CONCAT(prof_scope_, __LINE__)(PROFILE_CONCAT(prof_id_, __LINE__))
+
 class highres_timer_t { // should this share a base class with timer_t?
 	std::string name;
 	bool enabled, no_loading_screen, track_not_print;
-	high_resolution_clock::time_point timer1;
-	high_resolution_clock clock;
+	unsigned id=0; // nonzero if this scope is recorded by the profiler rather than printed
+	uint64_t start_ns=0;
+
+	void start();
 public:
-	highres_timer_t(char const *const name_,  bool enabled_=1, bool nls=0, bool tnp=0) : name(name_), enabled(enabled_), no_loading_screen(nls), track_not_print(tnp), timer1(clock.now()) {}
-	highres_timer_t(std::string const &name_, bool enabled_=1, bool nls=0, bool tnp=0) : name(name_), enabled(enabled_), no_loading_screen(nls), track_not_print(tnp), timer1(clock.now()) {}
+	highres_timer_t(char const *const name_,  bool enabled_=1, bool nls=0, bool tnp=0) : name(name_), enabled(enabled_), no_loading_screen(nls), track_not_print(tnp) {start();}
+	highres_timer_t(std::string const &name_, bool enabled_=1, bool nls=0, bool tnp=0) : name(name_), enabled(enabled_), no_loading_screen(nls), track_not_print(tnp) {start();}
 	~highres_timer_t() {end();}
 	void end();
 };
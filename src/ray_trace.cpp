@@ -6,8 +6,8 @@
 #include "mesh.h"
 #include "model3d.h"
 #include "binary_file_io.h"
+#include "job_system.h"
 #include <atomic>
-#include <thread>
 #include <omp.h>
 //#include "profiler.h"
 
@@ -513,34 +513,29 @@ struct rt_data {
 };
 
 
+// runs each T as a background job; the jobs share the job system's workers with streaming and frame jobs rather than having their own threads
 template<typename T> class thread_manager_t {
 
-	vector<std::thread> threads;
+	job_group_t jobs;
 public:
 	vector<T> data; // to be filled in by the caller
 
-	bool is_active() const {return (!threads.empty());}
+	bool is_active() const {return (!data.empty());}
+	bool any_threads_running() const {return !jobs.is_done();}
 
-	bool any_threads_running() const {
-		for (auto i = data.begin(); i != data.end(); ++i) {if (i->is_running) return 1;}
-		return 0;
-	}
 	void clear() {
+		assert(jobs.is_done());
 		data.clear();
-		threads.clear();
 	}
 	void create(unsigned num_threads) {
 		assert(!is_active());
 		data.resize(num_threads);
-		threads.resize(num_threads);
 	}
 	void run(void (*func)(rt_data *)) {
-		assert(threads.size() == data.size());
-		for (unsigned t = 0; t < threads.size(); ++t) {threads[t] = std::thread(func, (rt_data *)(&data[t]));}
-	}
-	void join() {
-		for (unsigned t = 0; t < threads.size(); ++t) {threads[t].join();}
+		for (T &d : data) {get_job_system().run_async([func, &d] {func((rt_data *)(&d));}, JOB_PRI_BKG, &jobs);}
 	}
+	void cancel() {jobs.cancel();} // jobs that haven't started are skipped
+	void join() {jobs.wait();} // the calling thread also runs queued jobs
 	void join_and_clear() {join(); clear();}
 };
 
@@ -553,6 +548,7 @@ bool indir_lighting_updated() {return (global_lighting_update && (lmap_manager.w
 void kill_current_raytrace_threads() {
 	if (!thread_manager.is_active()) return;
 	kill_raytrace = 1; // can't have two running at once, so kill the existing one
+	thread_manager.cancel();
 	thread_manager.join_and_clear();
 	assert(!thread_manager.is_active());
 	kill_raytrace = 0;
@@ -574,7 +570,7 @@ void check_for_lighting_finished() { // to be called about once per frame
 }
 
 
-// see https://computing.llnl.gov/tutorials/pthreads/ (for old pthread implementation - now using std::thread)
+// see https://computing.llnl.gov/tutorials/pthreads/ (for old pthread implementation - now using background jobs)
 void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bool verbose, bool blocking, bool use_temp_lmap, bool randomized, int ltype, unsigned job_id=0) {
 
 	kill_current_raytrace_threads();
@@ -1084,8 +1080,9 @@ void check_update_global_lighting(unsigned lights) {
 	// Note: we could check if the sun/moon is visible, but it might have been visible previously and now is not, and in that case we still need to update lighting
 	no_stat_moving = 1; // disable static moving cobjs for async updates, which aren't thread safe because the BVH is rebuilt every frame; no need to set back after first frame
 	lmap_manager.clear_lighting_values(LIGHTING_GLOBAL);
-	bool const reserve_thread((int)NUM_THREADS >= omp_get_max_threads()); // reserve a thread for rendering if needed
-	launch_threaded_job(max(1U, NUM_THREADS-reserve_thread), rt_funcs[LIGHTING_GLOBAL], 0, 0, lighting_update_offline, 0, LIGHTING_GLOBAL);
+	// background jobs never take the last free worker, so use one job per worker they can run on; more would leave the last one to run by itself
+	unsigned const num_jobs(max(1U, get_job_system().get_num_workers()-1));
+	launch_threaded_job(num_jobs, rt_funcs[LIGHTING_GLOBAL], 0, 0, lighting_update_offline, 0, LIGHTING_GLOBAL);
 }
 
 void check_all_platform_cobj_lighting_update() {
@@ -4,6 +4,7 @@
 
 #include "3DWorld.h"
 #include "collision_detect.h"
+#include <mutex>
 
 
 #ifdef _WIN32
@@ -19,6 +20,7 @@ deque<vert_norm_tc> added_pts;
 bool mode_valid(0), self_int(0), has_tess_error(0);
 int mode(0);
 unsigned vertex(0);
+std::mutex tessellate_mutex; // the GLU tessellator and its output triangles are global; models may add polygons from multiple threads
 
 
 void fgCALLBACK tess_error(GLenum errno) {
@@ -169,24 +171,27 @@ template<typename T> bool split_polygon(polygon_t const &poly, vector<T> &ppts,
 		ppts.push_back(poly);
 		return 1;
 	}
-	tessellate_polygon(poly); // could special case convex quads, but that might not help much
-
 	// calculate polygon normal (assuming planar polygon)
 	vector3d n(poly.get_planar_normal()), cp_sum;
 	for (unsigned i = 0; i < npts; ++i) {cp_sum += cross_product(poly[i].v, poly[(i+1)%npts].v);}
 	if (dot_product(n, cp_sum) < 0.0) {n *= -1.0;}
-	static polygon_t new_poly;
+	polygon_t new_poly;
 	new_poly.resize(3);
 
-	// triangles can be empty if they're all small fragments that get dropped
-	for (unsigned i = 0; i < triangles.size(); ++i) {
-		UNROLL_3X(new_poly[i_] = triangles[i].pts[i_];)
-		if (!new_poly.is_valid()) continue; // invalid zero area triangle - skip
-		if (dot_product(new_poly.get_planar_normal(), n) < 0.0) {swap(new_poly[0], new_poly[2]);} // invert draw order
-		ppts.push_back(new_poly);
+	{
+		std::lock_guard<std::mutex> lock(tessellate_mutex);
+		tessellate_polygon(poly); // could special case convex quads, but that might not help much
+
+		// triangles can be empty if they're all small fragments that get dropped
+		for (unsigned i = 0; i < triangles.size(); ++i) {
+			UNROLL_3X(new_poly[i_] = triangles[i].pts[i_];)
+			if (!new_poly.is_valid()) continue; // invalid zero area triangle - skip
+			if (dot_product(new_poly.get_planar_normal(), n) < 0.0) {swap(new_poly[0], new_poly[2]);} // invert draw order
+			ppts.push_back(new_poly);
+		}
+		// triangles and split_polygons can be empty here if they're all small fragments that get dropped
+		triangles.clear();
 	}
-	// triangles and split_polygons can be empty here if they're all small fragments that get dropped
-	triangles.clear();
 	return 1;
 }
 
@@ -254,7 +254,7 @@ public:
 		int x(get_xpos(pos.x - 0.5*DX_VAL)), y(get_ypos(pos.y - 0.5*DY_VAL));
 		if (!clamp_xy(x, y, 0.0, 0.0, 0)) return; // allow_wrap=0
 		assert(x >= 0 && y >= 0);
-		hmap.set_heightmap_value(x, y, unscale_mh_texture_val(pos.z));
+		set_heightmap_value(x, y, unscale_mh_texture_val(pos.z));
 	}
 	virtual bool modify_height_value(int x, int y, hmap_val_t val, bool is_delta, float fract_x, float fract_y, bool allow_wrap=1) {
 		int clamped_x(x), clamped_y(y);
@@ -278,6 +278,11 @@ float get_tiled_terrain_height_tex(float xval, float yval, bool nearest_texel) {
 }
 vector3d get_tiled_terrain_height_tex_norm(int x, int y) {return terrain_hmap_manager.get_norm(x, y);}
 
+uint32_t hash_tiled_terrain_hmap_area(cube_t const &area) { // area is in world space without xoff2/yoff2, as in get_exact_zval(x, y, no_xyoff=1)
+	return terrain_hmap_manager.hash_area((area.x1() + X_SCENE_SIZE)*DX_VAL_INV + 0.5, (area.y1() + Y_SCENE_SIZE)*DY_VAL_INV + 0.5,
+		                                  (area.x2() + X_SCENE_SIZE)*DX_VAL_INV + 0.5, (area.y2() + Y_SCENE_SIZE)*DY_VAL_INV + 0.5);
+}
+
 bool read_default_hmap_modmap() {
 
 	if (read_hmap_modmap_fn.empty()) return 0;
@@ -405,6 +410,7 @@ void tile_t::clear() {
 	tree_map.clear();
 	mesh_weight_data.clear();
 	weight_data.clear();
+	normal_data.clear();
 	zvals.clear();
 	clear_shadows();
 	pine_trees.clear_all();
@@ -455,10 +461,13 @@ void setup_height_gen_cached(mesh_xy_grid_cache_t &height_gen, float x0, float y
 	height_gen.build_arrays(x0/dx, y0/dy, xy_scale*dx, xy_scale*dy, nx, ny, 1); // cache_values=1
 	height_gen.enable_glaciate();
 }
-bool setup_height_gen_async(mesh_xy_grid_cache_t &height_gen, int x0, int y0, unsigned nx, unsigned ny, bool no_wait=0) {
+// heights_used should be false if eval_index() won't be called, such as for a heightmap without procedural detail
+bool setup_height_gen_async(mesh_xy_grid_cache_t &height_gen, int x0, int y0, unsigned nx, unsigned ny, bool heights_used, bool no_wait=0) {
 	float const xy_scale(get_xy_scale());
 	if (xy_scale == 0.0) return 1; // nothing to do
-	bool const results_avail(height_gen.build_arrays((x0 - MESH_X_SIZE/2), (y0 - MESH_Y_SIZE/2), xy_scale*DX_VAL, xy_scale*DY_VAL, nx, ny, 0, 0, no_wait));
+	// CPU modes: the whole grid is evaluated together much faster than one point at a time, but don't fill a grid that won't be read
+	bool const cache_values(heights_used && mesh_gen_mode < MGEN_SIMPLEX_GPU);
+	bool const results_avail(height_gen.build_arrays((x0 - MESH_X_SIZE/2), (y0 - MESH_Y_SIZE/2), xy_scale*DX_VAL, xy_scale*DY_VAL, nx, ny, cache_values, 0, no_wait));
 	height_gen.enable_glaciate();
 	return results_avail;
 }
@@ -474,10 +483,11 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 	mzmax = -FAR_DISTANCE;
 	unsigned const block_size(zvsize/4), context_sz(stride + 2*AO_RAY_LEN);
 	bool const using_hmap(using_tiled_terrain_hmap_tex()), add_detail(using_hmap_with_detail()); // add procedural detail to heightmap
+	bool const heights_used(!using_hmap || add_detail);
 
 	// When using AO + GPU noise generation, it's faster to compute the AO + context and clip the zvals from this rather than making two separate compute calls (one without blocking)
 	if (enable_tiled_mesh_ao && !using_hmap && mesh_gen_mode >= MGEN_SIMPLEX_GPU) {
-		bool results_ready(setup_height_gen_async(height_gen, (x1 - AO_RAY_LEN), (y1 - AO_RAY_LEN), context_sz, context_sz, no_wait));
+		bool results_ready(setup_height_gen_async(height_gen, (x1 - AO_RAY_LEN), (y1 - AO_RAY_LEN), context_sz, context_sz, 1, no_wait)); // heights_used=1
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 		ao_zvals.resize(context_sz*context_sz);
 
@@ -487,7 +497,7 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 		}
 	}
 	else {
-		bool results_ready(setup_height_gen_async(height_gen, x1, y1, zvsize, zvsize, no_wait));
+		bool results_ready(setup_height_gen_async(height_gen, x1, y1, zvsize, zvsize, heights_used, no_wait));
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 	}
 	float const xy_mult(1.0/float(size)), wpz_max(get_max_sea_level());
@@ -545,6 +555,13 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 	return 1; // results are ready
 }
 
+// called from the background tile gen thread for CPU mesh gen modes; must not use OpenGL or touch other tiles
+void tile_t::gen_cpu_data(mesh_xy_grid_cache_t &height_gen) {
+	create_zvals(height_gen, 0); // no_wait=0
+	if (enable_tiled_mesh_ao) {calc_mesh_ao_lighting();}
+	calc_normal_data();
+}
+
 void tile_t::get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const {
 
 	float const rx1(pos.x - radius), ry1(pos.y - radius), rx2(pos.x + radius), ry2(pos.y + radius);
@@ -606,7 +623,7 @@ void tile_t::calc_mesh_ao_lighting() {
 	if (use_ao_zvals) {czv.swap(ao_zvals);} // use precomputed values, will clear ao_zvals at the end
 	else {
 		czv.resize(context_sz*context_sz);
-		setup_height_gen_async(height_gen, (x1 - AO_RAY_LEN), (y1 - AO_RAY_LEN), context_sz, context_sz);
+		setup_height_gen_async(height_gen, (x1 - AO_RAY_LEN), (y1 - AO_RAY_LEN), context_sz, context_sz, (!using_hmap || add_detail));
 	}
 	float const dz(0.5*HALF_DXY);
 	ao_lighting.resize(stride*stride);
@@ -862,10 +879,11 @@ void create_or_update_texture(unsigned &tid, bool tid_is_valid, unsigned tsize,
 	}
 }
 
-void tile_t::upload_normal_texture(bool tid_is_valid) {
+void tile_t::calc_normal_data() {
 
-	//timer_t timer("Create Normal Texture");
-	vector<unsigned char> normal_data(4*stride*stride, 0);
+	//timer_t timer("Calc Normal Data");
+	normal_data.clear();
+	normal_data.resize(4*stride*stride, 0);
 	min_normal_z = 1.0;
 
 	for (unsigned y = 0; y < stride; ++y) {
@@ -876,7 +894,12 @@ void tile_t::upload_normal_texture(bool tid_is_valid) {
 			UNROLL_3X(normal_data[ix_off+i_] = (unsigned char)(127.0*(norm[i_] + 1.0)););
 		}
 	}
+}
+
+void tile_t::upload_normal_texture(bool tid_is_valid) {
+	if (normal_data.empty()) {calc_normal_data();} // not precomputed by the background tile gen thread
 	create_or_update_texture(normal_tid, tid_is_valid, stride, normal_data);
+	clear_cont(normal_data); // no longer needed
 }
 
 void tile_t::upload_shadow_map_texture(bool tid_is_valid) {
@@ -2288,9 +2311,121 @@ tile_draw_t::tile_draw_t() : lod_renderer(USE_TREE_BILLBOARDS) {
 	assert(MESH_X_SIZE == MESH_Y_SIZE && X_SCENE_SIZE == Y_SCENE_SIZE);
 }
 
+// *** background CPU tile generation ***
+
+tile_gen_queue_t::~tile_gen_queue_t() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		kill_gen = 1;
+	}
+	gen_jobs.wait(); // waits for the current tile to finish
+	for (auto &j : jobs) {delete j.second.tile;}
+}
+
+// runs as a streaming job until there are no unstarted tiles left; only one runs at a time since tile generation uses OpenMP internally
+void tile_gen_queue_t::gen_tiles() {
+	while (1) {
+		tile_t *tile(nullptr);
+		tile_xy_pair txy;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job_t *job(nullptr);
+
+			if (!kill_gen) {
+				for (auto &j : jobs) { // closest visible tiles first
+					if (!j.second.started && (job == nullptr || j.second.priority < job->priority)) {job = &j.second; txy = j.first;}
+				}
+			}
+			if (job == nullptr) { // done or killed; add_job() will start a new job
+				gen_running = 0;
+				return;
+			}
+			job->started = 1;
+			tile = job->tile;
+		}
+		tile->gen_cpu_data(height_gen); // slow part, unlocked; the tile isn't visible to the main thread until done
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it(jobs.find(txy));
+			assert(it != jobs.end() && it->second.tile == tile); // started jobs are never removed until done
+			it->second.done = 1;
+		}
+		done_cv.notify_all();
+	} // end while
+}
+
+void tile_gen_queue_t::wait_for_started_jobs(std::unique_lock<std::mutex> &lock) { // removes and deletes jobs that haven't been started
+	for (auto i = jobs.begin(); i != jobs.end(); ) { // Note: no ++i
+		if (i->second.started) {++i; continue;}
+		delete i->second.tile;
+		jobs.erase(i++);
+	}
+	done_cv.wait(lock, [&] {
+		for (auto const &j : jobs) {if (!j.second.done) return false;}
+		return true;
+	});
+}
+
+bool tile_gen_queue_t::empty() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return jobs.empty();
+}
+
+bool tile_gen_queue_t::update_job(tile_xy_pair const &txy, float priority) { // returns true if this tile is already queued
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it(jobs.find(txy));
+	if (it == jobs.end()) return 0;
+	it->second.priority  = priority;
+	it->second.update_id = update_id; // still in range
+	return 1;
+}
+
+void tile_gen_queue_t::add_job(tile_t *tile, float priority) {
+	bool start_job(0);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bool const did_ins(jobs.emplace(tile->get_tile_xy_pair(), job_t(tile, priority, update_id)).second);
+		assert(did_ins);
+		start_job   = !gen_running;
+		gen_running = 1;
+	}
+	if (start_job) {get_job_system().run_async([this] {gen_tiles();}, JOB_PRI_STREAM, &gen_jobs);}
+}
+
+// adds finished tiles to ready; jobs not updated since the last call to next_update() have gone out of range and are canceled
+void tile_gen_queue_t::get_finished_tiles(vector<tile_t *> &ready) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (auto i = jobs.begin(); i != jobs.end(); ) { // Note: no ++i
+		job_t &job(i->second);
+		bool const in_range(job.update_id == update_id);
+		if (job.started && !job.done) {++i; continue;} // in progress; if canceled, it will be deleted when done
+		if (job.done && in_range) {ready.push_back(job.tile);}
+		else if (!in_range) {delete job.tile;} // canceled
+		else {++i; continue;} // not yet started
+		jobs.erase(i++);
+	}
+}
+
+void tile_gen_queue_t::finish_all(vector<tile_t *> &ready) { // used when switching to synchronous tile generation
+	std::unique_lock<std::mutex> lock(mutex);
+	wait_for_started_jobs(lock);
+	for (auto &j : jobs) {ready.push_back(j.second.tile);}
+	jobs.clear();
+}
+
+void tile_gen_queue_t::clear() {
+	std::unique_lock<std::mutex> lock(mutex);
+	wait_for_started_jobs(lock);
+	for (auto &j : jobs) {delete j.second.tile;}
+	jobs.clear();
+}
+
+
 void tile_draw_t::clear(bool no_regen_buildings) {
 
 	clear_vbos_tids(); // needed to clear vbo, ivbo, and free list
+	cpu_tile_gen.clear();
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->clear();} // may not be necessary
 	to_draw.clear();
 	tiles.clear();
@@ -2307,14 +2442,7 @@ void tile_draw_t::free_compute_shader() {
 	for (auto i = height_gens.begin(); i != height_gens.end(); ++i) {i->clear_context();}
 }
 
-float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
-
-	//highres_timer_t timer("TT Update");
-	unsigned const max_tile_gen_per_frame = 16; // higher = less overall gen time (more parallel), but longer wait for first render
-	unsigned const max_cpu_tiles          = 3; // 0 = GPU only
-	unsigned const max_defer_tiles        = 8; // 0 = disable
-	if (height_gens.empty()) {height_gens.resize(max(max_defer_tiles, 1U));}
-
+void tile_draw_t::load_hmap_and_gen_buildings() {
 	if (terrain_hmap_manager.maybe_load(mh_filename_tt, (invert_mh_image != 0))) {
 		read_default_hmap_modmap();
 		force_onto_surface_mesh(surface_pos); // move camera onto newly loaded terrain so that the first drawn frame is correct
@@ -2329,6 +2457,33 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		gen_city_details(); // after building generation
 		buildings_valid = 1;
 	}
+}
+
+void tile_draw_t::gen_headless(int tile_radius) { // CPU-only generation with no GL context; tiles are generated for timing and then discarded
+	load_hmap_and_gen_buildings();
+	gen_all_building_room_geom();
+	timer_t timer("Gen Tile Zvals");
+	int const prev_mesh_gen_mode(mesh_gen_mode);
+	if (mesh_gen_mode >= MGEN_SIMPLEX_GPU) {mesh_gen_mode = MGEN_SIMPLEX;} // GPU simplex => CPU simplex
+	mesh_xy_grid_cache_t height_gen;
+
+	for (int y = -tile_radius; y <= tile_radius; ++y) {
+		for (int x = -tile_radius; x <= tile_radius; ++x) {
+			tile_t tile(get_tile_size(), x, y);
+			tile.create_zvals(height_gen, 0); // no_wait=0
+		}
+	}
+	mesh_gen_mode = prev_mesh_gen_mode;
+}
+
+float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
+
+	//highres_timer_t timer("TT Update");
+	unsigned const max_tile_gen_per_frame = 16; // higher = less overall gen time (more parallel), but longer wait for first render
+	unsigned const max_cpu_tiles          = 3; // 0 = GPU only
+	unsigned const max_defer_tiles        = 8; // 0 = disable
+	if (height_gens.empty()) {height_gens.resize(max(max_defer_tiles, 1U));}
+	load_hmap_and_gen_buildings();
 	auto_calc_model_zvals(); // must be done after heightmap loading but before any tiles are created
 	to_draw.clear();
 	terrain_zmin = FAR_DISTANCE;
@@ -2341,10 +2496,20 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	int const x2( tile_radius + toffx), y2( tile_radius + toffy);
 	unsigned const init_tiles((unsigned)tiles.size());
 	bool const create_buildings_first(FLATTEN_BUILDING_TILE && using_tiled_terrain_hmap_tex());
+	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
+	// CPU mode tiles are generated in a background thread, except when the heightmap may be modified by building placement or editing during generation
+	bool const async_cpu_gen(!gpu_mode && !create_buildings_first && inf_terrain_fire_mode == FM_NONE);
 	unsigned num_erased(0);
+	vector<tile_t *> ready_tiles;
 	min_camera_dist = FAR_DISTANCE;
 	// Note: we may want to calculate distant low-res or larger tiles when the camera is high above the mesh
 
+	if (!async_cpu_gen && !cpu_tile_gen.empty()) { // switched to synchronous mode; finish the started tiles and let the rest be recreated below
+		cpu_tile_gen.finish_all(ready_tiles);
+		for (tile_t *tile : ready_tiles) {insert_tile(tile);}
+		ready_tiles.clear();
+	}
+
 	if (!to_gen_zvals.empty()) {
 		assert(to_gen_zvals.size() <= height_gens.size());
 
@@ -2363,22 +2528,30 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 			++num_erased;
 		} else {++i;}
 	}
+	cpu_tile_gen.next_update();
+
 	for (int y = y1; y <= y2; ++y ) { // create new tiles
 		for (int x = x1; x <= x2; ++x ) {
 			tile_xy_pair const txy(x, y);
 			if (tiles.find(txy) != tiles.end()) continue; // already exists
 			tile_t tile(get_tile_size(), x, y);
 			if (!tile.rel_dist_to_camera_xy_lt(CREATE_DIST_TILES)) continue; // too far away to create
+			float const priority(tile.get_draw_priority());
+			if (cpu_tile_gen.update_job(txy, priority)) continue; // already being generated in the background
 			tile_t *new_tile(new tile_t(tile));
-			to_gen_zvals.emplace_back(new_tile->get_draw_priority(), new_tile);
+			if (async_cpu_gen) {cpu_tile_gen.add_job(new_tile, priority); continue;}
+			to_gen_zvals.emplace_back(priority, new_tile);
 			// in this mode, we need to place buildings and flatten the heightmap before calculating tile heights
 			if (create_buildings_first) {create_buildings_tile(x, y, 1);}
 		} // for x
 	} // for y
+	if (async_cpu_gen) { // insert tiles that have finished generating and cancel those that went out of range
+		cpu_tile_gen.get_finished_tiles(ready_tiles);
+		for (tile_t *tile : ready_tiles) {insert_tile(tile);}
+	}
 	//if (to_gen_zvals.size() < max_cpu_tiles) {to_gen_zvals.clear();} // block until at least max_cpu_tiles tiles to generate (lower average gen time, but causes more slow frames/lag)
 	unsigned const num_to_gen(to_gen_zvals.size());
 	unsigned gen_this_frame(min(num_to_gen, max_tile_gen_per_frame));
-	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
 	
 	// to balance tile gen time across frames, generate a number of tiles equal to the average of this frame and the previous frame
 	if (gen_this_frame > 1 && gen_this_frame < max_tile_gen_per_frame && inf_terrain_fire_mode == FM_NONE) { // disable this mode when editing mesh height to prevent visual artifacts
@@ -2423,6 +2596,7 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 			create_buildings_tile(i->first.x, i->first.y, 0); // create, or re-create if create_buildings_first; should already be flat
 		}
 		else if (rel_dist > CLEAR_DIST_TILES) {remove_buildings_tile(i->first.x, i->first.y);}
+		else {prefetch_buildings_tile(i->first.x, i->first.y);} // generate in the background before the tile is in draw range
 	} // for i
 	if (DEBUG_TILES && (tiles.size() != init_tiles || num_erased > 0)) {
 		cout << "update: tiles: " << init_tiles << " to " << tiles.size() << ", erased: " << num_erased << endl;
@@ -3717,6 +3891,7 @@ void draw_tiled_terrain(int reflection_pass) {
 void draw_tiled_terrain_lightning(bool reflection_pass) {terrain_tile_draw.update_lightning(reflection_pass);}
 void end_tiled_terrain_lightning() {terrain_tile_draw.end_lightning();}
 void clear_tiled_terrain(bool no_regen_buildings) {terrain_tile_draw.clear(no_regen_buildings);}
+void gen_tiled_terrain_headless(int tile_radius) {terrain_tile_draw.gen_headless(tile_radius);}
 void draw_tiled_terrain_clouds(bool reflection_pass) {terrain_tile_draw.draw_tile_clouds(reflection_pass);}
 void draw_tiled_terrain_decid_tree_shadows() {terrain_tile_draw.draw_decid_tree_shadows();}
 void reset_tiled_terrain_state() {terrain_tile_draw.clear_vbos_tids();}
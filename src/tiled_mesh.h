@@ -13,7 +13,10 @@
 #include "tree_3dw.h"
 #include "shadow_map.h"
 #include "animals.h"
+#include "job_system.h"
 #include <unordered_map>
+#include <mutex>
+#include <condition_variable>
 
 
 bool const ENABLE_TREE_LOD    = 1; // faster but has popping artifacts
@@ -163,7 +166,7 @@ private:
 	float sub_zmin[4][4] = {}, sub_zmax[4][4] = {};
 	vector<float> zvals, ao_zvals;
 	vector<tree_map_val> tree_map;
-	vector<unsigned char> mesh_weight_data, weight_data, ao_lighting, smask[NUM_LIGHT_SRC];
+	vector<unsigned char> mesh_weight_data, weight_data, ao_lighting, normal_data, smask[NUM_LIGHT_SRC]; // normal_data is only kept until upload
 	vector<float> sh_out[NUM_LIGHT_SRC][2];
 	vect_smap_t<tile_smap_data_t> smap_data;
 	small_tree_group pine_trees;
@@ -267,6 +270,7 @@ public:
 	void clear_vbo_tid(tile_shadow_map_manager *smap_manager);
 	void clear_pine_tree_vbos() {pine_trees.clear_vbos();}
 	bool create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait);
+	void gen_cpu_data(mesh_xy_grid_cache_t &height_gen);
 	void get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const;
 	float get_zval_at(float x, float y, bool in_global_space) const;
 
@@ -295,6 +299,7 @@ public:
 	void apply_ao_shadows_for_trees(tile_t const *const tile, bool no_adj_test);
 	void apply_tree_ao_shadows();
 	void check_shadow_map_and_normal_texture(bool no_push=0);
+	void calc_normal_data();
 	void upload_normal_texture(bool tid_is_valid);
 	void upload_shadow_map_texture(bool tid_is_valid);
 	void draw_smap_debug_vis(shader_t &s) const;
@@ -395,6 +400,40 @@ public:
 }; // tile_t
 
 
+// generates tile zvals, AO, and normals in a background streaming job for CPU mesh gen modes; tiles are returned to the caller once their data is ready
+class tile_gen_queue_t {
+	struct job_t {
+		tile_t *tile;
+		float priority; // tile draw priority; lowest value is generated first
+		unsigned update_id; // last update in which this tile was still in range
+		bool started=0, done=0;
+		job_t(tile_t *tile_, float priority_, unsigned update_id_) : tile(tile_), priority(priority_), update_id(update_id_) {}
+	};
+	std::mutex mutex;
+	std::condition_variable done_cv;
+	job_group_t gen_jobs;
+	mesh_xy_grid_cache_t height_gen; // reused across tiles; only used in CPU mode, so has no GPU context
+	map<tile_xy_pair, job_t> jobs;
+	unsigned update_id=0;
+	bool gen_running=0, kill_gen=0;
+
+	void gen_tiles();
+	void wait_for_started_jobs(std::unique_lock<std::mutex> &lock);
+public:
+	tile_gen_queue_t() {}
+	tile_gen_queue_t(tile_gen_queue_t const &) = delete; // forbidden
+	void operator=(tile_gen_queue_t const &) = delete; // forbidden
+	~tile_gen_queue_t();
+	bool empty();
+	void next_update() {++update_id;}
+	bool update_job(tile_xy_pair const &txy, float priority);
+	void add_job(tile_t *tile, float priority);
+	void get_finished_tiles(vector<tile_t *> &ready);
+	void finish_all(vector<tile_t *> &ready);
+	void clear();
+};
+
+
 class tile_draw_t : public indexed_vbo_manager_t {
 
 	typedef unordered_map<tile_xy_pair, unique_ptr<tile_t>, hash_tile_xy_pair> tile_map;
@@ -408,6 +447,7 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	vector<tile_t *> occluded_tiles, to_draw_trunk_pts;
 	cloud_draw_list_t to_draw_clouds;
 	vector<mesh_xy_grid_cache_t> height_gens;
+	tile_gen_queue_t cpu_tile_gen;
 	lightning_strike_t lightning_strike;
 	tree_lod_render_t lod_renderer;
 	crack_ibuf_t crack_ibuf;
@@ -428,6 +468,7 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	vector<occluder_cubes_t> occluders; // reused across draw calls
 	vector<unsigned> occluder_ixs; // reused across draw calls
 	void insert_tile(tile_t *tile);
+	void load_hmap_and_gen_buildings();
 
 public:
 	tile_draw_t();
@@ -435,6 +476,7 @@ public:
 	void clear(bool no_regen_buildings);
 	void free_compute_shader();
 	float update(float &min_camera_dist);
+	void gen_headless(int tile_radius);
 private:
 	static void setup_terrain_textures(shader_t &s, unsigned start_tu_id);
 	static void shared_shader_lighting_setup(shader_t &s, unsigned lighting_shader);
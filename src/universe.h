@@ -187,31 +187,44 @@ struct rotated_obj { // size = 48
 };
 
 
-class urev_body : public uobj_solid, public color_gen_class, public rotated_obj { // size = 360
-	// for textures/colors
+struct surface_color_params_t : public color_gen_class { // snapshot of the urev_body state used for surface colors, so that textures can be generated in another thread
 	unsigned char a[3]={}, b[3]={};
+	bool frozen=0, below_boil=0;
+	float water=0.0, atmos=0.0, lava=0.0, snow_thresh=0.0, wr_scale=1.0;
+
+	bool operator==(surface_color_params_t const &p) const;
+	void get_surface_color(unsigned char *data, float val, float phi) const;
+};
+
+void gen_texture_data_and_heightmap(unsigned char *data, unsigned size, upsurface &surface, surface_color_params_t const &params);
+
+
+class urev_body : public uobj_solid, public rotated_obj { // size = 360
 protected:
 	void calc_snow_thresh();
 public:
 	bool gas_giant=0; // planets only?
+	bool tex_gen_pending=0; // waiting on a background rocky texture generation job
 	int owner=NO_OWNER;
 	unsigned orbiting_refs=0, tid=0, tsize=0;
 	float orbit=0.0, rot_rate=0.0, rev_rate=0.0, atmos=0.0, water=0.0, lava=0.0, resources=0.0, cloud_density=1.0, cloud_scale=1.0;
-	float wr_scale=1.0, snow_thresh=0.0, population=0.0, prev_pop=0.0;
+	float snow_thresh=0.0, population=0.0, prev_pop=0.0;
 	vector3d rev_axis, v_orbit, orbit_scale;
 	std::shared_ptr<upsurface> surface;
 	string comment;
 
 	urev_body(char type_) : uobj_solid(type_), orbit_scale(all_ones) {}
-	virtual ~urev_body() {unset_owner();}
+	virtual ~urev_body() {unset_owner(); cancel_tex_gen();}
 	void gen_rotrev();
 	template<typename T> bool create_orbit(vector<T> const &objs, int i, point const &pos0, vector3d const &raxis,
 		float radius0, float max_size, float min_size, float rspacing, float ispacing, float minspacing, float min_gap, vector3d const &oscale);
-	void gen_surface();
+	p_upsurface create_surface() const;
+	surface_color_params_t get_surface_color_params() const;
 	void check_gen_texture(unsigned size);
 	void create_rocky_texture(unsigned size);
+	void apply_rocky_texture(p_upsurface const &surface_, vector<unsigned char> const &data, unsigned size);
+	void cancel_tex_gen();
 	void create_gas_giant_texture();
-	void gen_texture_data_and_heightmap(unsigned char *data, unsigned size);
 	bool has_heightmap() const {return (surface != nullptr && surface->has_heightmap() && !use_procedural_shader());}
 	bool surface_test(float rad, point const &p, float &coll_r, bool simple) const;
 	float get_radius_at(point const &p, bool exact=0) const;
@@ -236,7 +249,6 @@ public:
 	bool use_procedural_shader() const;
 	bool use_vert_shader_offset() const;
 	void upload_colors_to_shader(shader_t &s) const;
-	void get_surface_color(unsigned char *data, float val, float phi) const;
 	bool draw(point_d pos_, ushader_group &usg, pt_line_drawer planet_plds[2], shadow_vars_t const &svars, bool use_light2, bool enable_text_tag);
 	void draw_surface(point_d const &pos_, float size, int ndiv);
 	void show_colonizable_liveable(point const &pos_, float radius0, ushader_group &usg) const;
@@ -567,6 +579,7 @@ bool import_default_modmap();
 bool import_modmap(string const &filename);
 bool export_modmap(string const &filename);
 s_object get_shifted_sobj(s_object const &sobj);
+void reset_closest_object_hints();
 float calc_sphere_size(point const &pos, point const &camera, float radius, float d_adj=0.0);
 bool sphere_size_less_than(point const &pos, point const &camera, float radius, float num_pixels);
 float get_elliptical_orbit_radius(vector3d const &axis, vector3d const &orbit_scale, vector3d vref);
@@ -175,36 +175,34 @@ upsurface::~upsurface() {
 }
 
 
-void urev_body::gen_surface() {
+p_upsurface urev_body::create_surface() const { // deterministic for a given body; doesn't modify the global rand state
 
-	set_rseeds();
-	surface.reset(new upsurface(type)); // may delete a previous surface
+	p_upsurface new_surface(new upsurface(type));
 	float mag(SURFACE_HEIGHT*radius), freq(((type == UTYPE_MOON) ? 1.5 : 1.0)*INITIAL_FREQ*TWO_PI);
-	surface->rgen = rgen; // just copy it?
-	surface->gen(mag, freq);
+	new_surface->rgen = rgen; // just copy it?
+	new_surface->gen(mag, freq);
+	return new_surface;
 }
 
 
 // Note: many planet/sphere renderers use a texture with width = 2*height, which yields square regions at the equator
 // here we use a square texture for simplicity, so that this code can be shared with (and be similar to)
 // the rest of the 3DWorld sphere generation and drawing code; it also produces more uniform regions near the poles
-void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned size) {
+// Note: only reads params and writes surface and data, so this can be run in a background thread
+void gen_texture_data_and_heightmap(unsigned char *data, unsigned size, upsurface &surface, surface_color_params_t const &params) {
 
 	//RESET_TIME;
-	get_colors(a, b);
 	unsigned size_p2(0);
 	for (unsigned sz = size; sz > 1; sz >>= 1, ++size_p2);
 	assert((1U<<size_p2) == size); // size must be a power of 2
-	assert(surface != nullptr);
 	unsigned const table_size(MAX_TEXTURE_SIZE << 1); // larger is more accurate
-	static float xtable[TOT_NUM_SINES*table_size] = {}, ytable[TOT_NUM_SINES*table_size] = {};
-	surface->setup(size, max(water, lava), 1); // use_heightmap=1
-	unsigned const num_sines(surface->num_sines);
-	float const *const rdata(surface->rdata);
-	float const mt2(0.5*(table_size-1)), scale(1.5/surface->max_mag);
+	vector<float> xtable(TOT_NUM_SINES*table_size), ytable(TOT_NUM_SINES*table_size); // not static, since this may be called from multiple threads
+	surface.setup(size, max(params.water, params.lava), 1); // use_heightmap=1
+	unsigned const num_sines(surface.num_sines);
+	float const *const rdata(surface.rdata);
+	float const mt2(0.5*(table_size-1)), scale(1.5/surface.max_mag);
 	float const delta(TWO_PI/size), sin_ds(sin(delta)), cos_ds(cos(delta));
 	unsigned const pole_thresh(size>>3);
-	wr_scale = 1.0/max(0.01, (1.0 - water));
 
 	for (unsigned i = 0; i < table_size; ++i) { // build sin table
 		unsigned const offset(i*num_sines);
@@ -247,8 +245,8 @@ void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned siz
 				for (unsigned k = 0; k < num_sines; ++k) {val += ztable[k]*xtable[ox1+k]*ytable[oy1+k];}
 			}
 			val = 0.5*(max(-1.0f, min(1.0f, scale*val)) + 1.0);
-			surface->heightmap[hmoff + j] = val;
-			get_surface_color((data + index), val, phi);
+			surface.heightmap[hmoff + j] = val;
+			params.get_surface_color((data + index), val, phi);
 			sin_s = s*cos_ds + c*sin_ds;
 			cos_s = c*cos_ds - s*sin_ds;
 		} // for j
@@ -0,0 +1 @@
+#include "../dependencies/meshoptimizer/src/vertexcodec.cpp"
@@ -11,7 +11,10 @@
 #include "file_utils.h"
 #include "openal_wrap.h"
 #include "cobj_bsp_tree.h"
+#include "job_system.h"
 #include <glm/gtc/noise.hpp>
+#include <zlib.h>
+#include <mutex>
 
 
 bool const DEBUG_BLOCKS    = 0;
@@ -23,6 +26,7 @@ unsigned char const ON_EDGE_BIT    = 0x02;
 unsigned char const ANCHORED_BIT   = 0x04;
 unsigned char const UNDER_MESH_BIT = 0x08;
 
+unsigned const chunked_voxel_file_sig = 0xdeadbee3; // first value of a chunked_voxel_grid file; can't be a valid nx
 
 voxel_params_t global_voxel_params;
 voxel_model_ground terrain_voxel_model(GROUND_NUM_LOD);
@@ -78,28 +82,21 @@ float noise_texture_manager_t::eval_at(point const &pos) const {
 }
 
 
-template<typename V> void voxel_grid<V>::init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks) {
+void voxel_grid_base::init_dims(unsigned nx_, unsigned ny_, unsigned nz_, unsigned num_blocks) {
 	nx = nx_; ny = ny_; nz = nz_;
 	xblocks = 1+(nx-1)/num_blocks; // ceil
 	yblocks = 1+(ny-1)/num_blocks; // ceil
-	unsigned const tot_size(nx * ny * nz);
-	assert(tot_size > 0);
-	clear();
-	resize(tot_size, default_val);
+	assert(nx*ny*nz > 0);
 }
 
-template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_,
-	point const &center_, V const &default_val, unsigned num_blocks)
-{
-	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+void voxel_grid_base::init_pos(vector3d const &vsz_, point const &center_) {
 	vsz = vsz_;
 	assert(vsz.x > 0.0 && vsz.y > 0.0 && vsz.z > 0.0);
 	center = center_;
 	lo_pos = center - 0.5*vector3d((nx-1)*vsz.x, (ny-1)*vsz.y, (nz-1)*vsz.z);
 }
 
-template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks) {
-	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+void voxel_grid_base::init_pos(cube_t const &bcube) {
 	assert(!bcube.is_zero_area());
 	vector3d const csz(bcube.get_size());
 	center = bcube.get_cube_center();
@@ -108,6 +105,25 @@ template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsign
 }
 
 
+template<typename V> void voxel_grid<V>::init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks) {
+	init_dims(nx_, ny_, nz_, num_blocks);
+	clear();
+	resize(nx*ny*nz, default_val);
+}
+
+template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_,
+	point const &center_, V const &default_val, unsigned num_blocks)
+{
+	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+	init_pos(vsz_, center_);
+}
+
+template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks) {
+	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+	init_pos(bcube);
+}
+
+
 // Note: assumes mesh is centered around 0,0
 template<> void voxel_grid<float>::init_from_heightmap(float **height, unsigned mesh_nx, unsigned mesh_ny,
 	unsigned zsteps, float mesh_xsize, float mesh_ysize, unsigned num_blocks, bool invert)
@@ -171,7 +187,7 @@ template<> void voxel_grid<float>::downsample_2x() { // modify in place, perserv
 template<> void voxel_grid<cube_t>::downsample_2x() {assert(0);} // not supported
 
 
-template<typename V> void voxel_grid<V>::get_bcube_ix_bounds(cube_t const &bcube, int llc[3], int urc[3]) const {
+void voxel_grid_base::get_bcube_ix_bounds(cube_t const &bcube, int llc[3], int urc[3]) const {
 
 	get_xyz(bcube.get_llc(), llc);
 	get_xyz(bcube.get_urc(), urc);
@@ -199,46 +215,292 @@ template<typename T> bool write_pod(T const &v, FILE *fp, char const *const name
 }
 
 
-template<typename V> bool voxel_grid<V>::read(FILE *fp) {
-
-	assert(fp);
-	unsigned sz(0);
-	if (!read_pod(nx, fp, "voxel nx") || !read_pod(nx, fp, "voxel ny") || !read_pod(nx, fp, "voxel nz")) return 0;
+bool voxel_grid_base::read_header(FILE *fp) { // after the signature
+	if (!read_pod(nx, fp, "voxel nx") || !read_pod(ny, fp, "voxel ny") || !read_pod(nz, fp, "voxel nz")) return 0;
 	if (!read_pod(xblocks, fp, "voxel xblocks") || !read_pod(yblocks, fp, "voxel yblocks")) return 0;
-	if (!read_pod(vsz, fp, "voxel vsz") || !read_pod(center, fp, "voxel center") || !read_pod(lo_pos, fp, "voxel lo_pos")) return 0;
-	if (!read_pod(sz, fp, "voxel_grid size")) return 0;
+	return (read_pod(vsz, fp, "voxel vsz") && read_pod(center, fp, "voxel center") && read_pod(lo_pos, fp, "voxel lo_pos"));
+}
+
+bool voxel_grid_base::write_header(FILE *fp) const {
+	if (!write_pod(chunked_voxel_file_sig, fp, "voxel header")) return 0;
+	if (!write_pod(nx, fp, "voxel nx") || !write_pod(ny, fp, "voxel ny") || !write_pod(nz, fp, "voxel nz")) return 0;
+	if (!write_pod(xblocks, fp, "voxel xblocks") || !write_pod(yblocks, fp, "voxel yblocks")) return 0;
+	return (write_pod(vsz, fp, "voxel vsz") && write_pod(center, fp, "voxel center") && write_pod(lo_pos, fp, "voxel lo_pos"));
+}
+
+
+std::mutex voxel_chunk_mutex; // held while expanding a chunk of any chunked_voxel_grid; this only happens once per chunk between calls to compact()
+
+template<typename V> void chunked_voxel_grid<V>::init_chunks(V const &default_val) {
+	cnx = (nx + CHUNK_MASK) >> CHUNK_BITS;
+	cny = (ny + CHUNK_MASK) >> CHUNK_BITS;
+	cnz = (nz + CHUNK_MASK) >> CHUNK_BITS;
+	chunks.clear();
+	chunks.resize(cnx*cny*cnz, chunk_t(default_val));
+}
+
+template<typename V> void chunked_voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_,
+	point const &center_, V const &default_val, unsigned num_blocks)
+{
+	init_dims(nx_, ny_, nz_, num_blocks);
+	init_pos(vsz_, center_);
+	init_chunks(default_val);
+}
+
+template<typename V> void chunked_voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks) {
+	init_dims(nx_, ny_, nz_, num_blocks);
+	init_pos(bcube);
+	init_chunks(default_val);
+}
+
+template<typename V> void chunked_voxel_grid<V>::get_chunk_range(unsigned cix, unsigned &x0, unsigned &y0, unsigned &z0, unsigned &xe, unsigned &ye, unsigned &ze) const {
+	unsigned const csz(CHUNK_SZ);
+	x0 = ((cix / cnz) % cnx) << CHUNK_BITS;
+	y0 = (cix / (cnz*cnx))   << CHUNK_BITS;
+	z0 = (cix % cnz)         << CHUNK_BITS;
+	xe = min(csz, nx - x0); ye = min(csz, ny - y0); ze = min(csz, nz - z0); // number of voxels in the grid along each dim
+}
+
+template<typename V> void chunked_voxel_grid<V>::unpack_data(vector<unsigned char> const &packed, vector<V> &data) {
+
+	data.resize(CHUNK_VOXELS);
+	uLongf dest_len(CHUNK_VOXELS*sizeof(V));
 	
-	if (empty()) {
-		resize(sz);
-	}
-	else if (sz != size()) {
-		cerr << "Error reading voxel_grid size: expected " << size() << " but got " << sz << endl;
-		return 0;
+	if (uncompress((Bytef *)data.data(), &dest_len, packed.data(), packed.size()) != Z_OK || dest_len != CHUNK_VOXELS*sizeof(V)) {
+		cerr << "Error decompressing voxel chunk" << endl;
+		assert(0);
 	}
-	if (fread(&front(), sizeof(V), size(), fp) != size()) {
-		cerr << "Error reading voxel_grid data" << endl;
+}
+
+template<typename V> bool chunked_voxel_grid<V>::pack_data(vector<V> const &data, vector<unsigned char> &packed) { // returns 1 if the data was compressed
+
+	assert(data.size() == CHUNK_VOXELS);
+	uLongf comp_len(compressBound(CHUNK_VOXELS*sizeof(V)));
+	packed.resize(comp_len);
+
+	if (compress2(packed.data(), &comp_len, (Bytef const *)data.data(), CHUNK_VOXELS*sizeof(V), Z_BEST_SPEED) != Z_OK ||
+		comp_len >= CHUNK_VOXELS*sizeof(V)/2) // not worth the decompression time unless we at least halve the size
+	{
+		vector<unsigned char>().swap(packed);
 		return 0;
 	}
+	packed.resize(comp_len);
+	packed.shrink_to_fit();
 	return 1;
 }
 
+template<typename V> void chunked_voxel_grid<V>::expand_for_read(chunk_t &c) const { // the packed data is kept, so compact() can drop the expanded copy
 
-template<typename V> bool voxel_grid<V>::write(FILE *fp) const {
+	std::lock_guard<std::mutex> lock(voxel_chunk_mutex);
+	if (c.type.load() != CHUNK_PACKED) return; // expanded by another thread
+	unpack_data(c.packed, c.data);
+	c.type.store(CHUNK_COLD, std::memory_order_release);
+}
 
-	assert(fp);
-	unsigned const sz(size());
-	if (!write_pod(nx, fp, "voxel nx") || !write_pod(nx, fp, "voxel ny") || !write_pod(nx, fp, "voxel nz")) return 0;
-	if (!write_pod(xblocks, fp, "voxel xblocks") || !write_pod(yblocks, fp, "voxel yblocks")) return 0;
-	if (!write_pod(vsz, fp, "voxel vsz") || !write_pod(center, fp, "voxel center") || !write_pod(lo_pos, fp, "voxel lo_pos")) return 0;
-	if (!write_pod(sz, fp, "voxel_grid size")) return 0;
+template<typename V> void chunked_voxel_grid<V>::expand_for_write(chunk_t &c) {
+
+	std::lock_guard<std::mutex> lock(voxel_chunk_mutex);
+	unsigned char const type(c.type.load());
+	if (type == CHUNK_DENSE) return; // expanded by another thread
+	if      (type == CHUNK_UNIFORM) {c.data.assign(CHUNK_VOXELS, c.uniform_val);} // unused entries of edge chunks get this value as well
+	else if (type == CHUNK_PACKED ) {unpack_data(c.packed, c.data);}
+	vector<unsigned char>().swap(c.packed); // no longer valid; only accessed with the lock held
+	c.type.store(CHUNK_DENSE, std::memory_order_release);
+}
+
+template<typename V> void chunked_voxel_grid<V>::compact_chunk(unsigned cix, bool pack_cold, bool pack_written) {
+
+	chunk_t &c(chunks[cix]);
+	unsigned char const type(c.type.load());
+
+	if (type == CHUNK_DENSE) { // written since the last call
+		unsigned x0, y0, z0, xe, ye, ze;
+		get_chunk_range(cix, x0, y0, z0, xe, ye, ze); // only compare voxels inside the grid, since edge chunks have unused entries
+		V const first(c.data.front());
+		bool uniform(1);
+
+		for (unsigned y = 0; y < ye && uniform; ++y) {
+			for (unsigned x = 0; x < xe && uniform; ++x) {
+				V const *const row(c.data.data() + (x + y*CHUNK_SZ)*CHUNK_SZ);
+				for (unsigned z = 0; z < ze; ++z) {if (memcmp(row+z, &first, sizeof(V)) != 0) {uniform = 0; break;}}
+			}
+		}
+		if (uniform) {
+			c.uniform_val = first;
+			vector<V>().swap(c.data); // free the memory
+			c.type = CHUNK_UNIFORM;
+			return;
+		}
+		c.type = CHUNK_COLD;
+		if (!pack_written) return;
+	}
+	else if (type != CHUNK_COLD || !pack_cold) return;
 	
-	if (fwrite(&front(), sizeof(V), size(), fp) != size()) {
-		cerr << "Error writing voxel_grid data" << endl;
+	if (c.packed.empty() && !pack_data(c.data, c.packed)) { // not expanded from packed data, and doesn't compress well
+		c.type = CHUNK_INCOMPRESSIBLE;
+		return;
+	}
+	vector<V>().swap(c.data); // free the memory
+	c.type = CHUNK_PACKED;
+}
+
+template<typename V> void chunked_voxel_grid<V>::compact(bool pack_cold, bool pack_written) {
+	get_job_system().parallel_for(chunks.size(), [&](unsigned cix) {compact_chunk(cix, pack_cold, pack_written);});
+}
+
+template<typename V> void chunked_voxel_grid<V>::copy_from(vector<V> const &vals) { // the grid must already be initialized to the same size
+
+	assert(vals.size() == size());
+
+	get_job_system().parallel_for(chunks.size(), [&](unsigned cix) {
+		chunk_t &c(chunks[cix]);
+		unsigned x0, y0, z0, xe, ye, ze;
+		get_chunk_range(cix, x0, y0, z0, xe, ye, ze);
+		c.data.assign(CHUNK_VOXELS, vals[get_ix(x0, y0, z0)]); // unused entries of edge chunks get the first value, which helps compression
+
+		for (unsigned y = 0; y < ye; ++y) {
+			for (unsigned x = 0; x < xe; ++x) {
+				std::copy_n(vals.begin() + get_ix(x0+x, y0+y, z0), ze, c.data.begin() + (x + y*CHUNK_SZ)*CHUNK_SZ);
+			}
+		}
+		vector<unsigned char>().swap(c.packed);
+		c.type = CHUNK_DENSE;
+		compact_chunk(cix, 0, 0); // collapse if uniform
+	});
+}
+
+template<typename V> void chunked_voxel_grid<V>::copy_to(vector<V> &vals) const { // packed chunks are decompressed into a temp buffer rather than expanded
+
+	vals.resize(size());
+
+	get_job_system().parallel_for(chunks.size(), [&](unsigned cix) {
+		chunk_t const &c(chunks[cix]);
+		unsigned char const type(c.type.load());
+		unsigned x0, y0, z0, xe, ye, ze;
+		get_chunk_range(cix, x0, y0, z0, xe, ye, ze);
+		vector<V> temp;
+		V const *data(nullptr);
+
+		if (type == CHUNK_PACKED) {
+			unpack_data(c.packed, temp);
+			data = temp.data();
+		}
+		else if (type != CHUNK_UNIFORM) {data = c.data.data();}
+
+		for (unsigned y = 0; y < ye; ++y) {
+			for (unsigned x = 0; x < xe; ++x) {
+				auto dest(vals.begin() + get_ix(x0+x, y0+y, z0));
+				if (data) {std::copy_n(data + (x + y*CHUNK_SZ)*CHUNK_SZ, ze, dest);} else {std::fill_n(dest, ze, c.uniform_val);}
+			}
+		}
+	});
+}
+
+template<typename V> size_t chunked_voxel_grid<V>::get_mem_usage() const {
+
+	size_t mem(chunks.capacity()*sizeof(chunk_t));
+	for (chunk_t const &c : chunks) {mem += c.data.capacity()*sizeof(V) + c.packed.capacity();}
+	return mem;
+}
+
+// file format: the header, then per chunk the chunk type, followed by the uniform value, the raw values, or the compressed size and data
+template<typename V> bool chunked_voxel_grid<V>::read(FILE *fp) {
+
+	assert(fp);
+	unsigned const prev_size(size());
+	unsigned sig(0);
+	if (!read_pod(sig, fp, "voxel header")) return 0;
+
+	if (sig != chunked_voxel_file_sig) { // legacy flat format, which wrote nx in place of ny and nz, so it can only be read into a grid of the same size
+		unsigned dummy(0), sz(0);
+		if (!read_pod(dummy, fp, "voxel ny") || !read_pod(dummy, fp, "voxel nz")) return 0;
+		if (!read_pod(xblocks, fp, "voxel xblocks") || !read_pod(yblocks, fp, "voxel yblocks")) return 0;
+		if (!read_pod(vsz, fp, "voxel vsz") || !read_pod(center, fp, "voxel center") || !read_pod(lo_pos, fp, "voxel lo_pos")) return 0;
+		if (!read_pod(sz, fp, "voxel_grid size")) return 0;
+
+		if (empty() || sig != nx || sz != size()) {
+			cerr << "Error reading voxel_grid size: expected " << size() << " but got " << sz << endl;
+			return 0;
+		}
+		vector<V> vals(sz);
+
+		if (fread(vals.data(), sizeof(V), sz, fp) != sz) {
+			cerr << "Error reading voxel_grid data" << endl;
+			return 0;
+		}
+		copy_from(vals);
+		return 1;
+	}
+	if (!read_header(fp)) return 0;
+
+	if (prev_size > 0 && size() != prev_size) {
+		cerr << "Error reading voxel_grid size: expected " << prev_size << " but got " << size() << endl;
 		return 0;
 	}
+	init_chunks(V());
+
+	for (chunk_t &c : chunks) {
+		unsigned char type(CHUNK_UNIFORM);
+		if (!read_pod(type, fp, "voxel chunk type")) return 0;
+
+		if (type == CHUNK_UNIFORM) {
+			if (!read_pod(c.uniform_val, fp, "voxel chunk value")) return 0;
+		}
+		else if (type == CHUNK_DENSE) { // written uncompressed because it didn't compress well
+			c.data.resize(CHUNK_VOXELS);
+			if (fread(c.data.data(), sizeof(V), CHUNK_VOXELS, fp) != CHUNK_VOXELS) {cerr << "Error reading voxel chunk data" << endl; return 0;}
+			type = CHUNK_INCOMPRESSIBLE;
+		}
+		else if (type == CHUNK_PACKED) {
+			unsigned comp_sz(0);
+			if (!read_pod(comp_sz, fp, "voxel chunk size")) return 0;
+			c.packed.resize(comp_sz);
+			if (fread(c.packed.data(), 1, comp_sz, fp) != comp_sz) {cerr << "Error reading voxel chunk data" << endl; return 0;}
+		}
+		else {
+			cerr << "Error reading voxel chunk: invalid type " << unsigned(type) << endl;
+			return 0;
+		}
+		c.type = type;
+	} // for c
 	return 1;
 }
 
+template<typename V> bool chunked_voxel_grid<V>::write(FILE *fp) const {
+
+	assert(fp);
+	if (!write_header(fp)) return 0;
+	vector<vector<unsigned char>> temp_packed(chunks.size()); // for chunks that have been written since they were last compressed
+
+	get_job_system().parallel_for(chunks.size(), [&](unsigned cix) {
+		chunk_t const &c(chunks[cix]);
+		unsigned char const type(c.type.load());
+		if (type == CHUNK_DENSE || (type == CHUNK_COLD && c.packed.empty())) {pack_data(c.data, temp_packed[cix]);}
+	});
+	for (unsigned cix = 0; cix < chunks.size(); ++cix) {
+		chunk_t const &c(chunks[cix]);
+		vector<unsigned char> const &packed(temp_packed[cix].empty() ? c.packed : temp_packed[cix]);
+		unsigned char const type((c.type == CHUNK_UNIFORM) ? CHUNK_UNIFORM : (packed.empty() ? CHUNK_DENSE : CHUNK_PACKED)); // file chunk type
+		if (!write_pod(type, fp, "voxel chunk type")) return 0;
+
+		if (type == CHUNK_UNIFORM) {
+			if (!write_pod(c.uniform_val, fp, "voxel chunk value")) return 0;
+		}
+		else if (type == CHUNK_DENSE) {
+			if (fwrite(c.data.data(), sizeof(V), CHUNK_VOXELS, fp) != CHUNK_VOXELS) {cerr << "Error writing voxel chunk data" << endl; return 0;}
+		}
+		else {
+			unsigned const comp_sz(packed.size());
+			if (!write_pod(comp_sz, fp, "voxel chunk size")) return 0;
+			if (fwrite(packed.data(), 1, comp_sz, fp) != comp_sz) {cerr << "Error writing voxel chunk data" << endl; return 0;}
+		}
+	} // for cix
+	return 1;
+}
+
+template class chunked_voxel_grid<float>;         // explicit instantiation
+template class chunked_voxel_grid<unsigned char>; // explicit instantiation
+
 
 bool voxel_model::from_file(string const &fn) {
 
@@ -301,10 +563,12 @@ void voxel_manager::create_procedural(float mag, float freq, vector3d const &off
 		cshader.add_uniform_float("start_freq", 0.25*freq);
 		cshader.add_uniform_float("rx", rx);
 		cshader.add_uniform_float("ry", ry);
-		cshader.gen_matrix_R32F(*this, tid); // write directly to voxel values
-		if (normalize_to_1) {for (iterator i = begin(); i != end(); ++i) {*i = CLIP_TO_pm1(*i);}}
+		vector<float> vals;
+		cshader.gen_matrix_R32F(vals, tid);
+		if (normalize_to_1) {for (float &v : vals) {v = CLIP_TO_pm1(v);}}
 		cshader.end_shader();
 		free_texture(tid);
+		copy_from(vals);
 		return;
 	}
 	if (verbose) {cout << "Voxel resolution: " << nx << "x" << ny << "x" << nz << endl;}
@@ -506,11 +770,10 @@ unsigned voxel_manager::add_triangles_for_voxel(tri_data_t::value_type &tri_vert
 
 	for (unsigned yhi = 0; yhi < 2; ++yhi) {
 		for (unsigned xhi = 0; xhi < 2; ++xhi) {
-			unsigned const ix(get_ix(xv[xhi], yv[yhi], z));
-			if (all_under_mesh) {all_under_mesh = ((outside[ix] & UNDER_MESH_BIT) != 0);}
+			if (all_under_mesh) {all_under_mesh = ((outside.get(xv[xhi], yv[yhi], z) & UNDER_MESH_BIT) != 0);}
 			
 			for (unsigned zhi = 0; zhi < 2; ++zhi) {
-				if (outside[ix + zv[zhi]-z] & 7) {cix |= 1 << ((xhi^yhi) + 2*yhi + 4*zhi);} // outside or on edge
+				if (outside.get(xv[xhi], yv[yhi], zv[zhi]) & 7) {cix |= 1 << ((xhi^yhi) + 2*yhi + 4*zhi);} // outside or on edge
 			}
 		}
 	}
@@ -536,9 +799,8 @@ unsigned voxel_manager::add_triangles_for_voxel(tri_data_t::value_type &tri_vert
 
 		for (unsigned d = 0; d < 2; ++d) {
 			unsigned const yhi((eix[d] & 2) >> 1), xhi(yhi ^ (eix[d] & 1)), zhi(eix[d] >> 2);
-			unsigned const ix(get_ix(xv[xhi], yv[yhi], zv[zhi]));
 			xhv &= xhi; yhv &= yhi; zhv &= zhi;
-			vals[d] = ((outside[ix] & 7) == ON_EDGE_BIT) ? params.isolevel : operator[](ix);
+			vals[d] = ((outside.get(xv[xhi], yv[yhi], zv[zhi]) & 7) == ON_EDGE_BIT) ? params.isolevel : get(xv[xhi], yv[yhi], zv[zhi]);
 			pts[d].assign(cube.d[0][xhi], cube.d[1][yhi], cube.d[2][zhi]);
 		}
 		vlist[i] = interpolate_pt(params.isolevel, pts[0], pts[1], vals[0], vals[1]);
@@ -708,8 +970,8 @@ void voxel_model::remove_unconnected_outside_modified_blocks(bool postproc_brush
 			float const val(operator[](ix));
 			make_voxel_outside(ix);
 			assert(ix > 0); --ix; // move down one z step
-			operator[](ix) = val;
-			outside[ix]    = (is_under_mesh(i->pt - point(0.0, 0.0, vsz.z)) ? UNDER_MESH_BIT : 0); // make inside or under mesh
+			set(ix, val);
+			outside.set(ix, (is_under_mesh(i->pt - point(0.0, 0.0, vsz.z)) ? UNDER_MESH_BIT : 0)); // make inside or under mesh
 		}
 		return; // no fragments or sound (of could add sounds when falling begins?)
 	}
@@ -729,11 +991,11 @@ void voxel_model::remove_unconnected_outside_modified_blocks(bool postproc_brush
 #define FLOOD_FILL_INNER(pos, min_range, max_range, step) \
 	if (pos >= min_range + 1) { \
 		unsigned const ix(cur - step); \
-		if (outside[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
+		if (outside[ix] == fill_val) {work.push_back(ix); outside.get_ref(ix) |= bit_mask;} \
 	} \
 	if (pos + 1 < max_range) { \
 		unsigned const ix(cur + step); \
-		if (outside[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
+		if (outside[ix] == fill_val) {work.push_back(ix); outside.get_ref(ix) |= bit_mask;} \
 	}
 
 void voxel_manager::flood_fill_range(unsigned x1, unsigned y1, unsigned x2, unsigned y2, vector<unsigned> &work, unsigned char fill_val, unsigned char bit_mask) {
@@ -771,7 +1033,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 			unsigned const ix(outside.get_ix(x, y, nz/2));
 			assert(outside[ix] != UNDER_MESH_BIT); // outside or above mesh
 			work.push_back(ix); // inside, anchored to the mesh
-			outside[ix] |= ANCHORED_BIT; // mark as anchored
+			outside.get_ref(ix) |= ANCHORED_BIT; // mark as anchored
 		}
 	}
 	else { // add voxels along the mesh surface
@@ -782,7 +1044,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 				for (unsigned ix_end = ix + nz; ix < ix_end; ++ix) {
 					if (outside[ix] != UNDER_MESH_BIT) continue; // outside or above mesh
 					work.push_back(ix); // inside, anchored to the mesh
-					outside[ix] |= ANCHORED_BIT; // mark as anchored
+					outside.get_ref(ix) |= ANCHORED_BIT; // mark as anchored
 				}
 			}
 		}
@@ -798,7 +1060,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 					unsigned const ix(outside.get_ix(x, y, z));
 					if (outside[ix] == 1) continue; // outside
 					work.push_back(ix); // inside, anchored to the mesh
-					outside[ix] |= ANCHORED_BIT; // mark as anchored
+					outside.get_ref(ix) |= ANCHORED_BIT; // mark as anchored
 				}
 			}
 		}
@@ -814,7 +1076,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 				unsigned const ix(outside.get_ix(x, y, z));
 
 				if (outside[ix] > 1) { // anchored, on edge, or under mesh
-					outside[ix] &= ~ANCHORED_BIT; // remove anchored bit
+					outside.get_ref(ix) &= ~ANCHORED_BIT; // remove anchored bit
 				}
 				else if (outside[ix] != 1) { // inside and non-anchored
 					if (updated_pts) {updated_pts->push_back(pt_ix_t(get_pt_at(x, y, z), ix));}
@@ -839,7 +1101,7 @@ void voxel_manager::remove_interior_holes() {
 
 			if (outside[ix]) {
 				work.push_back(ix);
-				outside[ix] |= ANCHORED_BIT; // mark as anchored
+				outside.get_ref(ix) |= ANCHORED_BIT; // mark as anchored
 			}
 		}
 	}
@@ -849,7 +1111,7 @@ void voxel_manager::remove_interior_holes() {
 	// if inside but not anchored mark as outside
 	for (unsigned ix = 0; ix < size(); ++ix) {
 		if (outside[ix] & ANCHORED_BIT) { // anchored
-			outside[ix] &= ~ANCHORED_BIT; // remove anchored bit
+			outside.get_ref(ix) &= ~ANCHORED_BIT; // remove anchored bit
 		}
 		else if (outside[ix] == 1) { // outside, not on edge or under mesh, and non-anchored
 			make_voxel_inside(ix);
@@ -859,12 +1121,12 @@ void voxel_manager::remove_interior_holes() {
 
 
 void voxel_manager::make_voxel_outside(unsigned ix) {
-	outside[ix] = 1; // make outside
-	operator[](ix) = params.isolevel - (params.invert ? -TOLERANCE : TOLERANCE); // change voxel value to be outside
+	outside.set(ix, 1); // make outside
+	set(ix, params.isolevel - (params.invert ? -TOLERANCE : TOLERANCE)); // change voxel value to be outside
 }
 void voxel_manager::make_voxel_inside(unsigned ix) {
-	outside[ix] = 0; // make inside
-	operator[](ix) = params.isolevel + (params.invert ? -TOLERANCE : TOLERANCE); // change voxel value to be inside
+	outside.set(ix, 0); // make inside
+	set(ix, params.isolevel + (params.invert ? -TOLERANCE : TOLERANCE)); // change voxel value to be inside
 }
 
 
@@ -934,11 +1196,13 @@ bool voxel_manager::line_intersect(point const &p1, point const &p2, point *int_
 
 unsigned voxel_manager::upload_to_3d_texture(int wrap) const { // only works for float type
 
+	vector<float> vals;
+	copy_to(vals);
 	vector<unsigned char> data;
-	data.resize(size());
+	data.resize(vals.size());
 
-	for (unsigned i = 0; i < size(); ++i) {
-		data[i] = (unsigned char)(255*CLIP_TO_01(fabs(operator[](i)))); // use fabs() to convert from [-1,1] to [0,1]
+	for (unsigned i = 0; i < vals.size(); ++i) {
+		data[i] = (unsigned char)(255*CLIP_TO_01(fabs(vals[i]))); // use fabs() to convert from [-1,1] to [0,1]
 	}
 	return create_3d_texture(nx, ny, nz, 1, data, GL_LINEAR, wrap);
 }
@@ -1181,8 +1445,7 @@ void voxel_model::calc_ao_dirs() {
 				if (x == 0 && y == 0 && z == 0) continue;
 				vector3d const delta(x*vsz.x, y*vsz.y, z*vsz.z);
 				unsigned const nsteps(max(1, int(params.ao_radius/delta.mag())));
-				int const dist(z + (x + y*(int)nx)*(int)nz);
-				ao_dirs.push_back(step_dir_t(x, y, z, nsteps, dist));
+				ao_dirs.push_back(step_dir_t(x, y, z, nsteps));
 			}
 		}
 	}
@@ -1225,12 +1488,12 @@ void voxel_model::calc_ao_lighting_for_block(unsigned block_ix, bool increase_on
 						unsigned max_steps(i->nsteps);
 						UNROLL_3X(if (i->dir[i_] > 0) cur[i_] += 1;);
 						UNROLL_3X(if (i->dir[i_]) max_steps = min(max_steps, (unsigned)max(0, ((i->dir[i_] < 0) ? (int)cur[i_] : (int)voxel_sz[i_]-(int)cur[i_]-1))););
-						int ix(outside.get_ix(cur[0], cur[1], cur[2]));
 
 						for (unsigned s = 0; s < max_steps; ++s) { // take steps in this direction
-							ix += i->dist_per_step; // increment first to skip the current voxel
+							UNROLL_3X(cur[i_] += i->dir[i_];) // increment first to skip the current voxel
+							unsigned char const outside_val(outside.get(cur[0], cur[1], cur[2]));
 						
-							if (outside[ix] == 0 || (outside[ix] & end_ray_flags)) {
+							if (outside_val == 0 || (outside_val & end_ray_flags)) {
 								cur_val = s*i->nsteps_inv; // Note: ambient obscurance - uses actual distance to occluder
 								break; // voxel known to be inside the volume or under the mesh
 							}
@@ -1414,6 +1677,7 @@ void voxel_model::proc_pending_updates(bool postproc_brushes_mode) {
 	modified_blocks = next_frame_modified_blocks;
 	next_frame_modified_blocks.clear();
 	volume_added = 0;
+	compact_voxels(0); // keep the recently edited chunks expanded
 }
 
 
@@ -1553,6 +1817,19 @@ void voxel_model::build(bool verbose, bool do_ao_lighting) {
 		calc_ao_lighting();
 		if (verbose) {PRINT_TIME("  Voxel AO Lighting");}
 	}
+	compact_voxels(1); // edits are local, so pack everything now rather than waiting for it to go cold
+
+	if (verbose) {
+		PRINT_TIME("  Compact Voxels");
+		cout << "Voxel storage: " << (get_mem_usage() + outside.get_mem_usage() + ao_lighting.get_mem_usage())/1024 << " KB" << endl;
+	}
+}
+
+
+void voxel_model::compact_voxels(bool pack_written) { // must not be called while other threads access the voxels
+	compact(1, pack_written);
+	outside.compact(1, pack_written);
+	ao_lighting.compact(1, pack_written);
 }
 
 
@@ -1664,7 +1941,11 @@ void voxel_model_space::setup_tex_gen_for_rendering(shader_t &s) {
 	voxel_model::setup_tex_gen_for_rendering(s);
 	
 	if (!ao_lighting.empty()) {
-		if (ao_tid == 0) {ao_tid = create_3d_texture(nx, ny, nz, 1, ao_lighting, GL_LINEAR, GL_CLAMP_TO_EDGE);}
+		if (ao_tid == 0) {
+			vector<unsigned char> ao_data;
+			ao_lighting.copy_to(ao_data);
+			ao_tid = create_3d_texture(nx, ny, nz, 1, ao_data, GL_LINEAR, GL_CLAMP_TO_EDGE);
+		}
 		bind_texture_tu(ao_tid, 9);
 	}
 	if (shadow_tid == 0) {
@@ -5,6 +5,7 @@
 
 #include "3DWorld.h"
 #include "model3d.h"
+#include <atomic>
 
 struct coll_tquad;
 
@@ -96,28 +97,15 @@ public:
 };
 
 
-// stored internally in yxz order
-template<typename V> class voxel_grid : public vector<V> {
-	void init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks);
-public:
+// voxel grid dimensions and positions, shared by the dense and chunked storage; voxels are indexed in yxz order
+struct voxel_grid_base {
 	unsigned nx=0, ny=0, nz=0, xblocks=0, yblocks=0;
 	vector3d vsz; // size of a voxel in x,y,z
 	point center, lo_pos;
 
-	using vector<V>::clear;
-	using vector<V>::empty;
-	using vector<V>::size;
-	using vector<V>::at;
-	using vector<V>::operator[];
-	using vector<V>::resize;
-	using vector<V>::begin;
-	using vector<V>::end;
-	using vector<V>::front;
-
-	void init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_, point const &center_, V const &default_val, unsigned num_blocks=1);
-	void init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks=1);
-	void init_from_heightmap(float **height, unsigned mesh_nx, unsigned mesh_ny, unsigned zsteps, float mesh_xsize, float mesh_ysize, unsigned num_blocks=1, bool invert=0);
-	void downsample_2x();
+	void init_dims(unsigned nx_, unsigned ny_, unsigned nz_, unsigned num_blocks);
+	void init_pos(vector3d const &vsz_, point const &center_);
+	void init_pos(cube_t const &bcube);
 	bool is_valid_range(int i[3]) const {return (i[0] >= 0 && i[1] >= 0 && i[2] >= 0 && i[0] < (int)nx && i[1] < (int)ny && i[2] < (int)nz);}
 	float get_xv(int x) const {return (x*vsz.x + lo_pos.x);}
 	float get_yv(int y) const {return (y*vsz.y + lo_pos.y);}
@@ -126,6 +114,7 @@ public:
 	void get_xyz(point const &p, int xyz[3]) const { // returns whether or not the point was inside the voxel volume
 		UNROLL_3X(xyz[i_] = int((p[i_] - lo_pos[i_])/vsz[i_]);); // convert to voxel space
 	}
+	void get_xyz(unsigned ix, unsigned &x, unsigned &y, unsigned &z) const {z = ix % nz; ix /= nz; x = ix % nx; y = ix / nx;} // inverse of get_ix()
 	bool get_ix(point const &p, unsigned &ix) const { // returns whether or not the point was inside the voxel volume
 		int i[3]; // x,y,z
 		get_xyz(p, i);
@@ -136,22 +125,112 @@ public:
 	unsigned get_ix(unsigned x, unsigned y, unsigned z) const {return (z + (x + y*nx)*nz);} // no bounds checking
 	void get_bcube_ix_bounds(cube_t const &bcube, int llc[3], int urc[3]) const;
 	point get_pt_at(unsigned x, unsigned y, unsigned z) const  {return (point(x, y, z)*vsz + lo_pos);}
+	cube_t get_raw_bbox() const {return cube_t(lo_pos, center + (center - lo_pos));}
+	bool read_header(FILE *fp);
+	bool write_header(FILE *fp) const;
+};
+
+
+template<typename V> class voxel_grid : public voxel_grid_base, public vector<V> {
+	void init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks);
+public:
+	using vector<V>::clear;
+	using vector<V>::empty;
+	using vector<V>::size;
+	using vector<V>::at;
+	using vector<V>::operator[];
+	using vector<V>::resize;
+	using vector<V>::begin;
+	using vector<V>::end;
+	using vector<V>::front;
+
+	void init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_, point const &center_, V const &default_val, unsigned num_blocks=1);
+	void init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks=1);
+	void init_from_heightmap(float **height, unsigned mesh_nx, unsigned mesh_ny, unsigned zsteps, float mesh_xsize, float mesh_ysize, unsigned num_blocks=1, bool invert=0);
+	void downsample_2x();
 	V const &get   (unsigned x, unsigned y, unsigned z) const  {return operator[](get_ix(x, y, z));}
 	V &get_ref     (unsigned x, unsigned y, unsigned z)        {return operator[](get_ix(x, y, z));}
 	void set       (unsigned x, unsigned y, unsigned z, V const &val) {operator[](get_ix(x, y, z)) = val;}
-	cube_t get_raw_bbox() const {return cube_t(lo_pos, center + (center - lo_pos));}
+};
+
+
+// sparse voxel storage in 16x16x16 chunks with the same index space and get/set API as voxel_grid; chunks that hold a single value are collapsed
+// to that value, and chunks that haven't been written since the last compact() can be zlib compressed; reads return values rather than references
+// and expand compressed chunks, and get_ref()/set() expand the chunk being written; both may be called from multiple threads, but compact() may not
+template<typename V> class chunked_voxel_grid : public voxel_grid_base {
+	static unsigned const CHUNK_BITS = 4, CHUNK_SZ = (1 << CHUNK_BITS), CHUNK_MASK = (CHUNK_SZ - 1), CHUNK_VOXELS = CHUNK_SZ*CHUNK_SZ*CHUNK_SZ;
+	// DENSE chunks were written since the last compact(); COLD chunks weren't, and INCOMPRESSIBLE chunks are cold chunks that didn't compress well
+	enum {CHUNK_UNIFORM=0, CHUNK_DENSE, CHUNK_PACKED, CHUNK_COLD, CHUNK_INCOMPRESSIBLE};
+
+	struct chunk_t {
+		std::atomic<unsigned char> type; // only changed with the chunk lock held, or in compact()
+		V uniform_val; // CHUNK_UNIFORM
+		vector<V> data; // all types other than CHUNK_UNIFORM and CHUNK_PACKED
+		vector<unsigned char> packed; // CHUNK_PACKED, and CHUNK_COLD chunks that were expanded for a read, which can go back to CHUNK_PACKED for free
+
+		chunk_t(V const &val=V()) : type(CHUNK_UNIFORM), uniform_val(val) {}
+		chunk_t(chunk_t const &c) : type(c.type.load()), uniform_val(c.uniform_val), data(c.data), packed(c.packed) {}
+		chunk_t &operator=(chunk_t const &c) {type = c.type.load(); uniform_val = c.uniform_val; data = c.data; packed = c.packed; return *this;}
+	};
+	mutable vector<chunk_t> chunks; // mutable so that reads can expand packed chunks
+	unsigned cnx=0, cny=0, cnz=0; // chunks in x,y,z
+
+	unsigned get_chunk_ix(unsigned x, unsigned y, unsigned z) const {return ((z >> CHUNK_BITS) + ((x >> CHUNK_BITS) + (y >> CHUNK_BITS)*cnx)*cnz);}
+	static unsigned get_ix_in_chunk(unsigned x, unsigned y, unsigned z) {return ((z & CHUNK_MASK) + ((x & CHUNK_MASK) + (y & CHUNK_MASK)*CHUNK_SZ)*CHUNK_SZ);}
+	void init_chunks(V const &default_val);
+	void get_chunk_range(unsigned cix, unsigned &x0, unsigned &y0, unsigned &z0, unsigned &xe, unsigned &ye, unsigned &ze) const;
+	static void unpack_data(vector<unsigned char> const &packed, vector<V> &data);
+	static bool pack_data(vector<V> const &data, vector<unsigned char> &packed);
+	void expand_for_read (chunk_t &c) const;
+	void expand_for_write(chunk_t &c);
+	void compact_chunk(unsigned cix, bool pack_cold, bool pack_written);
+
+	chunk_t &get_writable_chunk(unsigned x, unsigned y, unsigned z) {
+		chunk_t &c(chunks[get_chunk_ix(x, y, z)]);
+		if (c.type.load(std::memory_order_acquire) != CHUNK_DENSE) {expand_for_write(c);}
+		return c;
+	}
+public:
+	void init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_, point const &center_, V const &default_val, unsigned num_blocks=1);
+	void init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks=1);
+	void clear() {chunks.clear(); nx = ny = nz = cnx = cny = cnz = 0;}
+	bool empty() const {return chunks.empty();}
+	unsigned size() const {return nx*ny*nz;}
+
+	V get(unsigned x, unsigned y, unsigned z) const { // no bounds checking
+		chunk_t &c(chunks[get_chunk_ix(x, y, z)]);
+		unsigned char const type(c.type.load(std::memory_order_acquire));
+		if (type == CHUNK_UNIFORM) return c.uniform_val;
+		if (type == CHUNK_PACKED ) {expand_for_read(c);}
+		return c.data[get_ix_in_chunk(x, y, z)];
+	}
+	V operator[](unsigned ix) const {unsigned x, y, z; get_xyz(ix, x, y, z); return get(x, y, z);}
+	V &get_ref(unsigned x, unsigned y, unsigned z) {return get_writable_chunk(x, y, z).data[get_ix_in_chunk(x, y, z)];}
+	V &get_ref(unsigned ix) {unsigned x, y, z; get_xyz(ix, x, y, z); return get_ref(x, y, z);}
+
+	void set(unsigned x, unsigned y, unsigned z, V const &val) {
+		chunk_t const &c(chunks[get_chunk_ix(x, y, z)]);
+		if (c.type.load(std::memory_order_acquire) == CHUNK_UNIFORM && c.uniform_val == val) return; // no change
+		get_ref(x, y, z) = val;
+	}
+	void set(unsigned ix, V const &val) {unsigned x, y, z; get_xyz(ix, x, y, z); set(x, y, z, val);}
+	// collapses uniform chunks, and compresses chunks not written since the last call if pack_cold=1, or all chunks if pack_written=1
+	void compact(bool pack_cold, bool pack_written=0);
+	void copy_from(vector<V> const &vals);
+	void copy_to(vector<V> &vals) const;
+	size_t get_mem_usage() const;
 	bool read(FILE *fp);
 	bool write(FILE *fp) const;
 };
 
-typedef voxel_grid<float> float_voxel_grid;
+typedef chunked_voxel_grid<float> float_voxel_grid;
 
 
 class voxel_manager : public float_voxel_grid {
 protected:
 	bool use_mesh=0;
 	voxel_params_t params;
-	voxel_grid<unsigned char> outside;
+	chunked_voxel_grid<unsigned char> outside;
 	vector<unsigned> temp_work; // used in remove_unconnected_outside_range()/flood_fill()
 	typedef vert_norm vertex_type_t;
 	typedef vntc_vect_block_t<vertex_type_t> tri_data_t;
@@ -220,13 +299,13 @@ protected:
 	vector<tri_data_t> tri_data; // one per LOD level
 	noise_texture_manager_t *noise_tex_gen;
 	std::set<unsigned> modified_blocks, next_frame_modified_blocks;
-	voxel_grid<unsigned char> ao_lighting;
+	chunked_voxel_grid<unsigned char> ao_lighting;
 
 	struct step_dir_t {
 		unsigned nsteps;
 		float nsteps_inv;
-		int dir[3], dist_per_step;
-		step_dir_t(int x, int y, int z, unsigned n, int d) : nsteps(n), nsteps_inv(1.0/nsteps), dist_per_step(d) {dir[0] = x; dir[1] = y; dir[2] = z;}
+		int dir[3];
+		step_dir_t(int x, int y, int z, unsigned n) : nsteps(n), nsteps_inv(1.0/nsteps) {dir[0] = x; dir[1] = y; dir[2] = z;}
 	};
 	vector<step_dir_t> ao_dirs;
 	vector<vector<pt_ix_t> > pt_to_ix;
@@ -260,6 +339,7 @@ protected:
 	void calc_ao_dirs();
 	virtual void calc_ao_lighting_for_block(unsigned block_ix, bool increase_only);
 	void calc_ao_lighting();
+	void compact_voxels(bool pack_written);
 
 	virtual void maybe_create_fragments(point const &center, float radius, int shooter, unsigned num_fragments, bool directly_from_update) const {} // do nothing
 	virtual void create_block_hook(unsigned block_ix) {}